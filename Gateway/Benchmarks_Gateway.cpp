@@ -0,0 +1,778 @@
+#include "Benchmarks_Gateway.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <mimalloc/mimalloc.h>
+#include <nlohmann/json.hpp>
+#include <Exception.h>
+#include <ThreadsafeConsumableQueue.h>
+#include <UVLoop.h>
+#include "SubjectMatchingEngine.h"
+#include "SnapshotSubjectMatchingEngine.h"
+#include "SubscriptionInfo.h"
+using namespace MessagingMesh;
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// Collects the results of benchmarks.
+    /// Each result is written to stdout when it is reported, and added to a JSON array.
+    /// </summary>
+    class BenchmarkResults
+    {
+    public:
+        // Reports the result of a benchmark.
+        void report(const std::string& name, const nlohmann::ordered_json& values)
+        {
+            // We write the result to stdout, for example "Name: Lookups=1000, NsPerLookup=123.4"...
+            std::string line = name + ":";
+            auto separator = " ";
+            for (const auto& [key, value] : values.items())
+            {
+                auto strValue = value.is_number_float() ? std::format("{:.1f}", value.get<double>()) :
+                                value.is_string() ? value.get<std::string>() :
+                                value.dump();
+                line += std::format("{}{}={}", separator, key, strValue);
+                separator = ", ";
+            }
+            std::cout << line << std::endl;
+
+            // We add the result to the JSON...
+            nlohmann::ordered_json result = { { "Name", name } };
+            result.update(values);
+            m_results.push_back(result);
+        }
+
+        // Gets the results as a JSON array.
+        const nlohmann::ordered_json& getJSON() const { return m_results; }
+
+    private:
+        nlohmann::ordered_json m_results = nlohmann::ordered_json::array();
+    };
+
+    /// <summary>
+    /// Stands in for a client socket in the sharded routing benchmark.
+    /// Writes are queued and drained by a unique event marshalled to the subscriber's loop, in the
+    /// same way as Socket::write(), and the delivered messages are counted.
+    /// </summary>
+    class BenchmarkSubscriber
+    {
+    public:
+        // Constructor.
+        BenchmarkSubscriber(UVLoop& uvLoop, std::atomic<size_t>& deliveredCount, size_t index) :
+            m_uvLoop(uvLoop),
+            m_deliveredCount(deliveredCount),
+            m_writeEventKey(std::format("WRITE_{}", index))
+        {
+        }
+
+        // Queues a message to be delivered on the subscriber's loop.
+        void write(size_t messageIndex)
+        {
+            m_queuedWrites.add(messageIndex);
+            m_uvLoop.marshallUniqueEvent(
+                m_writeEventKey,
+                [this](uv_loop_t* /*pLoop*/)
+                {
+                    m_deliveredCount += m_queuedWrites.getItems()->size();
+                }
+            );
+        }
+
+    private:
+        UVLoop& m_uvLoop;
+        std::atomic<size_t>& m_deliveredCount;
+        std::string m_writeEventKey;
+        ThreadsafeConsumableQueue<size_t> m_queuedWrites;
+    };
+} // namespace
+
+// Runs all benchmarks.
+void Benchmarks_Gateway::runAll(const Options& options)
+{
+    BenchmarkResults results;
+    Benchmarks_Gateway::subjectMatchingEngine(results);
+    Benchmarks_Gateway::subjectMatchingEngine_Caching(results);
+    Benchmarks_Gateway::subjectMatchingEngine_LiteralSubjects(results);
+    Benchmarks_Gateway::subjectMatchingEngine_InboxChurn(results);
+    Benchmarks_Gateway::subjectMatchingEngine_Disconnects(results);
+    Benchmarks_Gateway::snapshotSubjectMatchingEngine(results);
+    Benchmarks_Gateway::shardedRouting(results, options);
+    for (auto subscriptionCount : options.SubscriptionCounts)
+    {
+        Benchmarks_Gateway::syntheticInterestGraph(results, options, subscriptionCount);
+    }
+
+    // We save the results as JSON, with the options used...
+    if (!options.JSONPath.empty())
+    {
+        nlohmann::ordered_json json = {
+            { "Options", {
+                { "SubscriptionCounts", options.SubscriptionCounts },
+                { "Depth", options.Depth },
+                { "FanOut", options.FanOut },
+                { "StarRatio", options.StarRatio },
+                { "GreaterThanRatio", options.GreaterThanRatio },
+                { "ClientCount", options.ClientCount },
+                { "LookupCount", options.LookupCount },
+                { "Seed", options.Seed },
+                { "MaxShards", options.MaxShards } } },
+            { "Results", results.getJSON() } };
+        std::ofstream file(options.JSONPath);
+        if (!file)
+        {
+            throw Exception(std::format("Failed to open {} to save benchmark results", options.JSONPath));
+        }
+        file << json.dump(4) << std::endl;
+        std::cout << std::format("Benchmark results saved to {}", options.JSONPath) << std::endl;
+    }
+}
+
+// Benchmarks matching subjects in the subject-matching engine.
+void Benchmarks_Gateway::subjectMatchingEngine(BenchmarkResults& results)
+{
+    // We set up the graph...
+    SubjectMatchingEngine sme;
+    std::vector<std::string> subjects;
+    auto subscriptionCount = addMarketDataSubscriptions(sme, subjects);
+
+    // We match each subject a number of times, and report the average time per match...
+    VecSubscriptionInfo scratch;
+    const int iterations = 20;
+    size_t matchCount = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto iteration = 0; iteration < iterations; ++iteration)
+    {
+        for (const auto& subject : subjects)
+        {
+            matchCount += sme.getMatchingSubscriptionInfos(subject, scratch).size();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto elapsedNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    auto lookups = iterations * subjects.size();
+    auto stats = sme.getStats();
+    results.report("SubjectMatchingEngine", {
+        { "Subscriptions", subscriptionCount },
+        { "Lookups", lookups },
+        { "Matches", matchCount },
+        { "NsPerLookup", static_cast<double>(elapsedNanoseconds) / lookups },
+        { "FastPathMatches", stats.FastPathMatches },
+        { "GraphWalks", stats.GraphWalks } });
+}
+
+// Benchmarks matching subjects with caching, while subscriptions are being added and removed.
+void Benchmarks_Gateway::subjectMatchingEngine_Caching(BenchmarkResults& results)
+{
+    const std::vector<std::pair<std::string, SubjectMatchingEngine::CachingMode>> cachingModes = {
+        { "DISABLED", SubjectMatchingEngine::CachingMode::DISABLED },
+        { "ENABLED", SubjectMatchingEngine::CachingMode::ENABLED },
+        { "ADAPTIVE", SubjectMatchingEngine::CachingMode::ADAPTIVE } };
+    for (const auto& [modeName, cachingMode] : cachingModes)
+    {
+        // We set up the graph...
+        SubjectMatchingEngine sme;
+        sme.setCachingMode(cachingMode);
+        std::vector<std::string> subjects;
+        addMarketDataSubscriptions(sme, subjects);
+
+        // We match subjects. Every CHURN_INTERVAL lookups a client subscribes to one of the
+        // market-data subjects and to an inbox, and unsubscribes from the previous ones, as
+        // clients do when they come and go and make requests...
+        VecSubscriptionInfo scratch;
+        const int iterations = 20;
+        const size_t CHURN_INTERVAL = 100;
+        const uint64_t churnSocketID = 1000;
+        size_t matchCount = 0;
+        size_t lookups = 0;
+        std::string churnSubject;
+        std::string inboxSubject;
+        auto start = std::chrono::steady_clock::now();
+        for (auto iteration = 0; iteration < iterations; ++iteration)
+        {
+            for (const auto& subject : subjects)
+            {
+                matchCount += sme.getMatchingSubscriptionInfos(subject, scratch).size();
+                if (++lookups % CHURN_INTERVAL == 0)
+                {
+                    if (!churnSubject.empty())
+                    {
+                        sme.removeSubscription(churnSubject, churnSocketID);
+                        sme.removeSubscription(inboxSubject, churnSocketID);
+                    }
+                    churnSubject = subjects[(lookups * 7919) % subjects.size()];
+                    inboxSubject = std::format("_INBOX.{}", lookups);
+                    sme.addSubscription(churnSubject, 1, churnSocketID, nullptr);
+                    sme.addSubscription(inboxSubject, 2, churnSocketID, nullptr);
+                }
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        auto elapsedNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        auto cacheStats = sme.getCacheStats();
+        results.report("SubjectMatchingEngine_Caching", {
+            { "CachingMode", modeName },
+            { "ChurnInterval", CHURN_INTERVAL },
+            { "Lookups", lookups },
+            { "Matches", matchCount },
+            { "NsPerLookup", static_cast<double>(elapsedNanoseconds) / lookups },
+            { "CacheHits", cacheStats.Hits },
+            { "CacheMisses", cacheStats.Misses },
+            { "CacheInvalidations", cacheStats.Invalidations },
+            { "CacheEvictions", cacheStats.Evictions } });
+    }
+}
+
+// Benchmarks matching literal subjects, with wildcard subscriptions under only some prefixes.
+void Benchmarks_Gateway::subjectMatchingEngine_LiteralSubjects(BenchmarkResults& results)
+{
+    // We set up a graph of 100,000 literal subjects spread over 50 applications, for
+    // example APP7.ORDERS.12345. Two of the applications also have wildcard subscriptions...
+    SubjectMatchingEngine sme;
+    std::vector<std::string> subjects;
+    const uint32_t subjectCount = 100000;
+    const uint32_t applicationCount = 50;
+    for (uint32_t i = 0; i < subjectCount; ++i)
+    {
+        auto subject = std::format("APP{}.ORDERS.{}", i % applicationCount, i);
+        sme.addSubscription(subject, i, i % 100, nullptr);
+        subjects.push_back(subject);
+    }
+    sme.addSubscription("APP0.ORDERS.*", subjectCount, 100, nullptr);
+    sme.addSubscription("APP1.>", subjectCount + 1, 100, nullptr);
+
+    // We match each subject a number of times, and report the average time per match...
+    VecSubscriptionInfo scratch;
+    const int iterations = 20;
+    size_t matchCount = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto iteration = 0; iteration < iterations; ++iteration)
+    {
+        for (const auto& subject : subjects)
+        {
+            matchCount += sme.getMatchingSubscriptionInfos(subject, scratch).size();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto elapsedNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    auto lookups = iterations * subjects.size();
+    auto stats = sme.getStats();
+    results.report("SubjectMatchingEngine_LiteralSubjects", {
+        { "Subscriptions", stats.SubscriptionCount },
+        { "Lookups", lookups },
+        { "Matches", matchCount },
+        { "NsPerLookup", static_cast<double>(elapsedNanoseconds) / lookups },
+        { "FastPathMatches", stats.FastPathMatches },
+        { "GraphWalks", stats.GraphWalks } });
+}
+
+// Benchmarks request / reply inbox subscriptions being added and removed.
+void Benchmarks_Gateway::subjectMatchingEngine_InboxChurn(BenchmarkResults& results)
+{
+    // We set up the graph...
+    SubjectMatchingEngine sme;
+    std::vector<std::string> subjects;
+    addMarketDataSubscriptions(sme, subjects);
+    auto statsBefore = sme.getStats();
+
+    // Each request subscribes to a unique inbox, is sent a reply and unsubscribes...
+    const int requestCount = 200000;
+    const uint64_t requesterSocketID = 1000;
+    VecSubscriptionInfo scratch;
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < requestCount; ++i)
+    {
+        auto inbox = std::format("_INBOX.{}", 1000000000 + i);
+        sme.addSubscription(inbox, i, requesterSocketID, nullptr);
+        sme.getMatchingSubscriptionInfos(inbox, scratch);
+        sme.removeSubscription(inbox, requesterSocketID);
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto elapsedNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    auto statsAfter = sme.getStats();
+    results.report("SubjectMatchingEngine_InboxChurn", {
+        { "Requests", requestCount },
+        { "NsPerRequest", static_cast<double>(elapsedNanoseconds) / requestCount },
+        { "NodesBefore", statsBefore.NodeCount },
+        { "NodesAfter", statsAfter.NodeCount },
+        { "TokensBefore", statsBefore.TokenCount },
+        { "TokensAfter", statsAfter.TokenCount } });
+}
+
+// Benchmarks removing all subscriptions for clients when they disconnect.
+void Benchmarks_Gateway::subjectMatchingEngine_Disconnects(BenchmarkResults& results)
+{
+    // We set up two engines with 2,000 clients, each with 250 subscriptions...
+    const uint64_t clientCount = 2000;
+    const size_t subscriptionsPerClient = 250;
+    std::vector<std::string> subjects;
+    SubjectMatchingEngine sme1;
+    SubjectMatchingEngine sme2;
+    addMarketDataSubscriptions(sme1, subjects);
+    addMarketDataSubscriptions(sme2, subjects);
+    std::vector<uint64_t> clientSocketIDs;
+    for (uint64_t clientSocketID = 1000; clientSocketID < 1000 + clientCount; ++clientSocketID)
+    {
+        for (size_t i = 0; i < subscriptionsPerClient; ++i)
+        {
+            const auto& subject = subjects[(clientSocketID * 7919 + i * 104729) % subjects.size()];
+            sme1.addSubscription(subject, (uint32_t)i, clientSocketID, nullptr);
+            sme2.addSubscription(subject, (uint32_t)i, clientSocketID, nullptr);
+        }
+        clientSocketIDs.push_back(clientSocketID);
+    }
+
+    // We remove the clients one at a time from the first engine...
+    auto start = std::chrono::steady_clock::now();
+    for (auto clientSocketID : clientSocketIDs)
+    {
+        sme1.removeAllSubscriptions(clientSocketID);
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto oneAtATimeMilliseconds = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+
+    // We remove the clients in one batch from the second engine...
+    start = std::chrono::steady_clock::now();
+    sme2.removeAllSubscriptions(clientSocketIDs);
+    end = std::chrono::steady_clock::now();
+    auto batchMilliseconds = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+
+    results.report("SubjectMatchingEngine_Disconnects", {
+        { "Clients", clientCount },
+        { "SubscriptionsPerClient", subscriptionsPerClient },
+        { "OneAtATimeMs", oneAtATimeMilliseconds },
+        { "BatchMs", batchMilliseconds } });
+}
+
+// Benchmarks matching subjects from several threads with the snapshot engine, while subscriptions change.
+void Benchmarks_Gateway::snapshotSubjectMatchingEngine(BenchmarkResults& results)
+{
+    // We set up the graph...
+    SnapshotSubjectMatchingEngine sme;
+    std::vector<std::string> subjects;
+    addMarketDataSubscriptions(sme, subjects);
+    sme.publish();
+
+    for (auto threadCount : { 1, 2, 4 })
+    {
+        // Each reader thread matches every subject a number of times...
+        const int iterations = 5;
+        std::atomic<size_t> matchCount = 0;
+        std::atomic<bool> readersFinished = false;
+        std::vector<std::thread> readerThreads;
+        auto start = std::chrono::steady_clock::now();
+        for (auto i = 0; i < threadCount; ++i)
+        {
+            readerThreads.emplace_back(
+                [&]()
+                {
+                    auto pReader = sme.createReader();
+                    VecSubscriptionInfo scratch;
+                    size_t threadMatchCount = 0;
+                    for (auto iteration = 0; iteration < iterations; ++iteration)
+                    {
+                        for (const auto& subject : subjects)
+                        {
+                            threadMatchCount += sme.getMatchingSubscriptionInfos(subject, *pReader).size();
+                        }
+                    }
+                    matchCount += threadMatchCount;
+                });
+        }
+
+        // Meanwhile the writer subscribes and unsubscribes, publishing each change...
+        std::thread writerThread(
+            [&]()
+            {
+                const uint64_t churnSocketID = 1000;
+                size_t publishCount = 0;
+                while (!readersFinished)
+                {
+                    const auto& subject = subjects[(publishCount * 7919) % subjects.size()];
+                    sme.addSubscription(subject, 1, churnSocketID, nullptr);
+                    sme.publish();
+                    sme.removeSubscription(subject, churnSocketID);
+                    sme.publish();
+                    publishCount += 2;
+                }
+            });
+        for (auto& readerThread : readerThreads)
+        {
+            readerThread.join();
+        }
+        auto end = std::chrono::steady_clock::now();
+        readersFinished = true;
+        writerThread.join();
+
+        auto elapsedNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        auto lookups = threadCount * iterations * subjects.size();
+        auto stats = sme.getStats();
+        results.report("SnapshotSubjectMatchingEngine", {
+            { "ReaderThreads", threadCount },
+            { "Lookups", lookups },
+            { "Matches", matchCount.load() },
+            { "LookupsPerSecond", lookups * 1e9 / elapsedNanoseconds },
+            { "VersionsPublished", stats.Version } });
+    }
+}
+
+// Benchmarks routing throughput for a sharded service, with increasing numbers of shards.
+void Benchmarks_Gateway::shardedRouting(BenchmarkResults& results, const Options& options)
+{
+    // We set up the graph. The market-data subscriptions are spread over 100 client sockets,
+    // which are the subscribers...
+    SnapshotSubjectMatchingEngine sme;
+    std::vector<std::string> subjects;
+    addMarketDataSubscriptions(sme, subjects);
+    sme.publish();
+    const size_t subscriberCount = 100;
+
+    auto maxShards = options.MaxShards;
+    if (maxShards == 0)
+    {
+        maxShards = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8);
+    }
+
+    double oneShardMessagesPerSecond = 0.0;
+    for (size_t shardCount = 1; shardCount <= maxShards; shardCount *= 2)
+    {
+        // We create the shard loops, and spread the subscribers across them as the service
+        // manager spreads client sockets...
+        std::vector<UVLoopPtr> shardLoops;
+        for (size_t i = 0; i < shardCount; ++i)
+        {
+            shardLoops.push_back(UVLoop::create(std::format("BENCHMARK/{}", i), UVLoop::Temperature::COLD));
+        }
+        std::atomic<size_t> deliveredCount = 0;
+        std::vector<std::unique_ptr<BenchmarkSubscriber>> subscribers;
+        for (size_t i = 0; i < subscriberCount; ++i)
+        {
+            subscribers.push_back(std::make_unique<BenchmarkSubscriber>(*shardLoops[i % shardCount], deliveredCount, i));
+        }
+
+        // Each shard routes every subject a number of times, as if from its publishers. Messages are
+        // routed in batches, each batch marshalling the next one, so that the subscribers' write
+        // events are processed between batches as they would be for a real service. Each shard
+        // matches with its own reader, and writes to the subscriber for each match. (The graph
+        // was set up with subscription N for client socket N % 100, which is the subscriber.)
+        const size_t messagesPerShard = subjects.size() * 10;
+        const size_t batchSize = 256;
+        std::vector<SnapshotSubjectMatchingEngine::ReaderPtr> readers;
+        for (size_t i = 0; i < shardCount; ++i)
+        {
+            readers.push_back(sme.createReader());
+        }
+        std::atomic<size_t> writtenCount = 0;
+        std::atomic<size_t> shardsFinished = 0;
+        std::function<void(size_t, size_t)> routeBatch = [&](size_t shardIndex, size_t position)
+        {
+            auto& reader = *readers[shardIndex];
+            auto end = std::min(position + batchSize, messagesPerShard);
+            size_t batchWrittenCount = 0;
+            for (; position < end; ++position)
+            {
+                for (const auto& subscriptionInfo : sme.getMatchingSubscriptionInfos(subjects[position % subjects.size()], reader))
+                {
+                    subscribers[subscriptionInfo.getSubscriptionID() % subscriberCount]->write(position);
+                    ++batchWrittenCount;
+                }
+            }
+            writtenCount += batchWrittenCount;
+            if (position < messagesPerShard)
+            {
+                shardLoops[shardIndex]->marshallEvent([&, shardIndex, position](uv_loop_t* /*pLoop*/) { routeBatch(shardIndex, position); });
+            }
+            else
+            {
+                ++shardsFinished;
+            }
+        };
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < shardCount; ++i)
+        {
+            shardLoops[i]->marshallEvent([&, i](uv_loop_t* /*pLoop*/) { routeBatch(i, 0); });
+        }
+
+        // We wait for the shards to finish routing and for every write to be delivered...
+        while (shardsFinished < shardCount || deliveredCount < writtenCount)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        auto elapsedNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        auto messageCount = shardCount * messagesPerShard;
+        auto messagesPerSecond = messageCount * 1e9 / elapsedNanoseconds;
+        if (shardCount == 1)
+        {
+            oneShardMessagesPerSecond = messagesPerSecond;
+        }
+        results.report("ShardedRouting", {
+            { "Shards", shardCount },
+            { "Messages", messageCount },
+            { "Writes", writtenCount.load() },
+            { "MessagesPerSecond", messagesPerSecond },
+            { "WritesPerSecond", writtenCount * 1e9 / elapsedNanoseconds },
+            { "Scaling", messagesPerSecond / oneShardMessagesPerSecond } });
+
+        // We stop the loops before the subscribers and readers they use are destroyed...
+        shardLoops.clear();
+    }
+}
+
+// Runs the suite of benchmarks against a synthetic interest graph with the number of subscriptions specified.
+void Benchmarks_Gateway::syntheticInterestGraph(BenchmarkResults& results, const Options& options, size_t subscriptionCount)
+{
+    auto graph = createSyntheticGraph(options, subscriptionCount);
+    auto getElapsedNanoseconds = [](auto start) { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(); };
+
+    // We subscribe, measuring the throughput and the memory used by the engine.
+    // (Subscriptions to the same subject by the same client are only counted once.)
+    auto memoryBefore = getCommittedMemory();
+    auto pEngine = std::make_unique<SubjectMatchingEngine>();
+    auto& sme = *pEngine;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < graph.Subscriptions.size(); ++i)
+    {
+        const auto& [subject, clientSocketID] = graph.Subscriptions[i];
+        sme.addSubscription(subject, static_cast<uint32_t>(i), clientSocketID, nullptr);
+    }
+    auto subscribeNanoseconds = getElapsedNanoseconds(start);
+    auto memoryAfter = getCommittedMemory();
+    auto stats = sme.getStats();
+    results.report("Synthetic_Subscribe", {
+        { "Subscriptions", stats.SubscriptionCount },
+        { "Nodes", stats.NodeCount },
+        { "Tokens", stats.TokenCount },
+        { "NsPerSubscribe", static_cast<double>(subscribeNanoseconds) / graph.Subscriptions.size() },
+        { "BytesPerSubscription", memoryAfter > memoryBefore ? static_cast<double>(memoryAfter - memoryBefore) / stats.SubscriptionCount : 0.0 },
+        { "GraphBytesPerSubscription", static_cast<double>(stats.MemoryBytes) / stats.SubscriptionCount } });
+
+    // We time each match individually (without caching) and report percentiles of the latency.
+    // Note: This includes the overhead of reading the clock for each lookup.
+    VecSubscriptionInfo scratch;
+    std::vector<int64_t> latencies;
+    latencies.reserve(options.LookupCount);
+    size_t matchCount = 0;
+    for (size_t i = 0; i < options.LookupCount; ++i)
+    {
+        const auto& subject = graph.SentSubjects[i % graph.SentSubjects.size()];
+        auto lookupStart = std::chrono::steady_clock::now();
+        matchCount += sme.getMatchingSubscriptionInfos(subject, scratch).size();
+        latencies.push_back(getElapsedNanoseconds(lookupStart));
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))]; };
+    results.report("Synthetic_MatchLatency", {
+        { "Subscriptions", stats.SubscriptionCount },
+        { "Lookups", options.LookupCount },
+        { "Matches", matchCount },
+        { "P50Ns", percentile(0.50) },
+        { "P90Ns", percentile(0.90) },
+        { "P99Ns", percentile(0.99) },
+        { "P999Ns", percentile(0.999) },
+        { "MaxNs", latencies.back() } });
+
+    // We match with adaptive caching while subscriptions change. Every CHURN_INTERVAL lookups
+    // we remove one of the subscriptions and add it back...
+    const size_t CHURN_INTERVAL = 100;
+    sme.setCachingMode(SubjectMatchingEngine::CachingMode::ADAPTIVE);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < options.LookupCount; ++i)
+    {
+        sme.getMatchingSubscriptionInfos(graph.SentSubjects[i % graph.SentSubjects.size()], scratch);
+        if (i % CHURN_INTERVAL == 0)
+        {
+            auto subscriptionIndex = (i * 7919) % graph.Subscriptions.size();
+            const auto& [subject, clientSocketID] = graph.Subscriptions[subscriptionIndex];
+            sme.removeSubscription(subject, clientSocketID);
+            sme.addSubscription(subject, static_cast<uint32_t>(subscriptionIndex), clientSocketID, nullptr);
+        }
+    }
+    auto churnNanoseconds = getElapsedNanoseconds(start);
+    auto cacheStats = sme.getCacheStats();
+    sme.setCachingMode(SubjectMatchingEngine::CachingMode::DISABLED);
+    results.report("Synthetic_CachedChurn", {
+        { "Subscriptions", stats.SubscriptionCount },
+        { "ChurnInterval", CHURN_INTERVAL },
+        { "Lookups", options.LookupCount },
+        { "NsPerLookup", static_cast<double>(churnNanoseconds) / options.LookupCount },
+        { "CacheHits", cacheStats.Hits },
+        { "CacheMisses", cacheStats.Misses },
+        { "CacheInvalidations", cacheStats.Invalidations } });
+
+    // We unsubscribe from a tenth of the subscriptions one at a time...
+    auto unsubscribeCount = std::max<size_t>(1, graph.Subscriptions.size() / 10);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < unsubscribeCount; ++i)
+    {
+        const auto& [subject, clientSocketID] = graph.Subscriptions[i];
+        sme.removeSubscription(subject, clientSocketID);
+    }
+    auto unsubscribeNanoseconds = getElapsedNanoseconds(start);
+    results.report("Synthetic_Unsubscribe", {
+        { "Subscriptions", stats.SubscriptionCount },
+        { "Unsubscribes", unsubscribeCount },
+        { "NsPerUnsubscribe", static_cast<double>(unsubscribeNanoseconds) / unsubscribeCount } });
+
+    // We disconnect all clients in one batch, which removes the remaining subscriptions...
+    std::vector<uint64_t> clientSocketIDs;
+    for (uint64_t clientSocketID = 0; clientSocketID < options.ClientCount; ++clientSocketID)
+    {
+        clientSocketIDs.push_back(clientSocketID);
+    }
+    auto remainingSubscriptionCount = sme.getStats().SubscriptionCount;
+    start = std::chrono::steady_clock::now();
+    sme.removeAllSubscriptions(clientSocketIDs);
+    auto disconnectNanoseconds = getElapsedNanoseconds(start);
+    results.report("Synthetic_Disconnect", {
+        { "Subscriptions", stats.SubscriptionCount },
+        { "Clients", options.ClientCount },
+        { "SubscriptionsRemoved", remainingSubscriptionCount },
+        { "TotalMs", disconnectNanoseconds / 1e6 },
+        { "NsPerSubscription", remainingSubscriptionCount ? static_cast<double>(disconnectNanoseconds) / remainingSubscriptionCount : 0.0 },
+        { "NodesAfter", sme.getStats().NodeCount } });
+}
+
+// Creates a synthetic interest graph from the options.
+Benchmarks_Gateway::SyntheticGraph Benchmarks_Gateway::createSyntheticGraph(const Options& options, size_t subscriptionCount)
+{
+    if (options.Depth == 0 || options.FanOut == 0 || options.ClientCount == 0 || subscriptionCount == 0)
+    {
+        throw Exception("Synthetic interest graphs need a depth, fan-out, client count and subscription count of at least one");
+    }
+
+    SyntheticGraph graph;
+    std::mt19937_64 random(options.Seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    auto randomToken = [&]() { return std::format("T{}", random() % options.FanOut); };
+
+    // We create the subscriptions...
+    graph.Subscriptions.reserve(subscriptionCount);
+    std::vector<std::string> literalSubjects;
+    for (size_t i = 0; i < subscriptionCount; ++i)
+    {
+        auto type = uniform(random);
+        std::string subject;
+        if (type < options.GreaterThanRatio)
+        {
+            // A subscription ending with >, after between one and (Depth - 1) tokens...
+            auto prefixLength = 1 + random() % std::max<size_t>(1, options.Depth - 1);
+            for (size_t level = 0; level < prefixLength; ++level)
+            {
+                subject += randomToken() + ".";
+            }
+            subject += ">";
+        }
+        else
+        {
+            // A subscription with Depth tokens, one of which may be the * wildcard...
+            auto starLevel = (type < options.GreaterThanRatio + options.StarRatio) ? random() % options.Depth : options.Depth;
+            for (size_t level = 0; level < options.Depth; ++level)
+            {
+                subject += (level == 0) ? "" : ".";
+                subject += (level == starLevel) ? "*" : randomToken();
+            }
+            if (starLevel == options.Depth)
+            {
+                literalSubjects.push_back(subject);
+            }
+        }
+        graph.Subscriptions.push_back({ subject, random() % options.ClientCount });
+    }
+
+    // We create the subjects to send. Most are subjects which have been subscribed to, and the
+    // rest are random subjects which may not match anything...
+    auto sentSubjectCount = std::min<size_t>(options.LookupCount, 100000);
+    graph.SentSubjects.reserve(sentSubjectCount);
+    for (size_t i = 0; i < sentSubjectCount; ++i)
+    {
+        if (!literalSubjects.empty() && uniform(random) < 0.8)
+        {
+            graph.SentSubjects.push_back(literalSubjects[random() % literalSubjects.size()]);
+        }
+        else
+        {
+            std::string subject;
+            for (size_t level = 0; level < options.Depth; ++level)
+            {
+                subject += (level == 0) ? "" : ".";
+                subject += randomToken();
+            }
+            graph.SentSubjects.push_back(subject);
+        }
+    }
+    return graph;
+}
+
+// Gets the memory committed by the process.
+size_t Benchmarks_Gateway::getCommittedMemory()
+{
+    // We collect freed memory first, so that it is not counted...
+    mi_collect(true);
+    size_t elapsedMilliseconds, userMilliseconds, systemMilliseconds, currentRSS, peakRSS, currentCommit, peakCommit, pageFaults;
+    mi_process_info(&elapsedMilliseconds, &userMilliseconds, &systemMilliseconds, &currentRSS, &peakRSS, &currentCommit, &peakCommit, &pageFaults);
+    return currentCommit;
+}
+
+// Adds market-data style subscriptions to the engine, and the subjects to send to the vector.
+// Returns the number of subscriptions.
+template<typename EngineType>
+uint32_t Benchmarks_Gateway::addMarketDataSubscriptions(EngineType& sme, std::vector<std::string>& subjects)
+{
+    // We set up a graph of market-data style subscriptions, for example MD.EQ.LSE.VOD.L.BID,
+    // with some wildcard subscriptions (MD.EQ.*.VOD.L.> and MD.EQ.LSE.>) mixed in...
+    const std::vector<std::string> assetClasses = { "EQ", "FX", "FI", "CMD" };
+    const std::vector<std::string> fields = { "BID", "ASK", "LAST", "VOLUME" };
+    const int exchangeCount = 10;
+    const int instrumentCount = 250;
+    uint32_t subscriptionID = 0;
+    auto subscribe = [&](const std::string& subject)
+    {
+        // We spread the subscriptions over 100 client sockets...
+        ++subscriptionID;
+        sme.addSubscription(subject, subscriptionID, subscriptionID % 100, nullptr);
+    };
+    for (const auto& assetClass : assetClasses)
+    {
+        for (auto exchange = 0; exchange < exchangeCount; ++exchange)
+        {
+            auto exchangeSubject = std::format("MD.{}.X{}", assetClass, exchange);
+            subscribe(exchangeSubject + ".>");
+            for (auto instrument = 0; instrument < instrumentCount; ++instrument)
+            {
+                auto instrumentSubject = std::format("{}.I{}.L", exchangeSubject, instrument);
+                for (const auto& field : fields)
+                {
+                    auto subject = std::format("{}.{}", instrumentSubject, field);
+                    subscribe(subject);
+                    subjects.push_back(subject);
+                }
+                if (instrument % 10 == 0)
+                {
+                    auto starSubject = std::format("MD.{}.*.I{}.L.>", assetClass, instrument);
+                    subscribe(starSubject);
+                }
+            }
+        }
+    }
+
+    // We also send to subjects which nobody is subscribed to...
+    auto subscribedSubjectCount = subjects.size();
+    for (size_t i = 0; i < subscribedSubjectCount; i += 4)
+    {
+        subjects.push_back(subjects[i] + ".UNKNOWN");
+    }
+
+    return subscriptionID;
+}
+
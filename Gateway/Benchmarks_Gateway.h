@@ -0,0 +1,132 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace MessagingMesh
+{
+    // Forward declarations...
+    class BenchmarkResults;
+
+    /// <summary>
+    /// Performance benchmarks for the Gateway.
+    ///
+    /// Run with the -b / --benchmark command-line flag. Results are written to stdout and,
+    /// if a path is provided with --bench-json, saved as JSON so that they can be compared
+    /// between commits.
+    ///
+    /// Synthetic interest graphs
+    /// -------------------------
+    /// As well as benchmarks with fixed (market-data and inbox style) subscriptions, we run a
+    /// suite of benchmarks against synthetic interest graphs for each of the subscription counts
+    /// in the options. Subscribed subjects have Depth tokens, each chosen from FanOut values,
+    /// with the proportions of * and > wildcard subscriptions set by StarRatio and GreaterThanRatio.
+    /// Graphs are generated from a fixed seed so that runs are repeatable.
+    ///
+    /// For each graph we measure subscribe and unsubscribe throughput, memory per subscription,
+    /// match latency percentiles, matching with the cache enabled while subscriptions change and
+    /// the cost of removing subscriptions when clients disconnect.
+    ///
+    /// Sharded routing
+    /// ---------------
+    /// Measures routing throughput for a sharded service with 1 to MaxShards shards (doubling each
+    /// time). Each shard is a UV loop which routes messages from its publishers, matching against a
+    /// shared SnapshotSubjectMatchingEngine and writing to subscribers spread across the shards.
+    /// Subscribers stand in for client sockets, queueing writes and draining them on their own loop
+    /// as Socket::write() does, so the benchmark measures routing and fan-out without the network.
+    /// </summary>
+    class Benchmarks_Gateway
+    {
+    // Public types...
+    public:
+        // Options for the benchmarks.
+        struct Options
+        {
+            // Subscription counts for synthetic interest graphs (the suite is run for each one)...
+            std::vector<size_t> SubscriptionCounts = { 1000, 100000 };
+
+            // The number of tokens in each subscribed subject...
+            size_t Depth = 5;
+
+            // The number of distinct tokens at each level of the graph...
+            size_t FanOut = 20;
+
+            // The proportion of subscriptions with a * wildcard...
+            double StarRatio = 0.05;
+
+            // The proportion of subscriptions ending with a > wildcard...
+            double GreaterThanRatio = 0.01;
+
+            // The number of clients over which subscriptions are spread...
+            size_t ClientCount = 1000;
+
+            // The number of subjects matched when measuring latency and churn...
+            size_t LookupCount = 1000000;
+
+            // Seed for generating synthetic graphs...
+            uint64_t Seed = 12345;
+
+            // The largest number of shards for the sharded routing benchmark (0 for the number of cores, up to 8)...
+            size_t MaxShards = 0;
+
+            // File to which results are saved as JSON (not saved if empty)...
+            std::string JSONPath;
+        };
+
+    // Public methods...
+    public:
+        // Runs all benchmarks.
+        static void runAll(const Options& options);
+
+        // Benchmarks matching subjects in the subject-matching engine.
+        static void subjectMatchingEngine(BenchmarkResults& results);
+
+        // Benchmarks matching subjects with caching, while subscriptions are being added and removed.
+        static void subjectMatchingEngine_Caching(BenchmarkResults& results);
+
+        // Benchmarks matching literal subjects, with wildcard subscriptions under only some prefixes.
+        static void subjectMatchingEngine_LiteralSubjects(BenchmarkResults& results);
+
+        // Benchmarks request / reply inbox subscriptions being added and removed.
+        static void subjectMatchingEngine_InboxChurn(BenchmarkResults& results);
+
+        // Benchmarks removing all subscriptions for clients when they disconnect.
+        static void subjectMatchingEngine_Disconnects(BenchmarkResults& results);
+
+        // Benchmarks matching subjects from several threads with the snapshot engine, while subscriptions change.
+        static void snapshotSubjectMatchingEngine(BenchmarkResults& results);
+
+        // Benchmarks routing throughput for a sharded service, with increasing numbers of shards.
+        static void shardedRouting(BenchmarkResults& results, const Options& options);
+
+        // Runs the suite of benchmarks against a synthetic interest graph with the number of subscriptions specified.
+        static void syntheticInterestGraph(BenchmarkResults& results, const Options& options, size_t subscriptionCount);
+
+    // Private types...
+    private:
+        // A synthetic interest graph.
+        struct SyntheticGraph
+        {
+            // Subject and client socket ID for each subscription...
+            std::vector<std::pair<std::string, uint64_t>> Subscriptions;
+
+            // Subjects to send, mostly subscribed to but including some which are not...
+            std::vector<std::string> SentSubjects;
+        };
+
+    // Private functions...
+    private:
+        // Adds market-data style subscriptions to the engine, and the subjects to send to the vector.
+        // Returns the number of subscriptions.
+        template<typename EngineType>
+        static uint32_t addMarketDataSubscriptions(EngineType& sme, std::vector<std::string>& subjects);
+
+        // Creates a synthetic interest graph from the options.
+        static SyntheticGraph createSyntheticGraph(const Options& options, size_t subscriptionCount);
+
+        // Gets the memory committed by the process.
+        static size_t getCommittedMemory();
+    };
+}  // namespace
+
@@ -0,0 +1,34 @@
+#include "ConflatedSubjects.h"
+#include <string_view>
+using namespace MessagingMesh;
+
+// Constructor.
+ConflatedSubjects::ConflatedSubjects(const std::vector<std::string>& patterns) :
+    m_hasPatterns(!patterns.empty())
+{
+    if (!m_hasPatterns)
+    {
+        return;
+    }
+
+    // We add each pattern as a subscription (with no socket)...
+    m_patterns.setCachingMode(SubjectMatchingEngine::CachingMode::ADAPTIVE);
+    uint32_t patternID = 0;
+    for (const auto& pattern : patterns)
+    {
+        m_patterns.addSubscription(pattern, ++patternID, 0, nullptr);
+    }
+}
+
+// Returns the conflation key for the subject, or zero if the subject is not conflated.
+uint64_t ConflatedSubjects::getConflationKey(const std::string& subject)
+{
+    if (!m_hasPatterns || m_patterns.getMatchingSubscriptionInfos(subject, m_matchScratch).empty())
+    {
+        return 0;
+    }
+
+    // The key is a hash of the subject (which cannot be zero, as zero means 'not conflated')...
+    uint64_t key = std::hash<std::string_view>{}(subject);
+    return (key != 0) ? key : 1;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "SubjectMatchingEngine.h"
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// Finds the conflation key for subjects which a service conflates.
+    ///
+    /// A service can be configured with subject patterns (eg, PRICES.>) whose messages only
+    /// need their latest value delivered. When routing a message on one of these subjects we
+    /// write it to each socket with a conflation key (a hash of the subject), and the socket
+    /// replaces any queued write with the same key and subscription ID (see Socket). So a
+    /// consumer which falls behind gets the latest value for each subject, with bounded memory.
+    ///
+    /// The patterns are held in a SubjectMatchingEngine with adaptive caching, so subjects which
+    /// are sent often (as prices are) are not matched against the patterns each time.
+    ///
+    /// Not thread-safe: each loop which routes messages has its own instance.
+    /// </summary>
+    class ConflatedSubjects
+    {
+    // Public methods...
+    public:
+        // Constructor.
+        ConflatedSubjects(const std::vector<std::string>& patterns);
+
+        // Returns the conflation key for the subject, or zero if the subject is not conflated.
+        uint64_t getConflationKey(const std::string& subject);
+
+    // Private data...
+    private:
+        // True if there are any patterns (so that we do not match subjects if there are none)...
+        bool m_hasPatterns = false;
+
+        // The patterns...
+        SubjectMatchingEngine m_patterns;
+
+        // Scratch vector for matches (reused between subjects)...
+        VecSubscriptionInfo m_matchScratch;
+    };
+} // namespace
@@ -0,0 +1,51 @@
+#include "CreditGuard.h"
+#include <format>
+#include <Buffer.h>
+#include <Logger.h>
+#include <Message.h>
+#include <NetworkMessage.h>
+#include <Socket.h>
+using namespace MessagingMesh;
+
+// Constructor.
+CreditGuard::CreditGuard(Socket* pSocket, const BufferPtr& pBuffer, NetworkMessageHeader::Action action) :
+    m_pSocket(pSocket),
+    m_updateSizeBytes(pBuffer ? pBuffer->getBufferSize() : 0),
+    m_action(action)
+{
+}
+
+// Destructor. Grants the credit for the update, if it was a message.
+CreditGuard::~CreditGuard()
+{
+    try
+    {
+        if (m_action == NetworkMessageHeader::Action::SEND_MESSAGE || m_action == NetworkMessageHeader::Action::NONE)
+        {
+            grantCredit();
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
+
+// Grants the client more credit when it has used enough of its window.
+void CreditGuard::grantCredit()
+{
+    auto credit = m_pSocket->takeCreditToGrant(m_updateSizeBytes);
+    if (credit == 0)
+    {
+        return;
+    }
+    NetworkMessage creditMessage;
+    auto& header = creditMessage.getHeader();
+    header.setAction(NetworkMessageHeader::Action::CREDIT);
+    auto pMessage = Message::create();
+    pMessage->addUnsignedInt64("Bytes", credit);
+    creditMessage.setMessage(pMessage);
+    auto pBuffer = Buffer::create();
+    creditMessage.serialize(*pBuffer);
+    m_pSocket->write(pBuffer, 0, 0, Socket::WritePriority::CONTROL);
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <SharedAliases.h>
+#include <NetworkMessageHeader.h>
+
+namespace MessagingMesh
+{
+    // Forward declarations...
+    class Socket;
+
+    /// <summary>
+    /// Grants a client credit for an update it sent, once we have processed the update.
+    ///
+    /// Clients take credit for each message they send (see ConnectionImpl::takeCredit), and we
+    /// give it back as we process their messages (see Socket::takeCreditToGrant). The credit
+    /// must come back whether or not the message was routed. Otherwise each message which fails
+    /// (eg, if routing it throws) shrinks the client's window, until a publisher which blocks
+    /// for credit waits forever.
+    ///
+    /// So the guard is created when an update is received, and grants the credit when it goes
+    /// out of scope, on every path out of the code which processes the update. It is keyed on the
+    /// update's action, which is set once the header has been read. Only messages take credit,
+    /// but an update whose header could not be read (which has no action) may have been one, so
+    /// we grant credit for it too.
+    ///
+    /// The guard must be used on the loop which routes the socket's messages.
+    /// </summary>
+    class CreditGuard
+    {
+    // Public methods...
+    public:
+        // Constructor.
+        CreditGuard(Socket* pSocket, const BufferPtr& pBuffer, NetworkMessageHeader::Action action = NetworkMessageHeader::Action::NONE);
+
+        // Destructor. Grants the credit for the update, if it was a message.
+        ~CreditGuard();
+
+        // Sets the update's action, once its header has been read.
+        void setAction(NetworkMessageHeader::Action action) { m_action = action; }
+
+    // Private functions...
+    private:
+        // Grants the client more credit when it has used enough of its window.
+        void grantCredit();
+
+    // Private data...
+    private:
+        // The socket which sent the update...
+        Socket* m_pSocket;
+
+        // The size of the update...
+        size_t m_updateSizeBytes;
+
+        // The update's action (NONE until its header has been read)...
+        NetworkMessageHeader::Action m_action;
+    };
+} // namespace
+
@@ -0,0 +1,93 @@
+#include "EpochManager.h"
+#include <format>
+#include <Exception.h>
+using namespace MessagingMesh;
+
+// Destructor.
+EpochManager::~EpochManager()
+{
+    reclaimAll();
+}
+
+// Registers a reader and returns the index of its slot.
+// Throws an exception if all slots are in use.
+uint32_t EpochManager::registerReader()
+{
+    for (uint32_t readerIndex = 0; readerIndex < MAX_READERS; ++readerIndex)
+    {
+        auto expected = false;
+        if (m_readerSlots[readerIndex].InUse.compare_exchange_strong(expected, true))
+        {
+            return readerIndex;
+        }
+    }
+    throw Exception(std::format("EpochManager supports at most {} readers", MAX_READERS));
+}
+
+// Releases the slot for the reader.
+void EpochManager::unregisterReader(uint32_t readerIndex)
+{
+    auto& readerSlot = m_readerSlots[readerIndex];
+    readerSlot.Epoch.store(NOT_ACTIVE);
+    readerSlot.InUse.store(false);
+}
+
+// Marks the reader as active in the current epoch.
+// Shared data loaded after this is not reclaimed until the reader exits.
+void EpochManager::enter(uint32_t readerIndex)
+{
+    // Note: These are sequentially consistent. If the writer's scan in reclaim() does not
+    //       see the reader as active, then the reader's loads of shared data come after the
+    //       writer unpublished the retired data, so the reader cannot reach it.
+    m_readerSlots[readerIndex].Epoch.store(m_epoch.load());
+}
+
+// Marks the reader as no longer active.
+void EpochManager::exit(uint32_t readerIndex)
+{
+    m_readerSlots[readerIndex].Epoch.store(NOT_ACTIVE);
+}
+
+// Retires data which has been unpublished, and advances the epoch.
+// The reclaim function is called when no reader can still be using the data.
+void EpochManager::retire(std::function<void()> reclaim)
+{
+    m_retired.push_back({ m_epoch.load(), std::move(reclaim) });
+    m_epoch.fetch_add(1);
+}
+
+// Reclaims retired data which no active reader can still be using.
+void EpochManager::reclaim()
+{
+    // We find the earliest epoch entered by an active reader...
+    auto earliestEpoch = UINT64_MAX;
+    for (const auto& readerSlot : m_readerSlots)
+    {
+        auto epoch = readerSlot.Epoch.load();
+        if (epoch != NOT_ACTIVE && epoch < earliestEpoch)
+        {
+            earliestEpoch = epoch;
+        }
+    }
+
+    // Data retired before that epoch can no longer be reached by any reader...
+    while (!m_retired.empty() && m_retired.front().Epoch < earliestEpoch)
+    {
+        auto reclaimFunction = std::move(m_retired.front().Reclaim);
+        m_retired.pop_front();
+        reclaimFunction();
+    }
+}
+
+// Reclaims all retired data.
+// NOTE: Only call this when there are no active readers.
+void EpochManager::reclaimAll()
+{
+    while (!m_retired.empty())
+    {
+        auto reclaimFunction = std::move(m_retired.front().Reclaim);
+        m_retired.pop_front();
+        reclaimFunction();
+    }
+}
+
@@ -0,0 +1,149 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// Epoch-based reclamation of data shared between one writer and many reader threads.
+    ///
+    /// Used by SnapshotSubjectMatchingEngine, where readers match subjects against an
+    /// immutable version of the interest graph while the writer builds and publishes new
+    /// versions. The writer cannot delete the nodes of an old version when it publishes a
+    /// new one, as readers may still be walking them.
+    ///
+    /// Epochs
+    /// ------
+    /// We hold a global epoch number. Each reader thread registers for a slot, and before
+    /// it loads a pointer to shared data it enters the current epoch by storing the epoch
+    /// number in its slot. When it has finished with the data it exits, clearing its slot.
+    ///
+    /// When the writer unpublishes data (for example by replacing the root of the graph)
+    /// it retires the data, tagged with the current epoch, and then advances the epoch.
+    /// Readers which enter after this cannot reach the retired data. So the data can be
+    /// reclaimed once every active reader has entered a later epoch than the one the data
+    /// was retired in.
+    ///
+    /// Entering and exiting are a store to the reader's own slot, so readers do not lock
+    /// or contend with each other. Slots are cache-line aligned to avoid false sharing.
+    ///
+    /// NOTE: retire() and reclaim() are writer methods and must be serialized by the caller.
+    /// </summary>
+    class EpochManager
+    {
+    // Public types...
+    public:
+        /// <summary>
+        /// Enters the epoch for a reader on construction and exits it on destruction.
+        /// </summary>
+        class Guard
+        {
+        public:
+            // Constructor.
+            Guard(EpochManager& epochManager, uint32_t readerIndex) :
+                m_epochManager(epochManager),
+                m_readerIndex(readerIndex)
+            {
+                m_epochManager.enter(m_readerIndex);
+            }
+
+            // Destructor.
+            ~Guard()
+            {
+                m_epochManager.exit(m_readerIndex);
+            }
+
+            // The guard cannot be copied...
+            Guard(const Guard&) = delete;
+            Guard& operator=(const Guard&) = delete;
+
+        private:
+            EpochManager& m_epochManager;
+            uint32_t m_readerIndex;
+        };
+
+    // Public methods...
+    public:
+        // Constructor.
+        EpochManager() {}
+
+        // Destructor.
+        ~EpochManager();
+
+        // The epoch manager cannot be copied...
+        EpochManager(const EpochManager&) = delete;
+        EpochManager& operator=(const EpochManager&) = delete;
+
+        // Registers a reader and returns the index of its slot.
+        // Throws an exception if all slots are in use.
+        uint32_t registerReader();
+
+        // Releases the slot for the reader.
+        void unregisterReader(uint32_t readerIndex);
+
+        // Marks the reader as active in the current epoch.
+        // Shared data loaded after this is not reclaimed until the reader exits.
+        void enter(uint32_t readerIndex);
+
+        // Marks the reader as no longer active.
+        void exit(uint32_t readerIndex);
+
+        // Retires data which has been unpublished, and advances the epoch.
+        // The reclaim function is called when no reader can still be using the data.
+        void retire(std::function<void()> reclaim);
+
+        // Reclaims retired data which no active reader can still be using.
+        void reclaim();
+
+        // Reclaims all retired data.
+        // NOTE: Only call this when there are no active readers.
+        void reclaimAll();
+
+        // Gets the number of retired items which have not yet been reclaimed.
+        size_t getRetiredCount() const { return m_retired.size(); }
+
+    // Public constants...
+    public:
+        // The maximum number of registered readers...
+        static constexpr uint32_t MAX_READERS = 64;
+
+    // Private types...
+    private:
+        // The epoch for a reader, on its own cache line.
+        struct alignas(64) ReaderSlot
+        {
+            // The epoch the reader entered, or NOT_ACTIVE...
+            std::atomic<uint64_t> Epoch{ NOT_ACTIVE };
+
+            // True if the slot is registered to a reader...
+            std::atomic<bool> InUse{ false };
+        };
+
+        // Retired data waiting to be reclaimed.
+        struct RetiredItem
+        {
+            uint64_t Epoch = 0;
+            std::function<void()> Reclaim;
+        };
+
+    // Private data...
+    private:
+        // The global epoch...
+        std::atomic<uint64_t> m_epoch{ 1 };
+
+        // Reader slots...
+        std::array<ReaderSlot, MAX_READERS> m_readerSlots;
+
+        // Retired data, in the order it was retired (so in epoch order)...
+        std::deque<RetiredItem> m_retired;
+
+    // Constants...
+    private:
+        // Epoch value for a reader slot when the reader is not active...
+        static constexpr uint64_t NOT_ACTIVE = 0;
+    };
+} // namespace
+
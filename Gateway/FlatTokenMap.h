@@ -0,0 +1,200 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// An open-addressing hash map keyed by interned token ID (see TokenInterner).
+    ///
+    /// Used for the child nodes of the interest graph. Keys and values are held in
+    /// one contiguous array, so a lookup is usually a single cache line rather than
+    /// the pointer-chasing of a tree or node-based hash map.
+    ///
+    /// Hashing and probing
+    /// -------------------
+    /// Token IDs are allocated sequentially, so we spread them with a multiplicative
+    /// (Fibonacci) hash and resolve collisions with linear probing. The capacity is
+    /// always a power of two and the map grows when it is more than 3/4 full.
+    ///
+    /// Erasing
+    /// -------
+    /// Erased slots are marked as tombstones so that probe sequences for other keys
+    /// are not broken. Tombstones are reclaimed when the map is rehashed.
+    /// </summary>
+    template<typename ValueType>
+    class FlatTokenMap
+    {
+    // Public methods...
+    public:
+        // Returns a pointer to the value for the key, or nullptr if the key is not in the map.
+        ValueType* find(uint32_t key)
+        {
+            if (m_size == 0)
+            {
+                return nullptr;
+            }
+            auto mask = m_slots.size() - 1;
+            for (auto index = hash(key) & mask; ; index = (index + 1) & mask)
+            {
+                auto& slot = m_slots[index];
+                if (slot.Key == key)
+                {
+                    return &slot.Value;
+                }
+                if (slot.Key == EMPTY_KEY)
+                {
+                    return nullptr;
+                }
+            }
+        }
+
+        // Returns a pointer to the value for the key, or nullptr if the key is not in the map.
+        const ValueType* find(uint32_t key) const
+        {
+            return const_cast<FlatTokenMap*>(this)->find(key);
+        }
+
+        // Inserts the key and value.
+        // NOTE: The key must not already be in the map.
+        void insert(uint32_t key, const ValueType& value)
+        {
+            // If inserting would take the map over its maximum load we rehash it. We double
+            // the capacity if the map is more than half full of live items, otherwise we
+            // rehash at the same capacity just to clear out tombstones...
+            auto capacity = m_slots.size();
+            if ((m_size + m_tombstones + 1) * 4 > capacity * 3)
+            {
+                if (capacity == 0)
+                {
+                    capacity = INITIAL_CAPACITY;
+                }
+                else if ((m_size + 1) * 2 > capacity)
+                {
+                    capacity *= 2;
+                }
+                rehash(capacity);
+            }
+
+            // We find the first empty slot or tombstone in the key's probe sequence...
+            auto mask = m_slots.size() - 1;
+            for (auto index = hash(key) & mask; ; index = (index + 1) & mask)
+            {
+                auto& slot = m_slots[index];
+                if (slot.Key == EMPTY_KEY || slot.Key == TOMBSTONE_KEY)
+                {
+                    if (slot.Key == TOMBSTONE_KEY)
+                    {
+                        --m_tombstones;
+                    }
+                    slot.Key = key;
+                    slot.Value = value;
+                    ++m_size;
+                    return;
+                }
+            }
+        }
+
+        // Erases the key from the map.
+        // Returns true if the key was in the map, false if not.
+        bool erase(uint32_t key)
+        {
+            if (m_size == 0)
+            {
+                return false;
+            }
+            auto mask = m_slots.size() - 1;
+            for (auto index = hash(key) & mask; ; index = (index + 1) & mask)
+            {
+                auto& slot = m_slots[index];
+                if (slot.Key == key)
+                {
+                    slot.Key = TOMBSTONE_KEY;
+                    slot.Value = ValueType();
+                    --m_size;
+                    ++m_tombstones;
+                    return true;
+                }
+                if (slot.Key == EMPTY_KEY)
+                {
+                    return false;
+                }
+            }
+        }
+
+        // Calls the function provided with (key, value) for each item in the map.
+        // NOTE: The function may erase() items from the map (as erasing does not rehash),
+        //       but must not insert() them.
+        template<typename Function>
+        void forEach(Function function) const
+        {
+            for (const auto& slot : m_slots)
+            {
+                if (slot.Key != EMPTY_KEY && slot.Key != TOMBSTONE_KEY)
+                {
+                    function(slot.Key, slot.Value);
+                }
+            }
+        }
+
+        // Gets the number of items in the map.
+        size_t size() const { return m_size; }
+
+        // Returns true if the map is empty.
+        bool empty() const { return m_size == 0; }
+
+        // Gets the number of bytes allocated for the map's slots.
+        size_t getAllocatedBytes() const { return m_slots.capacity() * sizeof(Slot); }
+
+    // Private types...
+    private:
+        // A key-value slot in the table.
+        struct Slot
+        {
+            uint32_t Key = EMPTY_KEY;
+            ValueType Value = ValueType();
+        };
+
+    // Private functions...
+    private:
+        // Hashes a key (Fibonacci hashing, taking the high bits of the product).
+        static size_t hash(uint32_t key)
+        {
+            return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32);
+        }
+
+        // Rebuilds the table with the capacity specified, dropping tombstones.
+        void rehash(size_t capacity)
+        {
+            std::vector<Slot> oldSlots(capacity);
+            oldSlots.swap(m_slots);
+            m_size = 0;
+            m_tombstones = 0;
+            for (const auto& slot : oldSlots)
+            {
+                if (slot.Key != EMPTY_KEY && slot.Key != TOMBSTONE_KEY)
+                {
+                    insert(slot.Key, slot.Value);
+                }
+            }
+        }
+
+    // Private data...
+    private:
+        // The table of slots. Its size is always zero or a power of two...
+        std::vector<Slot> m_slots;
+
+        // The number of items in the map...
+        size_t m_size = 0;
+
+        // The number of erased slots not yet reclaimed...
+        size_t m_tombstones = 0;
+
+    // Constants...
+    private:
+        static constexpr uint32_t EMPTY_KEY = 0xffffffff;
+        static constexpr uint32_t TOMBSTONE_KEY = 0xfffffffe;
+        static constexpr size_t INITIAL_CAPACITY = 4;
+    };
+} // namespace
+
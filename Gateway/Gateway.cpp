@@ -1,8 +1,10 @@
 #include "Gateway.h"
 #include <format>
+#include <optional>
 #include <Socket.h>
 #include <Logger.h>
 #include <NetworkMessage.h>
+#include <Message.h>
 #include <Exception.h>
 #include <UVLoop.h>
 #include "MeshManager.h"
@@ -12,6 +14,7 @@ using namespace MessagingMesh;
 Gateway::Gateway(int port) :
     m_port(port),
     m_pUVLoop(UVLoop::create("GATEWAY", UVLoop::Temperature::COLD)),
+    m_serviceScheduler(m_pUVLoop, m_meshManager),
     m_meshManager(*this)
 {
     // We initialize the gateway in the context of the UV loop...
@@ -86,7 +89,8 @@ void Gateway::onDataReceived(Socket* pSocket, BufferPtr pBuffer)
         {
         case NetworkMessageHeader::Action::CONNECT:
         case NetworkMessageHeader::Action::CONNECT_MESH_PEER:
-            onConnect(pSocket->getSocketID(), header);
+            networkMessage.deserializeMessage(*pBuffer);
+            onConnect(pSocket->getSocketID(), networkMessage);
             break;
         }
     }
@@ -123,9 +127,10 @@ void Gateway::onConnectionStatusChanged(Socket* pSocket, Socket::ConnectionStatu
 }
 
 // Called when we receive a CONNECT message from a client.
-void Gateway::onConnect(uint64_t socketID, const NetworkMessageHeader& header)
+void Gateway::onConnect(uint64_t socketID, const NetworkMessage& networkMessage)
 {
     // We log the connect request...
+    auto& header = networkMessage.getHeader();
     auto& service = header.getSubject();
     bool isMeshPeer = false;
     std::string strAction;
@@ -154,11 +159,22 @@ void Gateway::onConnect(uint64_t socketID, const NetworkMessageHeader& header)
     pSocket->setClientID(header.getReplySubject());
     Logger::info(std::format("Received {} request from {} for service {}", strAction, pSocket->getName(), service));
 
+    // We only send large messages in chunks if the peer has said it can read them...
+    auto pMessage = networkMessage.getMessage();
+    pSocket->setPeerSupportsChunks(pMessage->tryGetBool("SupportsChunks").value_or(false));
+
+    // A mesh peer tells us its gateway ID (unless it is an older gateway)...
+    std::optional<uint32_t> peerGatewayID;
+    if (isMeshPeer)
+    {
+        peerGatewayID = pMessage->tryGetUnsignedInt32("GatewayID");
+    }
+
     // We get or create the ServiceManager for the service requested by the client...
     auto& serviceManager = getOrCreateServiceManager(service);
     
     // We move the socket to the service-manager...
-    serviceManager.registerSocket(pSocket, isMeshPeer);
+    serviceManager.registerSocket(pSocket, isMeshPeer, peerGatewayID);
 
     // The socket is now managed by the service-manager, so we remove it from our pending-collection...
     m_pendingConnections.erase(socketID);
@@ -167,6 +183,6 @@ void Gateway::onConnect(uint64_t socketID, const NetworkMessageHeader& header)
 // Gets or creates a service-manager for the specified service.
 ServiceManager& Gateway::getOrCreateServiceManager(const std::string& service)
 {
-    auto [it, inserted] = m_serviceManagers.try_emplace(service, service, *this, m_meshManager);
+    auto [it, inserted] = m_serviceManagers.try_emplace(service, service, *this, m_meshManager, m_serviceScheduler);
     return it->second;
 }
@@ -4,6 +4,7 @@
 #include <SharedAliases.h>
 #include "MeshManager.h"
 #include "ServiceManager.h"
+#include "ServiceScheduler.h"
 
 namespace MessagingMesh
 {
@@ -30,8 +31,8 @@ namespace MessagingMesh
     /// SERVICE-1. This allows a single gateway to manage messaging for multiple systems with
     /// no cross-talk of messaging between them, even if they use the same subject names.
     /// 
-    /// One UV loop per service
-    /// -----------------------
+    /// UV loops for services
+    /// ---------------------
     /// The gateway has a loop which it uses to listen for new client connections. All initial
     /// connections are handled by this loop, regardless of service. At the point of the initial
     /// connection we do not yet know the service requested by the client and the client socket
@@ -42,8 +43,10 @@ namespace MessagingMesh
     /// one if this is the first client for the service. The client socket will be handed to the
     /// ServiceManager and removed from the pending-connection collectio.
     /// 
-    /// Each ServiceManager runs its own UV loop, so all subsequent interactions with the client
-    /// will be managed by that loop. This means that each service runs on its own thread.
+    /// Each ServiceManager runs on a UV loop, so all subsequent interactions with the client
+    /// will be managed by that loop. Services share a pool of loops (one per core by default),
+    /// managed by the ServiceScheduler, which moves services between the loops to balance the
+    /// load. Each service runs on one loop at a time, so its processing is single-threaded.
     /// </summary>
     class Gateway : public Socket::ICallback
     {
@@ -94,7 +97,7 @@ namespace MessagingMesh
         void initialize();
 
         // Called when we receive a CONNECT message from a client.
-        void onConnect(uint64_t socketID, const NetworkMessageHeader& header);
+        void onConnect(uint64_t socketID, const NetworkMessage& networkMessage);
 
     // Private data...
     private:
@@ -116,6 +119,10 @@ namespace MessagingMesh
         // out of scope and being destructed.
         std::unordered_map<uint64_t, SocketPtr> m_pendingConnections;
 
+        // Places services on a pool of UV loops. (Declared before the service managers, so that
+        // the loops outlive them.)
+        ServiceScheduler m_serviceScheduler;
+
         // Service managers, keyed by service name...
         std::unordered_map<std::string, ServiceManager> m_serviceManagers;
 
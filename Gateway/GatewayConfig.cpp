@@ -21,17 +21,50 @@ NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE
     MeshGateways
 )
 
+// Raw config for one service in the Services section, and a JSON parsing helper for it.
+// (Fields not in the JSON keep their default values.)
+struct RawServiceConfig
+{
+    std::string Name;
+    size_t Shards = 1;
+    size_t IOLoops = 0;
+    size_t MaxQueuedBytes = GatewayConfig::DEFAULT_OUTPUT_QUEUE_LIMITS.MaxBytes;
+    size_t MaxQueuedMessages = GatewayConfig::DEFAULT_OUTPUT_QUEUE_LIMITS.MaxMessages;
+    std::string SlowConsumerPolicy = "DISCONNECT";
+    std::vector<std::string> ConflatedSubjects;
+    std::vector<std::string> CachedSubjects;
+    uint64_t PublishWindowBytes = GatewayConfig::DEFAULT_PUBLISH_WINDOW_BYTES;
+};
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT
+(
+    RawServiceConfig,
+    Name,
+    Shards,
+    IOLoops,
+    MaxQueuedBytes,
+    MaxQueuedMessages,
+    SlowConsumerPolicy,
+    ConflatedSubjects,
+    CachedSubjects,
+    PublishWindowBytes
+)
+
 // Raw config parsed from gateway-config.json, and a JSON parsing helper for it.
+// (The Services and ServiceLoops sections are optional, so older config files still parse.)
 struct RawConfig
 {
     std::string CoordinatorGateway;
     std::vector<RawStartupMeshConfig> StartupMeshes;
+    std::vector<RawServiceConfig> Services;
+    size_t ServiceLoops = 0;
 };
-NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT
 (
     RawConfig,
     CoordinatorGateway,
-    StartupMeshes
+    StartupMeshes,
+    Services,
+    ServiceLoops
 )
 
 // Constructor.
@@ -68,6 +101,51 @@ void GatewayConfig::parse(const std::string& filename)
         }
         m_config.StartupMeshConfigs[meshConfig.Name] = meshConfig;
     }
+
+    // Services...
+    for (const auto& rawServiceConfig : rawConfig.Services)
+    {
+        if (rawServiceConfig.Shards == 0)
+        {
+            throw Exception(std::format("Service {} must have at least one shard", rawServiceConfig.Name));
+        }
+        if (rawServiceConfig.Shards > 1 && rawServiceConfig.IOLoops > 0)
+        {
+            throw Exception(std::format("Service {} cannot be both sharded and pipelined (with IO loops)", rawServiceConfig.Name));
+        }
+        ServiceConfig serviceConfig;
+        serviceConfig.Name = rawServiceConfig.Name;
+        serviceConfig.Shards = rawServiceConfig.Shards;
+        serviceConfig.IOLoops = rawServiceConfig.IOLoops;
+        serviceConfig.OutputQueueLimits.MaxBytes = rawServiceConfig.MaxQueuedBytes;
+        serviceConfig.OutputQueueLimits.MaxMessages = rawServiceConfig.MaxQueuedMessages;
+        serviceConfig.OutputQueueLimits.Policy = parseSlowConsumerPolicy(rawServiceConfig.SlowConsumerPolicy);
+        serviceConfig.ConflatedSubjects = rawServiceConfig.ConflatedSubjects;
+        serviceConfig.CachedSubjects = rawServiceConfig.CachedSubjects;
+        serviceConfig.PublishWindowBytes = rawServiceConfig.PublishWindowBytes;
+        m_config.ServiceConfigs[serviceConfig.Name] = serviceConfig;
+    }
+
+    // Service loops...
+    m_config.ServiceLoops = rawConfig.ServiceLoops;
+}
+
+// Parses a slow-consumer policy from its name in the config, eg "DROP_OLDEST".
+Socket::SlowConsumerPolicy GatewayConfig::parseSlowConsumerPolicy(const std::string& policy)
+{
+    static const std::unordered_map<std::string, Socket::SlowConsumerPolicy> policies =
+    {
+        { "DROP_NEWEST", Socket::SlowConsumerPolicy::DROP_NEWEST },
+        { "DROP_OLDEST", Socket::SlowConsumerPolicy::DROP_OLDEST },
+        { "CONFLATE", Socket::SlowConsumerPolicy::CONFLATE },
+        { "DISCONNECT", Socket::SlowConsumerPolicy::DISCONNECT }
+    };
+    auto it = policies.find(policy);
+    if (it != policies.end())
+    {
+        return it->second;
+    }
+    throw Exception(std::format("{} is not a valid SlowConsumerPolicy (expected DROP_NEWEST, DROP_OLDEST, CONFLATE or DISCONNECT)", policy));
 }
 
 // Returns a GatewayInfo for the "hostname:port" provided.
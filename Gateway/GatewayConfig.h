@@ -2,6 +2,7 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <Socket.h>
 #include "GatewayInfo.h"
 
 namespace MessagingMesh
@@ -12,6 +13,14 @@ namespace MessagingMesh
     // Reads gateway-config.json, including enriching the config.
     class GatewayConfig
     {
+    // Constants...
+    public:
+        // Output queue limits for client sockets of services which do not configure them...
+        static constexpr Socket::OutputQueueLimits DEFAULT_OUTPUT_QUEUE_LIMITS = { 256 * 1024 * 1024, 0, Socket::SlowConsumerPolicy::DISCONNECT };
+
+        // Credit window (in bytes) for clients publishing to services which do not configure it...
+        static constexpr uint64_t DEFAULT_PUBLISH_WINDOW_BYTES = 8 * 1024 * 1024;
+
     // Public types...
     public:
         // Config (enriched) for one mesh in the StartupMeshes section.
@@ -22,11 +31,47 @@ namespace MessagingMesh
             std::vector<GatewayInfo> MeshGatewayInfos;
         };
 
+        // Config for one service in the Services section.
+        struct ServiceConfig
+        {
+            std::string Name;
+
+            // The number of UV loops across which the service's client sockets are spread.
+            // One (the default) runs the service on a single loop (see ServiceManager)...
+            size_t Shards = 1;
+
+            // The number of IO loops for a pipelined service, which do socket IO so that the
+            // service's own loop only routes messages. Zero (the default) does IO on the
+            // service's loop. A service cannot be both sharded and pipelined...
+            size_t IOLoops = 0;
+
+            // Limits on the data queued to each client socket, and what to do with a slow
+            // consumer when they are reached (see Socket)...
+            Socket::OutputQueueLimits OutputQueueLimits = DEFAULT_OUTPUT_QUEUE_LIMITS;
+
+            // Subject patterns for which clients only need the latest value. Queued messages on
+            // these subjects are replaced by newer ones (see ConflatedSubjects)...
+            std::vector<std::string> ConflatedSubjects;
+
+            // Subject patterns whose latest values the service caches. New subscriptions are sent
+            // the cached values for the subjects they match (see LastValueCache)...
+            std::vector<std::string> CachedSubjects;
+
+            // The number of bytes of messages a client can publish before it waits for the service
+            // to process them (credit-based flow control). Zero for no flow control...
+            uint64_t PublishWindowBytes = DEFAULT_PUBLISH_WINDOW_BYTES;
+        };
+
         // Enriched version of gateway-config.json.
         struct Config
         {
             GatewayInfo CoordinatorGateway;
             std::unordered_map<std::string, StartupMeshConfig> StartupMeshConfigs;
+            std::unordered_map<std::string, ServiceConfig> ServiceConfigs;
+
+            // The number of UV loops in the pool shared by (unsharded) services, or zero for
+            // the number of cores (see ServiceScheduler)...
+            size_t ServiceLoops = 0;
         };
 
     // Public methods...
@@ -40,6 +85,9 @@ namespace MessagingMesh
         // Returns the parsed and enriched config.
         const Config& getConfig() const { return m_config; }
 
+        // Parses a slow-consumer policy from its name in the config, eg "DROP_OLDEST".
+        static Socket::SlowConsumerPolicy parseSlowConsumerPolicy(const std::string& policy);
+
     // Private functions...
     private:
         // Returns a GatewayInfo for the "hostname:port" provided.
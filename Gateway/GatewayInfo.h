@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <format>
 #include <vector>
@@ -34,6 +35,19 @@ namespace MessagingMesh
         {
             return std::format("{}~{}", Hostname, Port);
         }
+
+        // Returns an ID for this gateway-info (a hash of its key). A gateway's ID for itself is used in
+        // its inbox subjects, and sent to its peers when they connect (see InboxRouter).
+        uint32_t makeID() const
+        {
+            // We use FNV-1a, as std::hash can differ between builds...
+            uint32_t id = 2166136261u;
+            for (auto c : makeKey())
+            {
+                id = (id ^ static_cast<uint8_t>(c)) * 16777619u;
+            }
+            return id;
+        }
     };
 
     // A vector of gateway-info.
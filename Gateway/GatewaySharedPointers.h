@@ -6,10 +6,7 @@ namespace MessagingMesh
     // Forward declarations...
     class SubscriptionInfo;
 
-    // Shared pointer to a SubscriptionInfo.
-    using SubscriptionInfoPtr = std::shared_ptr<SubscriptionInfo>;
-
-    // Vector of SubscriptionInfo.
-    using VecSubscriptionInfo = std::vector<SubscriptionInfoPtr>;
+    // Vector of SubscriptionInfo (held by value).
+    using VecSubscriptionInfo = std::vector<SubscriptionInfo>;
 
 } // namespace
@@ -0,0 +1,230 @@
+#include "InboxRouter.h"
+#include <algorithm>
+#include <charconv>
+#include <format>
+#include <iterator>
+#include <unordered_set>
+using namespace MessagingMesh;
+
+// Constructor.
+// The peer count is the number of peer gateways in the mesh, which connect to us.
+InboxRouter::InboxRouter(uint32_t gatewayID, size_t peerCount) :
+    m_gatewayID(gatewayID),
+    m_peerCount(peerCount),
+    m_peersRouteToInboxes(peerCount == 0)
+{
+}
+
+// Gets the prefix for the direct inboxes of a client socket.
+std::string InboxRouter::getInboxPrefix(uint64_t socketID) const
+{
+    return std::format("{}{:08x}.{}.", INBOX_SUBJECT_PREFIX, m_gatewayID, socketID);
+}
+
+// Adds a peer gateway, to which messages for its inboxes are sent, with the ID it reported in its ACK.
+void InboxRouter::addPeer(uint32_t gatewayID, const MeshGatewayConnection* pPeer)
+{
+    std::scoped_lock lock(m_mutex);
+    auto& peers = m_peers[gatewayID];
+    if (std::find(peers.begin(), peers.end(), pPeer) == peers.end())
+    {
+        peers.push_back(pPeer);
+    }
+}
+
+// Removes a peer gateway (eg, when our connection to it is lost).
+void InboxRouter::removePeer(const MeshGatewayConnection* pPeer)
+{
+    std::scoped_lock lock(m_mutex);
+    for (auto it = m_peers.begin(); it != m_peers.end();)
+    {
+        std::erase(it->second, pPeer);
+        it = it->second.empty() ? m_peers.erase(it) : std::next(it);
+    }
+}
+
+// Adds the socket of a peer gateway which has connected to us, with the ID it reported (if any).
+void InboxRouter::addPeerSocket(uint64_t socketID, std::optional<uint32_t> gatewayID)
+{
+    std::scoped_lock lock(m_mutex);
+    m_peerSocketGatewayIDs[socketID] = gatewayID;
+    updatePeersRouteToInboxes();
+}
+
+// Removes the socket of a peer gateway which has disconnected.
+void InboxRouter::removePeerSocket(uint64_t socketID)
+{
+    std::scoped_lock lock(m_mutex);
+    m_peerSocketGatewayIDs.erase(socketID);
+    updatePeersRouteToInboxes();
+}
+
+// Returns true if all peers can send replies straight to our direct inboxes.
+bool InboxRouter::getPeersRouteToInboxes() const
+{
+    std::scoped_lock lock(m_mutex);
+    return m_peersRouteToInboxes;
+}
+
+// Adds a subscription if it is to one of the socket's direct inboxes.
+// Returns false if it is not, or if not all peers can route to our inboxes yet, in which case it is routed by subscription.
+bool InboxRouter::addSubscription(const std::string& subject, uint32_t subscriptionID, uint64_t socketID, Socket* pSocket)
+{
+    // We check that the inbox is one of the socket's own...
+    uint32_t inboxGatewayID;
+    uint64_t inboxSocketID;
+    if (!parse(subject, inboxGatewayID, inboxSocketID) || inboxGatewayID != m_gatewayID || inboxSocketID != socketID)
+    {
+        return false;
+    }
+
+    // If a peer could not send the reply straight to us, the subscription must be relayed to the mesh...
+    std::scoped_lock lock(m_mutex);
+    if (!m_peersRouteToInboxes)
+    {
+        return false;
+    }
+    auto& socketInboxes = m_socketInboxes[socketID];
+    socketInboxes.pSocket = pSocket;
+    if (socketInboxes.SubscriptionIDs.insert_or_assign(subject, subscriptionID).second)
+    {
+        m_subscriptionCount++;
+    }
+    return true;
+}
+
+// Removes a subscription if it is to one of the socket's direct inboxes.
+// Returns false if we do not hold it (in which case it was routed by subscription).
+bool InboxRouter::removeSubscription(const std::string& subject, uint64_t socketID)
+{
+    uint32_t inboxGatewayID;
+    uint64_t inboxSocketID;
+    if (!parse(subject, inboxGatewayID, inboxSocketID) || inboxGatewayID != m_gatewayID || inboxSocketID != socketID)
+    {
+        return false;
+    }
+
+    // We remove the subscription, and the socket when it has no more...
+    std::scoped_lock lock(m_mutex);
+    auto it = m_socketInboxes.find(socketID);
+    if (it == m_socketInboxes.end())
+    {
+        return false;
+    }
+    auto& subscriptionIDs = it->second.SubscriptionIDs;
+    auto itSubscription = subscriptionIDs.find(subject);
+    if (itSubscription == subscriptionIDs.end())
+    {
+        return false;
+    }
+    subscriptionIDs.erase(itSubscription);
+    m_subscriptionCount--;
+    if (subscriptionIDs.empty())
+    {
+        m_socketInboxes.erase(it);
+    }
+    return true;
+}
+
+// Removes all direct inbox subscriptions for the socket.
+void InboxRouter::removeAllSubscriptions(uint64_t socketID)
+{
+    std::scoped_lock lock(m_mutex);
+    auto it = m_socketInboxes.find(socketID);
+    if (it != m_socketInboxes.end())
+    {
+        m_subscriptionCount -= it->second.SubscriptionIDs.size();
+        m_socketInboxes.erase(it);
+    }
+}
+
+// Finds where to send a message to a direct inbox.
+// Returns false if it is routed by subscription: if the subject is not a direct inbox of this gateway or a known peer, or we do not hold the subscription to it.
+bool InboxRouter::findDestination(const std::string& subject, Destination& destination) const
+{
+    uint32_t inboxGatewayID;
+    uint64_t inboxSocketID;
+    if (!parse(subject, inboxGatewayID, inboxSocketID))
+    {
+        return false;
+    }
+    std::scoped_lock lock(m_mutex);
+
+    // If the inbox is a peer's, we send the message to the peer (unless more than one peer has its ID)...
+    if (inboxGatewayID != m_gatewayID)
+    {
+        auto it = m_peers.find(inboxGatewayID);
+        if (it == m_peers.end() || it->second.size() != 1)
+        {
+            return false;
+        }
+        destination.pPeer = it->second.front();
+        return true;
+    }
+
+    // The inbox is ours, so we look up the client's subscription to it. If we do not hold one,
+    // the subscription may have been routed by subscription (see addSubscription), so we route
+    // the message by subscription too...
+    auto it = m_socketInboxes.find(inboxSocketID);
+    if (it == m_socketInboxes.end())
+    {
+        return false;
+    }
+    auto itSubscription = it->second.SubscriptionIDs.find(subject);
+    if (itSubscription == it->second.SubscriptionIDs.end())
+    {
+        return false;
+    }
+    destination.pSocket = it->second.pSocket;
+    destination.SubscriptionID = itSubscription->second;
+    return true;
+}
+
+// Gets the number of direct inbox subscriptions.
+size_t InboxRouter::size() const
+{
+    std::scoped_lock lock(m_mutex);
+    return m_subscriptionCount;
+}
+
+// Parses the gateway ID and socket ID from a direct inbox subject.
+// Returns false if the subject is not a direct inbox.
+bool InboxRouter::parse(std::string_view subject, uint32_t& gatewayID, uint64_t& socketID)
+{
+    // A direct inbox is _INBOX.[gateway ID (hex)].[socket ID].[guid]...
+    if (!subject.starts_with(INBOX_SUBJECT_PREFIX))
+    {
+        return false;
+    }
+    auto pStart = subject.data() + INBOX_SUBJECT_PREFIX.size();
+    auto pEnd = subject.data() + subject.size();
+    auto [pGatewayIDEnd, gatewayIDError] = std::from_chars(pStart, pEnd, gatewayID, 16);
+    if (gatewayIDError != std::errc() || pGatewayIDEnd == pEnd || *pGatewayIDEnd != '.')
+    {
+        return false;
+    }
+    auto [pSocketIDEnd, socketIDError] = std::from_chars(pGatewayIDEnd + 1, pEnd, socketID);
+    if (socketIDError != std::errc() || pSocketIDEnd == pEnd || *pSocketIDEnd != '.' || pSocketIDEnd + 1 == pEnd)
+    {
+        return false;
+    }
+    return true;
+}
+
+// Works out whether all peers can send replies straight to our direct inboxes.
+// Called with the router locked.
+void InboxRouter::updatePeersRouteToInboxes()
+{
+    // Each peer in the mesh must have connected to us, and reported an ID which is not ours
+    // or another peer's...
+    std::unordered_set<uint32_t> gatewayIDs;
+    for (const auto& [socketID, gatewayID] : m_peerSocketGatewayIDs)
+    {
+        if (!gatewayID || *gatewayID == m_gatewayID || !gatewayIDs.insert(*gatewayID).second)
+        {
+            m_peersRouteToInboxes = false;
+            return;
+        }
+    }
+    m_peersRouteToInboxes = (gatewayIDs.size() >= m_peerCount);
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "StringHash.h"
+
+namespace MessagingMesh
+{
+    // Forward declarations...
+    class Socket;
+    class MeshGatewayConnection;
+
+    /// <summary>
+    /// Routes replies to request inboxes straight to the client which made the request, rather
+    /// than through the subject-matching engine.
+    ///
+    /// Each request (see Connection::sendRequest) subscribes to a new inbox, and unsubscribes
+    /// when it has the reply. If these subscriptions went into the subject-matching engine they
+    /// would also be relayed to every mesh peer, which is three control messages per peer for
+    /// each request.
+    ///
+    /// Direct inboxes
+    /// --------------
+    /// When a client connects, its ACK holds an inbox prefix which names the gateway and the
+    /// client's socket (see getInboxPrefix), and the client creates its inboxes under it:
+    ///   _INBOX.[gateway ID].[socket ID].[guid]
+    /// The gateway ID is a hash of the gateway's own hostname and port (see GatewayInfo::makeID).
+    /// Gateways tell each other their IDs when they connect (in CONNECT_MESH_PEER and its ACK),
+    /// and peers are keyed on the ID they report, as our config may name a peer differently from
+    /// the way it names itself (eg, localhost).
+    ///
+    /// Subscriptions which a client makes to its own direct inboxes are held here, by socket ID
+    /// and subject. They are not added to the subject-matching engine or relayed to the mesh. A
+    /// message sent to a direct inbox is routed from its subject: to the client's socket if the
+    /// inbox is ours, or to the peer gateway which owns the inbox.
+    ///
+    /// Other inboxes (eg, from clients which do not use the inbox prefix) are routed by
+    /// subscription as before. Wildcard subscriptions (eg, to _INBOX.>) do not see messages
+    /// sent to direct inboxes.
+    ///
+    /// Peers which do not know our ID
+    /// ------------------------------
+    /// A peer can only send replies straight to our inboxes if it has our ID, which it gets in
+    /// the ACK to its CONNECT_MESH_PEER. Older peers do not report their IDs, and do not route
+    /// replies in this way. So until each peer in the mesh has connected to us and reported an
+    /// ID (which is not ours or another peer's), addSubscription returns false and subscriptions
+    /// to direct inboxes are routed by subscription, which relays them to the mesh. Replies to
+    /// these inboxes are matched by the subject-matching engine as before.
+    ///
+    /// Thread safety
+    /// -------------
+    /// The shards of a sharded service route messages on their own loops, so the router is locked.
+    /// </summary>
+    class InboxRouter
+    {
+    // Public types...
+    public:
+        // Where a message to a direct inbox is sent: to our client's socket (with the client's
+        // subscription ID for the inbox), or to the peer gateway which owns the inbox.
+        struct Destination
+        {
+            Socket* pSocket = nullptr;
+            uint32_t SubscriptionID = 0;
+            const MeshGatewayConnection* pPeer = nullptr;
+        };
+
+    // Public constants...
+    public:
+        // Prefix of inbox subjects, to which replies to requests are sent (see Connection::createInbox)...
+        static constexpr std::string_view INBOX_SUBJECT_PREFIX = "_INBOX.";
+
+    // Public methods...
+    public:
+        // Constructor.
+        // The peer count is the number of peer gateways in the mesh, which connect to us.
+        InboxRouter(uint32_t gatewayID, size_t peerCount = 0);
+
+        // Gets the ID of this gateway.
+        uint32_t getGatewayID() const { return m_gatewayID; }
+
+        // Gets the prefix for the direct inboxes of a client socket.
+        std::string getInboxPrefix(uint64_t socketID) const;
+
+        // Adds a peer gateway, to which messages for its inboxes are sent, with the ID it reported in its ACK.
+        void addPeer(uint32_t gatewayID, const MeshGatewayConnection* pPeer);
+
+        // Removes a peer gateway (eg, when our connection to it is lost).
+        void removePeer(const MeshGatewayConnection* pPeer);
+
+        // Adds the socket of a peer gateway which has connected to us, with the ID it reported (if any).
+        void addPeerSocket(uint64_t socketID, std::optional<uint32_t> gatewayID);
+
+        // Removes the socket of a peer gateway which has disconnected.
+        void removePeerSocket(uint64_t socketID);
+
+        // Returns true if all peers can send replies straight to our direct inboxes.
+        bool getPeersRouteToInboxes() const;
+
+        // Adds a subscription if it is to one of the socket's direct inboxes.
+        // Returns false if it is not, or if not all peers can route to our inboxes yet, in which case it is routed by subscription.
+        bool addSubscription(const std::string& subject, uint32_t subscriptionID, uint64_t socketID, Socket* pSocket);
+
+        // Removes a subscription if it is to one of the socket's direct inboxes.
+        // Returns false if we do not hold it (in which case it was routed by subscription).
+        bool removeSubscription(const std::string& subject, uint64_t socketID);
+
+        // Removes all direct inbox subscriptions for the socket.
+        void removeAllSubscriptions(uint64_t socketID);
+
+        // Finds where to send a message to a direct inbox.
+        // Returns false if it is routed by subscription: if the subject is not a direct inbox of this gateway or a known peer, or we do not hold the subscription to it.
+        bool findDestination(const std::string& subject, Destination& destination) const;
+
+        // Gets the number of direct inbox subscriptions.
+        size_t size() const;
+
+    // Private types...
+    private:
+        // The direct inbox subscriptions of one client socket, keyed by subject.
+        struct SocketInboxes
+        {
+            Socket* pSocket = nullptr;
+            std::unordered_map<std::string, uint32_t, StringHash, std::equal_to<>> SubscriptionIDs;
+        };
+
+    // Private functions...
+    private:
+        // Parses the gateway ID and socket ID from a direct inbox subject.
+        // Returns false if the subject is not a direct inbox.
+        static bool parse(std::string_view subject, uint32_t& gatewayID, uint64_t& socketID);
+
+        // Works out whether all peers can send replies straight to our direct inboxes.
+        // Called with the router locked.
+        void updatePeersRouteToInboxes();
+
+    // Private data...
+    private:
+        // The ID of this gateway...
+        uint32_t m_gatewayID;
+
+        // Peer gateways, keyed by the gateway ID they reported. (If more than one peer reports the
+        // same ID, messages to its inboxes are routed by subscription.)
+        std::unordered_map<uint32_t, std::vector<const MeshGatewayConnection*>> m_peers;
+
+        // The number of peer gateways in the mesh...
+        size_t m_peerCount;
+
+        // Sockets of peer gateways which have connected to us, with the IDs they reported...
+        std::unordered_map<uint64_t, std::optional<uint32_t>> m_peerSocketGatewayIDs;
+
+        // True if all peers can send replies straight to our direct inboxes...
+        bool m_peersRouteToInboxes;
+
+        // Direct inbox subscriptions, keyed by socket ID...
+        std::unordered_map<uint64_t, SocketInboxes> m_socketInboxes;
+
+        // The number of direct inbox subscriptions...
+        size_t m_subscriptionCount = 0;
+
+        // Locks the router...
+        mutable std::mutex m_mutex;
+    };
+} // namespace
+
@@ -0,0 +1,74 @@
+#include "LastValueCache.h"
+#include <MMUtils.h>
+using namespace MessagingMesh;
+
+// Constructor.
+LastValueCache::LastValueCache(const std::vector<std::string>& patterns) :
+    m_hasPatterns(!patterns.empty())
+{
+    if (!m_hasPatterns)
+    {
+        return;
+    }
+
+    // We add each pattern as a subscription (with no socket)...
+    m_patterns.setCachingMode(SubjectMatchingEngine::CachingMode::ADAPTIVE);
+    uint32_t patternID = 0;
+    for (const auto& pattern : patterns)
+    {
+        m_patterns.addSubscription(pattern, ++patternID, 0, nullptr);
+    }
+}
+
+// Holds the message as the latest value for its subject, if the subject is cached.
+void LastValueCache::update(const std::string& subject, const BufferPtr& pBuffer)
+{
+    if (!m_hasPatterns)
+    {
+        return;
+    }
+    std::scoped_lock lock(m_mutex);
+
+    // If the subject is already cached we replace its value...
+    auto it = m_values.find(subject);
+    if (it != m_values.end())
+    {
+        *it->second = pBuffer;
+        return;
+    }
+
+    // This is the first message on the subject, so we check whether it is cached...
+    if (m_patterns.getMatchingSubscriptionInfos(subject, m_matchScratch).empty())
+    {
+        return;
+    }
+    auto tokens = MMUtils::tokenize(subject, '.');
+    m_subjectIndex.insert(tokens, pBuffer);
+    m_values.emplace(subject, m_subjectIndex.find(tokens));
+}
+
+// Gets the latest messages for the cached subjects which the pattern matches.
+std::vector<BufferPtr> LastValueCache::getMatches(const std::string& pattern) const
+{
+    std::vector<BufferPtr> matches;
+    if (!m_hasPatterns)
+    {
+        return matches;
+    }
+    std::scoped_lock lock(m_mutex);
+    m_subjectIndex.forEachMatch(
+        MMUtils::tokenize(pattern, '.'),
+        [&matches](const BufferPtr& pBuffer)
+        {
+            matches.push_back(pBuffer);
+        }
+    );
+    return matches;
+}
+
+// Gets the number of subjects in the cache.
+size_t LastValueCache::size() const
+{
+    std::scoped_lock lock(m_mutex);
+    return m_subjectIndex.size();
+}
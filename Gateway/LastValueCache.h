@@ -0,0 +1,78 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <SharedAliases.h>
+#include "StringHash.h"
+#include "SubjectIndex.h"
+#include "SubjectMatchingEngine.h"
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// Holds the latest message sent on each subject which a service caches, so that
+    /// new subscribers get the current value straight away.
+    ///
+    /// A service can be configured with subject patterns (eg, PRICES.>) whose latest values are
+    /// cached. When a client subscribes, the service sends it the cached messages for all the
+    /// subjects its subscription matches (see ServiceManager::sendCachedValues), rather than the
+    /// client waiting for the next message on each subject.
+    ///
+    /// Finding the cached subjects for a subscription
+    /// ----------------------------------------------
+    /// Subscriptions can include wildcards, so the cached messages are held in a SubjectIndex,
+    /// which finds the subjects a pattern matches by walking only the matching branches of a
+    /// trie of the subjects' tokens.
+    ///
+    /// Subjects are also held in a map to their values in the index, so that updating a subject
+    /// which is already cached (by far the most common case) does not tokenize the subject or
+    /// match it against the patterns. (Values in the index do not move, as subjects are never
+    /// removed from it.) The patterns are held in a SubjectMatchingEngine with adaptive caching,
+    /// as for ConflatedSubjects.
+    ///
+    /// Thread safety
+    /// -------------
+    /// The shards of a sharded service share the cache, so it is locked. Services which do not
+    /// cache any subjects do not take the lock.
+    /// </summary>
+    class LastValueCache
+    {
+    // Public methods...
+    public:
+        // Constructor.
+        LastValueCache(const std::vector<std::string>& patterns);
+
+        // Returns true if the service caches any subjects.
+        bool isEnabled() const { return m_hasPatterns; }
+
+        // Holds the message as the latest value for its subject, if the subject is cached.
+        void update(const std::string& subject, const BufferPtr& pBuffer);
+
+        // Gets the latest messages for the cached subjects which the pattern matches.
+        std::vector<BufferPtr> getMatches(const std::string& pattern) const;
+
+        // Gets the number of subjects in the cache.
+        size_t size() const;
+
+    // Private data...
+    private:
+        // True if there are any patterns (so that we do not match subjects if there are none)...
+        bool m_hasPatterns = false;
+
+        // The patterns...
+        SubjectMatchingEngine m_patterns;
+
+        // Scratch vector for matches (reused between subjects)...
+        VecSubscriptionInfo m_matchScratch;
+
+        // The latest message for each cached subject, indexed by the subject's tokens...
+        SubjectIndex<BufferPtr> m_subjectIndex;
+
+        // Cached subjects to their values in the index...
+        std::unordered_map<std::string, BufferPtr*, StringHash, std::equal_to<>> m_values;
+
+        // Locks the cache...
+        mutable std::mutex m_mutex;
+    };
+} // namespace
@@ -1,8 +1,12 @@
 #include "MeshGatewayConnection.h"
+#include <chrono>
 #include <Logger.h>
 #include <NetworkMessage.h>
+#include <Message.h>
+#include <BLOB.h>
 #include "Gateway.h"
 #include "ServiceManager.h"
+#include "SubscriptionSnapshot.h"
 using namespace MessagingMesh;
 
 // Constructor.
@@ -35,9 +39,17 @@ MeshGatewayConnection::~MeshGatewayConnection()
 }
 
 // Relays a message / update to the mesh peer.
-void MeshGatewayConnection::relay(BufferPtr pBuffer) const
+void MeshGatewayConnection::relay(BufferPtr pBuffer, Socket::WritePriority priority) const
 {
-    m_pSocket->write(pBuffer);
+    m_pSocket->write(pBuffer, 0, 0, priority);
+}
+
+// Moves the connection to another UV loop (when the service moves).
+// The connection must be connected, as a socket cannot be moved while it is connecting.
+void MeshGatewayConnection::moveToLoop(UVLoopPtr pUVLoop)
+{
+    m_pUVLoop = pUVLoop;
+    m_pSocket->moveToLoop(pUVLoop);
 }
 
 // Connects to the peer gateway.
@@ -67,14 +79,20 @@ void MeshGatewayConnection::onDataReceived(Socket* pSocket, BufferPtr pBuffer)
         switch (action)
         {
         case NetworkMessageHeader::Action::ACK:
-            onAck();
+            networkMessage.deserializeMessage(*pBuffer);
+            onAck(networkMessage);
             break;
 
         case NetworkMessageHeader::Action::SEND_MESSAGE:
-            // The service-manager relays the update to clients...
+        {
+            // The service-manager relays the update to clients. We add the time this takes to
+            // the service's load...
+            auto start = std::chrono::steady_clock::now();
             m_serviceManager.onMessage(header, pSocket, pBuffer);
+            m_serviceManager.addBusyNanoseconds(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
             break;
         }
+        }
     }
     catch (const std::exception& ex)
     {
@@ -87,6 +105,10 @@ void MeshGatewayConnection::onConnectionStatusChanged(Socket* /*pSocket*/, Socke
 {
     try
     {
+        // We send replies to the peer's inboxes straight to it only while we are connected and it
+        // has told us its gateway ID (in its ACK). Until then they are routed by subscription...
+        m_serviceManager.getInboxRouter().removePeer(this);
+
         // We note the status and act on it...
         m_connectionStatus = connectionStatus;
         switch (connectionStatus)
@@ -114,12 +136,18 @@ void MeshGatewayConnection::onConnectionSucceeded()
 {
     Logger::info(std::format("Connection to mesh peer {} succeeded", m_peerName));
 
+    // We do not send chunks until the peer's ACK says that it can read them. (The peer
+    // may have restarted with a different version since we were last connected.)
+    m_pSocket->setPeerSupportsChunks(false);
+
     // We send a CONNECT message...
     NetworkMessage networkMessage;
     auto& header = networkMessage.getHeader();
     header.setAction(NetworkMessageHeader::Action::CONNECT_MESH_PEER);
     header.setSubject(m_serviceManager.getServiceName());
     header.setReplySubject(m_clientID);
+    networkMessage.getMessage()->addBool("SupportsChunks", true);
+    networkMessage.getMessage()->addUnsignedInt32("GatewayID", m_serviceManager.getInboxRouter().getGatewayID());
     MMUtils::sendNetworkMessage(networkMessage, m_pSocket);
 }
 
@@ -135,10 +163,38 @@ void MeshGatewayConnection::onConnectionFailed(const std::string& message)
 }
 
 // Called when we receive the ACK from a gateway peer.
-void MeshGatewayConnection::onAck()
+void MeshGatewayConnection::onAck(const NetworkMessage& ackMessage)
 {
     Logger::info(std::format("Received ACK from mesh peer {}", m_peerName));
 
-    // RSSTODO: We may need to relay existing subscriptions to the peer here.
+    // We only send large messages in chunks if the peer has said it can read them...
+    auto pAck = ackMessage.getMessage();
+    m_pSocket->setPeerSupportsChunks(pAck->tryGetBool("SupportsChunks").value_or(false));
+
+    // We send replies to the peer's inboxes straight to it, keyed on the gateway ID it reports.
+    // (Our config may name the peer differently from the way it names itself, so we do not work
+    // the ID out ourselves.) Older peers do not report an ID, and replies to them are routed by
+    // subscription...
+    auto gatewayID = pAck->tryGetUnsignedInt32("GatewayID");
+    if (gatewayID)
+    {
+        Logger::info(std::format("Mesh peer {} has gateway ID {:08x}", m_peerName, *gatewayID));
+        m_serviceManager.getInboxRouter().addPeer(*gatewayID, this);
+    }
+
+    // The peer does not know about our existing subscriptions. (It may have just started, or
+    // it may have dropped them when we disconnected.) We send all the patterns we advertise in
+    // one snapshot. Changes to them are relayed as SUBSCRIBE and UNSUBSCRIBE messages after this.
+    // (The BLOB can refer to the snapshot data, as the message is serialized before we return.)
+    auto patterns = m_serviceManager.getAdvertisedPatterns();
+    auto snapshot = SubscriptionSnapshot::serialize(patterns);
+    NetworkMessage networkMessage;
+    auto& header = networkMessage.getHeader();
+    header.setAction(NetworkMessageHeader::Action::SUBSCRIPTION_SNAPSHOT);
+    networkMessage.getMessage()->addBLOB(
+        SubscriptionSnapshot::FIELD_NAME,
+        BLOB::create_fromData(snapshot.data(), static_cast<int32_t>(snapshot.size()), BLOB::Ownership::HOLD_REFERENCE));
+    MMUtils::sendNetworkMessage(networkMessage, m_pSocket);
+    Logger::info(std::format("Sent subscription snapshot with {} patterns ({} bytes) to mesh peer {}", patterns.size(), snapshot.size(), m_peerName));
 }
 
@@ -7,6 +7,7 @@ namespace MessagingMesh
 {
     // Forward declarations...
     class ServiceManager;
+    class NetworkMessage;
 
     /// <summary>
     /// Manages a connection to a peer gateway in the mesh.
@@ -25,7 +26,11 @@ namespace MessagingMesh
         Socket::ConnectionStatus getConnectionStatus() const { return m_connectionStatus; }
 
         // Relays a message / update to the mesh peer.
-        void relay(BufferPtr pBuffer) const;
+        void relay(BufferPtr pBuffer, Socket::WritePriority priority = Socket::WritePriority::NORMAL) const;
+
+        // Moves the connection to another UV loop (when the service moves).
+        // The connection must be connected, as a socket cannot be moved while it is connecting.
+        void moveToLoop(UVLoopPtr pUVLoop);
 
     // Socket::ICallback implementation
     private:
@@ -53,7 +58,7 @@ namespace MessagingMesh
         void onConnectionFailed(const std::string& message);
 
         // Called when we receive the ACK from a gateway peer.
-        void onAck();
+        void onAck(const NetworkMessage& ackMessage);
 
     // Private data...
     private:
@@ -0,0 +1,287 @@
+#include "MeshInterestAggregator.h"
+#include <algorithm>
+using namespace MessagingMesh;
+
+// Constructor.
+MeshInterestAggregator::MeshInterestAggregator() :
+    m_pRootNode(std::make_unique<Node>())
+{
+}
+
+// Destructor.
+MeshInterestAggregator::~MeshInterestAggregator()
+{
+}
+
+// Adds local interest in the pattern, and adds any changes to the advertised patterns to the changes provided.
+void MeshInterestAggregator::addInterest(const std::string& pattern, Changes& changes)
+{
+    auto tokens = MMUtils::tokenize(pattern, '.');
+    if (tokens.empty())
+    {
+        return;
+    }
+
+    // We add the interest. If the pattern already had interest there is no change to
+    // the advertised patterns...
+    auto pNode = getOrCreateNode(tokens);
+    pNode->InterestCount++;
+    if (pNode->InterestCount > 1)
+    {
+        return;
+    }
+    m_patternCount++;
+
+    // If another pattern covers this one, peers already send us its messages...
+    if (isCovered(m_pRootNode.get(), tokens, 0, pNode))
+    {
+        return;
+    }
+
+    // We advertise the pattern, and withdraw advertised patterns which it covers...
+    setAdvertised(pNode, true, changes);
+    m_coveredNodes.clear();
+    findCoveredNodes(m_pRootNode.get(), tokens, 0, pNode, m_coveredNodes);
+    for (auto pCoveredNode : m_coveredNodes)
+    {
+        if (pCoveredNode->IsAdvertised)
+        {
+            setAdvertised(pCoveredNode, false, changes);
+        }
+    }
+}
+
+// Removes local interest in the pattern, and adds any changes to the advertised patterns to the changes provided.
+void MeshInterestAggregator::removeInterest(const std::string& pattern, Changes& changes)
+{
+    auto tokens = MMUtils::tokenize(pattern, '.');
+    auto pNode = findNode(tokens);
+    if (!pNode || pNode->InterestCount == 0)
+    {
+        return;
+    }
+
+    // We remove the interest. If the pattern still has interest there is no change to
+    // the advertised patterns...
+    pNode->InterestCount--;
+    if (pNode->InterestCount > 0)
+    {
+        return;
+    }
+    m_patternCount--;
+
+    // If the pattern was advertised, we advertise the patterns it covered which are not
+    // covered by any other pattern, and then withdraw it.
+    // Note: If the pattern was not advertised it was covered by another pattern, which
+    //       also covers everything this pattern covered, so nothing else changes.
+    if (pNode->IsAdvertised)
+    {
+        m_coveredNodes.clear();
+        findCoveredNodes(m_pRootNode.get(), tokens, 0, pNode, m_coveredNodes);
+        for (auto pCoveredNode : m_coveredNodes)
+        {
+            auto coveredTokens = MMUtils::tokenize(pCoveredNode->Pattern, '.');
+            if (!isCovered(m_pRootNode.get(), coveredTokens, 0, pCoveredNode))
+            {
+                setAdvertised(pCoveredNode, true, changes);
+            }
+        }
+        setAdvertised(pNode, false, changes);
+    }
+
+    // We remove the node (and its parents) if they are no longer used...
+    pruneNode(pNode);
+}
+
+// Gets the patterns currently advertised to mesh peers.
+std::vector<std::string> MeshInterestAggregator::getAdvertisedPatterns() const
+{
+    std::vector<std::string> patterns;
+    patterns.reserve(m_advertisedCount);
+    std::vector<const Node*> nodes = { m_pRootNode.get() };
+    while (!nodes.empty())
+    {
+        auto pNode = nodes.back();
+        nodes.pop_back();
+        if (pNode->IsAdvertised)
+        {
+            patterns.push_back(pNode->Pattern);
+        }
+        for (const auto& [token, pChildNode] : pNode->Nodes)
+        {
+            nodes.push_back(pChildNode.get());
+        }
+    }
+    return patterns;
+}
+
+// Gets the node for the pattern, creating nodes if necessary.
+MeshInterestAggregator::Node* MeshInterestAggregator::getOrCreateNode(const VecToken& tokens)
+{
+    auto pNode = m_pRootNode.get();
+    for (const auto& token : tokens)
+    {
+        auto it = pNode->Nodes.find(token);
+        if (it == pNode->Nodes.end())
+        {
+            auto pChildNode = std::make_unique<Node>();
+            pChildNode->pParent = pNode;
+            pChildNode->Token = token;
+            pChildNode->Pattern = (pNode == m_pRootNode.get()) ? pChildNode->Token : pNode->Pattern + "." + pChildNode->Token;
+            it = pNode->Nodes.emplace(pChildNode->Token, std::move(pChildNode)).first;
+        }
+        pNode = it->second.get();
+    }
+    return pNode;
+}
+
+// Gets the node for the pattern, or nullptr if there is no node for it.
+MeshInterestAggregator::Node* MeshInterestAggregator::findNode(const VecToken& tokens) const
+{
+    auto pNode = m_pRootNode.get();
+    for (const auto& token : tokens)
+    {
+        auto it = pNode->Nodes.find(token);
+        if (it == pNode->Nodes.end())
+        {
+            return nullptr;
+        }
+        pNode = it->second.get();
+    }
+    return pNode;
+}
+
+// Removes the node, and then its parents, while they are unused.
+void MeshInterestAggregator::pruneNode(Node* pNode)
+{
+    while (pNode != m_pRootNode.get() && pNode->InterestCount == 0 && pNode->Nodes.empty())
+    {
+        // We erase by iterator, as the key refers to the node's token which is destroyed with it...
+        auto pParent = pNode->pParent;
+        pParent->Nodes.erase(pParent->Nodes.find(pNode->Token));
+        pNode = pParent;
+    }
+}
+
+// Returns true if a pattern with interest (other than the pattern itself) covers the pattern.
+bool MeshInterestAggregator::isCovered(const Node* pNode, const VecToken& tokens, size_t tokenIndex, const Node* pPatternNode) const
+{
+    if (tokenIndex >= tokens.size())
+    {
+        return false;
+    }
+    const auto& token = tokens[tokenIndex];
+    auto isLastToken = (tokenIndex == tokens.size() - 1);
+
+    // We check if the child node for a token covers the pattern. At the last token the child
+    // holds a pattern of the same length, which covers this one unless it is the pattern itself...
+    auto isCoveredByChild = [&](std::string_view childToken)
+    {
+        auto it = pNode->Nodes.find(childToken);
+        if (it == pNode->Nodes.end())
+        {
+            return false;
+        }
+        auto pChildNode = it->second.get();
+        if (isLastToken)
+        {
+            return pChildNode->InterestCount != 0 && pChildNode != pPatternNode;
+        }
+        return isCovered(pChildNode, tokens, tokenIndex + 1, pPatternNode);
+    };
+
+    // A > pattern at this level covers the rest of the pattern, as it has at least one more token...
+    auto it = pNode->Nodes.find(WILDCARD_GREATER_THAN);
+    if (it != pNode->Nodes.end() && it->second->InterestCount != 0 && it->second.get() != pPatternNode)
+    {
+        return true;
+    }
+
+    // A * pattern at this level covers any single token other than >, and a token covers itself...
+    if (token != WILDCARD_GREATER_THAN && token != WILDCARD_STAR && isCoveredByChild(WILDCARD_STAR))
+    {
+        return true;
+    }
+    return token != WILDCARD_GREATER_THAN && isCoveredByChild(token);
+}
+
+// Adds patterns with interest which are covered by the pattern (not including the pattern itself) to the vector.
+void MeshInterestAggregator::findCoveredNodes(Node* pNode, const VecToken& tokens, size_t tokenIndex, const Node* pPatternNode, std::vector<Node*>& coveredNodes) const
+{
+    const auto& token = tokens[tokenIndex];
+    auto isLastToken = (tokenIndex == tokens.size() - 1);
+
+    // A > covers every pattern with at least one more token...
+    if (token == WILDCARD_GREATER_THAN)
+    {
+        for (const auto& [childToken, pChildNode] : pNode->Nodes)
+        {
+            findNodesWithInterest(pChildNode.get(), pPatternNode, coveredNodes);
+        }
+        return;
+    }
+
+    // We find the child nodes covered by this token. A * covers any single token other than >...
+    auto checkChildNode = [&](Node* pChildNode)
+    {
+        if (!isLastToken)
+        {
+            findCoveredNodes(pChildNode, tokens, tokenIndex + 1, pPatternNode, coveredNodes);
+        }
+        else if (pChildNode->InterestCount != 0 && pChildNode != pPatternNode)
+        {
+            coveredNodes.push_back(pChildNode);
+        }
+    };
+    if (token == WILDCARD_STAR)
+    {
+        for (const auto& [childToken, pChildNode] : pNode->Nodes)
+        {
+            if (childToken != WILDCARD_GREATER_THAN)
+            {
+                checkChildNode(pChildNode.get());
+            }
+        }
+    }
+    else
+    {
+        auto it = pNode->Nodes.find(token);
+        if (it != pNode->Nodes.end())
+        {
+            checkChildNode(it->second.get());
+        }
+    }
+}
+
+// Adds the node and all nodes below it which have interest to the vector, except for the node to exclude.
+void MeshInterestAggregator::findNodesWithInterest(Node* pNode, const Node* pExcludedNode, std::vector<Node*>& nodes) const
+{
+    if (pNode->InterestCount != 0 && pNode != pExcludedNode)
+    {
+        nodes.push_back(pNode);
+    }
+    for (const auto& [token, pChildNode] : pNode->Nodes)
+    {
+        findNodesWithInterest(pChildNode.get(), pExcludedNode, nodes);
+    }
+}
+
+// Marks the pattern for the node as advertised or not advertised, and adds the change.
+void MeshInterestAggregator::setAdvertised(Node* pNode, bool isAdvertised, Changes& changes)
+{
+    pNode->IsAdvertised = isAdvertised;
+    m_advertisedCount = isAdvertised ? m_advertisedCount + 1 : m_advertisedCount - 1;
+
+    // If the changes already hold the opposite change for the pattern, the two cancel out.
+    // This happens when several changes are collected together, for example when removing
+    // all of a client's subscriptions...
+    auto& opposite = isAdvertised ? changes.Unsubscribe : changes.Subscribe;
+    auto it = std::find(opposite.begin(), opposite.end(), pNode->Pattern);
+    if (it != opposite.end())
+    {
+        opposite.erase(it);
+        return;
+    }
+    auto& same = isAdvertised ? changes.Subscribe : changes.Unsubscribe;
+    same.push_back(pNode->Pattern);
+}
@@ -0,0 +1,163 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <MMUtils.h>
+#include "StringHash.h"
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// Works out which subscription patterns a gateway advertises to its mesh peers.
+    ///
+    /// Peers only need to know enough about our local subscriptions to send us the messages
+    /// our clients want. If a local client is subscribed to MD.>, peers send us every MD.*
+    /// message anyway, so also advertising MD.EQ.VOD would add control traffic and entries
+    /// in the peers' interest graphs without changing what they send us.
+    ///
+    /// So we advertise a covering set of patterns: each pattern with local interest which is
+    /// not covered by another pattern with local interest. Pattern P covers pattern Q if every
+    /// subject matching Q also matches P. For example:
+    /// - MD.> covers MD.EQ.VOD, MD.EQ.* and MD.*.VOD.>
+    /// - MD.* covers MD.EQ but not MD.EQ.VOD
+    /// - *.EQ covers MD.EQ but not MD.*
+    ///
+    /// Changes
+    /// -------
+    /// Adding and removing interest returns the changes to the advertised set:
+    /// - When a pattern is added which covers advertised patterns, we advertise it and withdraw
+    ///   the patterns it covers.
+    /// - When the last interest in an advertised pattern is removed, we withdraw it and advertise
+    ///   any patterns it covered which are not covered by another pattern.
+    ///
+    /// Patterns to subscribe should be sent to peers before patterns to unsubscribe, so that
+    /// peers do not stop sending messages we are interested in while the set changes.
+    ///
+    /// Changes from several calls can be collected together. A pattern which is advertised
+    /// and then withdrawn (or the other way round) in the same changes cancels out, so
+    /// removing all of a client's subscriptions does not briefly advertise patterns which
+    /// were covered by them.
+    ///
+    /// Pattern trie
+    /// ------------
+    /// Patterns with local interest are held in a trie keyed by token, where * and > are held
+    /// as ordinary tokens. This lets us find the patterns covering a pattern, and the patterns
+    /// covered by it, by walking only the relevant parts of the trie rather than comparing
+    /// every pair of patterns.
+    ///
+    /// Interest is reference counted per pattern, with one reference for each local subscription.
+    /// (As in the subject-matching engine, we are not expecting more than one subscription from a
+    /// client for the same subject.) Only interest from local clients should be added. Interest
+    /// from mesh peers is not relayed to other peers.
+    /// </summary>
+    class MeshInterestAggregator
+    {
+    // Public types...
+    public:
+        // Changes to the patterns advertised to mesh peers.
+        struct Changes
+        {
+            // Patterns to subscribe to on mesh peers...
+            std::vector<std::string> Subscribe;
+
+            // Patterns to unsubscribe from on mesh peers...
+            std::vector<std::string> Unsubscribe;
+
+            // Returns true if there are no changes.
+            bool empty() const { return Subscribe.empty() && Unsubscribe.empty(); }
+        };
+
+    // Public methods...
+    public:
+        // Constructor.
+        MeshInterestAggregator();
+
+        // Destructor.
+        ~MeshInterestAggregator();
+
+        // Adds local interest in the pattern, and adds any changes to the advertised patterns to the changes provided.
+        void addInterest(const std::string& pattern, Changes& changes);
+
+        // Removes local interest in the pattern, and adds any changes to the advertised patterns to the changes provided.
+        void removeInterest(const std::string& pattern, Changes& changes);
+
+        // Gets the patterns currently advertised to mesh peers.
+        std::vector<std::string> getAdvertisedPatterns() const;
+
+        // Gets the number of patterns with local interest.
+        size_t getPatternCount() const { return m_patternCount; }
+
+        // Gets the number of patterns advertised to mesh peers.
+        size_t getAdvertisedCount() const { return m_advertisedCount; }
+
+    // Private types...
+    private:
+        // A node in the pattern trie.
+        struct Node
+        {
+            // Map of tokens (including * and >) to child nodes...
+            std::unordered_map<std::string, std::unique_ptr<Node>, StringHash, std::equal_to<>> Nodes;
+
+            // The parent node (nullptr for the root)...
+            Node* pParent = nullptr;
+
+            // The token for this node in its parent's Nodes...
+            std::string Token;
+
+            // The pattern for the path from the root to this node...
+            std::string Pattern;
+
+            // The number of local subscriptions to the pattern...
+            size_t InterestCount = 0;
+
+            // True if the pattern is advertised to mesh peers...
+            bool IsAdvertised = false;
+        };
+
+    // Private functions...
+    private:
+        // Gets the node for the pattern, creating nodes if necessary.
+        Node* getOrCreateNode(const VecToken& tokens);
+
+        // Gets the node for the pattern, or nullptr if there is no node for it.
+        Node* findNode(const VecToken& tokens) const;
+
+        // Removes the node, and then its parents, while they are unused.
+        void pruneNode(Node* pNode);
+
+        // Returns true if a pattern with interest (other than the pattern itself) covers the pattern.
+        bool isCovered(const Node* pNode, const VecToken& tokens, size_t tokenIndex, const Node* pPatternNode) const;
+
+        // Adds patterns with interest which are covered by the pattern (not including the pattern itself) to the vector.
+        void findCoveredNodes(Node* pNode, const VecToken& tokens, size_t tokenIndex, const Node* pPatternNode, std::vector<Node*>& coveredNodes) const;
+
+        // Adds the node and all nodes below it which have interest to the vector, except for the node to exclude.
+        void findNodesWithInterest(Node* pNode, const Node* pExcludedNode, std::vector<Node*>& nodes) const;
+
+        // Marks the pattern for the node as advertised or not advertised, and adds the change.
+        void setAdvertised(Node* pNode, bool isAdvertised, Changes& changes);
+
+    // Private data...
+    private:
+        // The root of the pattern trie...
+        std::unique_ptr<Node> m_pRootNode;
+
+        // The number of patterns with local interest...
+        size_t m_patternCount = 0;
+
+        // The number of advertised patterns...
+        size_t m_advertisedCount = 0;
+
+        // Nodes covered by the pattern being added or removed (reused between calls)...
+        std::vector<Node*> m_coveredNodes;
+
+    // Constants...
+    private:
+        static constexpr std::string_view WILDCARD_STAR = "*";
+        static constexpr std::string_view WILDCARD_GREATER_THAN = ">";
+    };
+} // namespace
+
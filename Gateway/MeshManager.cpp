@@ -1,5 +1,7 @@
 #include "MeshManager.h"
+#include <algorithm>
 #include <fstream>
+#include <thread>
 #include <nlohmann/json.hpp>
 #include <Connection.h>
 #include <ConnectionParams.h>
@@ -66,6 +68,94 @@ VecGatewayInfo MeshManager::getPeerGatewayInfos(const std::string& serviceName)
     return result;
 }
 
+// Returns the gateway-info for this gateway in the mesh for the service-name specified (made from
+// our hostname and port if the service has no mesh).
+GatewayInfo MeshManager::getSelfGatewayInfo(const std::string& serviceName) const
+{
+    // We look for ourself in the gateway-infos for the service...
+    const auto& startupMeshConfigs = m_gatewayConfig.getConfig().StartupMeshConfigs;
+    auto it = startupMeshConfigs.find(serviceName);
+    if (it != startupMeshConfigs.end())
+    {
+        for (const auto& gatewayInfo : it->second.MeshGatewayInfos)
+        {
+            if (gatewayInfo.PeerType == GatewayInfo::PeerType::SELF)
+            {
+                return gatewayInfo;
+            }
+        }
+    }
+
+    // The service has no mesh, so we describe ourself...
+    GatewayInfo gatewayInfo;
+    gatewayInfo.Hostname = m_gateway.getHostname();
+    gatewayInfo.Port = m_gateway.getPort();
+    gatewayInfo.IPAddress = m_gateway.getIPAddress();
+    gatewayInfo.PeerType = GatewayInfo::PeerType::SELF;
+    return gatewayInfo;
+}
+
+// Returns the number of shards (UV loops) configured for the service-name specified.
+size_t MeshManager::getShardCount(const std::string& serviceName) const
+{
+    // Services which are not in the config run on a single UV loop...
+    const auto& serviceConfigs = m_gatewayConfig.getConfig().ServiceConfigs;
+    auto it = serviceConfigs.find(serviceName);
+    return (it == serviceConfigs.end()) ? 1 : it->second.Shards;
+}
+
+// Returns the number of IO loops configured for the service-name specified (zero if the service is not pipelined).
+size_t MeshManager::getIOLoopCount(const std::string& serviceName) const
+{
+    const auto& serviceConfigs = m_gatewayConfig.getConfig().ServiceConfigs;
+    auto it = serviceConfigs.find(serviceName);
+    return (it == serviceConfigs.end()) ? 0 : it->second.IOLoops;
+}
+
+// Returns the limits on the data queued to each client socket for the service-name specified.
+Socket::OutputQueueLimits MeshManager::getOutputQueueLimits(const std::string& serviceName) const
+{
+    const auto& serviceConfigs = m_gatewayConfig.getConfig().ServiceConfigs;
+    auto it = serviceConfigs.find(serviceName);
+    return (it == serviceConfigs.end()) ? GatewayConfig::DEFAULT_OUTPUT_QUEUE_LIMITS : it->second.OutputQueueLimits;
+}
+
+// Returns the subject patterns whose messages are conflated for the service-name specified.
+std::vector<std::string> MeshManager::getConflatedSubjects(const std::string& serviceName) const
+{
+    const auto& serviceConfigs = m_gatewayConfig.getConfig().ServiceConfigs;
+    auto it = serviceConfigs.find(serviceName);
+    return (it == serviceConfigs.end()) ? std::vector<std::string>() : it->second.ConflatedSubjects;
+}
+
+// Returns the subject patterns whose latest values are cached for the service-name specified.
+std::vector<std::string> MeshManager::getCachedSubjects(const std::string& serviceName) const
+{
+    const auto& serviceConfigs = m_gatewayConfig.getConfig().ServiceConfigs;
+    auto it = serviceConfigs.find(serviceName);
+    return (it == serviceConfigs.end()) ? std::vector<std::string>() : it->second.CachedSubjects;
+}
+
+// Returns the credit window (in bytes) for clients publishing to the service-name specified (zero for no flow control).
+uint64_t MeshManager::getPublishWindowBytes(const std::string& serviceName) const
+{
+    const auto& serviceConfigs = m_gatewayConfig.getConfig().ServiceConfigs;
+    auto it = serviceConfigs.find(serviceName);
+    return (it == serviceConfigs.end()) ? GatewayConfig::DEFAULT_PUBLISH_WINDOW_BYTES : it->second.PublishWindowBytes;
+}
+
+// Returns the number of UV loops in the pool shared by services.
+size_t MeshManager::getServiceLoopCount() const
+{
+    // By default we have one loop per core...
+    auto serviceLoops = m_gatewayConfig.getConfig().ServiceLoops;
+    if (serviceLoops == 0)
+    {
+        serviceLoops = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    return serviceLoops;
+}
+
 // Sends a message to the coordinator.
 void MeshManager::sendMessageToCoordinator(const MessagePtr& pMessage, const std::string& subject) const
 {
@@ -31,6 +31,31 @@ namespace MessagingMesh
         // Returns a vector of gateway-info for peer-gateways in the mesh for the service-name specified.
         VecGatewayInfo getPeerGatewayInfos(const std::string& serviceName) const;
 
+        // Returns the gateway-info for this gateway in the mesh for the service-name specified (made from
+        // our hostname and port if the service has no mesh).
+        GatewayInfo getSelfGatewayInfo(const std::string& serviceName) const;
+
+        // Returns the number of shards (UV loops) configured for the service-name specified.
+        size_t getShardCount(const std::string& serviceName) const;
+
+        // Returns the number of IO loops configured for the service-name specified (zero if the service is not pipelined).
+        size_t getIOLoopCount(const std::string& serviceName) const;
+
+        // Returns the limits on the data queued to each client socket for the service-name specified.
+        Socket::OutputQueueLimits getOutputQueueLimits(const std::string& serviceName) const;
+
+        // Returns the subject patterns whose messages are conflated for the service-name specified.
+        std::vector<std::string> getConflatedSubjects(const std::string& serviceName) const;
+
+        // Returns the subject patterns whose latest values are cached for the service-name specified.
+        std::vector<std::string> getCachedSubjects(const std::string& serviceName) const;
+
+        // Returns the credit window (in bytes) for clients publishing to the service-name specified (zero for no flow control).
+        uint64_t getPublishWindowBytes(const std::string& serviceName) const;
+
+        // Returns the number of UV loops in the pool shared by services.
+        size_t getServiceLoopCount() const;
+
         // Sends a message to the coordinator.
         void sendMessageToCoordinator(const MessagePtr& pMessage, const std::string& subject) const;
 
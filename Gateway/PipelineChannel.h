@@ -0,0 +1,157 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <string>
+#include <SharedAliases.h>
+#include <UVLoop.h>
+#include "SPSCRing.h"
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// Passes items from one UV loop to another, in order, through an SPSCRing.
+    ///
+    /// Used by pipelined services to pass parsed updates from an IO loop to the routing loop,
+    /// and writes from the routing loop back to the IO loop (see ServiceIOLoop).
+    ///
+    /// Waking the consumer
+    /// -------------------
+    /// When an item is pushed we wake the consumer loop with a (unique) marshalled event, which
+    /// drains the ring. An atomic flag notes whether a drain is already pending, so while the
+    /// consumer is catching up the producer pushes items without touching the loop's event queue
+    /// (and its lock). The drain clears the flag before it pops, so an item pushed after the
+    /// drain has looked at the ring always raises a new drain.
+    ///
+    /// A drain pops at most one ring's worth of items before yielding to other events on the loop.
+    ///
+    /// When the ring is full
+    /// ---------------------
+    /// Items which do not fit go into an overflow queue on the producer side. New items go behind
+    /// them, so the order is kept. We retry moving them into the ring from an event on the producer
+    /// loop until the consumer has caught up.
+    /// </summary>
+    template<typename T>
+    class PipelineChannel
+    {
+    // Public types...
+    public:
+        // Called on the consumer loop for each item.
+        using Consumer = std::function<void(T& item)>;
+
+    // Public methods...
+    public:
+        // Constructor.
+        PipelineChannel(UVLoopPtr pProducerUVLoop, UVLoopPtr pConsumerUVLoop, const std::string& name, Consumer consumer) :
+            m_ring(RING_CAPACITY),
+            m_pProducerUVLoop(pProducerUVLoop),
+            m_pConsumerUVLoop(pConsumerUVLoop),
+            m_drainEventKey(name + "_DRAIN"),
+            m_retryEventKey(name + "_RETRY"),
+            m_consumer(consumer)
+        {
+        }
+
+        // Passes the item to the consumer loop.
+        // Called on the producer loop.
+        void push(T&& item)
+        {
+            // Items which did not fit in the ring earlier go first...
+            if (!m_overflow.empty())
+            {
+                flushOverflow();
+            }
+            if (!m_overflow.empty() || !m_ring.tryPush(std::move(item)))
+            {
+                m_overflow.push_back(std::move(item));
+                scheduleRetry();
+            }
+            wakeConsumer();
+        }
+
+    // Private functions...
+    private:
+        // Marshalls an event to drain the ring to the consumer loop, if one is not already pending.
+        void wakeConsumer()
+        {
+            if (!m_drainPending.exchange(true, std::memory_order_acq_rel))
+            {
+                m_pConsumerUVLoop->marshallUniqueEvent(m_drainEventKey, [this](uv_loop_t* /*pLoop*/) { drain(); });
+            }
+        }
+
+        // Passes items in the ring to the consumer.
+        // Called on the consumer loop.
+        void drain()
+        {
+            m_drainPending.exchange(false, std::memory_order_acq_rel);
+            T item;
+            for (size_t i = 0; i < m_ring.getCapacity(); ++i)
+            {
+                if (!m_ring.tryPop(item))
+                {
+                    return;
+                }
+                m_consumer(item);
+            }
+
+            // There may be more items, so we drain again after other events on the loop...
+            wakeConsumer();
+        }
+
+        // Moves items from the overflow queue into the ring, while there is space.
+        // Called on the producer loop.
+        void flushOverflow()
+        {
+            while (!m_overflow.empty() && m_ring.tryPush(std::move(m_overflow.front())))
+            {
+                m_overflow.pop_front();
+            }
+        }
+
+        // Marshalls an event to the producer loop to retry moving overflow items into the ring.
+        void scheduleRetry()
+        {
+            m_pProducerUVLoop->marshallUniqueEvent(
+                m_retryEventKey,
+                [this](uv_loop_t* /*pLoop*/)
+                {
+                    flushOverflow();
+                    if (!m_overflow.empty())
+                    {
+                        scheduleRetry();
+                    }
+                    wakeConsumer();
+                }
+            );
+        }
+
+    // Private data...
+    private:
+        // The ring...
+        SPSCRing<T> m_ring;
+
+        // The loops which push and consume items...
+        UVLoopPtr m_pProducerUVLoop;
+        UVLoopPtr m_pConsumerUVLoop;
+
+        // Keys for the (unique) drain and retry events...
+        std::string m_drainEventKey;
+        std::string m_retryEventKey;
+
+        // Called for each item on the consumer loop...
+        Consumer m_consumer;
+
+        // True if a drain event has been marshalled and has not yet started...
+        std::atomic<bool> m_drainPending = false;
+
+        // Items which did not fit in the ring (only used on the producer loop)...
+        std::deque<T> m_overflow;
+
+    // Constants...
+    private:
+        // The number of items the ring holds...
+        static constexpr size_t RING_CAPACITY = 4096;
+    };
+} // namespace
+
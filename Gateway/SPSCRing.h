@@ -0,0 +1,97 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// A lock-free ring buffer for passing items from one producer thread to one consumer thread.
+    ///
+    /// Used to pass updates between the IO loops and the routing loop of a pipelined service
+    /// (see PipelineChannel), without taking a lock for each update.
+    ///
+    /// Implementation
+    /// --------------
+    /// The capacity is rounded up to a power of two, so that positions map to slots with a mask.
+    /// The head (next item to pop) is only written by the consumer, and the tail (next slot to
+    /// push to) only by the producer. Each side also keeps a cached copy of the other side's
+    /// position, so it only reads the other side's (contended) cache line when the ring looks
+    /// full or empty. The two sides' data are on separate cache lines, so they do not false-share.
+    ///
+    /// tryPush() and tryPop() must each only be called from one thread.
+    /// </summary>
+    template<typename T>
+    class SPSCRing
+    {
+    // Public methods...
+    public:
+        // Constructor.
+        explicit SPSCRing(size_t capacity) :
+            m_items(std::bit_ceil(std::max<size_t>(capacity, 2))),
+            m_mask(m_items.size() - 1)
+        {
+        }
+
+        // The ring cannot be copied...
+        SPSCRing(const SPSCRing&) = delete;
+        SPSCRing& operator=(const SPSCRing&) = delete;
+
+        // Moves the item into the ring, or returns false (leaving the item unchanged) if the ring is full.
+        // Called on the producer thread.
+        bool tryPush(T&& item)
+        {
+            auto tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_cachedHead == m_items.size())
+            {
+                m_cachedHead = m_head.load(std::memory_order_acquire);
+                if (tail - m_cachedHead == m_items.size())
+                {
+                    return false;
+                }
+            }
+            m_items[tail & m_mask] = std::move(item);
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Moves the oldest item out of the ring, or returns false if the ring is empty.
+        // Called on the consumer thread.
+        bool tryPop(T& item)
+        {
+            auto head = m_head.load(std::memory_order_relaxed);
+            if (head == m_cachedTail)
+            {
+                m_cachedTail = m_tail.load(std::memory_order_acquire);
+                if (head == m_cachedTail)
+                {
+                    return false;
+                }
+            }
+            item = std::move(m_items[head & m_mask]);
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Gets the number of items the ring can hold.
+        size_t getCapacity() const { return m_items.size(); }
+
+    // Private data...
+    private:
+        // The slots (fixed in size, so they can be read and written without a lock)...
+        std::vector<T> m_items;
+        const size_t m_mask;
+
+        // Consumer data: the position of the next item to pop, and the tail when we last read it...
+        alignas(64) std::atomic<size_t> m_head = 0;
+        size_t m_cachedTail = 0;
+
+        // Producer data: the position of the next slot to push to, and the head when we last read it...
+        alignas(64) std::atomic<size_t> m_tail = 0;
+        size_t m_cachedHead = 0;
+    };
+} // namespace
+
@@ -0,0 +1,114 @@
+#include "ServiceIOLoop.h"
+#include <format>
+#include <Buffer.h>
+#include <Logger.h>
+#include <NetworkMessage.h>
+#include <UVLoop.h>
+#include "CreditGuard.h"
+#include "ServiceManager.h"
+using namespace MessagingMesh;
+
+// Constructor.
+ServiceIOLoop::ServiceIOLoop(ServiceManager& serviceManager, UVLoopPtr pRoutingUVLoop, const std::string& name) :
+    m_serviceManager(serviceManager),
+    m_pUVLoop(UVLoop::create(name, UVLoop::Temperature::COLD)),
+    m_inboundUpdates(m_pUVLoop, pRoutingUVLoop, name + "_INBOUND",
+        [this](InboundUpdate& update)
+        {
+            // We grant the client credit for the update once it has been processed, even if that fails...
+            CreditGuard creditGuard(update.pSocket.get(), update.pBuffer, update.Header.getAction());
+            m_serviceManager.processUpdate(update.pSocket.get(), update.Header, update.pBuffer);
+        }),
+    m_outboundWrites(pRoutingUVLoop, m_pUVLoop, name + "_OUTBOUND",
+        [](OutboundWrite& write)
+        {
+            write.pSocket->write(write.pBuffer, write.SubscriptionID, write.ConflationKey, write.Priority);
+        })
+{
+}
+
+// Destructor.
+ServiceIOLoop::~ServiceIOLoop()
+{
+}
+
+// Queues a write to a socket on the IO loop.
+// Called on the routing loop.
+void ServiceIOLoop::write(Socket* pSocket, BufferPtr pBuffer, uint32_t subscriptionID, uint64_t conflationKey, Socket::WritePriority priority)
+{
+    m_outboundWrites.push({ pSocket->shared_from_this(), pBuffer, subscriptionID, conflationKey, priority });
+}
+
+// Called when data has been received on the socket.
+// Called on the IO loop.
+void ServiceIOLoop::onDataReceived(Socket* pSocket, BufferPtr pBuffer)
+{
+    // We parse the header here, so that the routing loop does not have to. If the header cannot be
+    // read, we still pass the update on (with no action), so that the routing loop grants credit
+    // for it (see CreditGuard)...
+    NetworkMessageHeader header;
+    try
+    {
+        NetworkMessage networkMessage;
+        networkMessage.deserializeHeader(*pBuffer);
+        header = std::move(networkMessage.getHeader());
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+    try
+    {
+        m_inboundUpdates.push({ pSocket->shared_from_this(), pBuffer, std::move(header) });
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
+
+// Called when the connection status has changed.
+void ServiceIOLoop::onConnectionStatusChanged(Socket* pSocket, Socket::ConnectionStatus connectionStatus, const std::string& /*message*/)
+{
+    try
+    {
+        // We pass the disconnection to the routing loop as a DISCONNECT update, behind any
+        // updates the socket sent before it...
+        if (connectionStatus == Socket::ConnectionStatus::DISCONNECTED)
+        {
+            NetworkMessageHeader header;
+            header.setAction(NetworkMessageHeader::Action::DISCONNECT);
+            m_inboundUpdates.push({ pSocket->shared_from_this(), nullptr, std::move(header) });
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
+
+// Called when the movement of the socket to a new UV loop has been completed.
+void ServiceIOLoop::onMoveToLoopComplete(Socket* pSocket)
+{
+    try
+    {
+        m_serviceManager.sendAck(pSocket);
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
+
+// Called when data written to the socket has been dropped (or conflated) as the output queue is full.
+void ServiceIOLoop::onOutputQueueDrops(Socket* pSocket)
+{
+    try
+    {
+        ServiceManager::sendSlowConsumerAdvisory(pSocket);
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
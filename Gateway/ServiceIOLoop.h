@@ -0,0 +1,107 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <SharedAliases.h>
+#include <Socket.h>
+#include <NetworkMessageHeader.h>
+#include "PipelineChannel.h"
+
+namespace MessagingMesh
+{
+    // Forward declarations...
+    class ServiceManager;
+
+    /// <summary>
+    /// Does socket IO for some of the client sockets of a pipelined service.
+    ///
+    /// In a pipelined service (see ServiceManager) client sockets are spread across one or more
+    /// IO loops, leaving the service's own loop free to route messages. Each IO loop is the
+    /// callback for the sockets on it.
+    ///
+    /// Reads
+    /// -----
+    /// The sockets read and reassemble frames on the IO loop. We parse the header of each update
+    /// and pass the update to the routing loop through a PipelineChannel, where the service
+    /// manager processes it (see ServiceManager::processUpdate). Disconnections go through the
+    /// same channel, so they are processed after any updates the socket sent before it went.
+    ///
+    /// Writes
+    /// ------
+    /// Writes to our sockets are passed back from the routing loop through a second channel,
+    /// and written to the socket on the IO loop. So the routing loop only pushes to a ring, and
+    /// the queueing, serialization and syscalls for the write happen on the IO loop.
+    ///
+    /// The channels hold shared pointers to the sockets, so a socket is not released while an
+    /// update from it or a write to it is in a channel.
+    /// </summary>
+    class ServiceIOLoop : public Socket::ICallback
+    {
+    // Public types...
+    public:
+        // An update read from a socket (with its header parsed) passed to the routing loop.
+        struct InboundUpdate
+        {
+            SocketPtr pSocket;
+            BufferPtr pBuffer;
+            NetworkMessageHeader Header;
+        };
+
+        // A write passed back from the routing loop.
+        struct OutboundWrite
+        {
+            SocketPtr pSocket;
+            BufferPtr pBuffer;
+            uint32_t SubscriptionID = 0;
+            uint64_t ConflationKey = 0;
+            Socket::WritePriority Priority = Socket::WritePriority::NORMAL;
+        };
+
+    // Public methods...
+    public:
+        // Constructor.
+        ServiceIOLoop(ServiceManager& serviceManager, UVLoopPtr pRoutingUVLoop, const std::string& name);
+
+        // Destructor.
+        ~ServiceIOLoop();
+
+        // Gets the IO loop.
+        const UVLoopPtr& getUVLoop() const { return m_pUVLoop; }
+
+        // Queues a write to a socket on the IO loop.
+        // Called on the routing loop.
+        void write(Socket* pSocket, BufferPtr pBuffer, uint32_t subscriptionID, uint64_t conflationKey, Socket::WritePriority priority);
+
+    // Socket::ICallback implementation...
+    private:
+        // Called when a new client connection has been made to a listening socket.
+        void onNewConnection(SocketPtr /*pClientSocket*/) {}
+
+        // Called when data has been received on the socket.
+        // Called on the IO loop.
+        void onDataReceived(Socket* pSocket, BufferPtr pBuffer);
+
+        // Called when the connection status has changed.
+        void onConnectionStatusChanged(Socket* pSocket, Socket::ConnectionStatus connectionStatus, const std::string& message);
+
+        // Called when the movement of the socket to a new UV loop has been completed.
+        void onMoveToLoopComplete(Socket* pSocket);
+
+        // Called when data written to the socket has been dropped (or conflated) as the output queue is full.
+        void onOutputQueueDrops(Socket* pSocket);
+
+    // Private data...
+    private:
+        // The service manager for the service...
+        ServiceManager& m_serviceManager;
+
+        // The IO loop...
+        UVLoopPtr m_pUVLoop;
+
+        // Updates passed from the IO loop to the routing loop...
+        PipelineChannel<InboundUpdate> m_inboundUpdates;
+
+        // Writes passed from the routing loop to the IO loop...
+        PipelineChannel<OutboundWrite> m_outboundWrites;
+    };
+} // namespace
+
@@ -1,25 +1,54 @@
 #include "ServiceManager.h"
 #include <algorithm>
+#include <chrono>
 #include <format>
 #include <UVLoop.h>
+#include <Buffer.h>
+#include <BLOB.h>
+#include <Exception.h>
 #include <Socket.h>
 #include <Logger.h>
 #include <Message.h>
-#include <MMUtils.h>
 #include <NetworkMessage.h>
+#include "CreditGuard.h"
 #include "Gateway.h"
 #include "MeshManager.h"
+#include "ServiceScheduler.h"
 #include "SubscriptionInfo.h"
+#include "SubscriptionSnapshot.h"
 using namespace MessagingMesh;
 
 // Constructor.
-ServiceManager::ServiceManager(const std::string& serviceName, const Gateway& gateway, const MeshManager& meshManager) :
+// Sharded and pipelined services have loops of their own. Other services run on a loop from the scheduler's pool.
+ServiceManager::ServiceManager(const std::string& serviceName, const Gateway& gateway, const MeshManager& meshManager, ServiceScheduler& serviceScheduler) :
     m_serviceName(serviceName),
+    m_processDisconnectionsEventKey(makeUniqueEventKey(serviceName, PROCESS_DISCONNECTIONS_EVENT)),
+    m_statsTimerEventKey(makeUniqueEventKey(serviceName, STATS_TIMER_EVENT)),
+    m_publishSubscriptionsEventKey(makeUniqueEventKey(serviceName, PUBLISH_SUBSCRIPTIONS_EVENT)),
     m_gateway(gateway),
     m_meshManager(meshManager),
-    m_pUVLoop(UVLoop::create(serviceName, UVLoop::Temperature::COLD)),
+    m_pUVLoop((meshManager.getShardCount(serviceName) > 1 || meshManager.getIOLoopCount(serviceName) > 0) ?
+        UVLoop::create(serviceName, UVLoop::Temperature::COLD) :
+        serviceScheduler.addService(*this)),
+    m_conflatedSubjects(meshManager.getConflatedSubjects(serviceName)),
+    m_lastValueCache(meshManager.getCachedSubjects(serviceName)),
+    m_inboxRouter(meshManager.getSelfGatewayInfo(serviceName).makeID(), meshManager.getPeerGatewayInfos(serviceName).size()),
     m_serviceStats(serviceName, gateway.getGatewayName())
 {
+    // We create shards if the service is configured to run on more than one UV loop...
+    auto shardCount = meshManager.getShardCount(serviceName);
+    if (shardCount > 1)
+    {
+        createShards(shardCount);
+    }
+
+    // We create IO loops if the service is pipelined...
+    auto ioLoopCount = meshManager.getIOLoopCount(serviceName);
+    if (ioLoopCount > 0)
+    {
+        createIOLoops(ioLoopCount);
+    }
+
     // We initialize the service manager in the context of the UV loop...
     m_pUVLoop->marshallEvent(
         [this](uv_loop_t* /*pLoop*/)
@@ -35,14 +64,17 @@ ServiceManager::~ServiceManager()
 }
 
 // Registers a client socket to be managed for this service.
-void ServiceManager::registerSocket(SocketPtr pSocket, bool isMeshPeer)
+// A mesh peer passes the gateway ID it reported in its CONNECT_MESH_PEER (if any).
+void ServiceManager::registerSocket(SocketPtr pSocket, bool isMeshPeer, std::optional<uint32_t> peerGatewayID)
 {
     // We add the socket to the collection of active clients...
     auto socketID = pSocket->getSocketID();
     if (isMeshPeer)
     {
-        // This is a mesh peer...
+        // This is a mesh peer. The inbox router notes whether it has reported its ID, and so
+        // whether it can send replies straight to our inboxes...
         m_meshGatewayConnections_WeAreTheServer[socketID] = pSocket;
+        m_inboxRouter.addPeerSocket(socketID, peerGatewayID);
     }
     else
     {
@@ -53,11 +85,291 @@ void ServiceManager::registerSocket(SocketPtr pSocket, bool isMeshPeer)
     // We note whether the socket is a mesh peer (ie, a gateway in the mesh).
     pSocket->setIsMeshPeer(isMeshPeer);
 
+    // We limit the data queued to clients, so that a slow consumer cannot use up the gateway's
+    // memory. (Data for mesh peers is not dropped.)
+    // We also give clients a credit window, so that a fast publisher is slowed down rather than
+    // filling the gateway's memory with messages it has not routed yet...
+    if (!isMeshPeer)
+    {
+        pSocket->setOutputQueueLimits(m_meshManager.getOutputQueueLimits(m_serviceName));
+        pSocket->setCreditWindow(m_meshManager.getPublishWindowBytes(m_serviceName));
+    }
+
+    // For a sharded service, we give client sockets to each shard in turn. The shard observes
+    // updates from the socket, which we move to the shard's UV loop...
+    if (!m_shards.empty() && !isMeshPeer)
+    {
+        auto& shard = *m_shards[m_nextShardIndex];
+        m_nextShardIndex = (m_nextShardIndex + 1) % m_shards.size();
+        pSocket->setCallback(&shard);
+        pSocket->moveToLoop(shard.getUVLoop());
+        return;
+    }
+
+    // For a pipelined service, client sockets are moved to an IO loop, which observes their updates...
+    if (!m_ioLoops.empty() && !isMeshPeer)
+    {
+        auto& ioLoop = *m_ioLoops[socketID % m_ioLoops.size()];
+        pSocket->setCallback(&ioLoop);
+        pSocket->moveToLoop(ioLoop.getUVLoop());
+        return;
+    }
+
     // We observe updates from the socket...
     pSocket->setCallback(this);
 
     // We move the socket to our UV loop...
-    pSocket->moveToLoop(m_pUVLoop);
+    pSocket->moveToLoop(getUVLoop());
+}
+
+// Gets the UV loop on which the service is running.
+// Can be called from any thread.
+UVLoopPtr ServiceManager::getUVLoop() const
+{
+    std::scoped_lock lock(m_uvLoopMutex);
+    return m_pUVLoop;
+}
+
+// Moves the service, and all its sockets, to another UV loop.
+// Called on the GATEWAY thread by the service scheduler.
+void ServiceManager::moveToLoop(UVLoopPtr pUVLoop)
+{
+    // The move takes place on our current loop...
+    getUVLoop()->marshallEvent(
+        [this, pUVLoop](uv_loop_t* /*pLoop*/)
+        {
+            moveToLoop_onCurrentLoop(pUVLoop);
+        }
+    );
+}
+
+// Creates the IO loops for a pipelined service.
+void ServiceManager::createIOLoops(size_t ioLoopCount)
+{
+    Logger::info(std::format("Creating {} IO loops for service {}", ioLoopCount, m_serviceName));
+    for (size_t i = 0; i < ioLoopCount; ++i)
+    {
+        m_ioLoops.push_back(std::make_unique<ServiceIOLoop>(*this, m_pUVLoop, std::format("{}/IO/{}", m_serviceName, i)));
+    }
+}
+
+// Writes to a target socket, through its IO loop if the service is pipelined.
+void ServiceManager::writeToSocket(Socket* pSocket, BufferPtr pBuffer, uint32_t subscriptionID, uint64_t conflationKey, Socket::WritePriority priority)
+{
+    if (m_ioLoops.empty() || pSocket->getIsMeshPeer())
+    {
+        pSocket->write(pBuffer, subscriptionID, conflationKey, priority);
+    }
+    else
+    {
+        m_ioLoops[pSocket->getSocketID() % m_ioLoops.size()]->write(pSocket, pBuffer, subscriptionID, conflationKey, priority);
+    }
+}
+
+// Moves the service to another UV loop.
+// Called on the service's current UV loop.
+void ServiceManager::moveToLoop_onCurrentLoop(UVLoopPtr pUVLoop)
+{
+    try
+    {
+        // Sockets which are still connecting cannot be moved, so we stay where we are until
+        // all our mesh connections have connected. (The scheduler will try again later.)
+        for (const auto& [key, meshGatewayConnection] : m_meshGatewayConnections_WeAreTheClient)
+        {
+            if (meshGatewayConnection.getConnectionStatus() != Socket::ConnectionStatus::CONNECTION_SUCCEEDED)
+            {
+                Logger::info(std::format("Not moving service {} to loop {} as mesh peers are still connecting", m_serviceName, pUVLoop->getName()));
+                return;
+            }
+        }
+        Logger::info(std::format("Moving service {} from loop {} to loop {}", m_serviceName, m_pUVLoop->getName(), pUVLoop->getName()));
+
+        // We process any pending disconnections now, so that we do not move sockets which
+        // have disconnected...
+        if (!m_disconnectedSockets.empty())
+        {
+            processDisconnections();
+        }
+
+        // We switch to the new loop. From now on, events for the service are marshalled to it...
+        auto pOldUVLoop = m_pUVLoop;
+        {
+            std::scoped_lock lock(m_uvLoopMutex);
+            m_pUVLoop = pUVLoop;
+        }
+
+        // We move the sockets which are on the old loop. (Sockets which are still being moved
+        // to the old loop are moved on when they get there, in onMoveToLoopComplete.) These
+        // sockets have already been sent an ACK...
+        auto moveSocket = [&](const SocketPtr& pSocket)
+        {
+            if (pSocket->isSameUVLoop(pOldUVLoop))
+            {
+                m_movedSocketIDs.insert(pSocket->getSocketID());
+                pSocket->moveToLoop(pUVLoop);
+            }
+        };
+        for (const auto& [socketID, pSocket] : m_clientSockets)
+        {
+            moveSocket(pSocket);
+        }
+        for (const auto& [socketID, pSocket] : m_meshGatewayConnections_WeAreTheServer)
+        {
+            moveSocket(pSocket);
+        }
+        for (auto& [key, meshGatewayConnection] : m_meshGatewayConnections_WeAreTheClient)
+        {
+            meshGatewayConnection.moveToLoop(pUVLoop);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
+
+// Marshalls a unique event to the service's UV loop. If the service moves to another
+// loop before the event runs, the event is passed on to the new loop.
+void ServiceManager::marshallUniqueServiceEvent(const std::string& key, std::function<void()> serviceEvent)
+{
+    getUVLoop()->marshallUniqueEvent(
+        key,
+        [this, key, serviceEvent](uv_loop_t* pLoop)
+        {
+            if (getUVLoop()->getUVLoop() != pLoop)
+            {
+                marshallUniqueServiceEvent(key, serviceEvent);
+                return;
+            }
+            serviceEvent();
+        }
+    );
+}
+
+// Starts the timer for the next stats report.
+void ServiceManager::scheduleStatsTimer()
+{
+    // The timer runs on our current loop, but we may have moved by the time it fires, so
+    // we report stats from a service event...
+    UVUtils::runSingleShotTimer(m_pUVLoop, 2000,
+        [this]()
+        {
+            marshallUniqueServiceEvent(m_statsTimerEventKey, [this]() { onStatsTimer(); });
+        }
+    );
+}
+
+// Passes an update (other than SEND_MESSAGE) received by a shard to the service's UV loop to be processed.
+void ServiceManager::marshallUpdate(Socket* pSocket, BufferPtr pBuffer)
+{
+    // We hold a reference to the socket until the update has been processed...
+    auto pSharedSocket = pSocket->shared_from_this();
+    m_pUVLoop->marshallEvent(
+        [this, pSharedSocket, pBuffer](uv_loop_t* /*pLoop*/)
+        {
+            onDataReceived(pSharedSocket.get(), pBuffer);
+        }
+    );
+}
+
+// Passes a disconnection seen by a shard to the service's UV loop to be processed.
+void ServiceManager::marshallDisconnection(Socket* pSocket)
+{
+    auto pSharedSocket = pSocket->shared_from_this();
+    m_pUVLoop->marshallEvent(
+        [this, pSharedSocket](uv_loop_t* /*pLoop*/)
+        {
+            onDisconnected(pSharedSocket.get());
+        }
+    );
+}
+
+// Sends an ACK to the client to let it know that its CONNECT has completed.
+// The ACK holds the client's credit window, if it is flow controlled, and the prefix for its inboxes.
+// It also tells the client (or mesh peer) that we can read large messages sent in chunks, and
+// tells a mesh peer our gateway ID.
+void ServiceManager::sendAck(Socket* pSocket) const
+{
+    NetworkMessage connectMessage;
+    auto& header = connectMessage.getHeader();
+    header.setAction(NetworkMessageHeader::Action::ACK);
+    auto pMessage = Message::create();
+    pMessage->addBool("SupportsChunks", true);
+    if (pSocket->getIsMeshPeer())
+    {
+        pMessage->addUnsignedInt32("GatewayID", m_inboxRouter.getGatewayID());
+    }
+    else
+    {
+        pMessage->addString("InboxPrefix", m_inboxRouter.getInboxPrefix(pSocket->getSocketID()));
+        if (pSocket->getCreditWindow() != 0)
+        {
+            pMessage->addUnsignedInt64("CreditWindow", pSocket->getCreditWindow());
+        }
+    }
+    connectMessage.setMessage(pMessage);
+    auto pBuffer = Buffer::create();
+    connectMessage.serialize(*pBuffer);
+    pSocket->write(pBuffer, 0, 0, Socket::WritePriority::CONTROL);
+}
+
+// Gets the priority with which a message is written to subscribers. Replies to inboxes go ahead
+// of other messages, and large messages go behind them.
+Socket::WritePriority ServiceManager::getWritePriority(const std::string& subject, size_t messageSizeBytes)
+{
+    if (subject.starts_with(InboxRouter::INBOX_SUBJECT_PREFIX))
+    {
+        return Socket::WritePriority::CONTROL;
+    }
+    if (messageSizeBytes >= BULK_MESSAGE_BYTES)
+    {
+        return Socket::WritePriority::BULK;
+    }
+    return Socket::WritePriority::NORMAL;
+}
+
+// Sends an advisory to a client telling it that data written to it has been dropped, as it is a slow consumer.
+// Called on the socket's UV loop.
+void ServiceManager::sendSlowConsumerAdvisory(Socket* pSocket)
+{
+    // We log the drops...
+    auto outputQueueStats = pSocket->getOutputQueueStats();
+    Logger::warn(std::format("Slow consumer: {} (DroppedMessages={}, DroppedBytes={}, ConflatedMessages={}, QueuedMessages={}, QueuedBytes={})",
+        pSocket->getName(),
+        outputQueueStats.DroppedMessages,
+        outputQueueStats.DroppedBytes,
+        outputQueueStats.ConflatedMessages,
+        outputQueueStats.QueuedMessages,
+        outputQueueStats.QueuedBytes));
+
+    // We send the advisory ahead of the data queued for the client...
+    auto pMessage = Message::create();
+    pMessage->addUnsignedInt64("DroppedMessages", outputQueueStats.DroppedMessages);
+    pMessage->addUnsignedInt64("DroppedBytes", outputQueueStats.DroppedBytes);
+    pMessage->addUnsignedInt64("ConflatedMessages", outputQueueStats.ConflatedMessages);
+    pMessage->addUnsignedInt64("QueuedMessages", outputQueueStats.QueuedMessages);
+    pMessage->addUnsignedInt64("QueuedBytes", outputQueueStats.QueuedBytes);
+    NetworkMessage advisoryMessage;
+    auto& header = advisoryMessage.getHeader();
+    header.setAction(NetworkMessageHeader::Action::ADVISORY);
+    header.setSubject(SLOW_CONSUMER_ADVISORY_SUBJECT);
+    advisoryMessage.setMessage(pMessage);
+    auto pBuffer = Buffer::create();
+    advisoryMessage.serialize(*pBuffer);
+    pSocket->writeAhead(pBuffer);
+}
+
+// Creates the shards for a sharded service.
+void ServiceManager::createShards(size_t shardCount)
+{
+    Logger::info(std::format("Creating {} shards for service {}", shardCount, m_serviceName));
+    m_pShardedSubjectMatchingEngine = std::make_unique<SnapshotSubjectMatchingEngine>();
+    for (size_t i = 0; i < shardCount; ++i)
+    {
+        // The first shard uses our UV loop...
+        auto pUVLoop = (i == 0) ? m_pUVLoop : UVLoop::create(std::format("{}/{}", m_serviceName, i), UVLoop::Temperature::COLD);
+        m_shards.push_back(std::make_unique<ServiceShard>(*this, pUVLoop, *m_pShardedSubjectMatchingEngine, m_meshManager.getConflatedSubjects(m_serviceName), m_lastValueCache, m_inboxRouter));
+    }
 }
 
 // Called when the connection status has changed for a mesh gateway connection.
@@ -78,6 +390,9 @@ void ServiceManager::initialize()
 {
     Logger::info(std::format("Initializing ServiceManager for {}", m_serviceName));
 
+    // We cache matches for subjects which are sent often...
+    m_subjectMatchingEngine.setCachingMode(SubjectMatchingEngine::CachingMode::ADAPTIVE);
+
     // We create mesh gateway connections to each peer gateway in the mesh...
     auto peerGatewayInfos = m_meshManager.getPeerGatewayInfos(m_serviceName);
     for (const auto& peerGatewayInfo : peerGatewayInfos)
@@ -87,23 +402,51 @@ void ServiceManager::initialize()
     }
 
     // We run a timer to report stats...
-    UVUtils::runSingleShotTimer(m_pUVLoop, 2000, [&]() { onStatsTimer(); });
+    scheduleStatsTimer();
 }
 
 // Called when data has been received on the socket.
 // Called on the thread of the client socket.
 void ServiceManager::onDataReceived(Socket* pSocket, BufferPtr pBuffer)
 {
+    // We measure the time we spend processing the update, for the service scheduler...
+    auto start = std::chrono::steady_clock::now();
+
+    // We grant the client credit for the update once we have processed it, even if that fails...
+    CreditGuard creditGuard(pSocket, pBuffer);
     try
     {
         // The buffer holds a serialized NetworkMessage. We deserialize the header...
         NetworkMessage networkMessage;
         networkMessage.deserializeHeader(*pBuffer);
         auto& header = networkMessage.getHeader();
-        auto action = header.getAction();
+        creditGuard.setAction(header.getAction());
 
+        // Subscription snapshots need the message as well as the header...
+        if (header.getAction() == NetworkMessageHeader::Action::SUBSCRIPTION_SNAPSHOT)
+        {
+            onSubscriptionSnapshot(pSocket, networkMessage, *pBuffer);
+        }
+        else
+        {
+            processUpdate(pSocket, header, pBuffer);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+    addBusyNanoseconds(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+// Processes an update (other than a SUBSCRIPTION_SNAPSHOT) whose header has been parsed.
+// Called on the service's UV loop, including for updates passed on by IO loops.
+void ServiceManager::processUpdate(Socket* pSocket, const NetworkMessageHeader& header, BufferPtr pBuffer)
+{
+    try
+    {
         // We process the update depending on the action...
-        switch (action)
+        switch (header.getAction())
         {
         case NetworkMessageHeader::Action::SUBSCRIBE:
             onSubscribe(pSocket, header, pBuffer);
@@ -151,12 +494,36 @@ void ServiceManager::onMoveToLoopComplete(Socket* pSocket)
 {
     try
     {
+        // If the service moved to another loop while the socket was being moved to us,
+        // we move it on to the new loop...
+        if (!pSocket->isSameUVLoop(getUVLoop()))
+        {
+            pSocket->moveToLoop(getUVLoop());
+            return;
+        }
+
+        // Sockets which moved with the service have already been sent an ACK...
+        if (m_movedSocketIDs.erase(pSocket->getSocketID()) != 0)
+        {
+            return;
+        }
+
         // We send an ACK message to the client to let them know that the
         // CONNECT has completed successfully...
-        NetworkMessage connectMessage;
-        auto& header = connectMessage.getHeader();
-        header.setAction(NetworkMessageHeader::Action::ACK);
-        MMUtils::sendNetworkMessage(connectMessage, pSocket);
+        sendAck(pSocket);
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
+
+// Called when data written to the socket has been dropped (or conflated) as the output queue is full.
+void ServiceManager::onOutputQueueDrops(Socket* pSocket)
+{
+    try
+    {
+        sendSlowConsumerAdvisory(pSocket);
     }
     catch (const std::exception& ex)
     {
@@ -169,13 +536,27 @@ void ServiceManager::onDisconnected(Socket* pSocket)
 {
     try
     {
-        // We remove any active subscriptions for the client...
+        // We remove the socket from the collections of sockets we manage. We hold on to
+        // it until its subscriptions have been removed, as the subject-matching engine
+        // refers to it...
         auto socketID = pSocket->getSocketID();
-        m_subjectMatchingEngine.removeAllSubscriptions(socketID);
+        auto pDisconnectedSocket = extractSocket(m_clientSockets, socketID);
+        if (!pDisconnectedSocket)
+        {
+            pDisconnectedSocket = extractSocket(m_meshGatewayConnections_WeAreTheServer, socketID);
+            m_inboxRouter.removePeerSocket(socketID);
+        }
+        if (!pDisconnectedSocket)
+        {
+            // We have already processed the disconnection for this socket...
+            return;
+        }
+        m_disconnectedSockets.push_back(pDisconnectedSocket);
+        m_movedSocketIDs.erase(socketID);
 
-        // We remove the socket from the collections of sockets we manage...
-        m_clientSockets.erase(socketID);
-        m_meshGatewayConnections_WeAreTheServer.erase(socketID);
+        // We remove subscriptions for disconnected sockets in batches. When many clients
+        // disconnect at the same time, we get one event for all of them...
+        marshallUniqueServiceEvent(m_processDisconnectionsEventKey, [this]() { processDisconnections(); });
     }
     catch (const std::exception& ex)
     {
@@ -183,46 +564,320 @@ void ServiceManager::onDisconnected(Socket* pSocket)
     }
 }
 
+// Removes subscriptions for sockets which have disconnected.
+void ServiceManager::processDisconnections()
+{
+    try
+    {
+        // We remove the interest that clients (not mesh peers) have advertised to the mesh.
+        // We also keep the output queue drops for the clients, so they stay in the stats...
+        MeshInterestAggregator::Changes changes;
+        for (const auto& pSocket : m_disconnectedSockets)
+        {
+            if (pSocket->getIsMeshPeer() == false)
+            {
+                for (const auto& subject : getSubjects(pSocket->getSocketID()))
+                {
+                    m_meshInterest.removeInterest(subject, changes);
+                }
+                auto outputQueueStats = pSocket->getOutputQueueStats();
+                m_disconnectedOutputQueueStats.DroppedMessages += outputQueueStats.DroppedMessages;
+                m_disconnectedOutputQueueStats.DroppedBytes += outputQueueStats.DroppedBytes;
+                m_disconnectedOutputQueueStats.ConflatedMessages += outputQueueStats.ConflatedMessages;
+                m_disconnectedOutputQueueStats.SlowConsumerDisconnections += outputQueueStats.SlowConsumerDisconnections;
+            }
+        }
+
+        // We remove any active subscriptions for the clients...
+        std::vector<uint64_t> socketIDs;
+        socketIDs.reserve(m_disconnectedSockets.size());
+        for (const auto& pSocket : m_disconnectedSockets)
+        {
+            socketIDs.push_back(pSocket->getSocketID());
+            m_inboxRouter.removeAllSubscriptions(pSocket->getSocketID());
+        }
+        removeAllSubscriptions(socketIDs);
+
+        // We update the patterns we advertise to the mesh...
+        advertiseToMesh(changes);
+
+        // We release the sockets...
+        releaseSockets(std::move(m_disconnectedSockets));
+        m_disconnectedSockets.clear();
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
+
+// Removes the socket from the collection provided and returns it, or nullptr if it is not in the collection.
+SocketPtr ServiceManager::extractSocket(std::unordered_map<uint64_t, SocketPtr>& sockets, uint64_t socketID)
+{
+    auto it = sockets.find(socketID);
+    if (it == sockets.end())
+    {
+        return nullptr;
+    }
+    auto pSocket = it->second;
+    sockets.erase(it);
+    return pSocket;
+}
+
+// Adds a subscription to the subject-matching engine for the service.
+void ServiceManager::addSubscription(const std::string& subject, uint32_t subscriptionID, Socket* pSocket)
+{
+    if (m_pShardedSubjectMatchingEngine)
+    {
+        m_pShardedSubjectMatchingEngine->addSubscription(subject, subscriptionID, pSocket->getSocketID(), pSocket);
+        publishSubscriptions();
+    }
+    else
+    {
+        m_subjectMatchingEngine.addSubscription(subject, subscriptionID, pSocket->getSocketID(), pSocket);
+    }
+}
+
+// Removes a subscription from the subject-matching engine for the service.
+void ServiceManager::removeSubscription(const std::string& subject, uint64_t socketID)
+{
+    if (m_pShardedSubjectMatchingEngine)
+    {
+        m_pShardedSubjectMatchingEngine->removeSubscription(subject, socketID);
+        publishSubscriptions();
+    }
+    else
+    {
+        m_subjectMatchingEngine.removeSubscription(subject, socketID);
+    }
+}
+
+// Removes all subscriptions for the sockets specified from the subject-matching engine for the service.
+void ServiceManager::removeAllSubscriptions(const std::vector<uint64_t>& socketIDs)
+{
+    if (m_pShardedSubjectMatchingEngine)
+    {
+        for (auto socketID : socketIDs)
+        {
+            m_pShardedSubjectMatchingEngine->removeAllSubscriptions(socketID);
+        }
+        publishSubscriptions();
+    }
+    else
+    {
+        m_subjectMatchingEngine.removeAllSubscriptions(socketIDs);
+    }
+}
+
+// Gets the subjects to which the socket has subscribed.
+std::vector<std::string> ServiceManager::getSubjects(uint64_t socketID)
+{
+    return m_pShardedSubjectMatchingEngine ? m_pShardedSubjectMatchingEngine->getSubjects(socketID) : m_subjectMatchingEngine.getSubjects(socketID);
+}
+
+// Publishes subscription changes to the shards of a sharded service (in a batch, from a unique event).
+void ServiceManager::publishSubscriptions()
+{
+    // Changes made while processing a batch of updates are published together...
+    m_pUVLoop->marshallUniqueEvent(
+        m_publishSubscriptionsEventKey,
+        [this](uv_loop_t* /*pLoop*/)
+        {
+            m_pShardedSubjectMatchingEngine->publish();
+        }
+    );
+}
+
+// Releases disconnected sockets once no shard can still be routing messages to them.
+void ServiceManager::releaseSockets(std::vector<SocketPtr> sockets)
+{
+    // Unsharded services route on our loop, so nothing else can be using the sockets...
+    if (m_shards.empty())
+    {
+        return;
+    }
+
+    // We publish the removal of the sockets' subscriptions, so that shards do not match them
+    // from now on. Shards may still be routing a message matched against an older snapshot,
+    // so we marshall an event holding the sockets to each of the other shard loops. A shard
+    // routes each message within one event, so when it processes ours it has finished with
+    // the older snapshots. The sockets are released when the last of the events is done with.
+    // (The first shard runs on our loop, so it cannot be routing now.)
+    m_pShardedSubjectMatchingEngine->publish();
+    auto pSockets = std::make_shared<std::vector<SocketPtr>>(std::move(sockets));
+    for (size_t i = 1; i < m_shards.size(); ++i)
+    {
+        m_shards[i]->getUVLoop()->marshallEvent([pSockets](uv_loop_t* /*pLoop*/) {});
+    }
+}
+
 // Called when we receive a SUBSCRIBE message.
-void ServiceManager::onSubscribe(Socket* pSocket, const NetworkMessageHeader& header, BufferPtr pBuffer)
+void ServiceManager::onSubscribe(Socket* pSocket, const NetworkMessageHeader& header, BufferPtr /*pBuffer*/)
 {
+    // Subscriptions a client makes to its own direct inboxes are held by the inbox router. They
+    // are not added to the subject matching engine or relayed to the mesh...
+    if (pSocket->getIsMeshPeer() == false
+        &&
+        m_inboxRouter.addSubscription(header.getSubject(), header.getSubscriptionID(), pSocket->getSocketID(), pSocket))
+    {
+        return;
+    }
+
     // We register the subscription with the subject matching engine...
-    auto subscriptionCount = m_subjectMatchingEngine.addSubscription(
-        header.getSubject(),
-        header.getSubscriptionID(),
-        pSocket->getSocketID(),
-        pSocket);
+    addSubscription(header.getSubject(), header.getSubscriptionID(), pSocket);
 
-    // If this is the first subscription we have for this subject AND the subscription came
-    // from a client (not a mesh peer) then we forward the subscription to the mesh...
-    if (subscriptionCount == 1 && pSocket->getIsMeshPeer() == false)
+    // If the subscription came from a client (not a mesh peer) we add it to the interest we
+    // advertise to the mesh. This relays it to mesh peers unless we already advertise a
+    // pattern which covers it...
+    if (pSocket->getIsMeshPeer() == false)
     {
-        relayToMesh(pBuffer);
+        MeshInterestAggregator::Changes changes;
+        m_meshInterest.addInterest(header.getSubject(), changes);
+        advertiseToMesh(changes);
+
+        // We send the client the cached values for the subjects it has subscribed to...
+        sendCachedValues(pSocket, header.getSubject(), header.getSubscriptionID());
+    }
+}
+
+// Sends the cached values for the subjects a new subscription matches to the client which subscribed.
+void ServiceManager::sendCachedValues(Socket* pSocket, const std::string& pattern, uint32_t subscriptionID)
+{
+    if (!m_lastValueCache.isEnabled())
+    {
+        return;
+    }
+
+    // For a sharded service, the client's shard sends the values on its loop (see ServiceShard)...
+    if (!m_shards.empty())
+    {
+        static_cast<ServiceShard*>(pSocket->getCallback())->sendCachedValues(pSocket, pattern, subscriptionID);
+        return;
+    }
+
+    // Otherwise messages are routed on our loop, so the values are queued ahead of any later
+    // message for the subscription. For a pipelined service they go through the client's IO
+    // loop in order with other writes to it, and are drained together, so they are still sent
+    // as one batch...
+    auto cachedValues = m_lastValueCache.getMatches(pattern);
+    if (m_ioLoops.empty())
+    {
+        pSocket->writeBatch(cachedValues, subscriptionID);
+        return;
+    }
+    for (const auto& pBuffer : cachedValues)
+    {
+        writeToSocket(pSocket, pBuffer, subscriptionID, 0, Socket::WritePriority::NORMAL);
     }
 }
 
 // Called when we receive an UNSUBSCRIBE message.
-void ServiceManager::onUnsubscribe(Socket* pSocket, const NetworkMessageHeader& header, BufferPtr pBuffer)
+void ServiceManager::onUnsubscribe(Socket* pSocket, const NetworkMessageHeader& header, BufferPtr /*pBuffer*/)
 {
+    // Subscriptions to direct inboxes are held by the inbox router...
+    if (pSocket->getIsMeshPeer() == false && m_inboxRouter.removeSubscription(header.getSubject(), pSocket->getSocketID()))
+    {
+        return;
+    }
+
     // We unregister the subscription from the subject matching engine...
-    auto subscriptionCount = m_subjectMatchingEngine.removeSubscription(
-        header.getSubject(),
-        pSocket->getSocketID());
+    removeSubscription(header.getSubject(), pSocket->getSocketID());
 
-    // If we have no subscriptions remaining for this subject AND the unsubscribe came
-    // from a client (not a mesh peer) then we forward the unsubscribe to the mesh...
-    if (subscriptionCount == 0 && pSocket->getIsMeshPeer() == false)
+    // If the unsubscribe came from a client (not a mesh peer) we remove it from the interest
+    // we advertise to the mesh. When no local clients remain interested in a pattern we
+    // unsubscribe from it on mesh peers, and advertise any patterns it was covering...
+    if (pSocket->getIsMeshPeer() == false)
     {
-        relayToMesh(pBuffer);
+        MeshInterestAggregator::Changes changes;
+        m_meshInterest.removeInterest(header.getSubject(), changes);
+        advertiseToMesh(changes);
+    }
+}
+
+// Called when we receive a SUBSCRIPTION_SNAPSHOT message from a mesh peer.
+void ServiceManager::onSubscriptionSnapshot(Socket* pSocket, NetworkMessage& networkMessage, Buffer& buffer)
+{
+    if (pSocket->getIsMeshPeer() == false)
+    {
+        throw Exception(std::format("Subscription snapshot received from {}, which is not a mesh peer", pSocket->getName()));
+    }
+
+    // We deserialize the patterns from the snapshot...
+    networkMessage.deserializeMessage(buffer);
+    auto pBLOB = networkMessage.getMessage()->getBLOB(SubscriptionSnapshot::FIELD_NAME);
+    auto patterns = SubscriptionSnapshot::deserialize(static_cast<const uint8_t*>(pBLOB->getData()), pBLOB->getLength());
+
+    // The snapshot replaces any subscriptions we hold for the peer. (These could be from
+    // SUBSCRIBE messages sent before the snapshot.)
+    // Note: We do not relay subscriptions from mesh peers to other peers.
+    auto socketID = pSocket->getSocketID();
+    removeAllSubscriptions({ socketID });
+    for (const auto& pattern : patterns)
+    {
+        addSubscription(pattern, 0, pSocket);
     }
+    Logger::info(std::format("Received subscription snapshot with {} patterns from {}", patterns.size(), pSocket->getName()));
 }
 
 // Called when we receive a SEND_MESSAGE message.
 void ServiceManager::onMessage(const NetworkMessageHeader& header, Socket* pSocket, BufferPtr pBuffer)
 {
-    // We find the clients which have subscriptions to the message subject...
+    // Messages for a sharded service are routed by the shards. The messages we receive ourselves
+    // (from mesh peers) are routed by the first shard, which runs on our loop...
+    if (!m_shards.empty())
+    {
+        m_shards[0]->onMessage(header, pSocket, pBuffer);
+        return;
+    }
+
+    // Messages to direct inboxes go straight to the client, or the peer gateway, which owns the
+    // inbox. Other messages go to the clients and peers subscribed to them...
     auto& subject = header.getSubject();
-    auto subscriptionInfos = m_subjectMatchingEngine.getMatchingSubscriptionInfos(subject);
+    InboxRouter::Destination destination;
+    if (m_inboxRouter.findDestination(subject, destination))
+    {
+        sendToInbox(destination, pSocket, pBuffer);
+    }
+    else
+    {
+        routeToSubscribers(subject, pSocket, pBuffer);
+    }
+
+    // We add the message to the stats if came from a client (non-peer). (The client is granted
+    // credit for it by the CreditGuard for the update.)
+    if (pSocket->getIsMeshPeer() == false)
+    {
+        m_serviceStats.add(subject, pBuffer->getBufferSize());
+    }
+}
+
+// Sends a message to a direct inbox.
+void ServiceManager::sendToInbox(const InboxRouter::Destination& destination, Socket* pSocket, const BufferPtr& pBuffer)
+{
+    // The inbox is one of our clients', or a peer's if the message came from a client. We do
+    // not relay messages from one peer gateway to others...
+    if (destination.pSocket)
+    {
+        writeToSocket(destination.pSocket, pBuffer, destination.SubscriptionID, 0, Socket::WritePriority::CONTROL);
+    }
+    else if (destination.pPeer && pSocket->getIsMeshPeer() == false)
+    {
+        destination.pPeer->relay(pBuffer, Socket::WritePriority::CONTROL);
+    }
+}
+
+// Sends a message to the clients and mesh peers subscribed to its subject.
+void ServiceManager::routeToSubscribers(const std::string& subject, Socket* pSocket, const BufferPtr& pBuffer)
+{
+    // We hold the message as the latest value for its subject, if the service caches it...
+    m_lastValueCache.update(subject, pBuffer);
+
+    // We find the clients which have subscriptions to the message subject...
+    auto subscriptionInfos = m_subjectMatchingEngine.getMatchingSubscriptionInfos(subject, m_matchScratch);
+
+    // If the subject is conflated, clients get the latest message for it...
+    auto conflationKey = m_conflatedSubjects.getConflationKey(subject);
+    auto priority = getWritePriority(subject, pBuffer->getBufferSize());
 
     // We send the update to each 'target' matching the subscription.
     // 1. We send to all non-mesh clients.
@@ -232,52 +887,88 @@ void ServiceManager::onMessage(const NetworkMessageHeader& header, Socket* pSock
     // 
     // 3. We forward the message only once to each mesh peer, even if the subject matches multiple 
     //    subscriptions (eg, wildcards). It is the peer gateway's job to fan out the update at its end.
-    for (const auto& pSubscriptionInfo : subscriptionInfos)
+    //    The subject matching engine deduplicates matches for mesh peers, so each peer appears at
+    //    most once in the matches.
+    //
+    // 4. We do not conflate messages to mesh peers, as they may have clients which do not.
+    for (const auto& subscriptionInfo : subscriptionInfos)
     {
-        const auto& pTargetSocket = pSubscriptionInfo->getSocket();
+        auto pTargetSocket = subscriptionInfo.getSocket();
 
         // 1. We send to non-mesh clients.
-        if (pTargetSocket->getIsMeshPeer() == false)
+        // 2 & 3. We send to mesh peers if the update came from a non-mesh client.
+        if (pTargetSocket->getIsMeshPeer() == false
+            ||
+            pSocket->getIsMeshPeer() == false)
         {
-            pTargetSocket->write(pBuffer, pSubscriptionInfo->getSubscriptionID());
-            pTargetSocket->setAlreadyUpdated(true);
-        }
-
-        // 2 & 3. We send to mesh peers.
-        // - If the target is a mesh peer
-        // - If the update came from a non-mesh client
-        // - If we have not already sent the update to the target
-        if (pTargetSocket->getIsMeshPeer() == true
-            &&
-            pSocket->getIsMeshPeer() == false
-            &&
-            pTargetSocket->getAlreadyUpdated() == false)
-        {
-            pTargetSocket->write(pBuffer, pSubscriptionInfo->getSubscriptionID());
-            pTargetSocket->setAlreadyUpdated(true);
+            writeToSocket(pTargetSocket, pBuffer, subscriptionInfo.getSubscriptionID(), pTargetSocket->getIsMeshPeer() ? 0 : conflationKey, priority);
         }
     }
+}
 
-    // We clear the already-updated flags on the sockets...
-    for (const auto& pSubscriptionInfo : subscriptionInfos)
+// Relays the message / update in the buffer to all mesh peers.
+void ServiceManager::relayToMesh(BufferPtr pBuffer)
+{
+    for (const auto& [key, meshGatewayConnection] : m_meshGatewayConnections_WeAreTheClient)
     {
-        const auto& pTargetSocket = pSubscriptionInfo->getSocket();
-        pTargetSocket->setAlreadyUpdated(false);
+        meshGatewayConnection.relay(pBuffer);
     }
+}
 
-    // We add the message to the stats if came from a client (non-peer)...
-    if (pSocket->getIsMeshPeer() == false)
+// Sends changes to the patterns we advertise to mesh peers.
+void ServiceManager::advertiseToMesh(const MeshInterestAggregator::Changes& changes)
+{
+    auto relayAction = [this](NetworkMessageHeader::Action action, const std::string& pattern)
     {
-        m_serviceStats.add(subject, pBuffer->getBufferSize());
+        NetworkMessage networkMessage;
+        auto& header = networkMessage.getHeader();
+        header.setAction(action);
+        header.setSubject(pattern);
+        auto pBuffer = Buffer::create();
+        networkMessage.serialize(*pBuffer);
+        relayToMesh(pBuffer);
+    };
+
+    // We subscribe before we unsubscribe, so that peers do not stop sending messages
+    // we are interested in while the advertised patterns change...
+    for (const auto& pattern : changes.Subscribe)
+    {
+        relayAction(NetworkMessageHeader::Action::SUBSCRIBE, pattern);
+    }
+    for (const auto& pattern : changes.Unsubscribe)
+    {
+        relayAction(NetworkMessageHeader::Action::UNSUBSCRIBE, pattern);
     }
 }
 
-// Relays the message / update in the buffer to all mesh peers.
-void ServiceManager::relayToMesh(BufferPtr pBuffer)
+// Collects message stats from the shards of a sharded service.
+void ServiceManager::collectShardStats()
 {
-    for (const auto& [key, meshGatewayConnection] : m_meshGatewayConnections_WeAreTheClient)
+    // We add the interest graph stats. The shared graph is a snapshot engine, which reports
+    // only its size...
+    auto engineStats = m_pShardedSubjectMatchingEngine->getStats();
+    m_serviceStats.setInterestGraphStats({ engineStats.SubscriptionCount, engineStats.NodeCount });
+
+    // The first shard runs on our loop, so we collect its stats directly. Other shards collect
+    // their stats on their own loops and marshall them back to us. These are included in the
+    // next stats we report...
+    m_shards[0]->collectStats(m_serviceStats);
+    for (size_t i = 1; i < m_shards.size(); ++i)
     {
-        meshGatewayConnection.relay(pBuffer);
+        auto pShard = m_shards[i].get();
+        pShard->getUVLoop()->marshallEvent(
+            [this, pShard](uv_loop_t* /*pLoop*/)
+            {
+                auto pShardStats = std::make_shared<ServiceStats>(m_serviceName, m_gateway.getGatewayName());
+                pShard->collectStats(*pShardStats);
+                m_pUVLoop->marshallEvent(
+                    [this, pShardStats](uv_loop_t* /*pLoop*/)
+                    {
+                        m_serviceStats.takeMessageStats(*pShardStats);
+                    }
+                );
+            }
+        );
     }
 }
 
@@ -286,13 +977,38 @@ void ServiceManager::onStatsTimer()
 {
     try
     {
+        // We add the interest graph stats...
+        if (m_pShardedSubjectMatchingEngine)
+        {
+            collectShardStats();
+        }
+        else
+        {
+            auto engineStats = m_subjectMatchingEngine.getStats();
+            auto cacheStats = m_subjectMatchingEngine.getCacheStats();
+            m_serviceStats.setInterestGraphStats({
+                engineStats.SubscriptionCount,
+                engineStats.NodeCount,
+                engineStats.TokenCount,
+                cacheStats.Size,
+                cacheStats.Hits,
+                cacheStats.Misses,
+                engineStats.FastPathMatches,
+                engineStats.GraphWalks,
+                engineStats.MemoryBytes,
+                engineStats.SubscriptionCount ? static_cast<double>(engineStats.MemoryBytes) / engineStats.SubscriptionCount : 0.0 });
+        }
+
+        // We add the output queue stats...
+        m_serviceStats.setOutputQueueStats(getOutputQueueStats());
+
         // We publish service stats to the Coordinator...
         auto pMessage = Message::create();
         pMessage->addString("SERVICE_STATS", m_serviceStats.getSnapshotAsJSON(false));
         auto subject = std::format("GATEWAY.STATS.{}.{}", m_gateway.getGatewayName(), m_serviceName);
         m_meshManager.sendMessageToCoordinator(pMessage, subject);
 
-        UVUtils::runSingleShotTimer(m_pUVLoop, 2000, [&]() { onStatsTimer(); });
+        scheduleStatsTimer();
     }
     catch (const std::exception& ex)
     {
@@ -300,3 +1016,26 @@ void ServiceManager::onStatsTimer()
     }
 }
 
+// Gets output queue stats for the service's client sockets.
+ServiceStats::OutputQueueStats ServiceManager::getOutputQueueStats() const
+{
+    // We start with the drops for clients which have disconnected, and add the stats for current clients...
+    auto outputQueueStats = m_disconnectedOutputQueueStats;
+    for (const auto& [socketID, pSocket] : m_clientSockets)
+    {
+        auto socketStats = pSocket->getOutputQueueStats();
+        outputQueueStats.DroppedMessages += socketStats.DroppedMessages;
+        outputQueueStats.DroppedBytes += socketStats.DroppedBytes;
+        outputQueueStats.ConflatedMessages += socketStats.ConflatedMessages;
+        outputQueueStats.SlowConsumerDisconnections += socketStats.SlowConsumerDisconnections;
+        outputQueueStats.QueuedMessages += socketStats.QueuedMessages;
+        outputQueueStats.QueuedBytes += socketStats.QueuedBytes;
+        for (size_t i = 0; i < Socket::WRITE_PRIORITY_COUNT; ++i)
+        {
+            outputQueueStats.QueuedByPriority[i].Messages += socketStats.QueuedByPriority[i].Messages;
+            outputQueueStats.QueuedByPriority[i].Bytes += socketStats.QueuedByPriority[i].Bytes;
+        }
+    }
+    return outputQueueStats;
+}
+
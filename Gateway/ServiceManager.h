@@ -1,18 +1,36 @@
 #pragma once
+#include <atomic>
+#include <format>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
+#include <vector>
 #include <SharedAliases.h>
 #include <Socket.h>
 #include "SubjectMatchingEngine.h"
+#include "SnapshotSubjectMatchingEngine.h"
+#include "ServiceShard.h"
+#include "ServiceIOLoop.h"
 #include "MeshGatewayConnection.h"
+#include "MeshInterestAggregator.h"
 #include "ServiceStats.h"
+#include "ConflatedSubjects.h"
+#include "LastValueCache.h"
+#include "InboxRouter.h"
 
 namespace MessagingMesh
 {
     // Forward declarations...
     class Gateway;
     class NetworkMessageHeader;
+    class NetworkMessage;
+    class Buffer;
     class MeshManager;
+    class ServiceScheduler;
 
     /// <summary>
     /// Manages a messaging-mesh service. 
@@ -23,17 +41,101 @@ namespace MessagingMesh
     /// 
     /// UV loop and thread
     /// ------------------
-    /// Each service runs it own UV loop, so message processing for each service is
-    /// managed on its own thread. As all updates on the UV loop take place on the
+    /// Each service runs on one UV loop at a time, so message processing for the service
+    /// takes place on one thread. As all updates on the UV loop take place on the
     /// (single) UV loop thread, this means that we do not have to lock service
     /// specific code such as the subject-matching engine.
+    /// 
+    /// Services share a pool of loops managed by the ServiceScheduler, so a loop may run
+    /// several services.
+    /// 
+    /// Moving to another loop
+    /// ----------------------
+    /// The scheduler moves services between loops to balance the load (see moveToLoop). The
+    /// move runs as an event on the service's current loop, and moves all the service's sockets
+    /// to the new loop with Socket::moveToLoop(). From then on the service runs on the new loop.
+    /// - Events and timers which were already set up on the old loop are passed on to the new
+    ///   loop when they run (see marshallUniqueServiceEvent).
+    /// - Sockets which were being moved to the old loop when the service moved (ie, clients
+    ///   which were connecting) are moved on to the new loop when they arrive.
+    /// - Sockets which are moved with the service are not sent a second ACK.
+    /// - We only move if all our connections to mesh peers are connected, as a socket which is
+    ///   still connecting cannot be moved.
+    /// 
+    /// We measure the time we spend processing updates, so that the scheduler knows our load.
+    /// 
+    /// Sharded services
+    /// ----------------
+    /// One loop limits a busy service to one core. A service can be configured (in the Services
+    /// section of gateway-config.json) with more than one shard. Each shard is a UV loop, and
+    /// client sockets are spread across the shards as they connect. The first shard runs on the
+    /// service's own loop, with the mesh connections.
+    /// 
+    /// Messages are routed by the shard which received them (see ServiceShard), so routing for
+    /// the service runs on all the shard loops at once. The shards match subjects against one
+    /// SnapshotSubjectMatchingEngine, which they can read without locking.
+    /// 
+    /// All other processing still runs on the service's loop. Subscription changes are made to
+    /// the snapshot engine there and published in batches. Sockets which disconnect are only
+    /// released once every shard loop has processed an event marshalled after the change was
+    /// published, so no shard can still be writing to them from an older snapshot.
+    /// 
+    /// Unsharded services (the default) use the SubjectMatchingEngine on the service's loop, as
+    /// described above. Sharded services have loops of their own, and are not in the scheduler's
+    /// pool.
+    /// 
+    /// Pipelined services
+    /// ------------------
+    /// Otherwise one loop reads the sockets, reassembles frames, parses headers, routes and
+    /// writes, all in turn. A service can instead be configured with IO loops (see ServiceIOLoop).
+    /// Client sockets are spread across the IO loops, which do the reads, framing, header parsing
+    /// and writes. They pass parsed updates to the service's loop through lock-free rings, and the
+    /// service's loop passes writes back in the same way. So the service's loop only routes.
+    /// 
+    /// Updates from each client are passed on in order through one ring, and writes to each
+    /// client come back in order through another, so per-publisher ordering is kept. Mesh peers
+    /// stay on the service's loop. Pipelined services also have loops of their own.
+    /// 
+    /// Mesh interest
+    /// -------------
+    /// Subscriptions from local clients are relayed to mesh peers, so that they send us
+    /// messages our clients are interested in. We only relay a covering set of patterns
+    /// (see MeshInterestAggregator), so a subscription to MD.EQ.VOD is not relayed while
+    /// a local client is subscribed to MD.>.
+    /// 
+    /// When we connect to a mesh peer we send it all our advertised patterns in one
+    /// SUBSCRIPTION_SNAPSHOT message (see SubscriptionSnapshot), and then send changes
+    /// as SUBSCRIBE and UNSUBSCRIBE messages.
+    /// 
+    /// Last-value cache
+    /// ----------------
+    /// A service can be configured to cache the latest message on some subjects (see
+    /// LastValueCache). When a client subscribes, it is sent the cached messages for all the
+    /// subjects its subscription matches, in one batch, before any later message is routed to
+    /// the new subscription. Mesh peers are not sent cached values, as their clients get them
+    /// from their own gateway.
+    /// 
+    /// Write priorities
+    /// ----------------
+    /// Messages are written with a priority (see Socket::WritePriority), so that data for a client
+    /// which is behind does not hold up its replies. Replies to inboxes, ACKs and credit grants
+    /// are sent ahead of other data, and large messages (eg, BLOBs) behind it.
+    /// 
+    /// Direct inboxes
+    /// --------------
+    /// Clients create request inboxes under a prefix we send in their ACK, which names this gateway
+    /// and the client's socket (see InboxRouter). Subscriptions to these inboxes are not added to the
+    /// subject-matching engine or relayed to the mesh, and replies to them are sent straight to the
+    /// client, or to the peer gateway which owns the inbox, from the reply's subject. Gateways send
+    /// each other their IDs in CONNECT_MESH_PEER and its ACK. Until all our peers have sent theirs
+    /// (so they have ours), subscriptions to inboxes are relayed to the mesh as before.
     /// </summary>
     class ServiceManager : public Socket::ICallback
     {
     // Public methods...
     public:
         // Constructor.
-        ServiceManager(const std::string& serviceName, const Gateway& gateway, const MeshManager& meshManager);
+        ServiceManager(const std::string& serviceName, const Gateway& gateway, const MeshManager& meshManager, ServiceScheduler& serviceScheduler);
 
         // Destructor.
         ~ServiceManager();
@@ -42,17 +144,67 @@ namespace MessagingMesh
         const Gateway& getGateway() const { return m_gateway; }
 
         // Registers a client socket to be managed for this service.
-        void registerSocket(SocketPtr pSocket, bool isMeshPeer);
+        // A mesh peer passes the gateway ID it reported in its CONNECT_MESH_PEER (if any).
+        void registerSocket(SocketPtr pSocket, bool isMeshPeer, std::optional<uint32_t> peerGatewayID);
 
         // Gets the service name.
         const std::string& getServiceName() const { return m_serviceName; }
 
+        // Makes the key for one of a service's unique events (see marshallUniqueServiceEvent).
+        // The key includes the service name, so that services sharing a loop do not drop each other's events.
+        static std::string makeUniqueEventKey(const std::string& serviceName, const std::string& eventName) { return std::format("{}/{}", serviceName, eventName); }
+
         // Called when the connection status has changed for a mesh gateway connection.
         void onMeshGatewayConnectionStatusChanged();
 
+        // Gets the router for messages to direct inboxes.
+        InboxRouter& getInboxRouter() { return m_inboxRouter; }
+
         // Called when we receive a SEND_MESSAGE message.
         void onMessage(const NetworkMessageHeader& header, Socket* pSocket, BufferPtr pBuffer);
 
+        // Gets the subscription patterns we advertise to mesh peers.
+        std::vector<std::string> getAdvertisedPatterns() const { return m_meshInterest.getAdvertisedPatterns(); }
+
+        // Passes an update (other than SEND_MESSAGE) received by a shard to the service's UV loop to be processed.
+        void marshallUpdate(Socket* pSocket, BufferPtr pBuffer);
+
+        // Passes a disconnection seen by a shard to the service's UV loop to be processed.
+        void marshallDisconnection(Socket* pSocket);
+
+        // Sends an ACK to the client to let it know that its CONNECT has completed.
+        // The ACK holds the client's credit window, if it is flow controlled, and the prefix for its inboxes.
+        // It also tells the client (or mesh peer) that we can read large messages sent in chunks, and
+        // tells a mesh peer our gateway ID.
+        void sendAck(Socket* pSocket) const;
+
+        // Gets the priority with which a message is written to subscribers. Replies to inboxes go ahead
+        // of other messages, and large messages go behind them.
+        static Socket::WritePriority getWritePriority(const std::string& subject, size_t messageSizeBytes);
+
+        // Sends an advisory to a client telling it that data written to it has been dropped, as it is a slow consumer.
+        // Called on the socket's UV loop.
+        static void sendSlowConsumerAdvisory(Socket* pSocket);
+
+        // Processes an update (other than a SUBSCRIPTION_SNAPSHOT) whose header has been parsed.
+        // Called on the service's UV loop, including for updates passed on by IO loops.
+        void processUpdate(Socket* pSocket, const NetworkMessageHeader& header, BufferPtr pBuffer);
+
+        // Gets the UV loop on which the service is running.
+        // Can be called from any thread.
+        UVLoopPtr getUVLoop() const;
+
+        // Moves the service, and all its sockets, to another UV loop.
+        // Called on the GATEWAY thread by the service scheduler.
+        void moveToLoop(UVLoopPtr pUVLoop);
+
+        // Gets the time the service has spent processing updates since the last call, and resets it.
+        // Can be called from any thread.
+        uint64_t takeBusyNanoseconds() { return m_busyNanoseconds.exchange(0, std::memory_order_relaxed); }
+
+        // Adds to the time the service has spent processing updates.
+        void addBusyNanoseconds(uint64_t nanoseconds) { m_busyNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed); }
+
     // Socket::ICallback implementation...
     private:
         // Called when a new client connection has been made to a listening socket.
@@ -68,39 +220,122 @@ namespace MessagingMesh
         // Called when the movement of the socket to a new UV loop has been completed.
         void onMoveToLoopComplete(Socket* pSocket);
 
+        // Called when data written to the socket has been dropped (or conflated) as the output queue is full.
+        void onOutputQueueDrops(Socket* pSocket);
+
     // Private functions...
     private:
         // Initializes the service manager in the context of the service's UV loop.
         void initialize();
 
+        // Creates the shards for a sharded service.
+        void createShards(size_t shardCount);
+
+        // Creates the IO loops for a pipelined service.
+        void createIOLoops(size_t ioLoopCount);
+
+        // Writes to a target socket, through its IO loop if the service is pipelined.
+        void writeToSocket(Socket* pSocket, BufferPtr pBuffer, uint32_t subscriptionID, uint64_t conflationKey, Socket::WritePriority priority);
+
+        // Moves the service to another UV loop.
+        // Called on the service's current UV loop.
+        void moveToLoop_onCurrentLoop(UVLoopPtr pUVLoop);
+
+        // Marshalls a unique event to the service's UV loop. If the service moves to another
+        // loop before the event runs, the event is passed on to the new loop.
+        void marshallUniqueServiceEvent(const std::string& key, std::function<void()> serviceEvent);
+
+        // Starts the timer for the next stats report.
+        void scheduleStatsTimer();
+
+        // Adds a subscription to the subject-matching engine for the service.
+        void addSubscription(const std::string& subject, uint32_t subscriptionID, Socket* pSocket);
+
+        // Removes a subscription from the subject-matching engine for the service.
+        void removeSubscription(const std::string& subject, uint64_t socketID);
+
+        // Removes all subscriptions for the sockets specified from the subject-matching engine for the service.
+        void removeAllSubscriptions(const std::vector<uint64_t>& socketIDs);
+
+        // Gets the subjects to which the socket has subscribed.
+        std::vector<std::string> getSubjects(uint64_t socketID);
+
+        // Publishes subscription changes to the shards of a sharded service (in a batch, from a unique event).
+        void publishSubscriptions();
+
+        // Releases disconnected sockets once no shard can still be routing messages to them.
+        void releaseSockets(std::vector<SocketPtr> sockets);
+
         // Called when we receive a SUBSCRIBE message.
         void onSubscribe(Socket* pSocket, const NetworkMessageHeader& header, BufferPtr pBuffer);
 
+        // Sends the cached values for the subjects a new subscription matches to the client which subscribed.
+        void sendCachedValues(Socket* pSocket, const std::string& pattern, uint32_t subscriptionID);
+
         // Called when we receive an UNSUBSCRIBE message.
         void onUnsubscribe(Socket* pSocket, const NetworkMessageHeader& header, BufferPtr pBuffer);
 
+        // Called when we receive a SUBSCRIPTION_SNAPSHOT message from a mesh peer.
+        void onSubscriptionSnapshot(Socket* pSocket, NetworkMessage& networkMessage, Buffer& buffer);
+
         // Called when a socket has been disconnected.
         void onDisconnected(Socket* pSocket);
 
+        // Removes subscriptions for sockets which have disconnected.
+        void processDisconnections();
+
+        // Removes the socket from the collection provided and returns it, or nullptr if it is not in the collection.
+        static SocketPtr extractSocket(std::unordered_map<uint64_t, SocketPtr>& sockets, uint64_t socketID);
+
+        // Sends a message to a direct inbox.
+        void sendToInbox(const InboxRouter::Destination& destination, Socket* pSocket, const BufferPtr& pBuffer);
+
+        // Sends a message to the clients and mesh peers subscribed to its subject.
+        void routeToSubscribers(const std::string& subject, Socket* pSocket, const BufferPtr& pBuffer);
+
         // Relays the message / update in the buffer to all mesh peers.
         void relayToMesh(BufferPtr pBuffer);
 
+        // Sends changes to the patterns we advertise to mesh peers.
+        void advertiseToMesh(const MeshInterestAggregator::Changes& changes);
+
         // Called when the stats timer ticks.
         void onStatsTimer();
 
+        // Gets output queue stats for the service's client sockets.
+        ServiceStats::OutputQueueStats getOutputQueueStats() const;
+
+        // Collects message stats from the shards of a sharded service.
+        void collectShardStats();
+
     // Private data...
     private:
         // The service name...
         std::string m_serviceName;
 
+        // Keys for our unique events. These include the service name, as services in the pool
+        // share loops, and a loop drops a unique event whose key is already queued...
+        std::string m_processDisconnectionsEventKey;
+        std::string m_statsTimerEventKey;
+        std::string m_publishSubscriptionsEventKey;
+
         // The 'parent' gateway...
         const Gateway& m_gateway;
             
         // Tells us about peer gateways in the mesh...
         const MeshManager& m_meshManager;
 
-        // UV loop for processing client messages...
+        // UV loop for processing client messages. This changes when the service moves to another
+        // loop. It is only changed on the service's loop (with the mutex held), so code running on
+        // the loop can read it without locking...
         UVLoopPtr m_pUVLoop;
+        mutable std::mutex m_uvLoopMutex;
+
+        // Sockets which are being moved to a new loop with the service (so they are not sent a second ACK)...
+        std::unordered_set<uint64_t> m_movedSocketIDs;
+
+        // Time spent processing updates since the service scheduler last measured our load...
+        std::atomic<uint64_t> m_busyNanoseconds = 0;
 
         // Client sockets, keyed by socket ID...
         std::unordered_map<uint64_t, SocketPtr> m_clientSockets;
@@ -108,6 +343,18 @@ namespace MessagingMesh
         // Maps sent messages to clients who are subscribed to them...
         SubjectMatchingEngine m_subjectMatchingEngine;
 
+        // Scratch vector for matches for the message being routed (reused between messages)...
+        VecSubscriptionInfo m_matchScratch;
+
+        // Subjects whose messages are conflated in the clients' output queues...
+        ConflatedSubjects m_conflatedSubjects;
+
+        // The latest values of subjects the service caches (shared with the shards of a sharded service)...
+        LastValueCache m_lastValueCache;
+
+        // Routes messages to direct inboxes (shared with the shards of a sharded service)...
+        InboxRouter m_inboxRouter;
+
         // Peer gateways in the mesh, keyed by GatewayInfo.makeKey().
         // These are the connections where we act as the client to the peer gateway.
         std::map<std::string, MeshGatewayConnection> m_meshGatewayConnections_WeAreTheClient;
@@ -116,8 +363,48 @@ namespace MessagingMesh
         // These are the connections where we act as the server to the peer gateway.
         std::unordered_map<uint64_t, SocketPtr> m_meshGatewayConnections_WeAreTheServer;
 
+        // Works out the subscription patterns we advertise to mesh peers...
+        MeshInterestAggregator m_meshInterest;
+
         // Message stats...
         ServiceStats m_serviceStats;
+
+        // Sockets which have disconnected, held until their subscriptions have been removed...
+        std::vector<SocketPtr> m_disconnectedSockets;
+
+        // Output queue drops for client sockets which have disconnected (added to the stats for current clients)...
+        ServiceStats::OutputQueueStats m_disconnectedOutputQueueStats;
+
+        // Interest graph shared by the shards of a sharded service (nullptr if the service is not sharded)...
+        std::unique_ptr<SnapshotSubjectMatchingEngine> m_pShardedSubjectMatchingEngine;
+
+        // Shards of a sharded service (empty if the service is not sharded). The first shard uses our UV loop.
+        // Note: These are declared after the engine, so that they (and their readers) are destroyed first.
+        std::vector<std::unique_ptr<ServiceShard>> m_shards;
+
+        // The shard to which we give the next client socket...
+        size_t m_nextShardIndex = 0;
+
+        // IO loops of a pipelined service (empty if the service is not pipelined). A client socket
+        // is on the IO loop given by its socket ID, modulo the number of loops.
+        std::vector<std::unique_ptr<ServiceIOLoop>> m_ioLoops;
+
+    // Constants...
+    private:
+        // Name of the (unique) event which processes disconnected sockets...
+        static constexpr const char* PROCESS_DISCONNECTIONS_EVENT = "PROCESS_DISCONNECTIONS";
+
+        // Name of the (unique) event which reports stats...
+        static constexpr const char* STATS_TIMER_EVENT = "STATS_TIMER";
+
+        // Name of the (unique) event which publishes subscription changes to the shards...
+        static constexpr const char* PUBLISH_SUBSCRIPTIONS_EVENT = "PUBLISH_SUBSCRIPTIONS";
+
+        // Subject of the advisory sent to clients when data written to them has been dropped...
+        static constexpr const char* SLOW_CONSUMER_ADVISORY_SUBJECT = "_MM.ADVISORY.SLOW_CONSUMER";
+
+        // Messages of this size or more are written to subscribers with bulk priority...
+        static constexpr size_t BULK_MESSAGE_BYTES = 64 * 1024;
     };
 } // namespace
 
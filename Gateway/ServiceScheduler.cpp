@@ -0,0 +1,155 @@
+#include "ServiceScheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <Exception.h>
+#include <Logger.h>
+#include <UVLoop.h>
+#include <UVUtils.h>
+#include "MeshManager.h"
+#include "ServiceManager.h"
+using namespace MessagingMesh;
+
+// Constructor.
+ServiceScheduler::ServiceScheduler(UVLoopPtr pGatewayUVLoop, const MeshManager& meshManager) :
+    m_pGatewayUVLoop(pGatewayUVLoop),
+    m_meshManager(meshManager)
+{
+}
+
+// Destructor.
+ServiceScheduler::~ServiceScheduler()
+{
+}
+
+// Adds a service, returning the loop on which it should run.
+// Called on the GATEWAY thread.
+UVLoopPtr ServiceScheduler::addService(ServiceManager& serviceManager)
+{
+    // We start the rebalance timer when the first service is added...
+    if (m_services.empty())
+    {
+        m_lastRebalanceTime = std::chrono::steady_clock::now();
+        UVUtils::runSingleShotTimer(m_pGatewayUVLoop, REBALANCE_INTERVAL_MS, [this]() { onRebalanceTimer(); });
+    }
+
+    // Until the pool is full, each service gets a loop of its own...
+    UVLoopPtr pUVLoop;
+    if (m_loops.size() < m_meshManager.getServiceLoopCount())
+    {
+        pUVLoop = UVLoop::create(std::format("SERVICES/{}", m_loops.size()), UVLoop::Temperature::COLD);
+        m_loops.push_back(pUVLoop);
+    }
+    else
+    {
+        // We choose the loop with the least load, and then with the fewest services...
+        std::vector<std::pair<double, size_t>> loopLoads(m_loops.size());
+        for (const auto& service : m_services)
+        {
+            auto& loopLoad = loopLoads[getLoopIndex(service.pServiceManager->getUVLoop())];
+            loopLoad.first += service.Load;
+            loopLoad.second++;
+        }
+        auto loopIndex = std::min_element(loopLoads.begin(), loopLoads.end()) - loopLoads.begin();
+        pUVLoop = m_loops[loopIndex];
+    }
+
+    m_services.push_back({ &serviceManager, 0.0, std::chrono::steady_clock::now() });
+    Logger::info(std::format("Running service {} on loop {}", serviceManager.getServiceName(), pUVLoop->getName()));
+    return pUVLoop;
+}
+
+// Chooses a service to move from the busiest loop to the idlest one, or returns nullopt if the loops are balanced well enough.
+std::optional<ServiceScheduler::Move> ServiceScheduler::chooseMove(const std::vector<ServiceLoad>& serviceLoads, size_t loopCount)
+{
+    if (loopCount < 2)
+    {
+        return std::nullopt;
+    }
+
+    // We total the load on each loop, and find the busiest and idlest loops...
+    std::vector<double> loopLoads(loopCount, 0.0);
+    for (const auto& serviceLoad : serviceLoads)
+    {
+        loopLoads[serviceLoad.LoopIndex] += serviceLoad.Load;
+    }
+    auto busiestLoopIndex = static_cast<size_t>(std::max_element(loopLoads.begin(), loopLoads.end()) - loopLoads.begin());
+    auto idlestLoopIndex = static_cast<size_t>(std::min_element(loopLoads.begin(), loopLoads.end()) - loopLoads.begin());
+    if (loopLoads[busiestLoopIndex] < MIN_BUSY_LOAD)
+    {
+        return std::nullopt;
+    }
+
+    // Moving a service with load L from the busiest loop to the idlest changes the gap between
+    // them from G to |G - 2L|. We choose the service which leaves the smallest gap, as long as
+    // this narrows the gap by enough to be worth the move...
+    auto gap = loopLoads[busiestLoopIndex] - loopLoads[idlestLoopIndex];
+    std::optional<Move> move;
+    auto bestGap = gap - MIN_IMPROVEMENT;
+    for (size_t i = 0; i < serviceLoads.size(); ++i)
+    {
+        const auto& serviceLoad = serviceLoads[i];
+        if (serviceLoad.LoopIndex != busiestLoopIndex || !serviceLoad.CanMove)
+        {
+            continue;
+        }
+        auto newGap = std::abs(gap - 2.0 * serviceLoad.Load);
+        if (newGap <= bestGap)
+        {
+            move = Move(i, idlestLoopIndex);
+            bestGap = newGap;
+        }
+    }
+    return move;
+}
+
+// Called when the rebalance timer ticks.
+void ServiceScheduler::onRebalanceTimer()
+{
+    try
+    {
+        // We measure the load of each service since the last tick...
+        auto now = std::chrono::steady_clock::now();
+        auto elapsedNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_lastRebalanceTime).count();
+        m_lastRebalanceTime = now;
+        std::vector<ServiceLoad> serviceLoads;
+        serviceLoads.reserve(m_services.size());
+        for (auto& service : m_services)
+        {
+            auto load = elapsedNanoseconds ? static_cast<double>(service.pServiceManager->takeBusyNanoseconds()) / elapsedNanoseconds : 0.0;
+            service.Load = LOAD_SMOOTHING * load + (1.0 - LOAD_SMOOTHING) * service.Load;
+            serviceLoads.push_back({ getLoopIndex(service.pServiceManager->getUVLoop()), service.Load, now - service.MovedTime >= MOVE_COOLDOWN });
+        }
+
+        // We move a service if the loops are out of balance...
+        auto move = chooseMove(serviceLoads, m_loops.size());
+        if (move)
+        {
+            auto& service = m_services[move->first];
+            const auto& pUVLoop = m_loops[move->second];
+            Logger::info(std::format("Moving service {} (load {:.2f}) from loop {} to loop {}",
+                service.pServiceManager->getServiceName(), service.Load, m_loops[serviceLoads[move->first].LoopIndex]->getName(), pUVLoop->getName()));
+            service.MovedTime = now;
+            service.pServiceManager->moveToLoop(pUVLoop);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+
+    // We schedule the next rebalance even if this one failed, so that one error does not stop
+    // rebalancing for the life of the gateway...
+    UVUtils::runSingleShotTimer(m_pGatewayUVLoop, REBALANCE_INTERVAL_MS, [this]() { onRebalanceTimer(); });
+}
+
+// Gets the index of the loop in the pool.
+size_t ServiceScheduler::getLoopIndex(const UVLoopPtr& pUVLoop) const
+{
+    auto it = std::find(m_loops.begin(), m_loops.end(), pUVLoop);
+    if (it == m_loops.end())
+    {
+        throw Exception(std::format("Loop {} is not in the service loop pool", pUVLoop->getName()));
+    }
+    return it - m_loops.begin();
+}
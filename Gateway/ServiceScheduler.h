@@ -0,0 +1,140 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <SharedAliases.h>
+
+namespace MessagingMesh
+{
+    // Forward declarations...
+    class ServiceManager;
+    class MeshManager;
+
+    /// <summary>
+    /// Places services onto a fixed pool of UV loops, and moves them between loops to balance
+    /// the load.
+    ///
+    /// Loop pool
+    /// ---------
+    /// A gateway may host hundreds of small services. Running each one on its own thread wastes
+    /// memory and makes the threads fight over the cores, so services share a pool of loops. The
+    /// size of the pool is set by ServiceLoops in gateway-config.json, and defaults to the number
+    /// of cores. Loops are created as they are needed: until the pool is full each new service gets
+    /// a loop of its own, and after that it goes on the least loaded loop.
+    ///
+    /// Sharded services (see ServiceManager) have loops of their own and are not in the pool.
+    ///
+    /// Load
+    /// ----
+    /// Each service measures the time it spends processing updates. Every REBALANCE_INTERVAL_MS we
+    /// take these times and work out the load of each service as the proportion of the interval it
+    /// was busy, smoothed over a few intervals. The load of a loop is the total for its services.
+    ///
+    /// Rebalancing
+    /// -----------
+    /// If the busiest loop is busy enough, and is much busier than the idlest loop, we move one
+    /// service from the busiest loop to the idlest. We choose the service which leaves the two
+    /// loops most evenly balanced. Moving a service moves all its sockets (with Socket::moveToLoop)
+    /// so this is not free. To avoid services bouncing between loops:
+    /// - We move at most one service per interval.
+    /// - We only move a service if this narrows the gap between the loops by MIN_IMPROVEMENT.
+    /// - A service is not moved again until MOVE_COOLDOWN has passed.
+    ///
+    /// The scheduler runs on the GATEWAY loop.
+    /// </summary>
+    class ServiceScheduler
+    {
+    // Public types...
+    public:
+        // The load of a service, and the loop it is running on.
+        struct ServiceLoad
+        {
+            // The index of the loop in the pool...
+            size_t LoopIndex = 0;
+
+            // The proportion of the time the service is busy...
+            double Load = 0.0;
+
+            // True if the service can be moved (ie, it has not been moved recently)...
+            bool CanMove = true;
+        };
+
+        // A service to move (by its index in the loads provided) and the index of the loop to move it to.
+        using Move = std::pair<size_t, size_t>;
+
+    // Public methods...
+    public:
+        // Constructor.
+        ServiceScheduler(UVLoopPtr pGatewayUVLoop, const MeshManager& meshManager);
+
+        // Destructor.
+        ~ServiceScheduler();
+
+        // Adds a service, returning the loop on which it should run.
+        // Called on the GATEWAY thread.
+        UVLoopPtr addService(ServiceManager& serviceManager);
+
+        // Chooses a service to move from the busiest loop to the idlest one, or returns nullopt if the loops are balanced well enough.
+        static std::optional<Move> chooseMove(const std::vector<ServiceLoad>& serviceLoads, size_t loopCount);
+
+    // Private types...
+    private:
+        // A service in the pool.
+        struct ServiceInfo
+        {
+            // The service...
+            ServiceManager* pServiceManager = nullptr;
+
+            // The smoothed load of the service...
+            double Load = 0.0;
+
+            // When the service was added or last moved...
+            std::chrono::steady_clock::time_point MovedTime;
+        };
+
+    // Private functions...
+    private:
+        // Called when the rebalance timer ticks.
+        void onRebalanceTimer();
+
+        // Gets the index of the loop in the pool.
+        size_t getLoopIndex(const UVLoopPtr& pUVLoop) const;
+
+    // Private data...
+    private:
+        // The GATEWAY loop, on which we run...
+        UVLoopPtr m_pGatewayUVLoop;
+
+        // Gives us the service-loop config...
+        const MeshManager& m_meshManager;
+
+        // The loops in the pool...
+        std::vector<UVLoopPtr> m_loops;
+
+        // The services in the pool...
+        std::vector<ServiceInfo> m_services;
+
+        // When we last measured the services' loads...
+        std::chrono::steady_clock::time_point m_lastRebalanceTime;
+
+    // Constants...
+    private:
+        // How often we measure loads and rebalance...
+        static constexpr int REBALANCE_INTERVAL_MS = 5000;
+
+        // The weight given to the latest load measurement when smoothing...
+        static constexpr double LOAD_SMOOTHING = 0.5;
+
+        // We only rebalance when the busiest loop has at least this load...
+        static constexpr double MIN_BUSY_LOAD = 0.5;
+
+        // We only move a service if this narrows the gap between the busiest and idlest loops by at least this much...
+        static constexpr double MIN_IMPROVEMENT = 0.1;
+
+        // The time after a service is added or moved before it can be moved (again)...
+        static constexpr std::chrono::seconds MOVE_COOLDOWN{ 30 };
+    };
+} // namespace
+
@@ -0,0 +1,195 @@
+#include "ServiceShard.h"
+#include <algorithm>
+#include <format>
+#include <Buffer.h>
+#include <Logger.h>
+#include <NetworkMessage.h>
+#include "CreditGuard.h"
+#include "Gateway.h"
+#include "ServiceManager.h"
+#include "SubscriptionInfo.h"
+using namespace MessagingMesh;
+
+// Constructor.
+ServiceShard::ServiceShard(ServiceManager& serviceManager, UVLoopPtr pUVLoop, SnapshotSubjectMatchingEngine& subjectMatchingEngine, const std::vector<std::string>& conflatedSubjects, LastValueCache& lastValueCache, const InboxRouter& inboxRouter) :
+    m_serviceManager(serviceManager),
+    m_pUVLoop(pUVLoop),
+    m_subjectMatchingEngine(subjectMatchingEngine),
+    m_pReader(subjectMatchingEngine.createReader()),
+    m_conflatedSubjects(conflatedSubjects),
+    m_lastValueCache(lastValueCache),
+    m_inboxRouter(inboxRouter),
+    m_serviceStats(serviceManager.getServiceName(), serviceManager.getGateway().getGatewayName())
+{
+}
+
+// Destructor.
+ServiceShard::~ServiceShard()
+{
+}
+
+// Routes a SEND_MESSAGE message.
+// Called on the shard's UV loop.
+void ServiceShard::onMessage(const NetworkMessageHeader& header, Socket* pSocket, BufferPtr pBuffer)
+{
+    // Messages to direct inboxes go straight to the client, or the peer gateway, which owns the
+    // inbox. Other messages go to the clients and peers subscribed to them...
+    auto& subject = header.getSubject();
+    InboxRouter::Destination destination;
+    if (m_inboxRouter.findDestination(subject, destination))
+    {
+        sendToInbox(destination, pSocket, pBuffer);
+    }
+    else
+    {
+        routeToSubscribers(subject, pSocket, pBuffer);
+    }
+
+    // We add the message to the stats if came from a client (non-peer). (The client is granted
+    // credit for it by the CreditGuard for the update.)
+    if (pSocket->getIsMeshPeer() == false)
+    {
+        m_serviceStats.add(subject, pBuffer->getBufferSize());
+    }
+}
+
+// Sends a message to a direct inbox, with the same rules as ServiceManager::sendToInbox().
+void ServiceShard::sendToInbox(const InboxRouter::Destination& destination, Socket* pSocket, const BufferPtr& pBuffer)
+{
+    if (destination.pSocket)
+    {
+        destination.pSocket->write(pBuffer, destination.SubscriptionID, 0, Socket::WritePriority::CONTROL);
+    }
+    else if (destination.pPeer && pSocket->getIsMeshPeer() == false)
+    {
+        destination.pPeer->relay(pBuffer, Socket::WritePriority::CONTROL);
+    }
+}
+
+// Sends a message to the clients and mesh peers subscribed to its subject.
+void ServiceShard::routeToSubscribers(const std::string& subject, Socket* pSocket, const BufferPtr& pBuffer)
+{
+    // We hold the message as the latest value for its subject, if the service caches it. (We do
+    // this before matching, so a subscriber we do not match yet gets it from the cache.)
+    m_lastValueCache.update(subject, pBuffer);
+
+    // We find the clients which have subscriptions to the message subject...
+    auto subscriptionInfos = m_subjectMatchingEngine.getMatchingSubscriptionInfos(subject, *m_pReader);
+
+    // We send the update to each 'target' matching the subscription, with the same rules as
+    // ServiceManager::onMessage(). Messages are only forwarded to mesh peers if they came from
+    // a non-mesh client, and only once to each peer. Messages to clients on conflated subjects
+    // are conflated. Messages are written with the priority for their subject and size...
+    auto conflationKey = m_conflatedSubjects.getConflationKey(subject);
+    auto priority = ServiceManager::getWritePriority(subject, pBuffer->getBufferSize());
+    m_meshPeersSent.clear();
+    for (const auto& subscriptionInfo : subscriptionInfos)
+    {
+        auto pTargetSocket = subscriptionInfo.getSocket();
+        if (pTargetSocket->getIsMeshPeer())
+        {
+            if (pSocket->getIsMeshPeer()
+                ||
+                std::find(m_meshPeersSent.begin(), m_meshPeersSent.end(), pTargetSocket) != m_meshPeersSent.end())
+            {
+                continue;
+            }
+            m_meshPeersSent.push_back(pTargetSocket);
+            pTargetSocket->write(pBuffer, subscriptionInfo.getSubscriptionID(), 0, priority);
+            continue;
+        }
+        pTargetSocket->write(pBuffer, subscriptionInfo.getSubscriptionID(), conflationKey, priority);
+    }
+}
+
+// Sends the cached values for the subjects a new subscription matches to one of our client sockets.
+// Called on the service's UV loop.
+void ServiceShard::sendCachedValues(Socket* pSocket, const std::string& pattern, uint32_t subscriptionID)
+{
+    // We read the cache on our loop, when we run the event, so that the values are at least as
+    // new as any message we have already routed to the client...
+    auto pSocketPtr = pSocket->shared_from_this();
+    m_pUVLoop->marshallEvent(
+        [this, pSocketPtr, pattern, subscriptionID](uv_loop_t* /*pLoop*/)
+        {
+            pSocketPtr->writeBatch(m_lastValueCache.getMatches(pattern), subscriptionID);
+        }
+    );
+}
+
+// Adds the message stats collected by the shard to the stats provided, and resets them.
+// Called on the shard's UV loop.
+void ServiceShard::collectStats(ServiceStats& serviceStats)
+{
+    serviceStats.takeMessageStats(m_serviceStats);
+}
+
+// Called when data has been received on the socket.
+// Called on the shard's UV loop.
+void ServiceShard::onDataReceived(Socket* pSocket, BufferPtr pBuffer)
+{
+    // We grant the client credit for messages once we have processed them, even if that fails...
+    CreditGuard creditGuard(pSocket, pBuffer);
+    try
+    {
+        // We route messages on our loop. Other updates are processed by the service manager...
+        NetworkMessage networkMessage;
+        networkMessage.deserializeHeader(*pBuffer);
+        auto& header = networkMessage.getHeader();
+        creditGuard.setAction(header.getAction());
+        if (header.getAction() == NetworkMessageHeader::Action::SEND_MESSAGE)
+        {
+            onMessage(header, pSocket, pBuffer);
+        }
+        else
+        {
+            m_serviceManager.marshallUpdate(pSocket, pBuffer);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
+
+// Called when the connection status has changed.
+void ServiceShard::onConnectionStatusChanged(Socket* pSocket, Socket::ConnectionStatus connectionStatus, const std::string& /*message*/)
+{
+    try
+    {
+        if (connectionStatus == Socket::ConnectionStatus::DISCONNECTED)
+        {
+            m_serviceManager.marshallDisconnection(pSocket);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
+
+// Called when the movement of the socket to a new UV loop has been completed.
+void ServiceShard::onMoveToLoopComplete(Socket* pSocket)
+{
+    try
+    {
+        m_serviceManager.sendAck(pSocket);
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
+
+// Called when data written to the socket has been dropped (or conflated) as the output queue is full.
+void ServiceShard::onOutputQueueDrops(Socket* pSocket)
+{
+    try
+    {
+        ServiceManager::sendSlowConsumerAdvisory(pSocket);
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
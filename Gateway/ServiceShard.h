@@ -0,0 +1,144 @@
+#pragma once
+#include <vector>
+#include <SharedAliases.h>
+#include <Socket.h>
+#include "SnapshotSubjectMatchingEngine.h"
+#include "ConflatedSubjects.h"
+#include "LastValueCache.h"
+#include "InboxRouter.h"
+#include "ServiceStats.h"
+
+namespace MessagingMesh
+{
+    // Forward declarations...
+    class ServiceManager;
+    class NetworkMessageHeader;
+
+    /// <summary>
+    /// Routes messages for one of the UV loops of a sharded service.
+    ///
+    /// A sharded service spreads its client sockets across several UV loops (see ServiceManager).
+    /// Each shard is the callback for the client sockets on its loop.
+    ///
+    /// Routing
+    /// -------
+    /// Messages sent by the shard's clients are routed on the shard's loop. We match the subject
+    /// against the service's SnapshotSubjectMatchingEngine, which is shared by all the shards and
+    /// can be read from any number of threads without locking. We then write the message to each
+    /// matching socket. Socket::write() queues the data and marshalls the write to the loop which
+    /// owns the socket, so fan-out writes run on the target socket's loop rather than ours.
+    ///
+    /// Other updates (SUBSCRIBE, UNSUBSCRIBE, DISCONNECT and so on) change the state of the service,
+    /// so they are passed to the ServiceManager to be processed on the service's own loop.
+    ///
+    /// Ordering
+    /// --------
+    /// All messages from one client are routed on its shard's loop, in the order in which they
+    /// were received, and each socket's write queue is first-in first-out. So each subscriber
+    /// receives the messages from a publisher in the order they were sent.
+    ///
+    /// Mesh peers
+    /// ----------
+    /// The snapshot engine does not deduplicate matches for mesh peers, so we do this as we route.
+    /// There are only a few mesh peers, so we keep the peers we have sent each message to in a
+    /// small vector.
+    ///
+    /// Last-value cache
+    /// ----------------
+    /// The shards update the service's LastValueCache (which is locked) as they route. When one
+    /// of our clients subscribes, the ServiceManager asks us to send it the cached values. We
+    /// read them and write them on our loop, so they are queued to the client ahead of any
+    /// message for the new subscription which we route after them.
+    ///
+    /// Direct inboxes
+    /// --------------
+    /// Messages to direct inboxes are sent to the client, or peer gateway, which owns the inbox,
+    /// as found by the service's InboxRouter (which is locked), rather than being matched.
+    ///
+    /// Stats
+    /// -----
+    /// Each shard collects its own message stats, so that routing does not lock. The ServiceManager
+    /// collects them from each shard (on the shard's loop) when it reports stats.
+    /// </summary>
+    class ServiceShard : public Socket::ICallback
+    {
+    // Public methods...
+    public:
+        // Constructor.
+        ServiceShard(ServiceManager& serviceManager, UVLoopPtr pUVLoop, SnapshotSubjectMatchingEngine& subjectMatchingEngine, const std::vector<std::string>& conflatedSubjects, LastValueCache& lastValueCache, const InboxRouter& inboxRouter);
+
+        // Destructor.
+        ~ServiceShard();
+
+        // Gets the UV loop on which the shard routes messages.
+        const UVLoopPtr& getUVLoop() const { return m_pUVLoop; }
+
+        // Routes a SEND_MESSAGE message.
+        // Called on the shard's UV loop.
+        void onMessage(const NetworkMessageHeader& header, Socket* pSocket, BufferPtr pBuffer);
+
+        // Sends the cached values for the subjects a new subscription matches to one of our client sockets.
+        // Called on the service's UV loop.
+        void sendCachedValues(Socket* pSocket, const std::string& pattern, uint32_t subscriptionID);
+
+        // Adds the message stats collected by the shard to the stats provided, and resets them.
+        // Called on the shard's UV loop.
+        void collectStats(ServiceStats& serviceStats);
+
+    // Socket::ICallback implementation...
+    private:
+        // Called when a new client connection has been made to a listening socket.
+        void onNewConnection(SocketPtr /*pClientSocket*/) {}
+
+        // Called when data has been received on the socket.
+        // Called on the shard's UV loop.
+        void onDataReceived(Socket* pSocket, BufferPtr pBuffer);
+
+        // Called when the connection status has changed.
+        void onConnectionStatusChanged(Socket* pSocket, Socket::ConnectionStatus connectionStatus, const std::string& message);
+
+        // Called when the movement of the socket to a new UV loop has been completed.
+        void onMoveToLoopComplete(Socket* pSocket);
+
+        // Called when data written to the socket has been dropped (or conflated) as the output queue is full.
+        void onOutputQueueDrops(Socket* pSocket);
+
+    // Private functions...
+    private:
+        // Sends a message to a direct inbox.
+        void sendToInbox(const InboxRouter::Destination& destination, Socket* pSocket, const BufferPtr& pBuffer);
+
+        // Sends a message to the clients and mesh peers subscribed to its subject.
+        void routeToSubscribers(const std::string& subject, Socket* pSocket, const BufferPtr& pBuffer);
+
+    // Private data...
+    private:
+        // The service manager for the service...
+        ServiceManager& m_serviceManager;
+
+        // The UV loop on which we route messages...
+        UVLoopPtr m_pUVLoop;
+
+        // The service's interest graph, shared by all shards...
+        SnapshotSubjectMatchingEngine& m_subjectMatchingEngine;
+
+        // Our reader for the interest graph...
+        SnapshotSubjectMatchingEngine::ReaderPtr m_pReader;
+
+        // Mesh peers to which we have sent the message being routed (reused between messages)...
+        std::vector<Socket*> m_meshPeersSent;
+
+        // Subjects whose messages are conflated in the clients' output queues...
+        ConflatedSubjects m_conflatedSubjects;
+
+        // The latest values of cached subjects, shared by all shards...
+        LastValueCache& m_lastValueCache;
+
+        // Routes messages to direct inboxes, shared by all shards...
+        const InboxRouter& m_inboxRouter;
+
+        // Stats for messages routed by the shard...
+        ServiceStats m_serviceStats;
+    };
+} // namespace
+
@@ -33,6 +33,21 @@ void ServiceStats::add(const std::string& subject, size_t messageSizeBytes)
     subjectStats.BytesProcessed += messageSizeBytes;
 }
 
+// Adds the message stats collected by another ServiceStats to ours, and resets them in the other stats.
+// (Used to collect stats from the shards of a sharded service.)
+void ServiceStats::takeMessageStats(ServiceStats& other)
+{
+    m_total.MessagesProcessed += other.m_total.MessagesProcessed;
+    m_total.BytesProcessed += other.m_total.BytesProcessed;
+    for (const auto& [subject, otherStats] : other.m_statsPerSubject)
+    {
+        auto& subjectStats = m_statsPerSubject[subject];
+        subjectStats.MessagesProcessed += otherStats.MessagesProcessed;
+        subjectStats.BytesProcessed += otherStats.BytesProcessed;
+    }
+    other.reset();
+}
+
 // Gets a stats snapshot (and resets the stats).
 ServiceStats::StatsSnapshot ServiceStats::getSnapshot()
 {
@@ -62,6 +77,12 @@ ServiceStats::StatsSnapshot ServiceStats::getSnapshot()
         15,
         [](const auto& a, const auto& b) {return a.second.BytesProcessed > b.second.BytesProcessed;});
 
+    // Interest graph...
+    snapshot.InterestGraph = m_interestGraphStats;
+
+    // Output queues...
+    snapshot.OutputQueues = m_outputQueueStats;
+
     // We reset the counters and return the stats...
     reset();
     return snapshot;
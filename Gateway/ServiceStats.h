@@ -1,3 +1,4 @@
+#include <array>
 #include <cstdint>
 #include <chrono>
 #include <string>
@@ -25,6 +26,43 @@ namespace MessagingMesh
         };
         using VecStats = std::vector<Stats>;
 
+        // Interest graph stats from the service's subject-matching engine, used by the Snapshot (below).
+        struct InterestGraphStats
+        {
+            uint64_t Subscriptions = 0;
+            uint64_t Nodes = 0;
+            uint64_t Tokens = 0;
+            uint64_t CachedSubjects = 0;
+            uint64_t CacheHits = 0;
+            uint64_t CacheMisses = 0;
+            uint64_t FastPathMatches = 0;
+            uint64_t GraphWalks = 0;
+            uint64_t MemoryBytes = 0;
+            double BytesPerSubscription = 0.0;
+        };
+
+        // The data queued in one priority class of the output queues.
+        struct QueueDepth
+        {
+            uint64_t Messages = 0;
+            uint64_t Bytes = 0;
+        };
+
+        // Output queue stats for the service's client sockets, used by the Snapshot (below).
+        // The dropped counts are totals since the service started; the queued counts are the data queued now.
+        struct OutputQueueStats
+        {
+            uint64_t DroppedMessages = 0;
+            uint64_t DroppedBytes = 0;
+            uint64_t ConflatedMessages = 0;
+            uint64_t SlowConsumerDisconnections = 0;
+            uint64_t QueuedMessages = 0;
+            uint64_t QueuedBytes = 0;
+
+            // The data queued now in each priority class, indexed by Socket::WritePriority...
+            std::array<QueueDepth, 3> QueuedByPriority;
+        };
+
         // Snapshot calculated every N seconds.
         struct StatsSnapshot 
         {
@@ -34,6 +72,8 @@ namespace MessagingMesh
             Stats Total;
             VecStats TopSubjects_MessagesPerSecond;
             VecStats TopSubjects_MegaBitsPerSecond;
+            InterestGraphStats InterestGraph;
+            OutputQueueStats OutputQueues;
         };
 
     // Public methods...
@@ -47,6 +87,16 @@ namespace MessagingMesh
         // Adds a message to the stats.
         void add(const std::string& subject, size_t messageSizeBytes);
 
+        // Adds the message stats collected by another ServiceStats to ours, and resets them in the other stats.
+        // (Used to collect stats from the shards of a sharded service.)
+        void takeMessageStats(ServiceStats& other);
+
+        // Sets the interest graph stats to include in the next snapshot.
+        void setInterestGraphStats(const InterestGraphStats& interestGraphStats) { m_interestGraphStats = interestGraphStats; }
+
+        // Sets the output queue stats to include in the next snapshot.
+        void setOutputQueueStats(const OutputQueueStats& outputQueueStats) { m_outputQueueStats = outputQueueStats; }
+
         // Gets a stats snapshot (and resets the stats).
         StatsSnapshot getSnapshot();
 
@@ -90,6 +140,12 @@ namespace MessagingMesh
 
         // Stats per subject for the current time period...
         std::unordered_map<std::string, InternalStats> m_statsPerSubject;
+
+        // Interest graph stats (set by the service manager)...
+        InterestGraphStats m_interestGraphStats;
+
+        // Output queue stats (set by the service manager)...
+        OutputQueueStats m_outputQueueStats;
     };
 
     // Serialize Stats struct to JSON.
@@ -105,6 +161,53 @@ namespace MessagingMesh
         };
     }
 
+    // Serialize InterestGraphStats struct to JSON.
+    template<typename JSONType>
+    inline void to_json(JSONType& j, const ServiceStats::InterestGraphStats& stats)
+    {
+        j = JSONType{
+            {"Subscriptions", stats.Subscriptions},
+            {"Nodes", stats.Nodes},
+            {"Tokens", stats.Tokens},
+            {"CachedSubjects", stats.CachedSubjects},
+            {"CacheHits", stats.CacheHits},
+            {"CacheMisses", stats.CacheMisses},
+            {"FastPathMatches", stats.FastPathMatches},
+            {"GraphWalks", stats.GraphWalks},
+            {"MemoryBytes", stats.MemoryBytes},
+            {"BytesPerSubscription", stats.BytesPerSubscription}
+        };
+    }
+
+    // Serialize QueueDepth struct to JSON.
+    template<typename JSONType>
+    inline void to_json(JSONType& j, const ServiceStats::QueueDepth& queueDepth)
+    {
+        j = JSONType{
+            {"Messages", queueDepth.Messages},
+            {"Bytes", queueDepth.Bytes}
+        };
+    }
+
+    // Serialize OutputQueueStats struct to JSON.
+    template<typename JSONType>
+    inline void to_json(JSONType& j, const ServiceStats::OutputQueueStats& stats)
+    {
+        j = JSONType{
+            {"DroppedMessages", stats.DroppedMessages},
+            {"DroppedBytes", stats.DroppedBytes},
+            {"ConflatedMessages", stats.ConflatedMessages},
+            {"SlowConsumerDisconnections", stats.SlowConsumerDisconnections},
+            {"QueuedMessages", stats.QueuedMessages},
+            {"QueuedBytes", stats.QueuedBytes},
+            {"QueuedByPriority", {
+                {"Control", stats.QueuedByPriority[0]},
+                {"Normal", stats.QueuedByPriority[1]},
+                {"Bulk", stats.QueuedByPriority[2]}
+            }}
+        };
+    }
+
     // Serialize StatsSnapshot struct to JSON.
     template<typename JSONType>
     inline void to_json(JSONType& j, const ServiceStats::StatsSnapshot& snapshot)
@@ -115,7 +218,9 @@ namespace MessagingMesh
             {"DurationSeconds", snapshot.DurationSeconds},
             {"Total", snapshot.Total},
             {"TopSubjects_MessagesPerSecond", snapshot.TopSubjects_MessagesPerSecond},
-            {"TopSubjects_MegaBitsPerSecond", snapshot.TopSubjects_MegaBitsPerSecond}
+            {"TopSubjects_MegaBitsPerSecond", snapshot.TopSubjects_MegaBitsPerSecond},
+            {"InterestGraph", snapshot.InterestGraph},
+            {"OutputQueues", snapshot.OutputQueues}
         };
     }
 
@@ -0,0 +1,103 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// A pool of objects of type T, allocated in slabs of OBJECTS_PER_SLAB objects.
+    ///
+    /// Used for nodes in the interest graph, so that the nodes for one engine are
+    /// allocated close together and nodes which are released are reused by the next
+    /// create() rather than going back to the general heap.
+    ///
+    /// Released objects are held in an intrusive free list (stored in the object's own
+    /// slot), so create() and release() are O(1) and do not allocate except when a new
+    /// slab is needed.
+    ///
+    /// The pool is not thread-safe. (Each engine is only used from its service's UV loop.)
+    ///
+    /// NOTE: Objects must be released before the pool is destroyed. The pool frees the
+    ///       memory for its slabs but does not call destructors of live objects.
+    /// </summary>
+    template<typename T, size_t OBJECTS_PER_SLAB = 256>
+    class SlabPool
+    {
+    // Public methods...
+    public:
+        // Constructor.
+        SlabPool() {}
+
+        // The pool cannot be copied...
+        SlabPool(const SlabPool&) = delete;
+        SlabPool& operator=(const SlabPool&) = delete;
+
+        // Creates an object in the pool, constructed with the arguments provided.
+        template<typename... Args>
+        T* create(Args&&... args)
+        {
+            if (!m_pFreeList)
+            {
+                addSlab();
+            }
+            auto pSlot = m_pFreeList;
+            m_pFreeList = pSlot->pNextFree;
+            ++m_liveCount;
+            return new (pSlot->Storage) T(std::forward<Args>(args)...);
+        }
+
+        // Destroys the object and returns its memory to the pool.
+        void release(T* pObject)
+        {
+            pObject->~T();
+            auto pSlot = reinterpret_cast<Slot*>(pObject);
+            pSlot->pNextFree = m_pFreeList;
+            m_pFreeList = pSlot;
+            --m_liveCount;
+        }
+
+        // Gets the number of live (created and not released) objects.
+        size_t getLiveCount() const { return m_liveCount; }
+
+        // Gets the number of objects the pool can hold without allocating another slab.
+        size_t getCapacity() const { return m_slabs.size() * OBJECTS_PER_SLAB; }
+
+    // Private types...
+    private:
+        // Storage for one object, or a link in the free list when the object is not in use.
+        union Slot
+        {
+            Slot* pNextFree;
+            alignas(T) std::byte Storage[sizeof(T)];
+        };
+
+    // Private functions...
+    private:
+        // Allocates a new slab and adds its slots to the free list.
+        void addSlab()
+        {
+            auto pSlab = std::make_unique<Slot[]>(OBJECTS_PER_SLAB);
+            for (size_t i = OBJECTS_PER_SLAB; i > 0; --i)
+            {
+                pSlab[i - 1].pNextFree = m_pFreeList;
+                m_pFreeList = &pSlab[i - 1];
+            }
+            m_slabs.push_back(std::move(pSlab));
+        }
+
+    // Private data...
+    private:
+        // The slabs...
+        std::vector<std::unique_ptr<Slot[]>> m_slabs;
+
+        // Slots which are not in use...
+        Slot* m_pFreeList = nullptr;
+
+        // The number of live objects...
+        size_t m_liveCount = 0;
+    };
+} // namespace
+
@@ -0,0 +1,434 @@
+#include "SnapshotSubjectMatchingEngine.h"
+#include <algorithm>
+#include <Socket.h>
+using namespace MessagingMesh;
+
+// Constructor.
+SnapshotSubjectMatchingEngine::Reader::Reader(EpochManager& epochManager, uint32_t readerIndex) :
+    m_epochManager(epochManager),
+    m_readerIndex(readerIndex)
+{
+}
+
+// Destructor.
+SnapshotSubjectMatchingEngine::Reader::~Reader()
+{
+    m_epochManager.unregisterReader(m_readerIndex);
+}
+
+// Constructor.
+SnapshotSubjectMatchingEngine::SnapshotSubjectMatchingEngine()
+{
+    // We start with an empty root, published as the first version...
+    m_pPendingRoot = new Node();
+    m_pPublishedRoot.store(m_pPendingRoot);
+    m_nodeCount = 1;
+}
+
+// Destructor.
+SnapshotSubjectMatchingEngine::~SnapshotSubjectMatchingEngine()
+{
+    // There are no readers by now. The pending version holds all nodes except those
+    // which have been replaced, and which are either waiting to be retired or have been
+    // retired to the epoch manager...
+    deleteNodes(m_pPendingRoot);
+    for (auto pNode : m_replacedNodes)
+    {
+        delete pNode;
+    }
+    m_epochManager.reclaimAll();
+}
+
+// Adds a subscription. The change is visible to readers after the next publish().
+// Returns the number of clients registered for this subject.
+size_t SnapshotSubjectMatchingEngine::addSubscription(const std::string& subject, uint32_t subscriptionID, uint64_t clientSocketID, Socket* pClientSocket)
+{
+    std::scoped_lock lock(m_writerMutex);
+
+    // We walk the pending version to the node for the subject, making writable copies of
+    // the nodes on the path and creating nodes where necessary...
+    auto tokens = MMUtils::tokenize(subject, '.');
+    auto pNode = makeWritable(m_pPendingRoot);
+    for (const auto& token : tokens)
+    {
+        auto ppChildNode = getChildSlot(pNode, token, true);
+        pNode = *ppChildNode ? makeWritable(*ppChildNode) : (*ppChildNode = createNode());
+    }
+
+    // We add subscription-info, if the client does not already have a subscription.
+    // Note: We are not expecting more than one subscription from a client
+    //       for the same subject. This is managed in client libraries.
+    auto& subscriptionInfos = pNode->SubscriptionInfos;
+    auto it = std::find_if(subscriptionInfos.begin(), subscriptionInfos.end(), [&](const auto& pair) { return pair.first == clientSocketID; });
+    if (it == subscriptionInfos.end())
+    {
+        subscriptionInfos.push_back({ clientSocketID, SubscriptionInfo(pClientSocket, subscriptionID) });
+        m_clientSubjects[clientSocketID].insert(subject);
+        m_subscriptionCount++;
+    }
+
+    // We returns the number of clients registered for the subject...
+    return subscriptionInfos.size();
+}
+
+// Removes a subscription. The change is visible to readers after the next publish().
+// Returns the number of clients registered for this subject.
+size_t SnapshotSubjectMatchingEngine::removeSubscription(const std::string& subject, uint64_t clientSocketID)
+{
+    std::scoped_lock lock(m_writerMutex);
+
+    // We remove the subject from the client's subjects...
+    auto it = m_clientSubjects.find(clientSocketID);
+    if (it != m_clientSubjects.end())
+    {
+        it->second.erase(subject);
+        if (it->second.empty())
+        {
+            m_clientSubjects.erase(it);
+        }
+    }
+
+    // We remove the subscription...
+    auto tokens = MMUtils::tokenize(subject, '.');
+    return removeSubscription(tokens, clientSocketID);
+}
+
+// Removes all subscriptions for the client specified. The change is visible to readers after the next publish().
+void SnapshotSubjectMatchingEngine::removeAllSubscriptions(uint64_t clientSocketID)
+{
+    std::scoped_lock lock(m_writerMutex);
+
+    // We find the subjects to which the client has subscribed...
+    auto it = m_clientSubjects.find(clientSocketID);
+    if (it == m_clientSubjects.end())
+    {
+        return;
+    }
+    auto subjects = std::move(it->second);
+    m_clientSubjects.erase(it);
+
+    // And remove the client's subscription to each one...
+    for (const auto& subject : subjects)
+    {
+        auto tokens = MMUtils::tokenize(subject, '.');
+        removeSubscription(tokens, clientSocketID);
+    }
+}
+
+// Gets the subjects (including wildcard patterns) to which the client has subscribed (including unpublished changes).
+std::vector<std::string> SnapshotSubjectMatchingEngine::getSubjects(uint64_t clientSocketID)
+{
+    std::scoped_lock lock(m_writerMutex);
+    auto it = m_clientSubjects.find(clientSocketID);
+    if (it == m_clientSubjects.end())
+    {
+        return {};
+    }
+    return std::vector<std::string>(it->second.begin(), it->second.end());
+}
+
+// Publishes changes made since the last publish, so that they are visible to readers.
+void SnapshotSubjectMatchingEngine::publish()
+{
+    std::scoped_lock lock(m_writerMutex);
+
+    // Any change copies the root, so if the root has not changed there is nothing to publish...
+    if (m_pPendingRoot == m_pPublishedRoot.load())
+    {
+        return;
+    }
+
+    // We publish the new version. Its nodes are now shared with readers, so the next
+    // change must copy them again...
+    m_pPublishedRoot.store(m_pPendingRoot);
+    m_writableNodes.clear();
+    m_version++;
+
+    // We retire the nodes which the new version replaced. They are deleted when no
+    // reader can still be walking the previous version...
+    m_epochManager.retire(
+        [replacedNodes = std::move(m_replacedNodes)]()
+        {
+            for (auto pNode : replacedNodes)
+            {
+                delete pNode;
+            }
+        });
+    m_replacedNodes.clear();
+    m_epochManager.reclaim();
+}
+
+// Creates a reader for matching subjects from the calling thread.
+SnapshotSubjectMatchingEngine::ReaderPtr SnapshotSubjectMatchingEngine::createReader()
+{
+    auto readerIndex = m_epochManager.registerReader();
+    return ReaderPtr(new Reader(m_epochManager, readerIndex));
+}
+
+// Returns subscription-infos that match the subject provided, from the current snapshot.
+// Can be called from any number of threads at the same time, each with its own reader.
+// The span returned refers to the reader's scratch vector and is valid until the next
+// call with the same reader.
+std::span<const SubscriptionInfo> SnapshotSubjectMatchingEngine::getMatchingSubscriptionInfos(const std::string& subject, Reader& reader)
+{
+    reader.m_matches.clear();
+    tokenize(subject, reader.m_tokens);
+    if (reader.m_tokens.empty())
+    {
+        return reader.m_matches;
+    }
+
+    // We enter the current epoch before loading the root, so that the nodes in the
+    // snapshot are not reclaimed while we are walking them...
+    EpochManager::Guard guard(m_epochManager, reader.m_readerIndex);
+    const Node* pRoot = m_pPublishedRoot.load();
+    getMatchingSubscriptionInfos(pRoot, reader.m_tokens, 0, reader.m_matches);
+    return reader.m_matches;
+}
+
+// Gets engine statistics.
+SnapshotSubjectMatchingEngine::Stats SnapshotSubjectMatchingEngine::getStats()
+{
+    std::scoped_lock lock(m_writerMutex);
+    Stats stats;
+    stats.SubscriptionCount = m_subscriptionCount;
+    stats.NodeCount = m_nodeCount;
+    stats.Version = m_version;
+    stats.RetiredVersionCount = m_epochManager.getRetiredCount();
+    return stats;
+}
+
+// Removes a subscription. Must be called with the writer mutex held.
+// Returns the number of clients registered for this subject.
+size_t SnapshotSubjectMatchingEngine::removeSubscription(const VecToken& tokens, uint64_t clientSocketID)
+{
+    // We check that the client has a subscription to the subject before copying any nodes...
+    auto pFoundNode = findNode(tokens);
+    if (!pFoundNode)
+    {
+        // There are no subscriptions to the subject...
+        return 0;
+    }
+    const auto& foundSubscriptionInfos = pFoundNode->SubscriptionInfos;
+    auto hasSubscription = std::any_of(foundSubscriptionInfos.begin(), foundSubscriptionInfos.end(), [&](const auto& pair) { return pair.first == clientSocketID; });
+    if (!hasSubscription)
+    {
+        return foundSubscriptionInfos.size();
+    }
+
+    // We walk the path again, making writable copies of the nodes and recording the path...
+    m_path.clear();
+    auto pNode = makeWritable(m_pPendingRoot);
+    for (const auto& token : tokens)
+    {
+        auto pParent = pNode;
+        pNode = makeWritable(*getChildSlot(pParent, token, false));
+        m_path.push_back({ pParent, token, pNode });
+    }
+
+    // We remove the client's subscription...
+    auto& subscriptionInfos = pNode->SubscriptionInfos;
+    std::erase_if(subscriptionInfos, [&](const auto& pair) { return pair.first == clientSocketID; });
+    m_subscriptionCount--;
+    auto clientCount = subscriptionInfos.size();
+
+    // We remove nodes from the end of the path while they are unused...
+    for (auto it = m_path.rbegin(); it != m_path.rend() && it->pNode->isUnused(); ++it)
+    {
+        if (it->Token == WILDCARD_STAR)
+        {
+            it->pParent->pNode_Wildcard_Star = nullptr;
+        }
+        else if (it->Token == WILDCARD_GREATER_THAN)
+        {
+            it->pParent->pNode_Wildcard_GreaterThan = nullptr;
+        }
+        else
+        {
+            it->pParent->Nodes.erase(it->pParent->Nodes.find(it->Token));
+        }
+        releaseNode(it->pNode);
+    }
+
+    // We returns the number of clients registered for the subject...
+    return clientCount;
+}
+
+// Gets the node in the pending version for the subject specified.
+// Returns nullptr if there is no node for the subject.
+const SnapshotSubjectMatchingEngine::Node* SnapshotSubjectMatchingEngine::findNode(const VecToken& tokens) const
+{
+    const Node* pNode = m_pPendingRoot;
+    for (const auto& token : tokens)
+    {
+        if (token == WILDCARD_STAR)
+        {
+            pNode = pNode->pNode_Wildcard_Star;
+        }
+        else if (token == WILDCARD_GREATER_THAN)
+        {
+            pNode = pNode->pNode_Wildcard_GreaterThan;
+        }
+        else
+        {
+            auto it = pNode->Nodes.find(token);
+            pNode = (it != pNode->Nodes.end()) ? it->second : nullptr;
+        }
+        if (!pNode)
+        {
+            return nullptr;
+        }
+    }
+    return pNode;
+}
+
+// Gets the child slot in the parent node for the token, or nullptr if there is no child
+// for a non-wildcard token and create is false.
+SnapshotSubjectMatchingEngine::Node** SnapshotSubjectMatchingEngine::getChildSlot(Node* pParent, std::string_view token, bool create)
+{
+    if (token == WILDCARD_STAR)
+    {
+        return &pParent->pNode_Wildcard_Star;
+    }
+    if (token == WILDCARD_GREATER_THAN)
+    {
+        return &pParent->pNode_Wildcard_GreaterThan;
+    }
+    auto it = pParent->Nodes.find(token);
+    if (it != pParent->Nodes.end())
+    {
+        return &it->second;
+    }
+    if (!create)
+    {
+        return nullptr;
+    }
+    return &pParent->Nodes.insert({ std::string(token), nullptr }).first->second;
+}
+
+// Gets a writable version of the node in the slot, copying it if it is shared with the published version.
+SnapshotSubjectMatchingEngine::Node* SnapshotSubjectMatchingEngine::makeWritable(Node*& pNode)
+{
+    if (m_writableNodes.contains(pNode))
+    {
+        return pNode;
+    }
+
+    // The node is in the published version, so we copy it. The copy shares the node's
+    // children, and the original is retired when we next publish...
+    auto pCopy = new Node(*pNode);
+    m_writableNodes.insert(pCopy);
+    m_replacedNodes.push_back(pNode);
+    pNode = pCopy;
+    return pCopy;
+}
+
+// Creates a new (writable) node.
+SnapshotSubjectMatchingEngine::Node* SnapshotSubjectMatchingEngine::createNode()
+{
+    auto pNode = new Node();
+    m_writableNodes.insert(pNode);
+    m_nodeCount++;
+    return pNode;
+}
+
+// Releases a node which has been removed from the pending version.
+void SnapshotSubjectMatchingEngine::releaseNode(Node* pNode)
+{
+    m_nodeCount--;
+    if (m_writableNodes.erase(pNode) != 0)
+    {
+        // The node was created or copied since the last publish, so readers cannot see it...
+        delete pNode;
+    }
+    else
+    {
+        // The node is in the published version, so it is retired when we next publish...
+        m_replacedNodes.push_back(pNode);
+    }
+}
+
+// Deletes the node and all its child nodes.
+void SnapshotSubjectMatchingEngine::deleteNodes(Node* pNode)
+{
+    for (const auto& pair : pNode->Nodes)
+    {
+        deleteNodes(pair.second);
+    }
+    if (pNode->pNode_Wildcard_Star)
+    {
+        deleteNodes(pNode->pNode_Wildcard_Star);
+    }
+    if (pNode->pNode_Wildcard_GreaterThan)
+    {
+        deleteNodes(pNode->pNode_Wildcard_GreaterThan);
+    }
+    delete pNode;
+}
+
+// Checks the current node for matching subscriptions.
+void SnapshotSubjectMatchingEngine::getMatchingSubscriptionInfos(const Node* pNode, const VecToken& tokens, size_t tokenIndex, VecSubscriptionInfo& subscriptionInfos)
+{
+    // We check if this node contains the current token...
+    auto isLastToken = (tokenIndex == tokens.size() - 1);
+    auto it = pNode->Nodes.find(tokens[tokenIndex]);
+    if (it != pNode->Nodes.end())
+    {
+        if (isLastToken)
+        {
+            // This is the last token, so we add the subscription-infos to the results...
+            addSubscriptionInfos(it->second, subscriptionInfos);
+        }
+        else
+        {
+            // This is not the last token, so we continue walking the graph...
+            getMatchingSubscriptionInfos(it->second, tokens, tokenIndex + 1, subscriptionInfos);
+        }
+    }
+
+    // We check if the node has the '>' wildcard, which matches all remaining tokens...
+    if (pNode->pNode_Wildcard_GreaterThan)
+    {
+        addSubscriptionInfos(pNode->pNode_Wildcard_GreaterThan, subscriptionInfos);
+    }
+
+    // We check if the node has the '*' wildcard, which matches the current token...
+    if (pNode->pNode_Wildcard_Star)
+    {
+        if (isLastToken)
+        {
+            addSubscriptionInfos(pNode->pNode_Wildcard_Star, subscriptionInfos);
+        }
+        else
+        {
+            getMatchingSubscriptionInfos(pNode->pNode_Wildcard_Star, tokens, tokenIndex + 1, subscriptionInfos);
+        }
+    }
+}
+
+// Adds all subscription infos from the node to the vector.
+void SnapshotSubjectMatchingEngine::addSubscriptionInfos(const Node* pNode, VecSubscriptionInfo& subscriptionInfos)
+{
+    for (const auto& pair : pNode->SubscriptionInfos)
+    {
+        subscriptionInfos.push_back(pair.second);
+    }
+}
+
+// Splits the subject into tokens (in the same way as MMUtils::tokenize) without allocating a new vector.
+void SnapshotSubjectMatchingEngine::tokenize(std::string_view subject, VecToken& tokens)
+{
+    tokens.clear();
+    size_t start = 0;
+    while (start < subject.size())
+    {
+        auto end = subject.find('.', start);
+        if (end == std::string_view::npos)
+        {
+            end = subject.size();
+        }
+        tokens.push_back(subject.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
@@ -0,0 +1,277 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <MMUtils.h>
+#include "GatewaySharedPointers.h"
+#include "SubscriptionInfo.h"
+#include "StringHash.h"
+#include "EpochManager.h"
+
+namespace MessagingMesh
+{
+    // Forward declarations...
+    class Socket;
+
+    /// <summary>
+    /// A variant of SubjectMatchingEngine which allows subjects to be matched from many
+    /// threads at the same time, without locking.
+    ///
+    /// SubjectMatchingEngine is only safe because all routing for a service runs on the
+    /// service's UV loop thread. This engine is for routing a service from more than one
+    /// thread. Matching follows the same rules (see SubjectMatchingEngine for details of
+    /// the interest graph and the * and > wildcards).
+    ///
+    /// Snapshots
+    /// ---------
+    /// Readers (routing threads) match against a snapshot: an immutable version of the
+    /// interest graph, found from an atomic pointer to its root node. Nodes in a published
+    /// snapshot are never changed.
+    ///
+    /// The writer builds the next version by path copying. To change the subscriptions for
+    /// A.B.C we copy the root, A, B and C nodes and change the copies. The copies share all
+    /// their other child nodes with the published version. Nodes copied since the last
+    /// publish are only visible to the writer, so further changes to them are made in place.
+    /// This means that a burst of subscriptions copies each node on their paths once.
+    ///
+    /// Changes are not visible to readers until publish() is called. This atomically replaces
+    /// the root, so readers see either all or none of the changes.
+    ///
+    /// Reclaiming old versions
+    /// -----------------------
+    /// Each node is only in one version until it is copied or removed. When we publish we retire
+    /// the nodes which were replaced to the EpochManager, which deletes them when no reader can
+    /// still be walking the version which held them.
+    ///
+    /// Readers
+    /// -------
+    /// Each thread which matches subjects creates a Reader with createReader(). This registers
+    /// the thread with the EpochManager and holds scratch vectors, so matching does not allocate
+    /// once the scratch vectors have grown.
+    ///
+    /// Writers
+    /// -------
+    /// Methods which change subscriptions (and publish) can be called from any thread. They are
+    /// serialized by a mutex, and do not block readers.
+    ///
+    /// NOTE: Sockets in the subscription-infos returned to readers must be kept alive by the
+    ///       caller until readers can no longer be using them.
+    /// </summary>
+    class SnapshotSubjectMatchingEngine
+    {
+    // Public types...
+    public:
+        // Engine statistics.
+        struct Stats
+        {
+            // The number of subscriptions (including unpublished changes)...
+            size_t SubscriptionCount = 0;
+
+            // The number of nodes in the graph (including unpublished changes)...
+            size_t NodeCount = 0;
+
+            // The number of times a new version has been published...
+            uint64_t Version = 0;
+
+            // The number of retired versions waiting to be reclaimed...
+            size_t RetiredVersionCount = 0;
+        };
+
+        /// <summary>
+        /// A thread's registration with the engine for matching subjects.
+        /// A reader must only be used by one thread at a time, and must be destroyed before the engine.
+        /// </summary>
+        class Reader
+        {
+        public:
+            // Destructor.
+            ~Reader();
+
+            // The reader cannot be copied...
+            Reader(const Reader&) = delete;
+            Reader& operator=(const Reader&) = delete;
+
+        private:
+            friend class SnapshotSubjectMatchingEngine;
+
+            // Constructor.
+            Reader(EpochManager& epochManager, uint32_t readerIndex);
+
+        private:
+            // The epoch manager with which the reader is registered...
+            EpochManager& m_epochManager;
+
+            // The reader's slot in the epoch manager...
+            uint32_t m_readerIndex;
+
+            // Tokens for the subject being matched (reused between matches)...
+            VecToken m_tokens;
+
+            // Matches for the subject being matched (reused between matches)...
+            VecSubscriptionInfo m_matches;
+        };
+        using ReaderPtr = std::unique_ptr<Reader>;
+
+    // Public methods...
+    public:
+        // Constructor.
+        SnapshotSubjectMatchingEngine();
+
+        // Destructor.
+        ~SnapshotSubjectMatchingEngine();
+
+        // The engine cannot be copied...
+        SnapshotSubjectMatchingEngine(const SnapshotSubjectMatchingEngine&) = delete;
+        SnapshotSubjectMatchingEngine& operator=(const SnapshotSubjectMatchingEngine&) = delete;
+
+        // Adds a subscription. The change is visible to readers after the next publish().
+        // Returns the number of clients registered for this subject.
+        size_t addSubscription(const std::string& subject, uint32_t subscriptionID, uint64_t clientSocketID, Socket* pClientSocket);
+
+        // Removes a subscription. The change is visible to readers after the next publish().
+        // Returns the number of clients registered for this subject.
+        size_t removeSubscription(const std::string& subject, uint64_t clientSocketID);
+
+        // Removes all subscriptions for the client specified. The change is visible to readers after the next publish().
+        void removeAllSubscriptions(uint64_t clientSocketID);
+
+        // Gets the subjects (including wildcard patterns) to which the client has subscribed (including unpublished changes).
+        std::vector<std::string> getSubjects(uint64_t clientSocketID);
+
+        // Publishes changes made since the last publish, so that they are visible to readers.
+        void publish();
+
+        // Creates a reader for matching subjects from the calling thread.
+        ReaderPtr createReader();
+
+        // Returns subscription-infos that match the subject provided, from the current snapshot.
+        // Can be called from any number of threads at the same time, each with its own reader.
+        // The span returned refers to the reader's scratch vector and is valid until the next
+        // call with the same reader.
+        std::span<const SubscriptionInfo> getMatchingSubscriptionInfos(const std::string& subject, Reader& reader);
+
+        // Gets engine statistics.
+        Stats getStats();
+
+    // Private types...
+    private:
+        // A node in the interest graph.
+        struct Node
+        {
+            // Map of tokens to child nodes...
+            std::unordered_map<std::string, Node*, StringHash, std::equal_to<>> Nodes;
+
+            // Child node for the * wildcard...
+            Node* pNode_Wildcard_Star = nullptr;
+
+            // Child node for the > wildcard...
+            Node* pNode_Wildcard_GreaterThan = nullptr;
+
+            // Subscription-infos, with the client socket ID for each one...
+            std::vector<std::pair<uint64_t, SubscriptionInfo>> SubscriptionInfos;
+
+            // Returns true if the node has no subscriptions and no child nodes.
+            bool isUnused() const
+            {
+                return SubscriptionInfos.empty() && Nodes.empty() && !pNode_Wildcard_Star && !pNode_Wildcard_GreaterThan;
+            }
+        };
+
+        // A step on the path from the root to a node.
+        struct PathEntry
+        {
+            // The parent node...
+            Node* pParent;
+
+            // The token for the child node in the parent...
+            std::string_view Token;
+
+            // The child node...
+            Node* pNode;
+        };
+
+    // Private functions...
+    private:
+        // Removes a subscription. Must be called with the writer mutex held.
+        // Returns the number of clients registered for this subject.
+        size_t removeSubscription(const VecToken& tokens, uint64_t clientSocketID);
+
+        // Gets the node in the pending version for the subject specified.
+        // Returns nullptr if there is no node for the subject.
+        const Node* findNode(const VecToken& tokens) const;
+
+        // Gets the child slot in the parent node for the token, or nullptr if there is no child
+        // for a non-wildcard token and create is false.
+        Node** getChildSlot(Node* pParent, std::string_view token, bool create);
+
+        // Gets a writable version of the node in the slot, copying it if it is shared with the published version.
+        Node* makeWritable(Node*& pNode);
+
+        // Creates a new (writable) node.
+        Node* createNode();
+
+        // Releases a node which has been removed from the pending version.
+        void releaseNode(Node* pNode);
+
+        // Deletes the node and all its child nodes.
+        void deleteNodes(Node* pNode);
+
+        // Checks the current node for matching subscriptions.
+        static void getMatchingSubscriptionInfos(const Node* pNode, const VecToken& tokens, size_t tokenIndex, VecSubscriptionInfo& subscriptionInfos);
+
+        // Adds all subscription infos from the node to the vector.
+        static void addSubscriptionInfos(const Node* pNode, VecSubscriptionInfo& subscriptionInfos);
+
+        // Splits the subject into tokens (in the same way as MMUtils::tokenize) without allocating a new vector.
+        static void tokenize(std::string_view subject, VecToken& tokens);
+
+    // Private data...
+    private:
+        // The root of the published version (read by readers)...
+        std::atomic<Node*> m_pPublishedRoot;
+
+        // Serializes changes and publishing...
+        std::mutex m_writerMutex;
+
+        // The root of the version being built by the writer...
+        Node* m_pPendingRoot;
+
+        // Nodes created or copied since the last publish, which can be changed in place...
+        std::unordered_set<Node*> m_writableNodes;
+
+        // Nodes in the published version which have been copied or removed since the last publish...
+        std::vector<Node*> m_replacedNodes;
+
+        // Subjects to which each client has subscribed, keyed by client socket ID...
+        std::unordered_map<uint64_t, std::unordered_set<std::string>> m_clientSubjects;
+
+        // The path to the node being changed (reused between calls)...
+        std::vector<PathEntry> m_path;
+
+        // The number of subscriptions...
+        size_t m_subscriptionCount = 0;
+
+        // The number of nodes in the pending version...
+        size_t m_nodeCount = 0;
+
+        // The number of published versions...
+        uint64_t m_version = 0;
+
+        // Reclaims nodes from old versions...
+        EpochManager m_epochManager;
+
+    // Constants...
+    private:
+        static constexpr std::string_view WILDCARD_STAR = "*";
+        static constexpr std::string_view WILDCARD_GREATER_THAN = ">";
+    };
+} // namespace
+
@@ -0,0 +1,19 @@
+#pragma once
+#include <functional>
+#include <string_view>
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// Transparent hash for maps keyed by std::string.
+    /// 
+    /// Used with std::equal_to<> so that maps can be searched with a string_view
+    /// (or const char*) without creating a temporary std::string.
+    /// </summary>
+    struct StringHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+    };
+} // namespace
+
@@ -0,0 +1,218 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <MMUtils.h>
+#include "StringHash.h"
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// A trie of (non-wildcard) subjects, holding a value for each subject.
+    ///
+    /// This is the mirror image of the interest graph in SubjectMatchingEngine. The
+    /// interest graph holds patterns and is searched with a subject. The subject index
+    /// holds subjects and is searched with a pattern, finding all subjects the pattern
+    /// matches.
+    ///
+    /// For example, if the index holds A.B.C, A.B.D and A.X.C:
+    /// - A.B.C matches A.B.C
+    /// - A.*.C matches A.B.C and A.X.C
+    /// - A.> matches all three subjects
+    ///
+    /// Tokens in the index are strings (not interned token IDs) as subjects can contain
+    /// tokens which do not appear in any subscription.
+    ///
+    /// Nodes are removed when they no longer hold a value or have any children, so the
+    /// size of the index follows the number of subjects held in it.
+    /// </summary>
+    template<typename ValueType>
+    class SubjectIndex
+    {
+    // Public methods...
+    public:
+        // Sets the value for the subject (tokenized) provided.
+        void insert(const VecToken& tokens, const ValueType& value)
+        {
+            auto pNode = &m_rootNode;
+            for (const auto& token : tokens)
+            {
+                auto it = pNode->Children.find(token);
+                if (it == pNode->Children.end())
+                {
+                    it = pNode->Children.emplace(std::string(token), std::make_unique<Node>()).first;
+                }
+                pNode = it->second.get();
+            }
+            if (!pNode->HasValue)
+            {
+                ++m_size;
+            }
+            pNode->HasValue = true;
+            pNode->Value = value;
+        }
+
+        // Returns a pointer to the value for the subject (tokenized) provided, or nullptr if the subject is not in the index.
+        ValueType* find(const VecToken& tokens)
+        {
+            auto pNode = &m_rootNode;
+            for (const auto& token : tokens)
+            {
+                auto it = pNode->Children.find(token);
+                if (it == pNode->Children.end())
+                {
+                    return nullptr;
+                }
+                pNode = it->second.get();
+            }
+            return pNode->HasValue ? &pNode->Value : nullptr;
+        }
+
+        // Removes the subject (tokenized) from the index.
+        // Returns true if the subject was in the index, false if not.
+        bool erase(const VecToken& tokens)
+        {
+            auto erased = false;
+            erase(&m_rootNode, tokens, 0, erased);
+            return erased;
+        }
+
+        // Calls the function provided with (value) for each subject in the index matched
+        // by the pattern (tokenized) provided. The pattern can include * and > wildcards.
+        // NOTE: The function must not modify the index.
+        template<typename Function>
+        void forEachMatch(const VecToken& patternTokens, Function function) const
+        {
+            forEachMatch(&m_rootNode, patternTokens, 0, function);
+        }
+
+        // Removes all subjects from the index.
+        void clear()
+        {
+            m_rootNode.Children.clear();
+            m_rootNode.HasValue = false;
+            m_rootNode.Value = ValueType();
+            m_size = 0;
+        }
+
+        // Gets the number of subjects in the index.
+        size_t size() const { return m_size; }
+
+    // Private types...
+    private:
+        // A node in the trie.
+        struct Node
+        {
+            // Child nodes keyed by token...
+            std::unordered_map<std::string, std::unique_ptr<Node>, StringHash, std::equal_to<>> Children;
+
+            // True if a subject ends at this node, in which case Value holds its value...
+            bool HasValue = false;
+            ValueType Value = ValueType();
+        };
+
+    // Private functions...
+    private:
+        // Removes the subject from the node provided and its children.
+        // Returns true if the node is now unused and can itself be removed.
+        bool erase(Node* pNode, const VecToken& tokens, size_t tokenIndex, bool& erased)
+        {
+            if (tokenIndex == tokens.size())
+            {
+                // This is the node for the subject...
+                if (pNode->HasValue)
+                {
+                    pNode->HasValue = false;
+                    pNode->Value = ValueType();
+                    --m_size;
+                    erased = true;
+                }
+            }
+            else
+            {
+                // We remove the subject from the child node for the token, and remove the
+                // child node itself if nothing else is using it...
+                auto it = pNode->Children.find(tokens[tokenIndex]);
+                if (it != pNode->Children.end() && erase(it->second.get(), tokens, tokenIndex + 1, erased))
+                {
+                    pNode->Children.erase(it);
+                }
+            }
+            return !pNode->HasValue && pNode->Children.empty();
+        }
+
+        // Calls the function for values in the node provided and its children matched by the pattern.
+        template<typename Function>
+        void forEachMatch(const Node* pNode, const VecToken& patternTokens, size_t tokenIndex, Function& function) const
+        {
+            if (tokenIndex == patternTokens.size())
+            {
+                // We have matched all the tokens in the pattern...
+                if (pNode->HasValue)
+                {
+                    function(pNode->Value);
+                }
+                return;
+            }
+
+            const auto& token = patternTokens[tokenIndex];
+            if (token == WILDCARD_GREATER_THAN)
+            {
+                // The > wildcard matches one or more tokens, so it matches everything below this
+                // node. (As in the interest graph, tokens after a > are not matched.)
+                if (tokenIndex == patternTokens.size() - 1)
+                {
+                    for (const auto& pair : pNode->Children)
+                    {
+                        forEachValue(pair.second.get(), function);
+                    }
+                }
+            }
+            else if (token == WILDCARD_STAR)
+            {
+                // The * wildcard matches any single token...
+                for (const auto& pair : pNode->Children)
+                {
+                    forEachMatch(pair.second.get(), patternTokens, tokenIndex + 1, function);
+                }
+            }
+            else
+            {
+                // We have a non-wildcard token...
+                auto it = pNode->Children.find(token);
+                if (it != pNode->Children.end())
+                {
+                    forEachMatch(it->second.get(), patternTokens, tokenIndex + 1, function);
+                }
+            }
+        }
+
+        // Calls the function for values in the node provided and all its children.
+        template<typename Function>
+        void forEachValue(const Node* pNode, Function& function) const
+        {
+            if (pNode->HasValue)
+            {
+                function(pNode->Value);
+            }
+            for (const auto& pair : pNode->Children)
+            {
+                forEachValue(pair.second.get(), function);
+            }
+        }
+
+    // Private data...
+    private:
+        // The root of the trie...
+        Node m_rootNode;
+
+        // The number of subjects in the index...
+        size_t m_size = 0;
+
+    // Constants...
+    private:
+        static constexpr std::string_view WILDCARD_STAR = "*";
+        static constexpr std::string_view WILDCARD_GREATER_THAN = ">";
+    };
+} // namespace
+
@@ -0,0 +1,187 @@
+#include "SubjectMatchCache.h"
+#include <algorithm>
+#include <bit>
+using namespace MessagingMesh;
+
+// Constructor.
+SubjectMatchCache::SubjectMatchCache(size_t capacity)
+{
+    setCapacity(capacity);
+}
+
+// Returns the cached matches for the subject, or nullptr if the subject is not cached.
+const VecSubscriptionInfo* SubjectMatchCache::find(const std::string& subject)
+{
+    auto it = m_entryIndexes.find(subject);
+    if (it == m_entryIndexes.end())
+    {
+        m_stats.Misses++;
+        return nullptr;
+    }
+
+    // We mark the entry as used so the clock hand passes over it...
+    auto& entry = m_entries[it->second];
+    entry.Referenced = true;
+    m_stats.Hits++;
+    return &entry.Matches;
+}
+
+// Adds matches for the subject to the cache, evicting an entry if the cache is full.
+void SubjectMatchCache::insert(const std::string& subject, const VecSubscriptionInfo& matches)
+{
+    if (m_capacity == 0 || m_entryIndexes.contains(subject))
+    {
+        return;
+    }
+
+    // We find an entry for the subject and add the subject to the indexes...
+    auto entryIndex = getFreeEntry();
+    auto it = m_entryIndexes.insert({ subject, entryIndex }).first;
+    m_subjectIndex.insert(MMUtils::tokenize(subject, '.'), entryIndex);
+
+    // We set up the entry...
+    auto& entry = m_entries[entryIndex];
+    entry.pSubject = &it->first;
+    entry.Matches = matches;
+    entry.Referenced = false;
+}
+
+// Returns true if the subject has been looked up often enough to be cached (for adaptive caching).
+bool SubjectMatchCache::shouldAdmit(const std::string& subject)
+{
+    // We update the count for the subject...
+    auto mask = m_lookupCounts.size() - 1;
+    auto& count = m_lookupCounts[StringHash{}(subject) & mask];
+    if (count < MAX_LOOKUP_COUNT)
+    {
+        count++;
+    }
+    auto admit = count >= ADMISSION_THRESHOLD;
+
+    // We periodically halve all counts so that they decay over time...
+    if (++m_lookupCountSamples >= m_lookupCounts.size() * LOOKUP_COUNT_SAMPLES_PER_ENTRY)
+    {
+        for (auto& c : m_lookupCounts)
+        {
+            c /= 2;
+        }
+        m_lookupCountSamples = 0;
+    }
+
+    return admit;
+}
+
+// Removes cached subjects matched by the subscription pattern (tokenized) provided.
+void SubjectMatchCache::invalidate(const VecToken& patternTokens)
+{
+    if (m_entryIndexes.empty())
+    {
+        return;
+    }
+
+    // We find the matching entries and then remove them. (We cannot remove them while
+    // iterating the subject index.)
+    m_invalidatedEntryIndexes.clear();
+    m_subjectIndex.forEachMatch(
+        patternTokens,
+        [this](uint32_t entryIndex)
+        {
+            m_invalidatedEntryIndexes.push_back(entryIndex);
+        });
+    for (auto entryIndex : m_invalidatedEntryIndexes)
+    {
+        removeEntry(entryIndex);
+        m_stats.Invalidations++;
+    }
+}
+
+// Removes all subjects from the cache.
+void SubjectMatchCache::clear()
+{
+    m_entries.clear();
+    m_freeEntryIndexes.clear();
+    m_entryIndexes.clear();
+    m_subjectIndex.clear();
+    m_clockHand = 0;
+}
+
+// Sets the maximum number of subjects held in the cache (and clears the cache).
+void SubjectMatchCache::setCapacity(size_t capacity)
+{
+    clear();
+    m_capacity = capacity;
+
+    // We size the lookup counts for adaptive admission to (a power of two) twice the capacity...
+    m_lookupCounts.assign(std::bit_ceil(std::max(capacity * 2, (size_t)64)), 0);
+    m_lookupCountSamples = 0;
+}
+
+// Gets cache statistics.
+SubjectMatchCache::Stats SubjectMatchCache::getStats() const
+{
+    auto stats = m_stats;
+    stats.Size = m_entryIndexes.size();
+    stats.Capacity = m_capacity;
+    return stats;
+}
+
+// Removes the entry at the index provided.
+void SubjectMatchCache::removeEntry(uint32_t entryIndex)
+{
+    auto& entry = m_entries[entryIndex];
+    if (!entry.pSubject)
+    {
+        return;
+    }
+
+    // We remove the subject from the indexes. (We erase from m_entryIndexes by iterator, as
+    // pSubject points to the key we are erasing.)
+    m_subjectIndex.erase(MMUtils::tokenize(*entry.pSubject, '.'));
+    m_entryIndexes.erase(m_entryIndexes.find(*entry.pSubject));
+
+    // We release the entry...
+    entry.pSubject = nullptr;
+    entry.Matches.clear();
+    entry.Referenced = false;
+    m_freeEntryIndexes.push_back(entryIndex);
+}
+
+// Returns the index of an unused entry, evicting an entry if the cache is full.
+uint32_t SubjectMatchCache::getFreeEntry()
+{
+    // We use an entry freed by invalidation if there is one...
+    if (!m_freeEntryIndexes.empty())
+    {
+        auto entryIndex = m_freeEntryIndexes.back();
+        m_freeEntryIndexes.pop_back();
+        return entryIndex;
+    }
+
+    // We add a new entry if the cache is not yet full...
+    if (m_entries.size() < m_capacity)
+    {
+        m_entries.emplace_back();
+        return static_cast<uint32_t>(m_entries.size() - 1);
+    }
+
+    // The cache is full, so we sweep the clock hand to find an entry which has
+    // not been used since the hand last passed it...
+    for (;;)
+    {
+        auto entryIndex = static_cast<uint32_t>(m_clockHand);
+        auto& entry = m_entries[entryIndex];
+        m_clockHand = (m_clockHand + 1) % m_entries.size();
+        if (entry.Referenced)
+        {
+            entry.Referenced = false;
+            continue;
+        }
+
+        // We evict the entry...
+        removeEntry(entryIndex);
+        m_freeEntryIndexes.pop_back();
+        m_stats.Evictions++;
+        return entryIndex;
+    }
+}
+
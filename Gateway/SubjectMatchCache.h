@@ -0,0 +1,156 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <MMUtils.h>
+#include "GatewaySharedPointers.h"
+#include "SubscriptionInfo.h"
+#include "StringHash.h"
+#include "SubjectIndex.h"
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// Bounded cache of sent subjects to the subscription-infos which match them,
+    /// used by SubjectMatchingEngine.
+    ///
+    /// Eviction
+    /// --------
+    /// The cache holds at most a fixed number of subjects. When it is full we evict an
+    /// entry using the CLOCK algorithm (an approximation of LRU): each entry has a
+    /// 'referenced' flag which is set when the entry is used. The clock hand sweeps the
+    /// entries, clearing the flag of entries which have it set and evicting the first
+    /// entry which does not.
+    ///
+    /// Invalidation
+    /// ------------
+    /// Cached subjects are also held in a SubjectIndex. When a subscription is added or
+    /// removed, invalidate() is called with the subscription's pattern and we remove only
+    /// the cached subjects which the pattern matches. The rest of the cache stays warm.
+    ///
+    /// Admission
+    /// ---------
+    /// In adaptive mode the engine only caches subjects which are sent often. We keep an
+    /// approximate count of how often each subject has been looked up in a small array of
+    /// counters indexed by the subject's hash. shouldAdmit() returns true when the count
+    /// reaches ADMISSION_THRESHOLD. The counters are halved periodically so that subjects
+    /// which were hot in the past but are no longer sent do not stay admitted.
+    /// </summary>
+    class SubjectMatchCache
+    {
+    // Public types...
+    public:
+        // Cache statistics.
+        struct Stats
+        {
+            uint64_t Hits = 0;
+            uint64_t Misses = 0;
+            uint64_t Evictions = 0;
+            uint64_t Invalidations = 0;
+            size_t Size = 0;
+            size_t Capacity = 0;
+        };
+
+    // Public methods...
+    public:
+        // Constructor.
+        SubjectMatchCache(size_t capacity = DEFAULT_CAPACITY);
+
+        // Returns the cached matches for the subject, or nullptr if the subject is not cached.
+        const VecSubscriptionInfo* find(const std::string& subject);
+
+        // Adds matches for the subject to the cache, evicting an entry if the cache is full.
+        void insert(const std::string& subject, const VecSubscriptionInfo& matches);
+
+        // Returns true if the subject has been looked up often enough to be cached (for adaptive caching).
+        bool shouldAdmit(const std::string& subject);
+
+        // Removes cached subjects matched by the subscription pattern (tokenized) provided.
+        void invalidate(const VecToken& patternTokens);
+
+        // Removes all subjects from the cache.
+        void clear();
+
+        // Sets the maximum number of subjects held in the cache (and clears the cache).
+        void setCapacity(size_t capacity);
+
+        // Returns true if the cache is empty.
+        bool empty() const { return m_entryIndexes.empty(); }
+
+        // Gets cache statistics.
+        Stats getStats() const;
+
+    // Private types...
+    private:
+        // A cached subject.
+        struct Entry
+        {
+            // The subject (pointing to the key in m_entryIndexes) or nullptr if the entry is not in use...
+            const std::string* pSubject = nullptr;
+
+            // Subscription-infos which match the subject...
+            VecSubscriptionInfo Matches;
+
+            // Set when the entry is used and cleared by the clock hand...
+            bool Referenced = false;
+        };
+
+    // Private functions...
+    private:
+        // Removes the entry at the index provided.
+        void removeEntry(uint32_t entryIndex);
+
+        // Returns the index of an unused entry, evicting an entry if the cache is full.
+        uint32_t getFreeEntry();
+
+    // Private data...
+    private:
+        // The maximum number of subjects in the cache...
+        size_t m_capacity;
+
+        // Cache entries (up to m_capacity)...
+        std::vector<Entry> m_entries;
+
+        // Indexes of entries which are not in use...
+        std::vector<uint32_t> m_freeEntryIndexes;
+
+        // Entry indexes keyed by subject...
+        std::unordered_map<std::string, uint32_t, StringHash, std::equal_to<>> m_entryIndexes;
+
+        // Index of cached subjects, used to find entries to invalidate...
+        SubjectIndex<uint32_t> m_subjectIndex;
+
+        // The CLOCK hand (an index into m_entries)...
+        size_t m_clockHand = 0;
+
+        // Entry indexes found by invalidate() (reused between calls)...
+        std::vector<uint32_t> m_invalidatedEntryIndexes;
+
+        // Approximate lookup counts for adaptive admission, indexed by subject hash...
+        std::vector<uint8_t> m_lookupCounts;
+
+        // The number of lookup counts added since the counts were last halved...
+        size_t m_lookupCountSamples = 0;
+
+        // Stats...
+        Stats m_stats;
+
+    // Public constants...
+    public:
+        // The default maximum number of subjects in the cache...
+        static constexpr size_t DEFAULT_CAPACITY = 65536;
+
+    // Constants...
+    private:
+        // The number of lookups of a subject before it is admitted in adaptive mode...
+        static constexpr uint8_t ADMISSION_THRESHOLD = 3;
+
+        // The maximum value of a lookup count...
+        static constexpr uint8_t MAX_LOOKUP_COUNT = 15;
+
+        // We halve the lookup counts after (capacity * this) lookups...
+        static constexpr size_t LOOKUP_COUNT_SAMPLES_PER_ENTRY = 10;
+    };
+} // namespace
+
@@ -1,25 +1,44 @@
 #include "SubjectMatchingEngine.h"
+#include <algorithm>
 #include <MMUtils.h>
 #include <Socket.h>
 #include <Logger.h>
 #include "SubscriptionInfo.h"
 using namespace MessagingMesh;
 
+// Constructor.
+SubjectMatchingEngine::SubjectMatchingEngine() :
+    m_pRootNode(m_nodePool.create())
+{
+}
+
+// Destructor.
+SubjectMatchingEngine::~SubjectMatchingEngine()
+{
+    releaseNodes(m_pRootNode);
+}
+
 // Adds a subscription.
 // Returns the number of clients registered for this subject.
 size_t SubjectMatchingEngine::addSubscription(const std::string& subject, uint32_t subscriptionID, uint64_t clientSocketID, Socket* pClientSocket)
 {
     // We get the node for the subject...
-    auto pNode = getOrCreateNode(subject);
+    auto tokens = MMUtils::tokenize(subject, '.');
+    auto pNode = getOrCreateNode(tokens);
 
     // We add subscription-info.
     // Note: We are not expecting more than one subscription from a client
     //       for the same subject. This is managed in client libraries.
-    auto pSubscriptionInfo = SubscriptionInfo::create(pClientSocket, subscriptionID);
-    pNode->SubscriptionInfos.insert({ clientSocketID, pSubscriptionInfo });
+    auto& client = getOrCreateClient(clientSocketID, pClientSocket);
+    SubscriptionInfo subscriptionInfo(pClientSocket, subscriptionID, client.ClientIndex);
+    if (insertSubscriptionInfo(pNode, subscriptionInfo))
+    {
+        onSubscriptionAdded(pNode);
+        client.Nodes.insert(pNode);
+    }
 
-    // The change to subscriptions has invalidated the cache...
-    m_cache.clear();
+    // The change to subscriptions has invalidated cached subjects matching it...
+    m_cache.invalidate(tokens);
 
     // We returns the number of clients registered for the subject...
     return pNode->SubscriptionInfos.size();
@@ -30,108 +49,282 @@ size_t SubjectMatchingEngine::addSubscription(const std::string& subject, uint32
 size_t SubjectMatchingEngine::removeSubscription(const std::string& subject, uint64_t clientSocketID)
 {
     // We get the node for the subject...
-    auto pNode = getOrCreateNode(subject);
+    auto tokens = MMUtils::tokenize(subject, '.');
+    auto pNode = findNode(tokens);
+    if (!pNode)
+    {
+        // There are no subscriptions to the subject...
+        return 0;
+    }
 
     // We remove info for this client...
-    pNode->SubscriptionInfos.erase(clientSocketID);
+    auto it = m_clients.find(clientSocketID);
+    if (it != m_clients.end() && eraseSubscriptionInfo(pNode, it->second.ClientIndex))
+    {
+        onSubscriptionRemoved(pNode);
+        removeClientNode(it, pNode);
 
-    // RSSTODO: Clean up nodes which are no longer used by any subscriptions.
+        // The change to subscriptions has invalidated cached subjects matching it...
+        m_cache.invalidate(tokens);
+    }
 
-    // The change to subscriptions has invalidated the cache...
-    m_cache.clear();
+    // We remove the node (and its parents) if they are no longer used...
+    auto clientCount = pNode->SubscriptionInfos.size();
+    pruneNode(pNode);
 
     // We returns the number of clients registered for the subject...
-    return pNode->SubscriptionInfos.size();
+    return clientCount;
 }
 
 // Removes all subscriptions for the client specified.
 void SubjectMatchingEngine::removeAllSubscriptions(uint64_t clientSocketID)
 {
-    removeAllSubscriptions(m_pRootNode, clientSocketID);
+    removeAllSubscriptions(clientSocketID, true);
+}
 
-    // The change to subscriptions has invalidated the cache...
-    m_cache.clear();
+// Removes all subscriptions for the clients specified.
+void SubjectMatchingEngine::removeAllSubscriptions(const std::vector<uint64_t>& clientSocketIDs)
+{
+    // We find how many subscriptions we are removing. If this is more than the number of
+    // cached subjects it is cheaper to clear the cache than to invalidate it for each one...
+    size_t subscriptionCount = 0;
+    for (auto clientSocketID : clientSocketIDs)
+    {
+        auto it = m_clients.find(clientSocketID);
+        if (it != m_clients.end())
+        {
+            subscriptionCount += it->second.Nodes.size();
+        }
+    }
+    auto clearCache = subscriptionCount > m_cache.getStats().Size;
+    if (clearCache)
+    {
+        m_cache.clear();
+    }
+
+    // We remove the subscriptions...
+    for (auto clientSocketID : clientSocketIDs)
+    {
+        removeAllSubscriptions(clientSocketID, !clearCache);
+    }
 }
 
-// Removes all subscriptions for the client specified from the node provided
-// and from all its child nodes recursively.
-void SubjectMatchingEngine::removeAllSubscriptions(Node* pNode, uint64_t clientSocketID)
+// Removes all subscriptions for the client specified, using the reverse index.
+// Invalidates cached subjects for each subscription if invalidateCache is true.
+void SubjectMatchingEngine::removeAllSubscriptions(uint64_t clientSocketID, bool invalidateCache)
 {
-    // We remove subscriptions from this node...
-    pNode->SubscriptionInfos.erase(clientSocketID);
+    // We find the nodes on which the client has subscriptions...
+    auto it = m_clients.find(clientSocketID);
+    if (it == m_clients.end())
+    {
+        return;
+    }
+    auto clientNodes = std::move(it->second.Nodes);
+    auto clientIndex = it->second.ClientIndex;
+    removeClient(it);
 
-    // We remove subscriptions (recursively) from child nodes for non-wildcard tokens...
-    for (const auto& pair : pNode->Nodes)
+    // We remove the client's subscription from each node.
+    // Note: Pruning a node cannot remove another node in the set, as those nodes all
+    //       still hold a subscription for this client until we reach them.
+    for (auto pNode : clientNodes)
     {
-        removeAllSubscriptions(pair.second, clientSocketID);
+        eraseSubscriptionInfo(pNode, clientIndex);
+        onSubscriptionRemoved(pNode);
+        if (invalidateCache && !m_cache.empty())
+        {
+            getPattern(pNode, m_pattern);
+            m_cache.invalidate(m_pattern);
+        }
+        pruneNode(pNode);
     }
+}
 
-    // We remove subscriptions (recursively) from wildcard tokens...
-    if (pNode->pNode_Wildcard_Star)
+// Gets the subjects (including wildcard patterns) to which the client has subscribed.
+std::vector<std::string> SubjectMatchingEngine::getSubjects(uint64_t clientSocketID)
+{
+    std::vector<std::string> subjects;
+    auto it = m_clients.find(clientSocketID);
+    if (it == m_clients.end())
     {
-        removeAllSubscriptions(pNode->pNode_Wildcard_Star, clientSocketID);
+        return subjects;
     }
-    if (pNode->pNode_Wildcard_GreaterThan)
+    subjects.reserve(it->second.Nodes.size());
+    for (auto pNode : it->second.Nodes)
     {
-        removeAllSubscriptions(pNode->pNode_Wildcard_GreaterThan, clientSocketID);
+        getSubject(pNode, subjects.emplace_back());
     }
+    return subjects;
 }
 
 // Returns subscription-infos that match the subject provided.
 VecSubscriptionInfo SubjectMatchingEngine::getMatchingSubscriptionInfos(const std::string& subject)
+{
+    VecSubscriptionInfo scratch;
+    auto matches = getMatchingSubscriptionInfos(subject, scratch);
+    return VecSubscriptionInfo(matches.begin(), matches.end());
+}
+
+// Returns subscription-infos that match the subject provided.
+// The caller provides a scratch vector, which should be reused between calls so that
+// matching does not allocate. The span returned refers either to the scratch vector or
+// to the engine's cache, and is valid until the next call to the engine.
+std::span<const SubscriptionInfo> SubjectMatchingEngine::getMatchingSubscriptionInfos(const std::string& subject, VecSubscriptionInfo& scratch)
 {
     // We check if we have the matches cached...
-    if (m_cachingEnabled)
+    if (m_cachingMode != CachingMode::DISABLED)
     {
-        auto it = m_cache.find(subject);
-        if (it != m_cache.end())
+        auto pCachedMatches = m_cache.find(subject);
+        if (pCachedMatches)
         {
-            return it->second;
+            return *pCachedMatches;
         }
     }
 
     // Caching is not enabled, or we did not find a match in the cache. So we
     // look for matching subscriptions...
-    VecSubscriptionInfo results;
+    scratch.clear();
+    m_matchTokenIDs.clear();
+    size_t tokenStart = 0;
+    if (canUseLiteralIndex(subject, tokenStart))
+    {
+        // No wildcard subscriptions can match the subject, so we only need to find
+        // subscriptions to the literal subject from the literal index...
+        m_fastPathMatches++;
+        auto it = m_literalNodes.find(subject);
+        if (it != m_literalNodes.end())
+        {
+            addSubscriptionInfos(it->second, scratch);
+        }
+    }
+    else
+    {
+        // Wildcard subscriptions could match the subject, or the subject is not in the form
+        // used by the literal index (see the class comments), so we walk the graph...
+        matchGraph(subject, tokenStart, scratch);
+    }
 
-    // We tokenize the subject...
-    auto tokens = MMUtils::tokenize(subject, '.');
-    auto tokenCount = tokens.size();
-    if (tokenCount != 0)
+    // We add the results to the cache. In adaptive mode we only do this if the
+    // subject is sent often...
+    if (m_cachingMode == CachingMode::ENABLED ||
+        (m_cachingMode == CachingMode::ADAPTIVE && m_cache.shouldAdmit(subject)))
     {
-        // We match tokens against the interest graph...
-        auto lastTokenIndex = tokenCount - 1;
-        getMatchingSubscriptionInfos(m_pRootNode, tokens, 0, lastTokenIndex, results);
+        m_cache.insert(subject, scratch);
     }
 
-    // We add the results to the cache...
-    if (m_cachingEnabled)
+    return scratch;
+}
+
+// Gets interest graph statistics.
+SubjectMatchingEngine::Stats SubjectMatchingEngine::getStats() const
+{
+    Stats stats;
+    stats.SubscriptionCount = m_subscriptionCount;
+    stats.NodeCount = m_nodePool.getLiveCount();
+    stats.NodeCapacity = m_nodePool.getCapacity();
+    stats.TokenCount = m_tokenInterner.size();
+    stats.LiteralSubjectCount = m_literalNodes.size();
+    stats.FastPathMatches = m_fastPathMatches;
+    stats.GraphWalks = m_graphWalks;
+    stats.MemoryBytes = m_nodePool.getCapacity() * sizeof(Node) + m_nodeAllocatedBytes;
+    return stats;
+}
+
+// Sets the caching mode and the maximum number of subjects to cache.
+void SubjectMatchingEngine::setCachingMode(CachingMode cachingMode, size_t cacheCapacity)
+{
+    m_cachingMode = cachingMode;
+    m_cache.setCapacity(cachingMode == CachingMode::DISABLED ? 0 : cacheCapacity);
+}
+
+// Looks up the token IDs for the subject, from the position provided, and adds them to m_matchTokenIDs.
+void SubjectMatchingEngine::findTokenIDs(std::string_view subject, size_t start)
+{
+    // We split the subject on the '.' delimiter in the same way as MMUtils::tokenize(),
+    // but look up the ID for each token rather than building a vector of tokens.
+    // Tokens which have not been interned are given the ID NO_TOKEN.
+    while (start < subject.size())
+    {
+        auto end = subject.find('.', start);
+        if (end == std::string_view::npos)
+        {
+            end = subject.size();
+        }
+        m_matchTokenIDs.push_back(m_tokenInterner.find(subject.substr(start, end - start)));
+        start = end + 1;
+    }
+}
+
+// Returns true if no wildcard subscriptions can match the subject, so that its matches
+// can be found from the literal index.
+// This may look up the first token of the subject into m_matchTokenIDs, in which case
+// tokenStart is set to the position of the next token.
+bool SubjectMatchingEngine::canUseLiteralIndex(std::string_view subject, size_t& tokenStart)
+{
+    // Subjects ending with '.' are not in the form used by the literal index...
+    if (subject.empty() || subject.back() == '.')
     {
-        m_cache.insert({ subject, results });
+        return false;
     }
 
-    return results;
+    // We check if there are any wildcard subscriptions at all...
+    if (m_pRootNode->WildcardSubscriptionCount == 0)
+    {
+        return true;
+    }
+
+    // A wildcard at the first level could match any subject...
+    if (m_pRootNode->pNode_Wildcard_Star || m_pRootNode->pNode_Wildcard_GreaterThan)
+    {
+        return false;
+    }
+
+    // Otherwise wildcard subscriptions must be below the node for the first token. We keep
+    // the token's ID so that we do not look it up again if we walk the graph...
+    auto firstTokenEnd = std::min(subject.find('.'), subject.size());
+    auto tokenID = m_tokenInterner.find(subject.substr(0, firstTokenEnd));
+    m_matchTokenIDs.push_back(tokenID);
+    tokenStart = firstTokenEnd + 1;
+    auto ppChildNode = (tokenID == TokenInterner::NO_TOKEN) ? nullptr : m_pRootNode->Nodes.find(tokenID);
+    return !ppChildNode || (*ppChildNode)->WildcardSubscriptionCount == 0;
+}
+
+// Matches the subject by walking the interest graph.
+// Tokens before the tokenStart position have already been looked up into m_matchTokenIDs.
+void SubjectMatchingEngine::matchGraph(std::string_view subject, size_t tokenStart, VecSubscriptionInfo& subscriptionInfos)
+{
+    m_graphWalks++;
+    startMatchStamp();
+
+    // We find the token IDs for the subject...
+    findTokenIDs(subject, tokenStart);
+    auto tokenCount = m_matchTokenIDs.size();
+    if (tokenCount != 0)
+    {
+        // We match tokens against the interest graph...
+        auto lastTokenIndex = tokenCount - 1;
+        getMatchingSubscriptionInfos(m_pRootNode, 0, lastTokenIndex, subscriptionInfos);
+    }
 }
 
 // Checks the current node for matching subscriptions.
-void SubjectMatchingEngine::getMatchingSubscriptionInfos(Node* pNode, const VecToken& tokens, size_t tokenIndex, size_t lastTokenIndex, VecSubscriptionInfo& subscriptionInfos)
+void SubjectMatchingEngine::getMatchingSubscriptionInfos(const Node* pNode, size_t tokenIndex, size_t lastTokenIndex, VecSubscriptionInfo& subscriptionInfos)
 {
     // We find the current token and check if this node contains it...
-    const auto& token = tokens[tokenIndex];
-    auto it = pNode->Nodes.find(token);
-    if (it != pNode->Nodes.end())
+    auto tokenID = m_matchTokenIDs[tokenIndex];
+    auto ppChildNode = (tokenID == TokenInterner::NO_TOKEN) ? nullptr : pNode->Nodes.find(tokenID);
+    if (ppChildNode)
     {
         // The token is in the node. 
-        auto pChildNode = it->second;
+        auto pChildNode = *ppChildNode;
         if (tokenIndex == lastTokenIndex)
         {
             // This is the last token, so we add the subscription-infos to the results...
-            addSubscriptionInfos(pChildNode, subscriptionInfos);
+            addDeduplicatedSubscriptionInfos(pChildNode, subscriptionInfos);
         }
         else
         {
             // This is not the last token, so we continue walking the graph...
-            getMatchingSubscriptionInfos(pChildNode, tokens, tokenIndex + 1, lastTokenIndex, subscriptionInfos);
+            getMatchingSubscriptionInfos(pChildNode, tokenIndex + 1, lastTokenIndex, subscriptionInfos);
         }
     }
 
@@ -140,7 +333,7 @@ void SubjectMatchingEngine::getMatchingSubscriptionInfos(Node* pNode, const VecT
     {
         // We have a '>' subscription. In this case we add the subscription infos
         // from the node without needing the walk the graph further...
-        addSubscriptionInfos(pNode->pNode_Wildcard_GreaterThan, subscriptionInfos);
+        addDeduplicatedSubscriptionInfos(pNode->pNode_Wildcard_GreaterThan, subscriptionInfos);
     }
 
     // We check if the node has the '*' wildcard...
@@ -151,32 +344,45 @@ void SubjectMatchingEngine::getMatchingSubscriptionInfos(Node* pNode, const VecT
         if (tokenIndex == lastTokenIndex)
         {
             // This is the last token, so we add the subscription-infos to the results...
-            addSubscriptionInfos(pChildNode, subscriptionInfos);
+            addDeduplicatedSubscriptionInfos(pChildNode, subscriptionInfos);
         }
         else
         {
             // This is not the last token, so we continue walking the graph...
-            getMatchingSubscriptionInfos(pChildNode, tokens, tokenIndex + 1, lastTokenIndex, subscriptionInfos);
+            getMatchingSubscriptionInfos(pChildNode, tokenIndex + 1, lastTokenIndex, subscriptionInfos);
         }
     }
 }
 
 // Adds all subscription infos from the node to the vector.
-void SubjectMatchingEngine::addSubscriptionInfos(Node* pNode, VecSubscriptionInfo& subscriptionInfos)
+void SubjectMatchingEngine::addSubscriptionInfos(const Node* pNode, VecSubscriptionInfo& subscriptionInfos) const
 {
-    for (const auto& pair : pNode->SubscriptionInfos)
+    subscriptionInfos.insert(subscriptionInfos.end(), pNode->SubscriptionInfos.begin(), pNode->SubscriptionInfos.end());
+}
+
+// Adds subscription infos from the node to the vector, skipping mesh peers which have already matched.
+void SubjectMatchingEngine::addDeduplicatedSubscriptionInfos(const Node* pNode, VecSubscriptionInfo& subscriptionInfos)
+{
+    for (const auto& subscriptionInfo : pNode->SubscriptionInfos)
     {
-        subscriptionInfos.push_back(pair.second);
+        auto& clientSlot = m_clientSlots[subscriptionInfo.getClientIndex()];
+        if (clientSlot.DeduplicateMatches)
+        {
+            if (clientSlot.MatchStamp == m_matchStamp)
+            {
+                // The client has already matched in this walk...
+                continue;
+            }
+            clientSlot.MatchStamp = m_matchStamp;
+        }
+        subscriptionInfos.push_back(subscriptionInfo);
     }
 }
 
 // Gets the node in the interest graph for the subject specified.
 // Creates nodes in the graph if necessary.
-SubjectMatchingEngine::Node* SubjectMatchingEngine::getOrCreateNode(const std::string& subject)
+SubjectMatchingEngine::Node* SubjectMatchingEngine::getOrCreateNode(const VecToken& tokens)
 {
-    // We tokenize the subject...
-    auto tokens = MMUtils::tokenize(subject, '.');
-
     // We find the node for the subject by walking the graph for each token...
     auto pNode = m_pRootNode;
     for (const auto& token : tokens)
@@ -186,7 +392,7 @@ SubjectMatchingEngine::Node* SubjectMatchingEngine::getOrCreateNode(const std::s
             // The token is is "*" wildcard...
             if (!pNode->pNode_Wildcard_Star)
             {
-                pNode->pNode_Wildcard_Star = new Node;
+                pNode->pNode_Wildcard_Star = createNode(pNode, TokenInterner::NO_TOKEN);
             }
             pNode = pNode->pNode_Wildcard_Star;
         }
@@ -195,7 +401,7 @@ SubjectMatchingEngine::Node* SubjectMatchingEngine::getOrCreateNode(const std::s
             // The token is is ">" wildcard...
             if (!pNode->pNode_Wildcard_GreaterThan)
             {
-                pNode->pNode_Wildcard_GreaterThan = new Node;
+                pNode->pNode_Wildcard_GreaterThan = createNode(pNode, TokenInterner::NO_TOKEN);
             }
             pNode = pNode->pNode_Wildcard_GreaterThan;
         }
@@ -203,20 +409,289 @@ SubjectMatchingEngine::Node* SubjectMatchingEngine::getOrCreateNode(const std::s
         {
             // We have a non-wildcard token.
             // We find or create the node for the token.
-            auto& nodeMap = pNode->Nodes;
-            auto it = nodeMap.find(token);
-            if (it == nodeMap.end())
+            auto tokenID = m_tokenInterner.find(token);
+            auto ppChildNode = (tokenID == TokenInterner::NO_TOKEN) ? nullptr : pNode->Nodes.find(tokenID);
+            if (!ppChildNode)
             {
-                // There is no node for the token, so we create it...
-                pNode = new Node;
-                nodeMap.insert({ std::string(token), pNode });
+                // There is no node for the token, so we create it. The new node holds
+                // a reference to the token...
+                tokenID = m_tokenInterner.addReference(token);
+                auto pChildNode = createNode(pNode, tokenID);
+                m_nodeAllocatedBytes -= pNode->Nodes.getAllocatedBytes();
+                pNode->Nodes.insert(tokenID, pChildNode);
+                m_nodeAllocatedBytes += pNode->Nodes.getAllocatedBytes();
+                pNode = pChildNode;
             }
             else
             {
-                pNode = it->second;
+                pNode = *ppChildNode;
             }
         }
     }
 
     return pNode;
 }
+
+// Gets the node in the interest graph for the subject specified.
+// Returns nullptr if there is no node for the subject.
+SubjectMatchingEngine::Node* SubjectMatchingEngine::findNode(const VecToken& tokens) const
+{
+    auto pNode = m_pRootNode;
+    for (const auto& token : tokens)
+    {
+        if (token == WILDCARD_STAR)
+        {
+            pNode = pNode->pNode_Wildcard_Star;
+        }
+        else if (token == WILDCARD_GREATER_THAN)
+        {
+            pNode = pNode->pNode_Wildcard_GreaterThan;
+        }
+        else
+        {
+            auto tokenID = m_tokenInterner.find(token);
+            auto ppChildNode = (tokenID == TokenInterner::NO_TOKEN) ? nullptr : pNode->Nodes.find(tokenID);
+            pNode = ppChildNode ? *ppChildNode : nullptr;
+        }
+        if (!pNode)
+        {
+            return nullptr;
+        }
+    }
+    return pNode;
+}
+
+// Creates a child node of the node provided.
+SubjectMatchingEngine::Node* SubjectMatchingEngine::createNode(Node* pParent, uint32_t tokenID)
+{
+    auto pNode = m_nodePool.create();
+    pNode->pParent = pParent;
+    pNode->TokenID = tokenID;
+    return pNode;
+}
+
+// Removes the node, and then its parents, while they are unused.
+void SubjectMatchingEngine::pruneNode(Node* pNode)
+{
+    // We walk up the graph until we find a node which is still in use. (We never remove the root.)
+    while (pNode != m_pRootNode && pNode->isUnused())
+    {
+        // We remove the node from its parent...
+        auto pParent = pNode->pParent;
+        if (pParent->pNode_Wildcard_Star == pNode)
+        {
+            pParent->pNode_Wildcard_Star = nullptr;
+        }
+        else if (pParent->pNode_Wildcard_GreaterThan == pNode)
+        {
+            pParent->pNode_Wildcard_GreaterThan = nullptr;
+        }
+        else
+        {
+            pParent->Nodes.erase(pNode->TokenID);
+            m_tokenInterner.release(pNode->TokenID);
+        }
+
+        // We return the node to the pool (along with the memory for its child map) and move up to the parent...
+        m_nodeAllocatedBytes -= pNode->Nodes.getAllocatedBytes() + pNode->SubscriptionInfos.getAllocatedBytes();
+        m_nodePool.release(pNode);
+        pNode = pParent;
+    }
+}
+
+// Releases the node and all its child nodes back to the node pool.
+void SubjectMatchingEngine::releaseNodes(Node* pNode)
+{
+    pNode->Nodes.forEach(
+        [&](uint32_t /*tokenID*/, Node* pChildNode)
+        {
+            releaseNodes(pChildNode);
+        });
+    if (pNode->pNode_Wildcard_Star)
+    {
+        releaseNodes(pNode->pNode_Wildcard_Star);
+    }
+    if (pNode->pNode_Wildcard_GreaterThan)
+    {
+        releaseNodes(pNode->pNode_Wildcard_GreaterThan);
+    }
+    m_nodePool.release(pNode);
+}
+
+// Gets the pattern (tokens) for the path from the root to the node provided.
+void SubjectMatchingEngine::getPattern(const Node* pNode, VecToken& pattern) const
+{
+    // We walk up the graph collecting the tokens, and then reverse them...
+    pattern.clear();
+    for (; pNode != m_pRootNode; pNode = pNode->pParent)
+    {
+        auto pParent = pNode->pParent;
+        if (pParent->pNode_Wildcard_Star == pNode)
+        {
+            pattern.push_back(WILDCARD_STAR);
+        }
+        else if (pParent->pNode_Wildcard_GreaterThan == pNode)
+        {
+            pattern.push_back(WILDCARD_GREATER_THAN);
+        }
+        else
+        {
+            pattern.push_back(m_tokenInterner.getToken(pNode->TokenID));
+        }
+    }
+    std::reverse(pattern.begin(), pattern.end());
+}
+
+// Removes the node from the reverse index for the client.
+void SubjectMatchingEngine::removeClientNode(std::unordered_map<uint64_t, ClientInfo>::iterator it, Node* pNode)
+{
+    it->second.Nodes.erase(pNode);
+    if (it->second.Nodes.empty())
+    {
+        removeClient(it);
+    }
+}
+
+// Adds the subscription info to the node, keeping track of allocated memory.
+// Returns true if it was added, or false if the client already has a subscription on the node.
+bool SubjectMatchingEngine::insertSubscriptionInfo(Node* pNode, const SubscriptionInfo& subscriptionInfo)
+{
+    m_nodeAllocatedBytes -= pNode->SubscriptionInfos.getAllocatedBytes();
+    auto inserted = pNode->SubscriptionInfos.insert(subscriptionInfo);
+    m_nodeAllocatedBytes += pNode->SubscriptionInfos.getAllocatedBytes();
+    return inserted;
+}
+
+// Erases the client's subscription info from the node, keeping track of allocated memory.
+// Returns true if it was erased, or false if the client has no subscription on the node.
+bool SubjectMatchingEngine::eraseSubscriptionInfo(Node* pNode, uint32_t clientIndex)
+{
+    m_nodeAllocatedBytes -= pNode->SubscriptionInfos.getAllocatedBytes();
+    auto erased = pNode->SubscriptionInfos.erase(clientIndex);
+    m_nodeAllocatedBytes += pNode->SubscriptionInfos.getAllocatedBytes();
+    return erased;
+}
+
+// Gets the client info for the client specified, creating it if necessary.
+SubjectMatchingEngine::ClientInfo& SubjectMatchingEngine::getOrCreateClient(uint64_t clientSocketID, Socket* pClientSocket)
+{
+    auto [it, inserted] = m_clients.try_emplace(clientSocketID);
+    auto& client = it->second;
+    if (inserted)
+    {
+        // This is a new client, so we give it an index, reusing one from a removed client if we can...
+        if (m_freeClientIndexes.empty())
+        {
+            client.ClientIndex = static_cast<uint32_t>(m_clientSlots.size());
+            m_clientSlots.emplace_back();
+        }
+        else
+        {
+            client.ClientIndex = m_freeClientIndexes.back();
+            m_freeClientIndexes.pop_back();
+        }
+
+        // Mesh peers only match once for each subject...
+        m_clientSlots[client.ClientIndex].DeduplicateMatches = pClientSocket && pClientSocket->getIsMeshPeer();
+    }
+    return client;
+}
+
+// Removes the client info, releasing the client's index.
+void SubjectMatchingEngine::removeClient(std::unordered_map<uint64_t, ClientInfo>::iterator it)
+{
+    // We reset the slot so that it does not carry a match stamp or the deduplication setting over
+    // to the next client which uses it.
+    // Note: The client no longer has subscriptions, so its index is not in any cached matches.
+    auto clientIndex = it->second.ClientIndex;
+    m_clientSlots[clientIndex] = ClientSlot();
+    m_freeClientIndexes.push_back(clientIndex);
+    m_clients.erase(it);
+}
+
+// Starts a new match stamp for deduplicating matches.
+void SubjectMatchingEngine::startMatchStamp()
+{
+    // Slots are reset to stamp zero. So when the stamp wraps around we reset all the slots,
+    // so that no slot can hold a stamp from before the wrap...
+    m_matchStamp++;
+    if (m_matchStamp == 0)
+    {
+        for (auto& clientSlot : m_clientSlots)
+        {
+            clientSlot.MatchStamp = 0;
+        }
+        m_matchStamp = 1;
+    }
+}
+
+// Updates the literal index and wildcard counts when a subscription has been added to the node.
+void SubjectMatchingEngine::onSubscriptionAdded(Node* pNode)
+{
+    m_subscriptionCount++;
+    if (isWildcardPattern(pNode))
+    {
+        // We add the subscription to the wildcard counts for the node and its parents...
+        for (auto pCountNode = pNode; pCountNode; pCountNode = pCountNode->pParent)
+        {
+            pCountNode->WildcardSubscriptionCount++;
+        }
+    }
+    else if (pNode->SubscriptionInfos.size() == 1)
+    {
+        // This is the first subscription to a literal subject, so we add the node to the literal index...
+        getSubject(pNode, m_literalSubject);
+        m_literalNodes.insert({ m_literalSubject, pNode });
+    }
+}
+
+// Updates the literal index and wildcard counts when a subscription has been removed from the node.
+void SubjectMatchingEngine::onSubscriptionRemoved(Node* pNode)
+{
+    m_subscriptionCount--;
+    if (isWildcardPattern(pNode))
+    {
+        // We remove the subscription from the wildcard counts for the node and its parents...
+        for (auto pCountNode = pNode; pCountNode; pCountNode = pCountNode->pParent)
+        {
+            pCountNode->WildcardSubscriptionCount--;
+        }
+    }
+    else if (pNode->SubscriptionInfos.empty())
+    {
+        // There are no more subscriptions to the literal subject, so we remove it from the literal index...
+        getSubject(pNode, m_literalSubject);
+        m_literalNodes.erase(m_literalSubject);
+    }
+}
+
+// Gets the subject (or pattern) for the node, joining its tokens with the '.' delimiter.
+void SubjectMatchingEngine::getSubject(const Node* pNode, std::string& subject)
+{
+    // We join the node's tokens with the '.' delimiter. This gives the subject in the form
+    // in which it is sent, even if the subscription was made with a trailing '.'...
+    getPattern(pNode, m_pattern);
+    subject.clear();
+    for (size_t i = 0; i < m_pattern.size(); ++i)
+    {
+        if (i != 0)
+        {
+            subject += '.';
+        }
+        subject += m_pattern[i];
+    }
+}
+
+// Returns true if the path from the root to the node includes a wildcard.
+bool SubjectMatchingEngine::isWildcardPattern(const Node* pNode) const
+{
+    // Wildcard nodes are the only nodes (other than the root) without a token ID...
+    for (; pNode != m_pRootNode; pNode = pNode->pParent)
+    {
+        if (pNode->TokenID == TokenInterner::NO_TOKEN)
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -1,11 +1,20 @@
 #pragma once
 #include <cstdint>
+#include <span>
 #include <string>
 #include <string_view>
-#include <map>
+#include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <MMUtils.h>
 #include "GatewaySharedPointers.h"
+#include "SubscriptionInfo.h"
+#include "SubscriberSet.h"
+#include "FlatTokenMap.h"
+#include "TokenInterner.h"
+#include "SubjectMatchCache.h"
+#include "SlabPool.h"
+#include "StringHash.h"
 
 namespace MessagingMesh
 {
@@ -47,6 +56,18 @@ namespace MessagingMesh
     /// - A.B.C => CLient-A
     /// - A.B.C.D => no-match
     /// 
+    /// Interned tokens
+    /// ---------------
+    /// Tokens are not stored in the graph as strings. Each token is interned to a 32-bit
+    /// ID (see TokenInterner) and each node holds its children in a FlatTokenMap keyed by
+    /// token ID. Walking one level of the graph is then an integer hash probe into a 
+    /// contiguous table.
+    /// 
+    /// When matching a subject we look up the ID for each of its tokens once, into a
+    /// scratch vector which is reused between calls, and then walk the graph using the
+    /// IDs. A token we have never interned cannot match a non-wildcard node, but can
+    /// still match * and > wildcards.
+    /// 
     /// Wildcard *
     /// ----------
     /// Subscriptions can include the * wildcard. This matches any single token at the
@@ -89,21 +110,141 @@ namespace MessagingMesh
     ///       If we find > we have an immediate match without checking further tokens.
     ///       We still check all remaining tokens as there may be matches to other subscriptions.
     /// 
+    /// Literal subjects
+    /// ----------------
+    /// Most subscriptions are to literal subjects (with no wildcards). As well as being in the
+    /// graph, each node which holds subscriptions to a literal subject is in a hash index keyed
+    /// by the full subject. So the literal matches for a sent subject are found with one hash
+    /// probe, without tokenizing the subject or walking the graph.
+    /// 
+    /// Each node also holds the number of wildcard subscriptions at or below it in the graph,
+    /// so we can tell which prefixes have wildcard subscriptions. We only use the literal index
+    /// when no wildcard subscriptions can match the sent subject, ie when the root has no * or >
+    /// child and the node for the subject's first token has no wildcard subscriptions below it.
+    /// Otherwise we walk the graph as described above, which finds both literal and wildcard
+    /// matches.
+    /// 
+    /// For example, with subscriptions to A.B.C, A.B.D and X.*.Z:
+    /// - A.B.C: A has no wildcard subscriptions below it, so we find its subscriptions with one hash probe.
+    /// - X.Y.Z: X has a wildcard subscription below it, so we walk the graph.
+    /// 
+    /// Subjects ending with '.' are not in the same form as the keys in the literal index (the
+    /// trailing empty token is dropped when tokenizing), so for these we always walk the graph.
+    /// 
+    /// Deduplicating matches for mesh peers
+    /// ------------------------------------
+    /// A subject can match several subscriptions from the same client, for example A.B.C
+    /// matches both A.B.* and A.>. Clients are sent the message for each of these, with each
+    /// subscription ID. But mesh peers should be sent the message only once, as the peer
+    /// gateway does its own matching and fans the message out to its clients.
+    /// 
+    /// So we give each client a dense index (held in its SubscriptionInfos) and keep a slot
+    /// for each index with a match stamp. Each graph walk uses a new stamp, and when we find
+    /// a subscription for a mesh peer whose slot already has the current stamp we skip it.
+    /// This means matches for mesh peers are deduplicated in the same pass which finds them,
+    /// without clearing anything afterwards or writing to the sockets.
+    /// 
+    /// Matches from the literal index come from a single node, which holds at most one
+    /// subscription per client, so these never need deduplicating.
+    /// 
     /// Cached lookups
     /// --------------
-    /// Caching can be enabled or disabled with the enableCaching(true/false) method.
-    /// If caching is enabled we store the results of matches (found via the interest 
-    /// graph) in a map of subject to client-infos. 
+    /// Caching is controlled with the setCachingMode() method:
+    /// - DISABLED: Every match uses the interest graph.
+    /// - ENABLED:  The results of every match are cached.
+    /// - ADAPTIVE: Only the results for subjects which are sent often are cached.
     /// 
     /// When matching a subject, we first check the cache and only use the interest graph
-    /// if no match is found.
+    /// if no match is found. The cache is bounded (see SubjectMatchCache).
+    /// 
+    /// When a subscription is added or removed we invalidate only the cached subjects which
+    /// its pattern matches. So a client subscribing to A.B.C invalidates A.B.C, but not
+    /// X.Y.Z. A client subscribing to A.> invalidates all cached subjects starting with A.
+    /// 
+    /// Removing nodes
+    /// --------------
+    /// A node is in use while it holds subscriptions or has child nodes. When a subscription
+    /// is removed we walk back up the graph from its node (using the parent pointers) removing
+    /// nodes which are no longer in use. This matters for subjects which are only subscribed
+    /// to once, such as request inboxes (_INBOX.[guid]), which would otherwise leave nodes
+    /// and interned tokens in the graph forever.
+    /// 
+    /// Nodes are allocated from a per-engine SlabPool, so removed nodes are reused for new
+    /// subscriptions.
+    /// 
+    /// Subscribers
+    /// -----------
+    /// The subscriptions on each node are held by value in a SubscriberSet, keyed by client
+    /// index. Up to four subscribers are held inline in the node, and larger sets spill to a
+    /// sorted vector. So the many nodes with one or two subscribers need no allocation beyond
+    /// the node itself.
     /// 
-    /// We clear or modify the cache as subscriptions are added or removed.
+    /// Stats include an estimate of the memory used by the graph, which is kept up to date as
+    /// nodes and subscriber sets grow and shrink rather than by walking the graph.
+    /// 
+    /// Removing all subscriptions for a client
+    /// ---------------------------------------
+    /// We keep a reverse index of the nodes on which each client socket has subscriptions.
+    /// When a client disconnects we only visit those nodes, rather than walking the whole
+    /// graph, so the cost depends on the number of subscriptions the client had.
+    /// 
+    /// Many clients can be removed in one batch. If the batch removes more subscriptions
+    /// than there are subjects in the cache we clear the cache once rather than invalidating
+    /// it for each subscription.
     /// </summary>
     class SubjectMatchingEngine
     {
+    // Public types...
+    public:
+        // Interest graph statistics.
+        struct Stats
+        {
+            // The number of subscriptions...
+            size_t SubscriptionCount = 0;
+
+            // The number of nodes in the interest graph (including the root)...
+            size_t NodeCount = 0;
+
+            // The number of nodes the node pool can hold without allocating more memory...
+            size_t NodeCapacity = 0;
+
+            // The number of interned tokens...
+            size_t TokenCount = 0;
+
+            // The number of literal subjects in the literal index...
+            size_t LiteralSubjectCount = 0;
+
+            // The number of matches resolved from the literal index without walking the graph...
+            uint64_t FastPathMatches = 0;
+
+            // The number of matches which walked the graph for wildcard subscriptions...
+            uint64_t GraphWalks = 0;
+
+            // The memory used by the interest graph: the node pool, child maps and spilled subscriber sets.
+            // (This does not include the literal index, the reverse index or the interned tokens.)
+            size_t MemoryBytes = 0;
+        };
+
+        // Controls caching of the results of matches.
+        enum class CachingMode
+        {
+            DISABLED,
+            ENABLED,
+            ADAPTIVE
+        };
+
     // Public methods...
     public:
+        // Constructor.
+        SubjectMatchingEngine();
+
+        // Destructor.
+        ~SubjectMatchingEngine();
+
+        // The engine cannot be copied...
+        SubjectMatchingEngine(const SubjectMatchingEngine&) = delete;
+        SubjectMatchingEngine& operator=(const SubjectMatchingEngine&) = delete;
+
         // Adds a subscription.
         // Returns the number of clients registered for this subject.
         size_t addSubscription(const std::string& subject, uint32_t subscriptionID, uint64_t clientSocketID, Socket* pClientSocket);
@@ -115,16 +256,39 @@ namespace MessagingMesh
         // Removes all subscriptions for the client specified.
         void removeAllSubscriptions(uint64_t clientSocketID);
 
+        // Removes all subscriptions for the clients specified.
+        void removeAllSubscriptions(const std::vector<uint64_t>& clientSocketIDs);
+
+        // Gets the subjects (including wildcard patterns) to which the client has subscribed.
+        std::vector<std::string> getSubjects(uint64_t clientSocketID);
+
         // Returns subscription-infos that match the subject provided.
+        // NOTE: This allocates a new vector for each call. Message routing should use the
+        //       overload (below) which takes a scratch vector.
         VecSubscriptionInfo getMatchingSubscriptionInfos(const std::string& subject);
 
+        // Returns subscription-infos that match the subject provided.
+        // The caller provides a scratch vector, which should be reused between calls so that
+        // matching does not allocate. The span returned refers either to the scratch vector or
+        // to the engine's cache, and is valid until the next call to the engine.
+        std::span<const SubscriptionInfo> getMatchingSubscriptionInfos(const std::string& subject, VecSubscriptionInfo& scratch);
+
+        // Sets the caching mode and the maximum number of subjects to cache.
+        void setCachingMode(CachingMode cachingMode, size_t cacheCapacity = SubjectMatchCache::DEFAULT_CAPACITY);
+
+        // Gets cache statistics.
+        SubjectMatchCache::Stats getCacheStats() const { return m_cache.getStats(); }
+
+        // Gets interest graph statistics.
+        Stats getStats() const;
+
     // Private types...
     private:
         // A node in the interest graph.
         struct Node
         {
-            // Map of tokens to child nodes...
-            std::map<std::string, Node*, std::less<>> Nodes;
+            // Map of token IDs to child nodes...
+            FlatTokenMap<Node*> Nodes;
 
             // Child node for the * wildcard...
             Node* pNode_Wildcard_Star = nullptr;
@@ -132,36 +296,178 @@ namespace MessagingMesh
             // Child node for the > wildcard...
             Node* pNode_Wildcard_GreaterThan = nullptr;
 
-            // Map of client socket ID to SubscriptionInfo.
-            std::unordered_map<uint64_t, SubscriptionInfoPtr> SubscriptionInfos;
+            // Subscriptions to the node's subject, keyed by client index...
+            SubscriberSet SubscriptionInfos;
+
+            // The parent node (nullptr for the root)...
+            Node* pParent = nullptr;
+
+            // The ID of the token for this node in its parent's Nodes (NO_TOKEN for wildcard nodes)...
+            uint32_t TokenID = TokenInterner::NO_TOKEN;
+
+            // The number of subscriptions with wildcard patterns at or below this node...
+            uint32_t WildcardSubscriptionCount = 0;
+
+            // Returns true if the node has no subscriptions and no child nodes.
+            bool isUnused() const
+            {
+                return SubscriptionInfos.empty() && Nodes.empty() && !pNode_Wildcard_Star && !pNode_Wildcard_GreaterThan;
+            }
+        };
+
+        // Info about a client with subscriptions.
+        struct ClientInfo
+        {
+            // The nodes on which the client has subscriptions...
+            std::unordered_set<Node*> Nodes;
+
+            // The client's dense index (into m_clientSlots)...
+            uint32_t ClientIndex = 0;
+        };
+
+        // The slot for a client's dense index.
+        struct ClientSlot
+        {
+            // The stamp of the last graph walk which matched the client (if it is deduplicated)...
+            uint32_t MatchStamp = 0;
+
+            // True if the client should match at most once for each subject (ie, it is a mesh peer)...
+            bool DeduplicateMatches = false;
         };
 
     // Private functions...
     private:
         // Gets the node in the interest graph for the subject specified.
         // Creates nodes in the graph if necessary.
-        Node* getOrCreateNode(const std::string& subject);
+        Node* getOrCreateNode(const VecToken& tokens);
+
+        // Gets the node in the interest graph for the subject specified.
+        // Returns nullptr if there is no node for the subject.
+        Node* findNode(const VecToken& tokens) const;
+
+        // Creates a child node of the node provided.
+        Node* createNode(Node* pParent, uint32_t tokenID);
+
+        // Removes the node, and then its parents, while they are unused.
+        void pruneNode(Node* pNode);
+
+        // Releases the node and all its child nodes back to the node pool.
+        void releaseNodes(Node* pNode);
+
+        // Removes all subscriptions for the client specified, using the reverse index.
+        // Invalidates cached subjects for each subscription if invalidateCache is true.
+        void removeAllSubscriptions(uint64_t clientSocketID, bool invalidateCache);
+
+        // Gets the pattern (tokens) for the path from the root to the node provided.
+        void getPattern(const Node* pNode, VecToken& pattern) const;
+
+        // Removes the node from the reverse index for the client.
+        void removeClientNode(std::unordered_map<uint64_t, ClientInfo>::iterator it, Node* pNode);
+
+        // Adds the subscription info to the node, keeping track of allocated memory.
+        // Returns true if it was added, or false if the client already has a subscription on the node.
+        bool insertSubscriptionInfo(Node* pNode, const SubscriptionInfo& subscriptionInfo);
+
+        // Erases the client's subscription info from the node, keeping track of allocated memory.
+        // Returns true if it was erased, or false if the client has no subscription on the node.
+        bool eraseSubscriptionInfo(Node* pNode, uint32_t clientIndex);
+
+        // Updates the literal index and wildcard counts when a subscription has been added to the node.
+        void onSubscriptionAdded(Node* pNode);
+
+        // Updates the literal index and wildcard counts when a subscription has been removed from the node.
+        void onSubscriptionRemoved(Node* pNode);
+
+        // Returns true if the path from the root to the node includes a wildcard.
+        bool isWildcardPattern(const Node* pNode) const;
 
-        // Removes all subscriptions for the client specified from the node provided
-        // and from all its child nodes recursively.
-        void removeAllSubscriptions(Node* pNode, uint64_t clientSocketID);
+        // Gets the subject (or pattern) for the node, joining its tokens with the '.' delimiter.
+        void getSubject(const Node* pNode, std::string& subject);
+
+        // Returns true if no wildcard subscriptions can match the subject, so that its matches
+        // can be found from the literal index.
+        // This may look up the first token of the subject into m_matchTokenIDs, in which case
+        // tokenStart is set to the position of the next token.
+        bool canUseLiteralIndex(std::string_view subject, size_t& tokenStart);
+
+        // Matches the subject by walking the interest graph.
+        // Tokens before the tokenStart position have already been looked up into m_matchTokenIDs.
+        void matchGraph(std::string_view subject, size_t tokenStart, VecSubscriptionInfo& subscriptionInfos);
 
         // Checks the current node for matching subscriptions.
-        void getMatchingSubscriptionInfos(Node* pNode, const VecToken& tokens, size_t tokenIndex, size_t lastTokenIndex, VecSubscriptionInfo& subscriptionInfos);
+        void getMatchingSubscriptionInfos(const Node* pNode, size_t tokenIndex, size_t lastTokenIndex, VecSubscriptionInfo& subscriptionInfos);
 
         // Adds all subscription infos from the node to the vector.
-        void addSubscriptionInfos(Node* pNode, VecSubscriptionInfo& subscriptionInfos);
+        void addSubscriptionInfos(const Node* pNode, VecSubscriptionInfo& subscriptionInfos) const;
+
+        // Adds subscription infos from the node to the vector, skipping mesh peers which have already matched.
+        void addDeduplicatedSubscriptionInfos(const Node* pNode, VecSubscriptionInfo& subscriptionInfos);
+
+        // Gets the client info for the client specified, creating it if necessary.
+        ClientInfo& getOrCreateClient(uint64_t clientSocketID, Socket* pClientSocket);
+
+        // Removes the client info, releasing the client's index.
+        void removeClient(std::unordered_map<uint64_t, ClientInfo>::iterator it);
+
+        // Starts a new match stamp for deduplicating matches.
+        void startMatchStamp();
+
+        // Looks up the token IDs for the subject, from the position provided, and adds them to m_matchTokenIDs.
+        void findTokenIDs(std::string_view subject, size_t start);
 
     // Private data...
     private:
+        // Pool from which we allocate nodes...
+        SlabPool<Node> m_nodePool;
+
         // The root node of the interest graph...
-        Node* m_pRootNode = new Node;
+        Node* m_pRootNode;
+
+        // The number of subscriptions in the graph...
+        size_t m_subscriptionCount = 0;
+
+        // Bytes allocated by nodes for their child maps and spilled subscriber sets...
+        size_t m_nodeAllocatedBytes = 0;
+
+        // Nodes holding subscriptions to literal subjects, keyed by subject...
+        std::unordered_map<std::string, Node*, StringHash, std::equal_to<>> m_literalNodes;
+
+        // Literal subject for the node being added or removed (reused between calls)...
+        std::string m_literalSubject;
+
+        // The number of matches resolved from the literal index without walking the graph...
+        uint64_t m_fastPathMatches = 0;
+
+        // The number of matches which walked the graph...
+        uint64_t m_graphWalks = 0;
+
+        // Clients with subscriptions, keyed by client socket ID. This includes the reverse index
+        // of the nodes on which each client has subscriptions...
+        std::unordered_map<uint64_t, ClientInfo> m_clients;
+
+        // Slots for client indexes...
+        std::vector<ClientSlot> m_clientSlots;
+
+        // Client indexes released by clients with no remaining subscriptions, for reuse...
+        std::vector<uint32_t> m_freeClientIndexes;
+
+        // The stamp for the current graph walk (see "Deduplicating matches for mesh peers")...
+        uint32_t m_matchStamp = 0;
+
+        // Pattern for the node being removed (reused between calls)...
+        VecToken m_pattern;
+
+        // Token IDs for the tokens used in the graph...
+        TokenInterner m_tokenInterner;
+
+        // Token IDs for the subject currently being matched (reused between matches)...
+        std::vector<uint32_t> m_matchTokenIDs;
 
-        // Controls whether caching of sent subjects to subscription-infos is enabled...
-        bool m_cachingEnabled = false;
+        // Controls caching of sent subjects to subscription-infos...
+        CachingMode m_cachingMode = CachingMode::DISABLED;
 
-        // Cache of sent subjects to subscription-infos for them...
-        std::unordered_map<std::string, VecSubscriptionInfo> m_cache;
+        // Cache of sent subjects to subscription-infos for them (empty until caching is enabled)...
+        SubjectMatchCache m_cache{ 0 };
 
     // Constants...
     private:
@@ -0,0 +1,186 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "SubscriptionInfo.h"
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// A compact set of the subscriptions to one subject, keyed by client index.
+    ///
+    /// Used for the subscriptions held on each node of the interest graph. Most subjects have
+    /// only a handful of subscribers (and request inboxes have exactly one), so a hash map per
+    /// node costs far more in buckets and per-item allocations than the subscriptions themselves.
+    ///
+    /// Storage
+    /// -------
+    /// Up to INLINE_CAPACITY subscription infos are held inline, with no heap allocation. Beyond
+    /// this the set spills to a vector. In both cases the items are held by value in one
+    /// contiguous array sorted by client index, so:
+    /// - Iterating the subscribers for a match is a linear read of the array.
+    /// - Finding a client's subscription is a short scan (inline) or a binary search (spilled).
+    ///
+    /// When a spilled set shrinks to INLINE_CAPACITY / 2 items it moves back inline. (We wait until
+    /// it is well below the inline capacity, so a set which hovers around the capacity does not
+    /// allocate and free a vector on every change.)
+    ///
+    /// The set is not copyable, as it owns the spilled vector.
+    /// </summary>
+    class SubscriberSet
+    {
+    // Public methods...
+    public:
+        // Constructor.
+        SubscriberSet() {}
+
+        // Destructor.
+        ~SubscriberSet()
+        {
+            if (m_isSpilled)
+            {
+                delete m_pSpilled;
+            }
+        }
+
+        // The set cannot be copied...
+        SubscriberSet(const SubscriberSet&) = delete;
+        SubscriberSet& operator=(const SubscriberSet&) = delete;
+
+        // Adds the subscription info, keyed by its client index.
+        // Returns true if it was added, or false if the client already has a subscription in the set.
+        bool insert(const SubscriptionInfo& subscriptionInfo)
+        {
+            auto clientIndex = subscriptionInfo.getClientIndex();
+            auto index = lowerBound(clientIndex);
+            if (index < m_size && begin()[index].getClientIndex() == clientIndex)
+            {
+                return false;
+            }
+
+            if (m_isSpilled)
+            {
+                m_pSpilled->insert(m_pSpilled->begin() + index, subscriptionInfo);
+            }
+            else if (m_size < INLINE_CAPACITY)
+            {
+                // We shift the items after the insertion point up by one...
+                std::copy_backward(m_inline + index, m_inline + m_size, m_inline + m_size + 1);
+                m_inline[index] = subscriptionInfo;
+            }
+            else
+            {
+                // The inline storage is full, so we spill to a vector...
+                auto pSpilled = new std::vector<SubscriptionInfo>();
+                pSpilled->reserve(INLINE_CAPACITY * 2);
+                pSpilled->assign(m_inline, m_inline + m_size);
+                pSpilled->insert(pSpilled->begin() + index, subscriptionInfo);
+                m_pSpilled = pSpilled;
+                m_isSpilled = true;
+            }
+            ++m_size;
+            return true;
+        }
+
+        // Erases the subscription info for the client index.
+        // Returns true if it was erased, or false if the client has no subscription in the set.
+        bool erase(uint32_t clientIndex)
+        {
+            auto index = lowerBound(clientIndex);
+            if (index >= m_size || begin()[index].getClientIndex() != clientIndex)
+            {
+                return false;
+            }
+            --m_size;
+
+            if (!m_isSpilled)
+            {
+                std::copy(m_inline + index + 1, m_inline + m_size + 1, m_inline + index);
+                return true;
+            }
+
+            m_pSpilled->erase(m_pSpilled->begin() + index);
+            if (m_size <= INLINE_CAPACITY / 2)
+            {
+                // The set is small enough to move back inline. The inline storage shares
+                // memory with the vector pointer, so we take the pointer first...
+                auto pSpilled = m_pSpilled;
+                m_isSpilled = false;
+                std::copy(pSpilled->begin(), pSpilled->end(), m_inline);
+                delete pSpilled;
+            }
+            return true;
+        }
+
+        // Returns the subscription info for the client index, or nullptr if the client has no subscription in the set.
+        const SubscriptionInfo* find(uint32_t clientIndex) const
+        {
+            auto index = lowerBound(clientIndex);
+            if (index < m_size && begin()[index].getClientIndex() == clientIndex)
+            {
+                return begin() + index;
+            }
+            return nullptr;
+        }
+
+        // Gets the first subscription info (in client index order).
+        const SubscriptionInfo* begin() const { return m_isSpilled ? m_pSpilled->data() : m_inline; }
+
+        // Gets the position after the last subscription info.
+        const SubscriptionInfo* end() const { return begin() + m_size; }
+
+        // Gets the number of subscription infos in the set.
+        size_t size() const { return m_size; }
+
+        // Returns true if the set is empty.
+        bool empty() const { return m_size == 0; }
+
+        // Gets the number of heap bytes allocated by the set (zero unless it has spilled).
+        size_t getAllocatedBytes() const
+        {
+            return m_isSpilled ? sizeof(std::vector<SubscriptionInfo>) + m_pSpilled->capacity() * sizeof(SubscriptionInfo) : 0;
+        }
+
+    // Public constants...
+    public:
+        // The number of subscription infos held without allocating...
+        static constexpr uint32_t INLINE_CAPACITY = 4;
+
+    // Private functions...
+    private:
+        // Gets the position of the first item with a client index not less than the one provided.
+        size_t lowerBound(uint32_t clientIndex) const
+        {
+            // Inline sets are small enough that a linear scan is quicker than a binary search...
+            auto pBegin = begin();
+            if (!m_isSpilled)
+            {
+                size_t index = 0;
+                while (index < m_size && pBegin[index].getClientIndex() < clientIndex)
+                {
+                    ++index;
+                }
+                return index;
+            }
+            auto it = std::lower_bound(pBegin, pBegin + m_size, clientIndex,
+                [](const SubscriptionInfo& subscriptionInfo, uint32_t index) { return subscriptionInfo.getClientIndex() < index; });
+            return it - pBegin;
+        }
+
+    // Private data...
+    private:
+        // The items are held inline until the set spills, and then in the vector...
+        union
+        {
+            std::vector<SubscriptionInfo>* m_pSpilled = nullptr;
+            SubscriptionInfo m_inline[INLINE_CAPACITY];
+        };
+
+        // The number of items in the set...
+        uint32_t m_size = 0;
+
+        // True if the items are held in the spilled vector...
+        bool m_isSpilled = false;
+    };
+} // namespace
+
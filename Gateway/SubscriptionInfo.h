@@ -8,15 +8,20 @@ namespace MessagingMesh
 
     /// <summary>
     /// Info about a subscription, stored in the subject matching engine's interest graph. 
+    /// 
+    /// This is a small value type (socket pointer, subscription ID and client index), so matches
+    /// can be copied into vectors and caches without heap allocation or reference counting.
     /// </summary>
     class SubscriptionInfo
     {
     // Public methods...
     public:
-        // Creates a SubscriptionInfo instance.
-        static SubscriptionInfoPtr create(Socket* pSocket, uint32_t subscriptionID) 
-        { 
-            return SubscriptionInfoPtr(new SubscriptionInfo(pSocket, subscriptionID)); 
+        // Constructor.
+        SubscriptionInfo(Socket* pSocket, uint32_t subscriptionID, uint32_t clientIndex = 0) :
+            m_pSocket(pSocket),
+            m_subscriptionID(subscriptionID),
+            m_clientIndex(clientIndex)
+        {
         }
 
         // Gets the socket.
@@ -25,15 +30,8 @@ namespace MessagingMesh
         // Gets the subscription ID.
         uint32_t getSubscriptionID() const { return m_subscriptionID; }
 
-    // Private functions...
-    private:
-        // Constructor.
-        // NOTE: The constructor is private. Use SubscriptionInfo::create() to create an instance.
-        SubscriptionInfo(Socket* pSocket, uint32_t subscriptionID) :
-            m_pSocket(pSocket),
-            m_subscriptionID(subscriptionID)
-        {
-        }
+        // Gets the dense index of the client in the subject matching engine.
+        uint32_t getClientIndex() const { return m_clientIndex; }
 
     // Private data...
     private:
@@ -42,7 +40,10 @@ namespace MessagingMesh
 
         // The client's subscription ID...
         uint32_t m_subscriptionID;
+
+        // Dense index of the client, assigned by the subject matching engine to deduplicate matches.
+        // (This fits in what would otherwise be padding, so the size is unchanged.)
+        uint32_t m_clientIndex;
     };
 } // namespace
 
-
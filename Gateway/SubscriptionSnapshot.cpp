@@ -0,0 +1,152 @@
+#include "SubscriptionSnapshot.h"
+#include <algorithm>
+#include <format>
+#include <string_view>
+#include <unordered_map>
+#include <Exception.h>
+using namespace MessagingMesh;
+
+// Serializes the patterns to a snapshot.
+std::vector<uint8_t> SubscriptionSnapshot::serialize(const std::vector<std::string>& patterns)
+{
+    // We intern the tokens, writing each pattern as the indexes of its tokens. The token
+    // table goes before the patterns in the snapshot, so we write the patterns to a separate
+    // vector until we know all the tokens...
+    std::unordered_map<std::string_view, uint32_t> tokenIndexes;
+    std::vector<std::string_view> tokens;
+    std::vector<uint8_t> patternData;
+    std::vector<uint32_t> indexes;
+    for (const auto& pattern : patterns)
+    {
+        // We split the pattern on the '.' delimiter in the same way as MMUtils::tokenize()...
+        indexes.clear();
+        std::string_view remaining = pattern;
+        size_t start = 0;
+        while (start < remaining.size())
+        {
+            auto end = std::min(remaining.find('.', start), remaining.size());
+            auto [it, inserted] = tokenIndexes.try_emplace(remaining.substr(start, end - start), static_cast<uint32_t>(tokens.size()));
+            if (inserted)
+            {
+                tokens.push_back(it->first);
+            }
+            indexes.push_back(it->second);
+            start = end + 1;
+        }
+        writeVarint(patternData, indexes.size());
+        for (auto index : indexes)
+        {
+            writeVarint(patternData, index);
+        }
+    }
+
+    // We write the version and the token table, followed by the patterns...
+    std::vector<uint8_t> data;
+    writeVarint(data, VERSION);
+    writeVarint(data, tokens.size());
+    for (const auto& token : tokens)
+    {
+        writeVarint(data, token.size());
+        data.insert(data.end(), token.begin(), token.end());
+    }
+    writeVarint(data, patterns.size());
+    data.insert(data.end(), patternData.begin(), patternData.end());
+    return data;
+}
+
+// Deserializes the patterns from a snapshot.
+// Throws an exception if the snapshot is not valid.
+std::vector<std::string> SubscriptionSnapshot::deserialize(const uint8_t* pData, size_t length)
+{
+    auto pPosition = pData;
+    auto pEnd = pData + length;
+
+    // We check the version...
+    auto version = readVarint(pPosition, pEnd);
+    if (version != VERSION)
+    {
+        throw Exception(std::format("Unsupported subscription snapshot version: {}", version));
+    }
+
+    // We read the token table...
+    // Note: We check counts against the remaining data before reserving, so that a corrupt
+    //       count cannot make us allocate a huge vector.
+    auto tokenCount = readVarint(pPosition, pEnd);
+    if (tokenCount > static_cast<uint64_t>(pEnd - pPosition))
+    {
+        throw Exception("Subscription snapshot token count is larger than the data");
+    }
+    std::vector<std::string_view> tokens;
+    tokens.reserve(tokenCount);
+    for (uint64_t i = 0; i < tokenCount; ++i)
+    {
+        auto tokenLength = readVarint(pPosition, pEnd);
+        if (tokenLength > static_cast<uint64_t>(pEnd - pPosition))
+        {
+            throw Exception("Subscription snapshot token is longer than the data");
+        }
+        tokens.emplace_back(reinterpret_cast<const char*>(pPosition), tokenLength);
+        pPosition += tokenLength;
+    }
+
+    // We read the patterns, joining their tokens with the '.' delimiter...
+    auto patternCount = readVarint(pPosition, pEnd);
+    if (patternCount > static_cast<uint64_t>(pEnd - pPosition))
+    {
+        throw Exception("Subscription snapshot pattern count is larger than the data");
+    }
+    std::vector<std::string> patterns;
+    patterns.reserve(patternCount);
+    for (uint64_t i = 0; i < patternCount; ++i)
+    {
+        auto& pattern = patterns.emplace_back();
+        auto patternTokenCount = readVarint(pPosition, pEnd);
+        for (uint64_t j = 0; j < patternTokenCount; ++j)
+        {
+            auto tokenIndex = readVarint(pPosition, pEnd);
+            if (tokenIndex >= tokens.size())
+            {
+                throw Exception(std::format("Subscription snapshot token index {} is out of range", tokenIndex));
+            }
+            if (j != 0)
+            {
+                pattern += '.';
+            }
+            pattern += tokens[tokenIndex];
+        }
+    }
+    return patterns;
+}
+
+// Writes an unsigned integer as a varint.
+void SubscriptionSnapshot::writeVarint(std::vector<uint8_t>& data, uint64_t value)
+{
+    // We write seven bits per byte, with the top bit set on all bytes except the last...
+    while (value >= 0x80)
+    {
+        data.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    data.push_back(static_cast<uint8_t>(value));
+}
+
+// Reads a varint, moving the position past it.
+// Throws an exception if the data ends before the varint does.
+uint64_t SubscriptionSnapshot::readVarint(const uint8_t*& pPosition, const uint8_t* pEnd)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (pPosition == pEnd)
+        {
+            throw Exception("Subscription snapshot ended in the middle of a value");
+        }
+        auto byte = *pPosition++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+    throw Exception("Subscription snapshot value is too long");
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// A compact serialized form of the subscription patterns a gateway advertises to its
+    /// mesh peers.
+    ///
+    /// When a gateway connects (or reconnects) to a peer it sends a SUBSCRIPTION_SNAPSHOT
+    /// holding all its advertised patterns in one message, rather than replaying them as
+    /// one SUBSCRIBE message each. The peer replaces the subscriptions it holds for the
+    /// connection with the patterns in the snapshot. Incremental SUBSCRIBE and UNSUBSCRIBE
+    /// messages follow on the same connection.
+    ///
+    /// Format
+    /// ------
+    /// The patterns are the deduplicated, covering set from MeshInterestAggregator. Their tokens
+    /// are interned so that tokens shared by many patterns (such as MD in MD.EQ.VOD and
+    /// MD.FX.EURUSD) are only sent once. Integers are written as LEB128 varints:
+    ///
+    ///   version
+    ///   token-count, then for each token: length, bytes
+    ///   pattern-count, then for each pattern: token-count, token-index...
+    ///
+    /// The snapshot is sent as a BLOB field in the network message.
+    /// </summary>
+    class SubscriptionSnapshot
+    {
+    // Public methods...
+    public:
+        // Serializes the patterns to a snapshot.
+        // The patterns should be unique, as the patterns advertised by MeshInterestAggregator are.
+        static std::vector<uint8_t> serialize(const std::vector<std::string>& patterns);
+
+        // Deserializes the patterns from a snapshot.
+        // Throws an exception if the snapshot is not valid.
+        static std::vector<std::string> deserialize(const uint8_t* pData, size_t length);
+
+    // Public constants...
+    public:
+        // The name of the BLOB field holding the snapshot in the network message...
+        static constexpr const char* FIELD_NAME = "SNAPSHOT";
+
+    // Private functions...
+    private:
+        // Writes an unsigned integer as a varint.
+        static void writeVarint(std::vector<uint8_t>& data, uint64_t value);
+
+        // Reads a varint, moving the position past it.
+        // Throws an exception if the data ends before the varint does.
+        static uint64_t readVarint(const uint8_t*& pPosition, const uint8_t* pEnd);
+
+    // Constants...
+    private:
+        // The version of the format...
+        static constexpr uint64_t VERSION = 1;
+    };
+} // namespace
+
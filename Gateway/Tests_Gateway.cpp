@@ -1,8 +1,34 @@
 #include "Tests_Gateway.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <Buffer.h>
+#include <Socket.h>
 #include <Tests_MessagingMeshLib.h>
 #include <TestUtils.h>
+#include <UVLoop.h>
 #include "SubjectMatchingEngine.h"
 #include "SubscriptionInfo.h"
+#include "FlatTokenMap.h"
+#include "SubscriberSet.h"
+#include "SubjectIndex.h"
+#include "SnapshotSubjectMatchingEngine.h"
+#include "MeshInterestAggregator.h"
+#include "SubscriptionSnapshot.h"
+#include "ServiceScheduler.h"
+#include "SPSCRing.h"
+#include "GatewayConfig.h"
+#include "ConflatedSubjects.h"
+#include "LastValueCache.h"
+#include "InboxRouter.h"
+#include "GatewayInfo.h"
+#include "CreditGuard.h"
+#include "ServiceManager.h"
 using namespace MessagingMesh;
 using namespace MessagingMesh::TestUtils;
 
@@ -13,6 +39,24 @@ void Tests_Gateway::runAll()
 
     Tests_MessagingMeshLib::runAll(testRun);
     Tests_Gateway::subjectMatchingEngine(testRun);
+    Tests_Gateway::subjectMatchingEngine_NodePruning(testRun);
+    Tests_Gateway::subjectMatchingEngine_LiteralIndex(testRun);
+    Tests_Gateway::subjectMatchingEngine_MeshPeers(testRun);
+    Tests_Gateway::flatTokenMap(testRun);
+    Tests_Gateway::subscriberSet(testRun);
+    Tests_Gateway::subjectIndex(testRun);
+    Tests_Gateway::subjectMatchCache(testRun);
+    Tests_Gateway::snapshotSubjectMatchingEngine(testRun);
+    Tests_Gateway::meshInterestAggregator(testRun);
+    Tests_Gateway::subscriptionSnapshot(testRun);
+    Tests_Gateway::serviceScheduler(testRun);
+    Tests_Gateway::serviceEventKeys(testRun);
+    Tests_Gateway::spscRing(testRun);
+    Tests_Gateway::gatewayConfig(testRun);
+    Tests_Gateway::conflatedSubjects(testRun);
+    Tests_Gateway::lastValueCache(testRun);
+    Tests_Gateway::inboxRouter(testRun);
+    Tests_Gateway::creditGuard(testRun);
 }
 
 // Tests for the subject-matching engine.
@@ -40,23 +84,23 @@ void Tests_Gateway::subjectMatchingEngine(TestRun& testRun)
         // We check for matches...
         auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C");
         assertEqual(testRun, matchesABC.size(), (size_t)2);
-        assertEqual(testRun, matchesABC[0]->getSubscriptionID(), (uint32_t)123);
-        assertEqual(testRun, matchesABC[1]->getSubscriptionID(), (uint32_t)234);
+        assertEqual(testRun, matchesABC[0].getSubscriptionID(), (uint32_t)123);
+        assertEqual(testRun, matchesABC[1].getSubscriptionID(), (uint32_t)234);
 
         // We check for matches...
         auto matchesABD = sme.getMatchingSubscriptionInfos("A.B.D");
         assertEqual(testRun, matchesABD.size(), (size_t)1);
-        assertEqual(testRun, matchesABD[0]->getSubscriptionID(), (uint32_t)345);
+        assertEqual(testRun, matchesABD[0].getSubscriptionID(), (uint32_t)345);
 
         // We check for matches...
         auto matchesABDE = sme.getMatchingSubscriptionInfos("A.B.D.E");
         assertEqual(testRun, matchesABDE.size(), (size_t)1);
-        assertEqual(testRun, matchesABDE[0]->getSubscriptionID(), (uint32_t)456);
+        assertEqual(testRun, matchesABDE[0].getSubscriptionID(), (uint32_t)456);
 
         // We check for matches...
         auto matchesABDEF = sme.getMatchingSubscriptionInfos("A.B.D.E.F");
         assertEqual(testRun, matchesABDEF.size(), (size_t)1);
-        assertEqual(testRun, matchesABDEF[0]->getSubscriptionID(), (uint32_t)567);
+        assertEqual(testRun, matchesABDEF[0].getSubscriptionID(), (uint32_t)567);
 
         // We check for matches...
         auto matchesAB = sme.getMatchingSubscriptionInfos("A.B");
@@ -85,13 +129,13 @@ void Tests_Gateway::subjectMatchingEngine(TestRun& testRun)
         // We check for matches...
         auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C");
         assertEqual(testRun, matchesABC.size(), (size_t)2);
-        assertEqual(testRun, matchesABC[0]->getSubscriptionID(), (uint32_t)123);
-        assertEqual(testRun, matchesABC[1]->getSubscriptionID(), (uint32_t)345);
+        assertEqual(testRun, matchesABC[0].getSubscriptionID(), (uint32_t)123);
+        assertEqual(testRun, matchesABC[1].getSubscriptionID(), (uint32_t)345);
 
         // We check for matches...
         auto matchesABCD = sme.getMatchingSubscriptionInfos("A.B.C.D");
         assertEqual(testRun, matchesABCD.size(), (size_t)1);
-        assertEqual(testRun, matchesABCD[0]->getSubscriptionID(), (uint32_t)567);
+        assertEqual(testRun, matchesABCD[0].getSubscriptionID(), (uint32_t)567);
     }
 
     TestUtils::log("Remove subscriptions (with * wildcard)...");
@@ -109,8 +153,8 @@ void Tests_Gateway::subjectMatchingEngine(TestRun& testRun)
         // We check for matches...
         auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C");
         assertEqual(testRun, matchesABC.size(), (size_t)2);
-        assertEqual(testRun, matchesABC[0]->getSubscriptionID(), (uint32_t)123);
-        assertEqual(testRun, matchesABC[1]->getSubscriptionID(), (uint32_t)345);
+        assertEqual(testRun, matchesABC[0].getSubscriptionID(), (uint32_t)123);
+        assertEqual(testRun, matchesABC[1].getSubscriptionID(), (uint32_t)345);
     }
 
     TestUtils::log("Remove subscriptions (with > wildcard)...");
@@ -128,8 +172,8 @@ void Tests_Gateway::subjectMatchingEngine(TestRun& testRun)
         // We check for matches...
         auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C");
         assertEqual(testRun, matchesABC.size(), (size_t)2);
-        assertEqual(testRun, matchesABC[0]->getSubscriptionID(), (uint32_t)123);
-        assertEqual(testRun, matchesABC[1]->getSubscriptionID(), (uint32_t)345);
+        assertEqual(testRun, matchesABC[0].getSubscriptionID(), (uint32_t)123);
+        assertEqual(testRun, matchesABC[1].getSubscriptionID(), (uint32_t)345);
     }
 
     TestUtils::log("Remove all subscriptions...");
@@ -149,13 +193,13 @@ void Tests_Gateway::subjectMatchingEngine(TestRun& testRun)
         // We check for matches...
         auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C");
         assertEqual(testRun, matchesABC.size(), (size_t)2);
-        assertEqual(testRun, matchesABC[0]->getSubscriptionID(), (uint32_t)234);
-        assertEqual(testRun, matchesABC[1]->getSubscriptionID(), (uint32_t)345);
+        assertEqual(testRun, matchesABC[0].getSubscriptionID(), (uint32_t)234);
+        assertEqual(testRun, matchesABC[1].getSubscriptionID(), (uint32_t)345);
 
         // We check for matches...
         auto matchesABCD = sme.getMatchingSubscriptionInfos("A.B.C.D");
         assertEqual(testRun, matchesABCD.size(), (size_t)1);
-        assertEqual(testRun, matchesABCD[0]->getSubscriptionID(), (uint32_t)567);
+        assertEqual(testRun, matchesABCD[0].getSubscriptionID(), (uint32_t)567);
     }
 
     TestUtils::log("Remove all subscriptions (with * wildcard)...");
@@ -175,13 +219,13 @@ void Tests_Gateway::subjectMatchingEngine(TestRun& testRun)
         // We check for matches...
         auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C");
         assertEqual(testRun, matchesABC.size(), (size_t)2);
-        assertEqual(testRun, matchesABC[0]->getSubscriptionID(), (uint32_t)234);
-        assertEqual(testRun, matchesABC[1]->getSubscriptionID(), (uint32_t)345);
+        assertEqual(testRun, matchesABC[0].getSubscriptionID(), (uint32_t)234);
+        assertEqual(testRun, matchesABC[1].getSubscriptionID(), (uint32_t)345);
 
         // We check for matches...
         auto matchesABCD = sme.getMatchingSubscriptionInfos("A.B.C.D");
         assertEqual(testRun, matchesABCD.size(), (size_t)1);
-        assertEqual(testRun, matchesABCD[0]->getSubscriptionID(), (uint32_t)567);
+        assertEqual(testRun, matchesABCD[0].getSubscriptionID(), (uint32_t)567);
     }
 
     TestUtils::log("Remove all subscriptions (with > wildcard)...");
@@ -201,13 +245,13 @@ void Tests_Gateway::subjectMatchingEngine(TestRun& testRun)
         // We check for matches...
         auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C");
         assertEqual(testRun, matchesABC.size(), (size_t)2);
-        assertEqual(testRun, matchesABC[0]->getSubscriptionID(), (uint32_t)234);
-        assertEqual(testRun, matchesABC[1]->getSubscriptionID(), (uint32_t)345);
+        assertEqual(testRun, matchesABC[0].getSubscriptionID(), (uint32_t)234);
+        assertEqual(testRun, matchesABC[1].getSubscriptionID(), (uint32_t)345);
 
         // We check for matches...
         auto matchesABCD = sme.getMatchingSubscriptionInfos("A.B.C.D");
         assertEqual(testRun, matchesABCD.size(), (size_t)1);
-        assertEqual(testRun, matchesABCD[0]->getSubscriptionID(), (uint32_t)567);
+        assertEqual(testRun, matchesABCD[0].getSubscriptionID(), (uint32_t)567);
     }
 
     TestUtils::log("Wildcard '>'...");
@@ -280,17 +324,1404 @@ void Tests_Gateway::subjectMatchingEngine(TestRun& testRun)
         assertEqual(testRun, matchesAXQ.size(), (size_t)1);
         assertEqual(testRun, containsID(matchesAXQ, 678), 678);
     }
+
+    TestUtils::log("Matching with a scratch vector...");
+    {
+        SubjectMatchingEngine sme;
+        sme.addSubscription("A.B.C", 123, ClientA, nullptr);
+        sme.addSubscription("A.>", 234, ClientB, nullptr);
+
+        // We match into a scratch vector...
+        VecSubscriptionInfo scratch;
+        auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C", scratch);
+        assertEqual(testRun, matchesABC.size(), (size_t)2);
+        assertEqual(testRun, matchesABC.data() == scratch.data(), true);
+
+        // Matching again reuses the scratch vector's memory...
+        auto pScratchData = scratch.data();
+        auto matchesAX = sme.getMatchingSubscriptionInfos("A.X", scratch);
+        assertEqual(testRun, matchesAX.size(), (size_t)1);
+        assertEqual(testRun, matchesAX[0].getSubscriptionID(), (uint32_t)234);
+        assertEqual(testRun, scratch.data() == pScratchData, true);
+
+        // With caching enabled, a cached match refers to the cache rather than the scratch vector...
+        sme.setCachingMode(SubjectMatchingEngine::CachingMode::ENABLED);
+        sme.getMatchingSubscriptionInfos("A.B.C", scratch);
+        auto cachedMatchesABC = sme.getMatchingSubscriptionInfos("A.B.C", scratch);
+        assertEqual(testRun, cachedMatchesABC.size(), (size_t)2);
+        assertEqual(testRun, cachedMatchesABC.data() != scratch.data(), true);
+    }
+
+    TestUtils::log("Tokens not in the graph...");
+    {
+        SubjectMatchingEngine sme;
+
+        // We add subscriptions...
+        sme.addSubscription("A.B.C", 123, ClientA, nullptr);
+        sme.addSubscription("A.*.C", 234, ClientB, nullptr);
+        sme.addSubscription("A.>", 345, ClientC, nullptr);
+
+        // We check for matches. X and Y have never been subscribed to, but can still match wildcards...
+        auto matchesAXC = sme.getMatchingSubscriptionInfos("A.X.C");
+        assertEqual(testRun, matchesAXC.size(), (size_t)2);
+        assertEqual(testRun, containsID(matchesAXC, 234), 234);
+        assertEqual(testRun, containsID(matchesAXC, 345), 345);
+
+        // We check for matches...
+        auto matchesXBC = sme.getMatchingSubscriptionInfos("X.B.C");
+        assertEqual(testRun, matchesXBC.size(), (size_t)0);
+
+        // We check for matches...
+        auto matchesAXY = sme.getMatchingSubscriptionInfos("A.X.Y");
+        assertEqual(testRun, matchesAXY.size(), (size_t)1);
+        assertEqual(testRun, containsID(matchesAXY, 345), 345);
+    }
+}
+
+// Tests for removing unused nodes from the interest graph.
+void Tests_Gateway::subjectMatchingEngine_NodePruning(TestRun& testRun)
+{
+    // Test socket IDs...
+    const uint64_t ClientA = 1;
+    const uint64_t ClientB = 2;
+
+    TestUtils::log("Node pruning (removeSubscription)...");
+    {
+        SubjectMatchingEngine sme;
+
+        // We add and remove inbox subscriptions, as for request / reply...
+        sme.addSubscription("A.B.C", 123, ClientA, nullptr);
+        for (auto i = 0; i < 100; ++i)
+        {
+            auto inbox = std::format("_INBOX.{}", i);
+            sme.addSubscription(inbox, 1000 + i, ClientB, nullptr);
+            sme.removeSubscription(inbox, ClientB);
+        }
+
+        // Only the nodes and tokens for A.B.C remain...
+        auto stats = sme.getStats();
+        assertEqual(testRun, stats.SubscriptionCount, (size_t)1);
+        assertEqual(testRun, stats.NodeCount, (size_t)4);
+        assertEqual(testRun, stats.TokenCount, (size_t)3);
+
+        // Removing A.B.C leaves just the root...
+        sme.removeSubscription("A.B.C", ClientA);
+        stats = sme.getStats();
+        assertEqual(testRun, stats.SubscriptionCount, (size_t)0);
+        assertEqual(testRun, stats.NodeCount, (size_t)1);
+        assertEqual(testRun, stats.TokenCount, (size_t)0);
+
+        // Removing a subscription which does not exist does not create nodes...
+        assertEqual(testRun, sme.removeSubscription("X.Y.Z", ClientA), (size_t)0);
+        assertEqual(testRun, sme.getStats().NodeCount, (size_t)1);
+    }
+
+    TestUtils::log("Node pruning (shared nodes and wildcards)...");
+    {
+        SubjectMatchingEngine sme;
+        sme.addSubscription("A.B.C", 123, ClientA, nullptr);
+        sme.addSubscription("A.B", 234, ClientB, nullptr);
+        sme.addSubscription("A.*.C", 345, ClientB, nullptr);
+        sme.addSubscription("A.>", 456, ClientB, nullptr);
+
+        // Removing A.B.C keeps A.B, which still has a subscription...
+        sme.removeSubscription("A.B.C", ClientA);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B").size(), (size_t)2);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.C").size(), (size_t)2);
+
+        // Removing all subscriptions for client B removes everything else...
+        sme.removeAllSubscriptions(ClientB);
+        auto stats = sme.getStats();
+        assertEqual(testRun, stats.SubscriptionCount, (size_t)0);
+        assertEqual(testRun, stats.NodeCount, (size_t)1);
+        assertEqual(testRun, stats.TokenCount, (size_t)0);
+    }
+
+    TestUtils::log("Remove all subscriptions for a batch of clients...");
+    {
+        const uint64_t ClientC = 3;
+        SubjectMatchingEngine sme;
+        sme.setCachingMode(SubjectMatchingEngine::CachingMode::ENABLED);
+        sme.addSubscription("A.B.C", 123, ClientA, nullptr);
+        sme.addSubscription("A.*.C", 234, ClientA, nullptr);
+        sme.addSubscription("A.B.C", 345, ClientB, nullptr);
+        sme.addSubscription("A.>", 456, ClientB, nullptr);
+        sme.addSubscription("A.B.C", 567, ClientC, nullptr);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.C").size(), (size_t)5);
+
+        // We unsubscribe from one subject before removing client A...
+        sme.removeSubscription("A.B.C", ClientA);
+
+        // We remove clients A and B in one batch...
+        sme.removeAllSubscriptions({ ClientA, ClientB });
+        auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C");
+        assertEqual(testRun, matchesABC.size(), (size_t)1);
+        assertEqual(testRun, containsID(matchesABC, 567), 567);
+        auto stats = sme.getStats();
+        assertEqual(testRun, stats.SubscriptionCount, (size_t)1);
+        assertEqual(testRun, stats.NodeCount, (size_t)4);
+
+        // Removing clients which have no subscriptions does nothing...
+        sme.removeAllSubscriptions({ ClientA, ClientB });
+        assertEqual(testRun, sme.getStats().SubscriptionCount, (size_t)1);
+    }
+
+    TestUtils::log("Token ID reuse...");
+    {
+        SubjectMatchingEngine sme;
+
+        // We subscribe and unsubscribe, which releases the token IDs for A and B...
+        sme.addSubscription("A.B", 123, ClientA, nullptr);
+        sme.removeSubscription("A.B", ClientA);
+
+        // X and Y reuse the IDs. A.B must not match X.Y...
+        sme.addSubscription("X.Y", 234, ClientA, nullptr);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B").size(), (size_t)0);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("X.Y").size(), (size_t)1);
+        assertEqual(testRun, sme.getStats().TokenCount, (size_t)2);
+    }
+}
+
+// Tests for the literal subject index (fast path) in the subject-matching engine.
+void Tests_Gateway::subjectMatchingEngine_LiteralIndex(TestRun& testRun)
+{
+    // Test socket IDs...
+    const uint64_t ClientA = 1;
+    const uint64_t ClientB = 2;
+
+    TestUtils::log("Literal subjects use the fast path...");
+    {
+        SubjectMatchingEngine sme;
+        sme.addSubscription("A.B.C", 123, ClientA, nullptr);
+        sme.addSubscription("A.B.D", 234, ClientB, nullptr);
+        sme.addSubscription("X.*.Z", 345, ClientB, nullptr);
+        assertEqual(testRun, sme.getStats().LiteralSubjectCount, (size_t)2);
+
+        // A has no wildcard subscriptions below it, so we do not walk the graph...
+        auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C");
+        assertEqual(testRun, matchesABC.size(), (size_t)1);
+        assertEqual(testRun, containsID(matchesABC, 123), 123);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.E").size(), (size_t)0);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("Q.R").size(), (size_t)0);
+        auto stats = sme.getStats();
+        assertEqual(testRun, stats.FastPathMatches, (uint64_t)3);
+        assertEqual(testRun, stats.GraphWalks, (uint64_t)0);
+
+        // X has a wildcard subscription below it, so we walk the graph...
+        auto matchesXYZ = sme.getMatchingSubscriptionInfos("X.Y.Z");
+        assertEqual(testRun, matchesXYZ.size(), (size_t)1);
+        assertEqual(testRun, containsID(matchesXYZ, 345), 345);
+        assertEqual(testRun, sme.getStats().GraphWalks, (uint64_t)1);
+    }
+
+    TestUtils::log("Literal and wildcard subscriptions under the same prefix...");
+    {
+        SubjectMatchingEngine sme;
+        sme.addSubscription("A.B.C", 123, ClientA, nullptr);
+        sme.addSubscription("A.*.C", 234, ClientB, nullptr);
+        sme.addSubscription("A.>", 345, ClientB, nullptr);
+
+        // Each subscription is matched once...
+        auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C");
+        assertEqual(testRun, matchesABC.size(), (size_t)3);
+        assertEqual(testRun, containsID(matchesABC, 123), 123);
+        assertEqual(testRun, containsID(matchesABC, 234), 234);
+        assertEqual(testRun, containsID(matchesABC, 345), 345);
+
+        // Removing the wildcard subscriptions restores the fast path for A...
+        sme.removeSubscription("A.*.C", ClientB);
+        sme.removeSubscription("A.>", ClientB);
+        auto fastPathMatches = sme.getStats().FastPathMatches;
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.C").size(), (size_t)1);
+        assertEqual(testRun, sme.getStats().FastPathMatches, fastPathMatches + 1);
+    }
+
+    TestUtils::log("Wildcards at the root...");
+    {
+        SubjectMatchingEngine sme;
+        sme.addSubscription("A.B", 123, ClientA, nullptr);
+        sme.addSubscription("*.B", 234, ClientB, nullptr);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B").size(), (size_t)2);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("Z.B").size(), (size_t)1);
+        assertEqual(testRun, sme.getStats().FastPathMatches, (uint64_t)0);
+
+        // Removing the client's subscriptions updates the wildcard counts...
+        sme.removeAllSubscriptions(ClientB);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B").size(), (size_t)1);
+        assertEqual(testRun, sme.getStats().FastPathMatches, (uint64_t)1);
+    }
+
+    TestUtils::log("Subjects with empty and trailing tokens...");
+    {
+        SubjectMatchingEngine sme;
+        sme.addSubscription("A..B", 123, ClientA, nullptr);
+        sme.addSubscription("C.D.", 234, ClientA, nullptr);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A..B").size(), (size_t)1);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B").size(), (size_t)0);
+
+        // The trailing empty token is dropped, so C.D. and C.D are the same subject...
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("C.D").size(), (size_t)1);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("C.D.").size(), (size_t)1);
+
+        // The literal index is emptied when the subscriptions are removed...
+        sme.removeSubscription("C.D", ClientA);
+        sme.removeAllSubscriptions(ClientA);
+        assertEqual(testRun, sme.getStats().LiteralSubjectCount, (size_t)0);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A..B").size(), (size_t)0);
+    }
+}
+
+// Tests deduplication of matches for mesh peers in the subject-matching engine.
+void Tests_Gateway::subjectMatchingEngine_MeshPeers(TestRun& testRun)
+{
+    // Test socket IDs...
+    const uint64_t ClientA = 1;
+    const uint64_t PeerA = 2;
+    const uint64_t PeerB = 3;
+
+    // Sockets for the mesh peers...
+    auto pPeerSocketA = Socket::create(nullptr);
+    pPeerSocketA->setIsMeshPeer(true);
+    auto pPeerSocketB = Socket::create(nullptr);
+    pPeerSocketB->setIsMeshPeer(true);
+
+    TestUtils::log("Mesh peers match once for overlapping subscriptions...");
+    {
+        SubjectMatchingEngine sme;
+        sme.addSubscription("A.B.C", 123, ClientA, nullptr);
+        sme.addSubscription("A.*.C", 234, ClientA, nullptr);
+        sme.addSubscription("A.>", 345, ClientA, nullptr);
+        sme.addSubscription("A.B.C", 456, PeerA, pPeerSocketA.get());
+        sme.addSubscription("A.*.C", 567, PeerA, pPeerSocketA.get());
+        sme.addSubscription("A.>", 678, PeerA, pPeerSocketA.get());
+        sme.addSubscription("A.>", 789, PeerB, pPeerSocketB.get());
+
+        // The client matches for each subscription, and each peer matches once...
+        auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C");
+        assertEqual(testRun, matchesABC.size(), (size_t)5);
+        assertEqual(testRun, containsID(matchesABC, 123), 123);
+        assertEqual(testRun, containsID(matchesABC, 234), 234);
+        assertEqual(testRun, containsID(matchesABC, 345), 345);
+        assertEqual(testRun, containsID(matchesABC, 789), 789);
+
+        // Deduplication is reset for each match...
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.C").size(), (size_t)5);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.X.C").size(), (size_t)4);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.X").size(), (size_t)3);
+    }
+
+    TestUtils::log("Client indexes are reused...");
+    {
+        SubjectMatchingEngine sme;
+        sme.addSubscription("A.*", 123, PeerA, pPeerSocketA.get());
+        sme.addSubscription("A.>", 234, PeerA, pPeerSocketA.get());
+        sme.removeAllSubscriptions(PeerA);
+
+        // The client reusing the peer's index is not deduplicated...
+        sme.addSubscription("A.*", 345, ClientA, nullptr);
+        sme.addSubscription("A.>", 456, ClientA, nullptr);
+        auto matchesAB = sme.getMatchingSubscriptionInfos("A.B");
+        assertEqual(testRun, matchesAB.size(), (size_t)2);
+        assertEqual(testRun, containsID(matchesAB, 345), 345);
+        assertEqual(testRun, containsID(matchesAB, 456), 456);
+    }
+}
+
+// Tests for the flat token map.
+void Tests_Gateway::flatTokenMap(TestRun& testRun)
+{
+    TestUtils::log("FlatTokenMap insert and find...");
+    {
+        // We insert enough items to make the map grow a number of times...
+        FlatTokenMap<int> map;
+        for (uint32_t i = 0; i < 1000; ++i)
+        {
+            map.insert(i, (int)i * 10);
+        }
+        assertEqual(testRun, map.size(), (size_t)1000);
+
+        // We check that we can find all the items...
+        auto foundCount = 0;
+        for (uint32_t i = 0; i < 1000; ++i)
+        {
+            auto pValue = map.find(i);
+            if (pValue && *pValue == (int)i * 10) foundCount++;
+        }
+        assertEqual(testRun, foundCount, 1000);
+        assertEqual(testRun, map.find(1000) == nullptr, true);
+    }
+
+    TestUtils::log("FlatTokenMap erase...");
+    {
+        FlatTokenMap<int> map;
+        for (uint32_t i = 0; i < 100; ++i)
+        {
+            map.insert(i, (int)i);
+        }
+
+        // We erase the even items...
+        for (uint32_t i = 0; i < 100; i += 2)
+        {
+            map.erase(i);
+        }
+        assertEqual(testRun, map.size(), (size_t)50);
+        assertEqual(testRun, map.erase(2), false);
+
+        // We check that the odd items are still found past the erased slots...
+        auto foundCount = 0;
+        for (uint32_t i = 0; i < 100; ++i)
+        {
+            if (map.find(i)) foundCount++;
+        }
+        assertEqual(testRun, foundCount, 50);
+
+        // We check that forEach visits only the remaining items...
+        auto sum = 0;
+        map.forEach([&](uint32_t /*key*/, int value) { sum += value; });
+        assertEqual(testRun, sum, 2500);
+    }
+}
+
+// Tests for the compact set of subscriptions held on each node.
+void Tests_Gateway::subscriberSet(TestRun& testRun)
+{
+    // Returns the client indexes in the set, joined with commas...
+    auto getClientIndexes = [](const SubscriberSet& set)
+    {
+        std::string result;
+        for (const auto& subscriptionInfo : set)
+        {
+            result += result.empty() ? std::to_string(subscriptionInfo.getClientIndex()) : "," + std::to_string(subscriptionInfo.getClientIndex());
+        }
+        return result;
+    };
+
+    TestUtils::log("SubscriberSet inline...");
+    {
+        // We insert out of order, and check that the items are sorted by client index without allocating...
+        SubscriberSet set;
+        assertEqual(testRun, set.insert(SubscriptionInfo(nullptr, 30, 3)), true);
+        assertEqual(testRun, set.insert(SubscriptionInfo(nullptr, 10, 1)), true);
+        assertEqual(testRun, set.insert(SubscriptionInfo(nullptr, 20, 2)), true);
+        assertEqual(testRun, set.insert(SubscriptionInfo(nullptr, 99, 2)), false);
+        assertEqual(testRun, set.size(), (size_t)3);
+        assertEqual(testRun, getClientIndexes(set), std::string("1,2,3"));
+        assertEqual(testRun, set.getAllocatedBytes(), (size_t)0);
+        assertEqual(testRun, set.find(2)->getSubscriptionID(), (uint32_t)20);
+        assertEqual(testRun, set.find(4) == nullptr, true);
+
+        // We erase from the middle...
+        assertEqual(testRun, set.erase(2), true);
+        assertEqual(testRun, set.erase(2), false);
+        assertEqual(testRun, getClientIndexes(set), std::string("1,3"));
+    }
+
+    TestUtils::log("SubscriberSet spilling...");
+    {
+        // We insert more items than fit inline, so the set spills to a vector...
+        SubscriberSet set;
+        for (uint32_t clientIndex = 10; clientIndex > 0; --clientIndex)
+        {
+            set.insert(SubscriptionInfo(nullptr, clientIndex * 10, clientIndex));
+        }
+        assertEqual(testRun, set.size(), (size_t)10);
+        assertEqual(testRun, getClientIndexes(set), std::string("1,2,3,4,5,6,7,8,9,10"));
+        assertEqual(testRun, set.getAllocatedBytes() > 0, true);
+        assertEqual(testRun, set.find(7)->getSubscriptionID(), (uint32_t)70);
+
+        // We erase items until the set moves back inline, keeping the remaining items...
+        for (uint32_t clientIndex = 1; clientIndex <= 8; ++clientIndex)
+        {
+            set.erase(clientIndex);
+        }
+        assertEqual(testRun, set.getAllocatedBytes(), (size_t)0);
+        assertEqual(testRun, getClientIndexes(set), std::string("9,10"));
+        assertEqual(testRun, set.find(10)->getSubscriptionID(), (uint32_t)100);
+    }
+
+    TestUtils::log("Interest graph memory...");
+    {
+        // Subscribers beyond the inline capacity add to the memory used by the graph.
+        // Removing them returns the graph to the memory it used before...
+        SubjectMatchingEngine sme;
+        sme.addSubscription("A.B", 1, 1, nullptr);
+        auto memoryBytes = sme.getStats().MemoryBytes;
+        for (uint64_t clientSocketID = 2; clientSocketID <= 10; ++clientSocketID)
+        {
+            sme.addSubscription("A.B", 1, clientSocketID, nullptr);
+        }
+        assertEqual(testRun, sme.getStats().MemoryBytes > memoryBytes, true);
+        for (uint64_t clientSocketID = 2; clientSocketID <= 10; ++clientSocketID)
+        {
+            sme.removeSubscription("A.B", clientSocketID);
+        }
+        assertEqual(testRun, sme.getStats().MemoryBytes, memoryBytes);
+    }
+}
+
+// Tests for choosing services to move between loops in the service scheduler.
+void Tests_Gateway::serviceScheduler(TestRun& testRun)
+{
+    TestUtils::log("Balanced or idle loops...");
+    {
+        // Loops which are evenly loaded are left alone...
+        auto move = ServiceScheduler::chooseMove({ { 0, 0.6 }, { 1, 0.6 } }, 2);
+        assertEqual(testRun, move.has_value(), false);
+
+        // Loops which are not busy are left alone, even if they are out of balance...
+        move = ServiceScheduler::chooseMove({ { 0, 0.2 }, { 0, 0.2 }, { 1, 0.0 } }, 2);
+        assertEqual(testRun, move.has_value(), false);
+
+        // A single loop cannot be rebalanced...
+        move = ServiceScheduler::chooseMove({ { 0, 0.9 }, { 0, 0.9 } }, 1);
+        assertEqual(testRun, move.has_value(), false);
+    }
+
+    TestUtils::log("Choosing the service to move...");
+    {
+        // Loop 0 has load 1.2 and loop 2 is idle. Moving the 0.6 service to loop 2 splits the load evenly...
+        auto move = ServiceScheduler::chooseMove({ { 0, 0.6 }, { 0, 0.5 }, { 0, 0.1 }, { 1, 0.4 }, { 2, 0.0 } }, 3);
+        assertEqual(testRun, move.has_value(), true);
+        assertEqual(testRun, move->first, (size_t)0);
+        assertEqual(testRun, move->second, (size_t)2);
+
+        // A service which cannot be moved (eg, it moved recently) is not chosen, so we move the next best one...
+        move = ServiceScheduler::chooseMove({ { 0, 0.6, false }, { 0, 0.5 }, { 0, 0.1 }, { 1, 0.4 }, { 2, 0.0 } }, 3);
+        assertEqual(testRun, move->first, (size_t)1);
+        assertEqual(testRun, move->second, (size_t)2);
+
+        // Moving the only service on a busy loop would just move the load, so it stays...
+        move = ServiceScheduler::chooseMove({ { 0, 0.9 }, { 1, 0.0 } }, 2);
+        assertEqual(testRun, move.has_value(), false);
+
+        // A move which only narrows the gap a little is not worth making...
+        move = ServiceScheduler::chooseMove({ { 0, 0.55 }, { 0, 0.02 }, { 1, 0.5 } }, 2);
+        assertEqual(testRun, move.has_value(), false);
+    }
+}
+
+// Tests that services sharing a pool loop do not drop each other's unique events.
+void Tests_Gateway::serviceEventKeys(TestRun& testRun)
+{
+    // Waits (for up to ten seconds) for the condition to be true...
+    auto waitFor = [](const std::function<bool()>& condition)
+    {
+        for (int i = 0; i < 1000 && !condition(); ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return condition();
+    };
+
+    TestUtils::log("Keys differ between services...");
+    {
+        assertEqual(testRun, ServiceManager::makeUniqueEventKey("SERVICE-A", "STATS_TIMER"), std::string("SERVICE-A/STATS_TIMER"));
+        assertEqual(testRun, ServiceManager::makeUniqueEventKey("SERVICE-A", "STATS_TIMER") != ServiceManager::makeUniqueEventKey("SERVICE-B", "STATS_TIMER"), true);
+    }
+
+    TestUtils::log("Two services on one pool loop...");
+    {
+        auto pUVLoop = UVLoop::create("SERVICES/0", UVLoop::Temperature::COLD);
+        std::atomic<int> statsA = 0;
+        std::atomic<int> statsB = 0;
+        std::atomic<int> disconnectionsA = 0;
+        std::atomic<int> disconnectionsB = 0;
+        std::atomic<bool> queued = false;
+
+        // We queue the events from an event on the loop, so that they are all queued before any of
+        // them runs. This is what happens when the stats timers of two services fire together, or when
+        // clients of two services disconnect together...
+        pUVLoop->marshallEvent(
+            [&](uv_loop_t* /*pLoop*/)
+            {
+                auto marshallUnique = [&](const std::string& serviceName, const char* eventName, std::atomic<int>& count)
+                {
+                    pUVLoop->marshallUniqueEvent(ServiceManager::makeUniqueEventKey(serviceName, eventName), [&count](uv_loop_t* /*pLoop*/) { ++count; });
+                };
+                marshallUnique("SERVICE-A", "STATS_TIMER", statsA);
+                marshallUnique("SERVICE-B", "STATS_TIMER", statsB);
+                marshallUnique("SERVICE-A", "PROCESS_DISCONNECTIONS", disconnectionsA);
+                marshallUnique("SERVICE-B", "PROCESS_DISCONNECTIONS", disconnectionsB);
+
+                // A second disconnection for one service is batched with the first...
+                marshallUnique("SERVICE-A", "PROCESS_DISCONNECTIONS", disconnectionsA);
+                queued = true;
+            }
+        );
+
+        // Both services get their stats and disconnect processing, once each...
+        assertEqual(testRun, waitFor([&]() { return queued && statsA == 1 && statsB == 1 && disconnectionsA == 1 && disconnectionsB == 1; }), true);
+
+        // We check that the batched event did not run later...
+        std::atomic<bool> flushed = false;
+        pUVLoop->marshallEvent([&](uv_loop_t* /*pLoop*/) { flushed = true; });
+        assertEqual(testRun, waitFor([&]() { return flushed.load(); }), true);
+        assertEqual(testRun, disconnectionsA.load(), 1);
+    }
+}
+
+// Tests for the single-producer single-consumer ring used by pipelined services.
+void Tests_Gateway::spscRing(TestRun& testRun)
+{
+    TestUtils::log("Full and empty...");
+    {
+        // The capacity is rounded up to a power of two...
+        SPSCRing<int> ring(3);
+        assertEqual(testRun, ring.getCapacity(), (size_t)4);
+
+        int item = 0;
+        assertEqual(testRun, ring.tryPop(item), false);
+        for (int i = 1; i <= 4; ++i)
+        {
+            assertEqual(testRun, ring.tryPush(std::move(i)), true);
+        }
+
+        // Items are popped in the order they were pushed, and a full ring takes another
+        // item once one has been popped...
+        assertEqual(testRun, ring.tryPush(5), false);
+        assertEqual(testRun, ring.tryPop(item), true);
+        assertEqual(testRun, item, 1);
+        assertEqual(testRun, ring.tryPush(5), true);
+        for (int i = 2; i <= 5; ++i)
+        {
+            ring.tryPop(item);
+            assertEqual(testRun, item, i);
+        }
+        assertEqual(testRun, ring.tryPop(item), false);
+
+        // A push to a full ring fails, leaving the item unchanged...
+        SPSCRing<std::shared_ptr<int>> pointerRing(2);
+        assertEqual(testRun, pointerRing.tryPush(std::make_shared<int>(1)), true);
+        assertEqual(testRun, pointerRing.tryPush(std::make_shared<int>(2)), true);
+        auto pItem = std::make_shared<int>(3);
+        assertEqual(testRun, pointerRing.tryPush(std::move(pItem)), false);
+        assertEqual(testRun, pItem != nullptr, true);
+    }
+
+    TestUtils::log("Producer and consumer threads...");
+    {
+        // The consumer should see every item, in order, as the ring wraps many times...
+        SPSCRing<uint64_t> ring(64);
+        const uint64_t itemCount = 1000000;
+        std::thread producer(
+            [&]()
+            {
+                for (uint64_t i = 0; i < itemCount; )
+                {
+                    auto item = i;
+                    if (ring.tryPush(std::move(item)))
+                    {
+                        ++i;
+                    }
+                }
+            });
+        uint64_t expected = 0;
+        uint64_t outOfOrderCount = 0;
+        while (expected < itemCount)
+        {
+            uint64_t item;
+            if (ring.tryPop(item))
+            {
+                if (item != expected)
+                {
+                    ++outOfOrderCount;
+                }
+                ++expected;
+            }
+        }
+        producer.join();
+        assertEqual(testRun, outOfOrderCount, (uint64_t)0);
+    }
 }
 
 // Returns the subscription ID (as an int) if the collection contains it, -1 if not.
 int Tests_Gateway::containsID(const VecSubscriptionInfo& subscriptionInfos, uint32_t subscriptionID)
 {
-    for (const auto& pSubscriptionInfo : subscriptionInfos)
+    for (const auto& subscriptionInfo : subscriptionInfos)
     {
-        if (pSubscriptionInfo->getSubscriptionID() == subscriptionID)
+        if (subscriptionInfo.getSubscriptionID() == subscriptionID)
         {
             return subscriptionID;
         }
     }
     return -1;
 }
+
+// Returns the strings sorted and joined with commas, so that they can be compared in any order.
+std::string Tests_Gateway::sortAndJoin(std::vector<std::string> strings)
+{
+    std::sort(strings.begin(), strings.end());
+    std::string result;
+    for (const auto& string : strings)
+    {
+        result += result.empty() ? string : "," + string;
+    }
+    return result;
+}
+
+// Tests for the subject index.
+void Tests_Gateway::subjectIndex(TestRun& testRun)
+{
+    TestUtils::log("SubjectIndex matching...");
+    {
+        SubjectIndex<int> index;
+        index.insert(MMUtils::tokenize("A.B.C", '.'), 1);
+        index.insert(MMUtils::tokenize("A.B.D", '.'), 2);
+        index.insert(MMUtils::tokenize("A.X.C", '.'), 3);
+        index.insert(MMUtils::tokenize("A.B", '.'), 4);
+        assertEqual(testRun, index.size(), (size_t)4);
+
+        // We sum the values matched by each pattern...
+        auto sumMatches = [&](const std::string& pattern)
+        {
+            auto sum = 0;
+            index.forEachMatch(MMUtils::tokenize(pattern, '.'), [&](int value) { sum += value; });
+            return sum;
+        };
+        assertEqual(testRun, sumMatches("A.B.C"), 1);
+        assertEqual(testRun, sumMatches("A.*.C"), 4);
+        assertEqual(testRun, sumMatches("A.B.*"), 3);
+        assertEqual(testRun, sumMatches("A.>"), 10);
+        assertEqual(testRun, sumMatches("A.B.>"), 3);
+        assertEqual(testRun, sumMatches("*.*"), 4);
+        assertEqual(testRun, sumMatches("A.B.C.>"), 0);
+        assertEqual(testRun, sumMatches("X.>"), 0);
+    }
+
+    TestUtils::log("SubjectIndex erase...");
+    {
+        SubjectIndex<int> index;
+        index.insert(MMUtils::tokenize("A.B.C", '.'), 1);
+        index.insert(MMUtils::tokenize("A.B", '.'), 2);
+
+        // We erase A.B.C, leaving A.B in the index...
+        assertEqual(testRun, index.erase(MMUtils::tokenize("A.B.C", '.')), true);
+        assertEqual(testRun, index.erase(MMUtils::tokenize("A.B.C", '.')), false);
+        assertEqual(testRun, index.size(), (size_t)1);
+        assertEqual(testRun, index.find(MMUtils::tokenize("A.B.C", '.')) == nullptr, true);
+        assertEqual(testRun, *index.find(MMUtils::tokenize("A.B", '.')), 2);
+    }
+}
+
+// Tests for caching in the subject-matching engine.
+void Tests_Gateway::subjectMatchCache(TestRun& testRun)
+{
+    // Test socket IDs...
+    const uint64_t ClientA = 1;
+    const uint64_t ClientB = 2;
+    const uint64_t ClientC = 3;
+
+    TestUtils::log("Cache invalidation on subscribe / unsubscribe...");
+    {
+        SubjectMatchingEngine sme;
+        sme.setCachingMode(SubjectMatchingEngine::CachingMode::ENABLED);
+
+        // We add subscriptions and cache matches...
+        sme.addSubscription("A.B.C", 123, ClientA, nullptr);
+        sme.addSubscription("X.Y.Z", 234, ClientB, nullptr);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.C").size(), (size_t)1);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("X.Y.Z").size(), (size_t)1);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.D").size(), (size_t)0);
+        assertEqual(testRun, sme.getCacheStats().Size, (size_t)3);
+
+        // A new wildcard subscription invalidates only the subjects it matches...
+        sme.addSubscription("A.*.C", 345, ClientC, nullptr);
+        assertEqual(testRun, sme.getCacheStats().Size, (size_t)2);
+        auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C");
+        assertEqual(testRun, matchesABC.size(), (size_t)2);
+        assertEqual(testRun, containsID(matchesABC, 345), 345);
+
+        // We check that X.Y.Z was still cached...
+        auto hits = sme.getCacheStats().Hits;
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("X.Y.Z").size(), (size_t)1);
+        assertEqual(testRun, sme.getCacheStats().Hits, hits + 1);
+
+        // Removing a subscription invalidates the subjects it matches...
+        sme.removeSubscription("A.*.C", ClientC);
+        auto matchesABC2 = sme.getMatchingSubscriptionInfos("A.B.C");
+        assertEqual(testRun, matchesABC2.size(), (size_t)1);
+        assertEqual(testRun, containsID(matchesABC2, 123), 123);
+
+        // Removing all subscriptions for a client invalidates the subjects they match...
+        sme.addSubscription("A.>", 456, ClientB, nullptr);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.C").size(), (size_t)2);
+        sme.removeAllSubscriptions(ClientB);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.C").size(), (size_t)1);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("X.Y.Z").size(), (size_t)0);
+    }
+
+    TestUtils::log("Cache eviction...");
+    {
+        SubjectMatchingEngine sme;
+        sme.setCachingMode(SubjectMatchingEngine::CachingMode::ENABLED, 2);
+        sme.addSubscription("A.>", 123, ClientA, nullptr);
+
+        // We cache A.1 and A.2, and use A.1 again so that it is referenced...
+        sme.getMatchingSubscriptionInfos("A.1");
+        sme.getMatchingSubscriptionInfos("A.2");
+        sme.getMatchingSubscriptionInfos("A.1");
+
+        // Caching A.3 evicts one entry and the cache stays at its capacity...
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.3").size(), (size_t)1);
+        auto stats = sme.getCacheStats();
+        assertEqual(testRun, stats.Size, (size_t)2);
+        assertEqual(testRun, stats.Evictions, (uint64_t)1);
+    }
+
+    TestUtils::log("Adaptive caching...");
+    {
+        SubjectMatchingEngine sme;
+        sme.setCachingMode(SubjectMatchingEngine::CachingMode::ADAPTIVE);
+        sme.addSubscription("A.B.C", 123, ClientA, nullptr);
+
+        // A subject sent once is not cached...
+        sme.getMatchingSubscriptionInfos("A.B.D");
+        assertEqual(testRun, sme.getCacheStats().Size, (size_t)0);
+
+        // A subject sent repeatedly is cached...
+        for (auto i = 0; i < 5; ++i)
+        {
+            assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.C").size(), (size_t)1);
+        }
+        auto stats = sme.getCacheStats();
+        assertEqual(testRun, stats.Size, (size_t)1);
+        assertEqual(testRun, stats.Hits, (uint64_t)2);
+    }
+}
+
+// Tests for the snapshot (multi-threaded) subject-matching engine.
+void Tests_Gateway::snapshotSubjectMatchingEngine(TestRun& testRun)
+{
+    // Test socket IDs...
+    const uint64_t ClientA = 1;
+    const uint64_t ClientB = 2;
+
+    TestUtils::log("Snapshot matching and publishing...");
+    {
+        SnapshotSubjectMatchingEngine sme;
+        auto pReader = sme.createReader();
+        sme.addSubscription("A.B.C", 123, ClientA, nullptr);
+        sme.addSubscription("A.*.C", 234, ClientB, nullptr);
+        sme.addSubscription("A.>", 345, ClientB, nullptr);
+
+        // Changes are not visible until they are published...
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.C", *pReader).size(), (size_t)0);
+        sme.publish();
+        auto matchesABC = sme.getMatchingSubscriptionInfos("A.B.C", *pReader);
+        VecSubscriptionInfo matches(matchesABC.begin(), matchesABC.end());
+        assertEqual(testRun, matches.size(), (size_t)3);
+        assertEqual(testRun, containsID(matches, 123), 123);
+        assertEqual(testRun, containsID(matches, 234), 234);
+        assertEqual(testRun, containsID(matches, 345), 345);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.X.C", *pReader).size(), (size_t)2);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A", *pReader).size(), (size_t)0);
+        assertEqual(testRun, sme.getStats().Version, (uint64_t)1);
+
+        // Publishing with no changes does not create a new version...
+        sme.publish();
+        assertEqual(testRun, sme.getStats().Version, (uint64_t)1);
+
+        // We check the subjects each client has subscribed to...
+        assertEqual(testRun, sme.getSubjects(ClientA).size(), (size_t)1);
+        assertEqual(testRun, sme.getSubjects(ClientA)[0], std::string("A.B.C"));
+        assertEqual(testRun, sme.getSubjects(ClientB).size(), (size_t)2);
+
+        // We remove client B's subscriptions...
+        sme.removeAllSubscriptions(ClientB);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.C", *pReader).size(), (size_t)3);
+        assertEqual(testRun, sme.getSubjects(ClientB).size(), (size_t)0);
+        sme.publish();
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.C", *pReader).size(), (size_t)1);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.X.C", *pReader).size(), (size_t)0);
+    }
+
+    TestUtils::log("Snapshot node pruning and reclamation...");
+    {
+        SnapshotSubjectMatchingEngine sme;
+        auto pReader = sme.createReader();
+        sme.addSubscription("A.B.C", 123, ClientA, nullptr);
+        sme.publish();
+        for (auto i = 0; i < 100; ++i)
+        {
+            auto inbox = std::format("_INBOX.{}", i);
+            sme.addSubscription(inbox, 1000 + i, ClientB, nullptr);
+            sme.publish();
+            assertEqual(testRun, sme.getMatchingSubscriptionInfos(inbox, *pReader).size(), (size_t)1);
+            sme.removeSubscription(inbox, ClientB);
+            sme.publish();
+        }
+
+        // Only the nodes for A.B.C remain, and old versions have been reclaimed...
+        auto stats = sme.getStats();
+        assertEqual(testRun, stats.SubscriptionCount, (size_t)1);
+        assertEqual(testRun, stats.NodeCount, (size_t)4);
+        assertEqual(testRun, stats.RetiredVersionCount, (size_t)0);
+        assertEqual(testRun, sme.getMatchingSubscriptionInfos("A.B.C", *pReader).size(), (size_t)1);
+    }
+
+    TestUtils::log("Snapshot matching from many threads...");
+    {
+        // Reader threads match A.B.C while the writer adds and removes other subscriptions.
+        // Every match must see exactly the one subscription to A.B.C...
+        SnapshotSubjectMatchingEngine sme;
+        sme.addSubscription("A.B.C", 123, ClientA, nullptr);
+        sme.publish();
+        std::atomic<bool> stop = false;
+        std::atomic<uint64_t> badMatchCount = 0;
+        std::vector<std::thread> readerThreads;
+        for (auto i = 0; i < 4; ++i)
+        {
+            readerThreads.emplace_back(
+                [&]()
+                {
+                    auto pReader = sme.createReader();
+                    while (!stop)
+                    {
+                        auto matches = sme.getMatchingSubscriptionInfos("A.B.C", *pReader);
+                        if (matches.size() != 1 || matches[0].getSubscriptionID() != 123)
+                        {
+                            badMatchCount++;
+                        }
+                    }
+                });
+        }
+        for (auto i = 0; i < 2000; ++i)
+        {
+            auto subject = std::format("A.B.{}", i % 50);
+            sme.addSubscription(subject, i, ClientB, nullptr);
+            sme.addSubscription("A.*.D", i, ClientB, nullptr);
+            sme.publish();
+            sme.removeSubscription(subject, ClientB);
+            sme.removeSubscription("A.*.D", ClientB);
+            sme.publish();
+        }
+        stop = true;
+        for (auto& readerThread : readerThreads)
+        {
+            readerThread.join();
+        }
+        assertEqual(testRun, badMatchCount.load(), (uint64_t)0);
+        assertEqual(testRun, sme.getStats().NodeCount, (size_t)4);
+    }
+}
+
+// Tests for the covering set of patterns advertised to mesh peers.
+void Tests_Gateway::meshInterestAggregator(TestRun& testRun)
+{
+    TestUtils::log("Patterns covered by > are not advertised...");
+    {
+        MeshInterestAggregator aggregator;
+        MeshInterestAggregator::Changes changes;
+        aggregator.addInterest("MD.EQ.VOD", changes);
+        aggregator.addInterest("MD.EQ.BP", changes);
+        assertEqual(testRun, sortAndJoin(changes.Subscribe), std::string("MD.EQ.BP,MD.EQ.VOD"));
+
+        // Adding MD.> advertises it and withdraws the patterns it covers...
+        changes = {};
+        aggregator.addInterest("MD.>", changes);
+        assertEqual(testRun, sortAndJoin(changes.Subscribe), std::string("MD.>"));
+        assertEqual(testRun, sortAndJoin(changes.Unsubscribe), std::string("MD.EQ.BP,MD.EQ.VOD"));
+
+        // Covered patterns are not advertised...
+        changes = {};
+        aggregator.addInterest("MD.FX.*", changes);
+        aggregator.addInterest("MD.EQ.VOD", changes);
+        assertEqual(testRun, changes.empty(), true);
+        assertEqual(testRun, aggregator.getPatternCount(), (size_t)4);
+        assertEqual(testRun, sortAndJoin(aggregator.getAdvertisedPatterns()), std::string("MD.>"));
+
+        // Removing MD.> advertises the patterns it covered...
+        aggregator.removeInterest("MD.>", changes);
+        assertEqual(testRun, sortAndJoin(changes.Subscribe), std::string("MD.EQ.BP,MD.EQ.VOD,MD.FX.*"));
+        assertEqual(testRun, sortAndJoin(changes.Unsubscribe), std::string("MD.>"));
+        assertEqual(testRun, aggregator.getAdvertisedCount(), (size_t)3);
+    }
+
+    TestUtils::log("Patterns covered by *...");
+    {
+        MeshInterestAggregator aggregator;
+        MeshInterestAggregator::Changes changes;
+        aggregator.addInterest("A.*", changes);
+        aggregator.addInterest("A.B", changes);
+        aggregator.addInterest("A.B.C", changes);
+        aggregator.addInterest("*.B", changes);
+        aggregator.addInterest("A.>", changes);
+
+        // A.* and A.B.C were advertised and then withdrawn in the same changes, so they cancel out...
+        assertEqual(testRun, sortAndJoin(changes.Subscribe), std::string("*.B,A.>"));
+        assertEqual(testRun, changes.Unsubscribe.empty(), true);
+        assertEqual(testRun, sortAndJoin(aggregator.getAdvertisedPatterns()), std::string("*.B,A.>"));
+
+        // A.B is still covered by *.B when A.> is removed...
+        changes = {};
+        aggregator.removeInterest("A.>", changes);
+        assertEqual(testRun, sortAndJoin(changes.Subscribe), std::string("A.*,A.B.C"));
+        assertEqual(testRun, sortAndJoin(aggregator.getAdvertisedPatterns()), std::string("*.B,A.*,A.B.C"));
+    }
+
+    TestUtils::log("Patterns covered through a *...");
+    {
+        MeshInterestAggregator aggregator;
+        MeshInterestAggregator::Changes changes;
+        aggregator.addInterest("A.*.B", changes);
+        aggregator.addInterest("A.X.B", changes);
+        aggregator.addInterest("A.X.*", changes);
+        assertEqual(testRun, sortAndJoin(aggregator.getAdvertisedPatterns()), std::string("A.*.B,A.X.*"));
+    }
+
+    TestUtils::log("Interest is reference counted...");
+    {
+        MeshInterestAggregator aggregator;
+        MeshInterestAggregator::Changes changes;
+        aggregator.addInterest("A.B", changes);
+        aggregator.addInterest("A.B", changes);
+        aggregator.removeInterest("A.B", changes);
+        assertEqual(testRun, sortAndJoin(changes.Subscribe), std::string("A.B"));
+        assertEqual(testRun, changes.Unsubscribe.empty(), true);
+        changes = {};
+        aggregator.removeInterest("A.B", changes);
+        aggregator.removeInterest("A.B", changes);
+        assertEqual(testRun, sortAndJoin(changes.Unsubscribe), std::string("A.B"));
+        assertEqual(testRun, aggregator.getPatternCount(), (size_t)0);
+        assertEqual(testRun, aggregator.getAdvertisedCount(), (size_t)0);
+    }
+
+    TestUtils::log("Removing the interest of a disconnected client...");
+    {
+        // The service manager removes interest using the subjects from the subject-matching engine...
+        SubjectMatchingEngine sme;
+        MeshInterestAggregator aggregator;
+        MeshInterestAggregator::Changes changes;
+        for (const auto& subject : { "A.B.C", "A.*.C", "X.>" })
+        {
+            sme.addSubscription(subject, 123, 1, nullptr);
+            aggregator.addInterest(subject, changes);
+        }
+        auto subjects = sme.getSubjects(1);
+        assertEqual(testRun, sortAndJoin(subjects), std::string("A.*.C,A.B.C,X.>"));
+        changes = {};
+        for (const auto& subject : subjects)
+        {
+            aggregator.removeInterest(subject, changes);
+        }
+        assertEqual(testRun, changes.Subscribe.empty(), true);
+        assertEqual(testRun, sortAndJoin(changes.Unsubscribe), std::string("A.*.C,X.>"));
+        assertEqual(testRun, aggregator.getPatternCount(), (size_t)0);
+    }
+}
+
+// Tests for serializing subscription snapshots sent to mesh peers.
+void Tests_Gateway::subscriptionSnapshot(TestRun& testRun)
+{
+    TestUtils::log("Snapshot round trip...");
+    {
+        std::vector<std::string> patterns = { "MD.EQ.VOD", "MD.EQ.*", "MD.>", "NEWS", "A..B" };
+        auto snapshot = SubscriptionSnapshot::serialize(patterns);
+        auto result = SubscriptionSnapshot::deserialize(snapshot.data(), snapshot.size());
+        assertEqual(testRun, result.size(), (size_t)5);
+        assertEqual(testRun, sortAndJoin(result), std::string("A..B,MD.>,MD.EQ.*,MD.EQ.VOD,NEWS"));
+    }
+
+    TestUtils::log("Tokens are interned...");
+    {
+        // Each pattern costs a few bytes once its tokens are in the token table...
+        std::vector<std::string> patterns;
+        for (int i = 0; i < 1000; ++i)
+        {
+            patterns.push_back(std::format("MARKET.DATA.EQUITY.T{}", i));
+            patterns.push_back(std::format("MARKET.DATA.FX.T{}", i));
+        }
+        auto snapshot = SubscriptionSnapshot::serialize(patterns);
+        assertEqual(testRun, snapshot.size() < 20000, true);
+        auto result = SubscriptionSnapshot::deserialize(snapshot.data(), snapshot.size());
+        assertEqual(testRun, result.size(), (size_t)2000);
+        assertEqual(testRun, result[0], std::string("MARKET.DATA.EQUITY.T0"));
+    }
+
+    TestUtils::log("Empty and invalid snapshots...");
+    {
+        auto snapshot = SubscriptionSnapshot::serialize({});
+        assertEqual(testRun, SubscriptionSnapshot::deserialize(snapshot.data(), snapshot.size()).size(), (size_t)0);
+
+        // Truncated data...
+        snapshot = SubscriptionSnapshot::serialize({ "A.B.C" });
+        std::string error;
+        try
+        {
+            SubscriptionSnapshot::deserialize(snapshot.data(), snapshot.size() - 1);
+        }
+        catch (const std::exception& ex)
+        {
+            error = ex.what();
+        }
+        assertEqual(testRun, error.empty(), false);
+    }
+}
+
+// Tests for parsing service settings in the gateway config.
+void Tests_Gateway::gatewayConfig(TestRun& testRun)
+{
+    TestUtils::log("Slow consumer policies...");
+    {
+        assertEqual(testRun, GatewayConfig::parseSlowConsumerPolicy("DROP_NEWEST") == Socket::SlowConsumerPolicy::DROP_NEWEST, true);
+        assertEqual(testRun, GatewayConfig::parseSlowConsumerPolicy("DROP_OLDEST") == Socket::SlowConsumerPolicy::DROP_OLDEST, true);
+        assertEqual(testRun, GatewayConfig::parseSlowConsumerPolicy("CONFLATE") == Socket::SlowConsumerPolicy::CONFLATE, true);
+        assertEqual(testRun, GatewayConfig::parseSlowConsumerPolicy("DISCONNECT") == Socket::SlowConsumerPolicy::DISCONNECT, true);
+
+        // Unknown policy...
+        std::string error;
+        try
+        {
+            GatewayConfig::parseSlowConsumerPolicy("DROP_EVERYTHING");
+        }
+        catch (const std::exception& ex)
+        {
+            error = ex.what();
+        }
+        assertEqual(testRun, error.empty(), false);
+    }
+
+    TestUtils::log("Default service settings...");
+    {
+        GatewayConfig::ServiceConfig serviceConfig;
+        assertEqual(testRun, serviceConfig.OutputQueueLimits.MaxBytes, (size_t)(256 * 1024 * 1024));
+        assertEqual(testRun, serviceConfig.OutputQueueLimits.MaxMessages, (size_t)0);
+        assertEqual(testRun, serviceConfig.OutputQueueLimits.Policy == Socket::SlowConsumerPolicy::DISCONNECT, true);
+        assertEqual(testRun, serviceConfig.PublishWindowBytes, (uint64_t)(8 * 1024 * 1024));
+    }
+}
+
+// Tests for finding the conflation key for subjects a service conflates.
+void Tests_Gateway::conflatedSubjects(TestRun& testRun)
+{
+    TestUtils::log("No conflated subjects...");
+    {
+        ConflatedSubjects conflatedSubjects({});
+        assertEqual(testRun, conflatedSubjects.getConflationKey("PRICES.VOD"), (uint64_t)0);
+    }
+
+    TestUtils::log("Conflated subjects...");
+    {
+        ConflatedSubjects conflatedSubjects({ "PRICES.>", "FX.*.SPOT" });
+
+        // Subjects matching the patterns have a key, which is the same each time for the same subject...
+        auto keyVOD = conflatedSubjects.getConflationKey("PRICES.VOD");
+        auto keyBARC = conflatedSubjects.getConflationKey("PRICES.BARC");
+        assertEqual(testRun, keyVOD != 0, true);
+        assertEqual(testRun, keyBARC != 0, true);
+        assertEqual(testRun, keyVOD != keyBARC, true);
+        assertEqual(testRun, conflatedSubjects.getConflationKey("PRICES.VOD"), keyVOD);
+        assertEqual(testRun, conflatedSubjects.getConflationKey("FX.GBPUSD.SPOT") != 0, true);
+
+        // Subjects which do not match are not conflated...
+        assertEqual(testRun, conflatedSubjects.getConflationKey("TRADES.VOD"), (uint64_t)0);
+        assertEqual(testRun, conflatedSubjects.getConflationKey("FX.GBPUSD.FWD"), (uint64_t)0);
+        assertEqual(testRun, conflatedSubjects.getConflationKey("PRICES"), (uint64_t)0);
+    }
+}
+
+// Tests for the last-value cache.
+void Tests_Gateway::lastValueCache(TestRun& testRun)
+{
+    TestUtils::log("No cached subjects...");
+    {
+        LastValueCache lastValueCache({});
+        lastValueCache.update("PRICES.VOD", Buffer::create());
+        assertEqual(testRun, lastValueCache.isEnabled(), false);
+        assertEqual(testRun, lastValueCache.size(), (size_t)0);
+        assertEqual(testRun, lastValueCache.getMatches("PRICES.>").size(), (size_t)0);
+    }
+
+    TestUtils::log("Cached subjects...");
+    {
+        LastValueCache lastValueCache({ "PRICES.>" });
+        auto pVOD1 = Buffer::create();
+        auto pVOD2 = Buffer::create();
+        auto pBARC = Buffer::create();
+        auto pFX = Buffer::create();
+        auto pTrade = Buffer::create();
+        lastValueCache.update("PRICES.EQ.VOD", pVOD1);
+        lastValueCache.update("PRICES.EQ.BARC", pBARC);
+        lastValueCache.update("PRICES.FX.GBPUSD", pFX);
+        lastValueCache.update("TRADES.EQ.VOD", pTrade);
+        assertEqual(testRun, lastValueCache.size(), (size_t)3);
+
+        // A newer message replaces the cached value for its subject...
+        lastValueCache.update("PRICES.EQ.VOD", pVOD2);
+        assertEqual(testRun, lastValueCache.size(), (size_t)3);
+        auto matches = lastValueCache.getMatches("PRICES.EQ.VOD");
+        assertEqual(testRun, matches.size(), (size_t)1);
+        assertEqual(testRun, matches[0] == pVOD2, true);
+
+        // Wildcard subscriptions get the values for all the cached subjects they match...
+        matches = lastValueCache.getMatches("PRICES.EQ.*");
+        assertEqual(testRun, matches.size(), (size_t)2);
+        assertEqual(testRun, std::count(matches.begin(), matches.end(), pVOD2), (std::ptrdiff_t)1);
+        assertEqual(testRun, std::count(matches.begin(), matches.end(), pBARC), (std::ptrdiff_t)1);
+        assertEqual(testRun, lastValueCache.getMatches("PRICES.>").size(), (size_t)3);
+        assertEqual(testRun, lastValueCache.getMatches("*.*.VOD").size(), (size_t)1);
+        assertEqual(testRun, lastValueCache.getMatches(">").size(), (size_t)3);
+
+        // Subjects which are not cached are not returned...
+        assertEqual(testRun, lastValueCache.getMatches("TRADES.>").size(), (size_t)0);
+        assertEqual(testRun, lastValueCache.getMatches("PRICES.EQ").size(), (size_t)0);
+    }
+}
+
+// Tests for routing messages to direct inboxes.
+void Tests_Gateway::inboxRouter(TestRun& testRun)
+{
+    // Sockets and peers are only compared, so we use dummy pointers...
+    int socket1 = 0;
+    int socket2 = 0;
+    int peer = 0;
+    auto pSocket1 = reinterpret_cast<Socket*>(&socket1);
+    auto pSocket2 = reinterpret_cast<Socket*>(&socket2);
+    auto pPeer = reinterpret_cast<const MeshGatewayConnection*>(&peer);
+
+    TestUtils::log("Inbox prefix...");
+    {
+        InboxRouter inboxRouter(0xabc);
+        assertEqual(testRun, inboxRouter.getInboxPrefix(12), std::string("_INBOX.00000abc.12."));
+    }
+
+    TestUtils::log("Only the socket's own direct inboxes are added...");
+    {
+        InboxRouter inboxRouter(0xabc);
+        assertEqual(testRun, inboxRouter.addSubscription("_INBOX.00000abc.12.guid1", 1, 12, pSocket1), true);
+        assertEqual(testRun, inboxRouter.addSubscription("_INBOX.00000abc.13.guid2", 2, 12, pSocket1), false);
+        assertEqual(testRun, inboxRouter.addSubscription("_INBOX.00000def.12.guid3", 3, 12, pSocket1), false);
+        assertEqual(testRun, inboxRouter.addSubscription("_INBOX.abcdefgh", 4, 12, pSocket1), false);
+        assertEqual(testRun, inboxRouter.addSubscription("_INBOX.00000abc.12.", 5, 12, pSocket1), false);
+        assertEqual(testRun, inboxRouter.addSubscription("PRICES.VOD", 6, 12, pSocket1), false);
+        assertEqual(testRun, inboxRouter.size(), (size_t)1);
+    }
+
+    TestUtils::log("Local destinations...");
+    {
+        InboxRouter inboxRouter(0xabc);
+        inboxRouter.addSubscription("_INBOX.00000abc.12.guid1", 1, 12, pSocket1);
+        inboxRouter.addSubscription("_INBOX.00000abc.13.guid2", 2, 13, pSocket2);
+
+        InboxRouter::Destination destination1;
+        assertEqual(testRun, inboxRouter.findDestination("_INBOX.00000abc.12.guid1", destination1), true);
+        assertEqual(testRun, destination1.pSocket == pSocket1, true);
+        assertEqual(testRun, destination1.SubscriptionID, (uint32_t)1);
+        assertEqual(testRun, destination1.pPeer == nullptr, true);
+
+        InboxRouter::Destination destination2;
+        assertEqual(testRun, inboxRouter.findDestination("_INBOX.00000abc.13.guid2", destination2), true);
+        assertEqual(testRun, destination2.pSocket == pSocket2, true);
+        assertEqual(testRun, destination2.SubscriptionID, (uint32_t)2);
+
+        // An inbox of ours with no subscription here is routed by subscription (as it may have
+        // been subscribed to before all peers could route to our inboxes)...
+        InboxRouter::Destination destination3;
+        assertEqual(testRun, inboxRouter.findDestination("_INBOX.00000abc.12.guid9", destination3), false);
+        assertEqual(testRun, destination3.pSocket == nullptr, true);
+        assertEqual(testRun, destination3.pPeer == nullptr, true);
+    }
+
+    TestUtils::log("Peer destinations...");
+    {
+        InboxRouter inboxRouter(0xabc);
+        inboxRouter.addPeer(0xdef, pPeer);
+
+        InboxRouter::Destination destination1;
+        assertEqual(testRun, inboxRouter.findDestination("_INBOX.00000def.7.guid1", destination1), true);
+        assertEqual(testRun, destination1.pPeer == pPeer, true);
+        assertEqual(testRun, destination1.pSocket == nullptr, true);
+
+        // Inboxes of unknown gateways, and other inboxes, are routed by subscription...
+        InboxRouter::Destination destination2;
+        assertEqual(testRun, inboxRouter.findDestination("_INBOX.00000123.7.guid1", destination2), false);
+        assertEqual(testRun, inboxRouter.findDestination("_INBOX.abcdefgh", destination2), false);
+        assertEqual(testRun, inboxRouter.findDestination("PRICES.VOD", destination2), false);
+    }
+
+    TestUtils::log("Removing subscriptions...");
+    {
+        InboxRouter inboxRouter(0xabc);
+        inboxRouter.addSubscription("_INBOX.00000abc.12.guid1", 1, 12, pSocket1);
+        inboxRouter.addSubscription("_INBOX.00000abc.12.guid2", 2, 12, pSocket1);
+        inboxRouter.addSubscription("_INBOX.00000abc.13.guid3", 3, 13, pSocket2);
+        assertEqual(testRun, inboxRouter.size(), (size_t)3);
+
+        assertEqual(testRun, inboxRouter.removeSubscription("_INBOX.00000abc.12.guid1", 12), true);
+        assertEqual(testRun, inboxRouter.removeSubscription("_INBOX.00000abc.12.guid1", 12), false);
+        assertEqual(testRun, inboxRouter.removeSubscription("_INBOX.abcdefgh", 12), false);
+        assertEqual(testRun, inboxRouter.size(), (size_t)2);
+
+        InboxRouter::Destination destination1;
+        inboxRouter.findDestination("_INBOX.00000abc.12.guid1", destination1);
+        assertEqual(testRun, destination1.pSocket == nullptr, true);
+
+        inboxRouter.removeAllSubscriptions(12);
+        assertEqual(testRun, inboxRouter.size(), (size_t)1);
+
+        InboxRouter::Destination destination2;
+        inboxRouter.findDestination("_INBOX.00000abc.13.guid3", destination2);
+        assertEqual(testRun, destination2.pSocket == pSocket2, true);
+    }
+
+    TestUtils::log("Gateway IDs...");
+    {
+        GatewayInfo gatewayInfo1;
+        gatewayInfo1.Hostname = "host1";
+        gatewayInfo1.Port = 5050;
+        GatewayInfo gatewayInfo2 = gatewayInfo1;
+        gatewayInfo2.Port = 5051;
+        assertEqual(testRun, gatewayInfo1.makeID(), gatewayInfo1.makeID());
+        assertEqual(testRun, gatewayInfo1.makeID() != gatewayInfo2.makeID(), true);
+    }
+
+    TestUtils::log("Mismatched peer naming...");
+    {
+        // Our config names the peer localhost, but it names itself host2, so the ID it reports
+        // (in its ACK) is not the one we would work out...
+        GatewayInfo configuredPeer;
+        configuredPeer.Hostname = "localhost";
+        configuredPeer.Port = 5050;
+        GatewayInfo peerSelf = configuredPeer;
+        peerSelf.Hostname = "host2";
+        auto reportedID = peerSelf.makeID();
+        assertEqual(testRun, configuredPeer.makeID() != reportedID, true);
+
+        // Replies to the peer's inboxes go to it by the ID it reported...
+        InboxRouter inboxRouter(0xabc, 1);
+        inboxRouter.addPeer(reportedID, pPeer);
+        InboxRouter::Destination destination1;
+        assertEqual(testRun, inboxRouter.findDestination(std::format("_INBOX.{:08x}.7.guid1", reportedID), destination1), true);
+        assertEqual(testRun, destination1.pPeer == pPeer, true);
+        InboxRouter::Destination destination2;
+        assertEqual(testRun, inboxRouter.findDestination(std::format("_INBOX.{:08x}.7.guid1", configuredPeer.makeID()), destination2), false);
+
+        // When we lose the connection to the peer, replies to it are routed by subscription...
+        inboxRouter.removePeer(pPeer);
+        InboxRouter::Destination destination3;
+        assertEqual(testRun, inboxRouter.findDestination(std::format("_INBOX.{:08x}.7.guid1", reportedID), destination3), false);
+    }
+
+    TestUtils::log("Inbox subscriptions before peers report their IDs...");
+    {
+        // Until the peer has connected to us and reported its ID, it cannot send replies straight
+        // to our inboxes, so subscriptions to them are routed by subscription (and relayed)...
+        InboxRouter inboxRouter(0xabc, 1);
+        assertEqual(testRun, inboxRouter.getPeersRouteToInboxes(), false);
+        assertEqual(testRun, inboxRouter.addSubscription("_INBOX.00000abc.12.guid1", 1, 12, pSocket1), false);
+
+        // An older peer does not report its ID...
+        inboxRouter.addPeerSocket(100, std::nullopt);
+        assertEqual(testRun, inboxRouter.getPeersRouteToInboxes(), false);
+        inboxRouter.removePeerSocket(100);
+
+        // Once it has, subscriptions are held by the router...
+        inboxRouter.addPeerSocket(101, 0xdef);
+        assertEqual(testRun, inboxRouter.getPeersRouteToInboxes(), true);
+        assertEqual(testRun, inboxRouter.addSubscription("_INBOX.00000abc.12.guid2", 2, 12, pSocket1), true);
+
+        // The subscription made before is routed (and removed) by subscription...
+        InboxRouter::Destination destination1;
+        assertEqual(testRun, inboxRouter.findDestination("_INBOX.00000abc.12.guid1", destination1), false);
+        assertEqual(testRun, inboxRouter.removeSubscription("_INBOX.00000abc.12.guid1", 12), false);
+        InboxRouter::Destination destination2;
+        assertEqual(testRun, inboxRouter.findDestination("_INBOX.00000abc.12.guid2", destination2), true);
+        assertEqual(testRun, destination2.pSocket == pSocket1, true);
+
+        // When the peer disconnects, new subscriptions are routed by subscription again...
+        inboxRouter.removePeerSocket(101);
+        assertEqual(testRun, inboxRouter.addSubscription("_INBOX.00000abc.12.guid3", 3, 12, pSocket1), false);
+    }
+
+    TestUtils::log("Gateway ID collisions...");
+    {
+        // A peer which reports our own ID cannot route to our inboxes...
+        InboxRouter inboxRouter(0xabc, 2);
+        inboxRouter.addPeerSocket(100, 0xdef);
+        inboxRouter.addPeerSocket(101, 0xabc);
+        assertEqual(testRun, inboxRouter.getPeersRouteToInboxes(), false);
+
+        // Nor can two peers which report the same ID...
+        inboxRouter.addPeerSocket(101, 0xdef);
+        assertEqual(testRun, inboxRouter.getPeersRouteToInboxes(), false);
+        inboxRouter.addPeerSocket(101, 0x123);
+        assertEqual(testRun, inboxRouter.getPeersRouteToInboxes(), true);
+
+        // Replies to an ID reported by two of the peers we connect to are routed by subscription...
+        int peer2 = 0;
+        auto pPeer2 = reinterpret_cast<const MeshGatewayConnection*>(&peer2);
+        inboxRouter.addPeer(0xdef, pPeer);
+        inboxRouter.addPeer(0xdef, pPeer2);
+        InboxRouter::Destination destination1;
+        assertEqual(testRun, inboxRouter.findDestination("_INBOX.00000def.7.guid1", destination1), false);
+        inboxRouter.removePeer(pPeer2);
+        InboxRouter::Destination destination2;
+        assertEqual(testRun, inboxRouter.findDestination("_INBOX.00000def.7.guid1", destination2), true);
+        assertEqual(testRun, destination2.pPeer == pPeer, true);
+    }
+}
+
+// Tests for granting clients credit for the updates they send.
+void Tests_Gateway::creditGuard(TestRun& testRun)
+{
+    // We use a window large enough that the tests do not grant credit (which would write to
+    // the socket), and check the credit noted for the socket with takeCreditToGrant()...
+    auto pBuffer = Buffer::create();
+    pBuffer->write_bytes(std::string(100, 'x').data(), 100);
+    auto updateSize = static_cast<uint64_t>(pBuffer->getBufferSize());
+
+    TestUtils::log("Credit for a routed message...");
+    {
+        auto pSocket = Socket::create(nullptr);
+        pSocket->setCreditWindow(1000000);
+        {
+            CreditGuard creditGuard(pSocket.get(), pBuffer);
+            creditGuard.setAction(NetworkMessageHeader::Action::SEND_MESSAGE);
+        }
+        assertEqual(testRun, pSocket->takeCreditToGrant(500000), 500000 + updateSize);
+    }
+
+    TestUtils::log("Credit for a message whose routing fails...");
+    {
+        auto pSocket = Socket::create(nullptr);
+        pSocket->setCreditWindow(1000000);
+        try
+        {
+            CreditGuard creditGuard(pSocket.get(), pBuffer);
+            creditGuard.setAction(NetworkMessageHeader::Action::SEND_MESSAGE);
+            throw std::runtime_error("Routing failed");
+        }
+        catch (const std::exception&)
+        {
+        }
+        assertEqual(testRun, pSocket->takeCreditToGrant(500000), 500000 + updateSize);
+    }
+
+    TestUtils::log("Credit for an update whose header cannot be read...");
+    {
+        auto pSocket = Socket::create(nullptr);
+        pSocket->setCreditWindow(1000000);
+        try
+        {
+            CreditGuard creditGuard(pSocket.get(), pBuffer);
+            throw std::runtime_error("Bad header");
+        }
+        catch (const std::exception&)
+        {
+        }
+        assertEqual(testRun, pSocket->takeCreditToGrant(500000), 500000 + updateSize);
+    }
+
+    TestUtils::log("No credit for other updates...");
+    {
+        auto pSocket = Socket::create(nullptr);
+        pSocket->setCreditWindow(1000000);
+        {
+            CreditGuard creditGuard(pSocket.get(), pBuffer, NetworkMessageHeader::Action::SUBSCRIBE);
+        }
+        {
+            CreditGuard creditGuard(pSocket.get(), nullptr, NetworkMessageHeader::Action::DISCONNECT);
+        }
+        assertEqual(testRun, pSocket->takeCreditToGrant(500000), (uint64_t)500000);
+    }
+}
@@ -1,5 +1,7 @@
 #pragma once
 #include <cstdint>
+#include <string>
+#include <vector>
 #include <TestUtils.h>
 #include "GatewaySharedPointers.h"
 
@@ -18,10 +20,67 @@ namespace MessagingMesh
         // Tests for the subject-matching engine.
         static void subjectMatchingEngine(TestUtils::TestRun& testRun);
 
+        // Tests for removing unused nodes from the interest graph.
+        static void subjectMatchingEngine_NodePruning(TestUtils::TestRun& testRun);
+
+        // Tests for the literal subject index (fast path) in the subject-matching engine.
+        static void subjectMatchingEngine_LiteralIndex(TestUtils::TestRun& testRun);
+
+        // Tests deduplication of matches for mesh peers in the subject-matching engine.
+        static void subjectMatchingEngine_MeshPeers(TestUtils::TestRun& testRun);
+
+        // Tests for the flat token map.
+        static void flatTokenMap(TestUtils::TestRun& testRun);
+
+        // Tests for the compact set of subscriptions held on each node.
+        static void subscriberSet(TestUtils::TestRun& testRun);
+
+        // Tests for the subject index.
+        static void subjectIndex(TestUtils::TestRun& testRun);
+
+        // Tests for caching in the subject-matching engine.
+        static void subjectMatchCache(TestUtils::TestRun& testRun);
+
+        // Tests for the snapshot (multi-threaded) subject-matching engine.
+        static void snapshotSubjectMatchingEngine(TestUtils::TestRun& testRun);
+
+        // Tests for the covering set of patterns advertised to mesh peers.
+        static void meshInterestAggregator(TestUtils::TestRun& testRun);
+
+        // Tests for serializing subscription snapshots sent to mesh peers.
+        static void subscriptionSnapshot(TestUtils::TestRun& testRun);
+
+        // Tests for choosing services to move between loops in the service scheduler.
+        static void serviceScheduler(TestUtils::TestRun& testRun);
+
+        // Tests that services sharing a pool loop do not drop each other's unique events.
+        static void serviceEventKeys(TestUtils::TestRun& testRun);
+
+        // Tests for the single-producer single-consumer ring used by pipelined services.
+        static void spscRing(TestUtils::TestRun& testRun);
+
+        // Tests for parsing service settings in the gateway config.
+        static void gatewayConfig(TestUtils::TestRun& testRun);
+
+        // Tests for finding the conflation key for subjects a service conflates.
+        static void conflatedSubjects(TestUtils::TestRun& testRun);
+
+        // Tests for the last-value cache.
+        static void lastValueCache(TestUtils::TestRun& testRun);
+
+        // Tests for routing messages to direct inboxes.
+        static void inboxRouter(TestUtils::TestRun& testRun);
+
+        // Tests for granting clients credit for the updates they send.
+        static void creditGuard(TestUtils::TestRun& testRun);
+
     // Private functions...
     private:
         // Returns the subscription ID (as an int) if the collection contains it, -1 if not.
         static int containsID(const VecSubscriptionInfo& subscriptionInfos, uint32_t subscriptionID);
+
+        // Returns the strings sorted and joined with commas, so that they can be compared in any order.
+        static std::string sortAndJoin(std::vector<std::string> strings);
     };
 }  // namespace
 
@@ -0,0 +1,60 @@
+#include "TokenInterner.h"
+using namespace MessagingMesh;
+
+// Adds a reference to the token, interning it if we do not already have it.
+// Returns the token's ID.
+uint32_t TokenInterner::addReference(std::string_view token)
+{
+    // We check if we already have the token...
+    auto it = m_tokenIDs.find(token);
+    if (it != m_tokenIDs.end())
+    {
+        m_tokens[it->second].ReferenceCount++;
+        return it->second;
+    }
+
+    // This is a new token, so we give it a released ID or the next new ID...
+    uint32_t tokenID;
+    if (!m_freeTokenIDs.empty())
+    {
+        tokenID = m_freeTokenIDs.back();
+        m_freeTokenIDs.pop_back();
+    }
+    else
+    {
+        tokenID = static_cast<uint32_t>(m_tokens.size());
+        m_tokens.emplace_back();
+    }
+    auto& tokenInfo = m_tokens[tokenID];
+    tokenInfo.Token = token;
+    tokenInfo.ReferenceCount = 1;
+    m_tokenIDs.insert({ tokenInfo.Token, tokenID });
+    return tokenID;
+}
+
+// Releases a reference to the token, removing it when it is no longer referenced.
+void TokenInterner::release(uint32_t tokenID)
+{
+    auto& tokenInfo = m_tokens[tokenID];
+    if (--tokenInfo.ReferenceCount != 0)
+    {
+        return;
+    }
+
+    // The token is no longer used, so we remove it and make its ID available for reuse...
+    m_tokenIDs.erase(tokenInfo.Token);
+    std::string().swap(tokenInfo.Token);
+    m_freeTokenIDs.push_back(tokenID);
+}
+
+// Returns the ID for the token, or NO_TOKEN if it has not been interned.
+uint32_t TokenInterner::find(std::string_view token) const
+{
+    auto it = m_tokenIDs.find(token);
+    if (it == m_tokenIDs.end())
+    {
+        return NO_TOKEN;
+    }
+    return it->second;
+}
+
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "StringHash.h"
+
+namespace MessagingMesh
+{
+    /// <summary>
+    /// Maps subject tokens (the strings between the '.' delimiters) to 32-bit IDs.
+    ///
+    /// Each SubjectMatchingEngine - ie, each service - has its own interner. Tokens
+    /// are interned when subscriptions are added, so the interest graph can key its
+    /// nodes by integer rather than by string.
+    ///
+    /// When matching a sent subject we only need to look tokens up. A token which
+    /// has never been interned cannot match any non-wildcard node in the graph, so
+    /// lookups do not add to the interner and do not allocate.
+    ///
+    /// Reference counting
+    /// ------------------
+    /// Tokens are reference counted by the nodes in the interest graph which use them.
+    /// When the last node for a token is removed the token is removed from the interner
+    /// and its ID is reused for the next new token. So tokens which are only used once,
+    /// for example the GUIDs in inbox subjects, do not accumulate.
+    /// </summary>
+    class TokenInterner
+    {
+    // Public methods...
+    public:
+        // Adds a reference to the token, interning it if we do not already have it.
+        // Returns the token's ID.
+        uint32_t addReference(std::string_view token);
+
+        // Releases a reference to the token, removing it when it is no longer referenced.
+        void release(uint32_t tokenID);
+
+        // Returns the ID for the token, or NO_TOKEN if it has not been interned.
+        uint32_t find(std::string_view token) const;
+
+        // Returns the token for the ID provided.
+        const std::string& getToken(uint32_t tokenID) const { return m_tokens[tokenID].Token; }
+
+        // Gets the number of interned tokens.
+        size_t size() const { return m_tokenIDs.size(); }
+
+    // Public constants...
+    public:
+        // ID returned by find() for tokens which have not been interned.
+        static constexpr uint32_t NO_TOKEN = 0xffffffff;
+
+    // Private types...
+    private:
+        // Info about an interned token.
+        struct TokenInfo
+        {
+            std::string Token;
+            uint32_t ReferenceCount = 0;
+        };
+
+    // Private data...
+    private:
+        // Token IDs keyed by token...
+        std::unordered_map<std::string, uint32_t, StringHash, std::equal_to<>> m_tokenIDs;
+
+        // Token info indexed by token ID...
+        std::vector<TokenInfo> m_tokens;
+
+        // IDs released and available for reuse...
+        std::vector<uint32_t> m_freeTokenIDs;
+    };
+} // namespace
+
@@ -6,6 +6,7 @@
 #include <CLI/CLI11.hpp>
 #include "Gateway.h"
 #include "Tests_Gateway.h"
+#include "Benchmarks_Gateway.h"
 using namespace MessagingMesh;
 
 // Logs messages to the screen.
@@ -23,9 +24,22 @@ int main(int argc, char** argv)
     CLI::App app("Gateway");
     argv = app.ensure_utf8(argv);
     bool runTests = false;
+    bool runBenchmarks = false;
     int port;
+    Benchmarks_Gateway::Options benchmarkOptions;
     app.add_flag("-t,--test", runTests, "Runs tests");
+    app.add_flag("-b,--benchmark", runBenchmarks, "Runs benchmarks");
     app.add_option("-p,--port", port, "Listening port")->default_val(5050);
+    app.add_option("--bench-subscriptions", benchmarkOptions.SubscriptionCounts, "Subscription counts for synthetic benchmark graphs, eg 1000,100000,10000000")->delimiter(',');
+    app.add_option("--bench-depth", benchmarkOptions.Depth, "Tokens in each subject of synthetic benchmark graphs");
+    app.add_option("--bench-fanout", benchmarkOptions.FanOut, "Distinct tokens at each level of synthetic benchmark graphs");
+    app.add_option("--bench-star-ratio", benchmarkOptions.StarRatio, "Proportion of * subscriptions in synthetic benchmark graphs");
+    app.add_option("--bench-gt-ratio", benchmarkOptions.GreaterThanRatio, "Proportion of > subscriptions in synthetic benchmark graphs");
+    app.add_option("--bench-clients", benchmarkOptions.ClientCount, "Clients in synthetic benchmark graphs");
+    app.add_option("--bench-lookups", benchmarkOptions.LookupCount, "Subjects matched by synthetic benchmarks");
+    app.add_option("--bench-seed", benchmarkOptions.Seed, "Seed for synthetic benchmark graphs");
+    app.add_option("--bench-shards", benchmarkOptions.MaxShards, "Largest number of shards for the sharded routing benchmark (0 for the number of cores)");
+    app.add_option("--bench-json", benchmarkOptions.JSONPath, "File to save benchmark results to as JSON");
     CLI11_PARSE(app, argc, argv);
 
     if (runTests)  
@@ -33,6 +47,11 @@ int main(int argc, char** argv)
         // We run tests...
         Tests_Gateway::runAll();
     }
+    else if (runBenchmarks)
+    {
+        // We run benchmarks...
+        Benchmarks_Gateway::runAll(benchmarkOptions);
+    }
     else
     {
         // We run the gateway.
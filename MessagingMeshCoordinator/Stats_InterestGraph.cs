@@ -0,0 +1,59 @@
+﻿namespace MessagingMeshCoordinator
+{
+    /// <summary>
+    /// Interest graph stats for a service on one gateway.
+    /// This is equivalent to the ServiceStats::InterestGraphStats from the Gateway.
+    /// </summary>
+    public class Stats_InterestGraph
+    {
+        /// <summary>
+        /// Gets or sets the number of subscriptions.
+        /// </summary>
+        public ulong Subscriptions { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the number of nodes in the interest graph.
+        /// </summary>
+        public ulong Nodes { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the number of distinct subject tokens used by the interest graph.
+        /// </summary>
+        public ulong Tokens { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the number of subjects in the match cache.
+        /// </summary>
+        public ulong CachedSubjects { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the total number of match cache hits.
+        /// </summary>
+        public ulong CacheHits { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the total number of match cache misses.
+        /// </summary>
+        public ulong CacheMisses { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the total number of matches resolved from the literal subject index without walking the interest graph.
+        /// </summary>
+        public ulong FastPathMatches { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the total number of matches which walked the interest graph for wildcard subscriptions.
+        /// </summary>
+        public ulong GraphWalks { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the estimated memory used by the interest graph, in bytes.
+        /// </summary>
+        public ulong MemoryBytes { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the estimated memory used by the interest graph per subscription, in bytes.
+        /// </summary>
+        public double BytesPerSubscription { get; set; } = 0.0;
+    }
+}
@@ -37,5 +37,10 @@ namespace MessagingMeshCoordinator
         /// Gets or sets stats for the top subjects by Mb/sec processed in the reporting interval.
         /// </summary>
         public List<Stats_PerSubject> TopSubjects_MegaBitsPerSecond { get; set; } = new();
+
+        /// <summary>
+        /// Gets or sets interest graph stats (subscriptions, nodes and match cache).
+        /// </summary>
+        public Stats_InterestGraph InterestGraph { get; set; } = new();
     }
 }
@@ -82,6 +82,17 @@ namespace MessagingMeshLib.NET
         /// </summary>
         public const int SIZE_SIZE = 4;
 
+        /// <summary>
+        /// Set in the size of a network message which holds a chunk of a larger message.
+        /// </summary>
+        public const uint CHUNK_FLAG = 0x80000000;
+
+        /// <summary>
+        /// The size of the header at the start of a chunk: its size, its stream ID (uint32)
+        /// and the size of the whole message (int32).
+        /// </summary>
+        public const int CHUNK_HEADER_SIZE = SIZE_SIZE + sizeof(uint) + sizeof(int);
+
         #endregion
 
         #region Properties
@@ -91,6 +102,11 @@ namespace MessagingMeshLib.NET
         /// </summary>
         public bool HasAllData => m_hasAllData;
 
+        /// <summary>
+        /// Gets whether the network message is a chunk of a larger message.
+        /// </summary>
+        public bool IsChunk => m_isChunk;
+
         #endregion
 
         #region Public methods
@@ -466,6 +482,21 @@ namespace MessagingMeshLib.NET
             updatePosition_Write(size);
         }
 
+        /// <summary>
+        /// Writes bytes to the buffer from part of the array passed in.
+        /// </summary>
+        public void write_bytes(byte[] bytes, int offset, int size)
+        {
+            // We make sure that the buffer can hold the new data...
+            checkBufferSize_Write(size);
+
+            // We write the data to the buffer...
+            System.Buffer.BlockCopy(bytes, offset, m_buffer, m_position, size);
+
+            // We update the position and data size... 
+            updatePosition_Write(size);
+        }
+
         /// <summary>
         /// Reads a field from the buffer.
         /// </summary>
@@ -581,6 +612,14 @@ namespace MessagingMeshLib.NET
                 // the messaging-mesh network protocol for int32 is little-endian.)
                 m_bufferSize = BitConverter.ToInt32(m_networkMessageSizeBuffer, 0);
 
+                // If the chunk flag is set, the message is a chunk of a larger message, and
+                // the rest of the size is the size of the chunk...
+                if ((unchecked((uint)m_bufferSize) & CHUNK_FLAG) != 0)
+                {
+                    m_isChunk = true;
+                    m_bufferSize = unchecked((int)(unchecked((uint)m_bufferSize) & ~CHUNK_FLAG));
+                }
+
                 // We allocate the data buffer for the size...
                 m_dataSize = m_bufferSize;
                 m_buffer = new byte[m_bufferSize];
@@ -708,6 +747,9 @@ namespace MessagingMeshLib.NET
         // True if we have all data for a network message, false if not.
         private bool m_hasAllData = false;
 
+        // True if the network message is a chunk of a larger message.
+        private bool m_isChunk = false;
+
         // Buffer when reading the size from a network message.
         // (We may receive the size across multiple network updates.)
         private byte[] m_networkMessageSizeBuffer = new byte[SIZE_SIZE];
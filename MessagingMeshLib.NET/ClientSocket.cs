@@ -334,7 +334,21 @@ namespace MessagingMeshLib.NET
                         // We reset the position of the message / buffer so that it is 
                         // ready to be read by the client in the callback...
                         m_currentMessage.resetPosition();
-                        m_callback?.onDataReceived(this, m_currentMessage);
+                        if (m_currentMessage.IsChunk)
+                        {
+                            // If the chunk breaks the chunking limits we cannot trust the rest of the data
+                            // from the gateway, so we stop reading and disconnect...
+                            if (!onChunkReceived(m_currentMessage, out var error))
+                            {
+                                m_currentMessage = null;
+                                onProtocolError(error);
+                                return;
+                            }
+                        }
+                        else
+                        {
+                            m_callback?.onDataReceived(this, m_currentMessage);
+                        }
 
                         // We clear the current message to start a new one...
                         m_currentMessage = null;
@@ -351,6 +365,71 @@ namespace MessagingMeshLib.NET
             }
         }
 
+        /// <summary>
+        /// Adds a chunk to the message it is part of, and calls back with the message when it is complete.
+        /// (The gateway sends large messages in chunks, so that it can send other messages between them.)
+        /// Returns false (with the reason in error) if the chunk breaks the chunking limits.
+        /// </summary>
+        private bool onChunkReceived(Buffer chunk, out string error)
+        {
+            error = null;
+
+            // We read the chunk header...
+            if (chunk.getBufferSize() < Buffer.CHUNK_HEADER_SIZE)
+            {
+                error = "Chunk is smaller than its header";
+                return false;
+            }
+            var streamID = chunk.read_uint32();
+            var messageSize = chunk.read_int32();
+            if (messageSize <= 0 || messageSize > MAX_CHUNKED_MESSAGE_SIZE)
+            {
+                error = $"Chunked message size {messageSize} is not valid";
+                return false;
+            }
+
+            // We add the chunk's data to the message, which we create for its first chunk...
+            if (!m_chunkedMessages.TryGetValue(streamID, out var message))
+            {
+                if (m_chunkedMessages.Count >= MAX_CHUNKED_MESSAGES)
+                {
+                    error = $"More than {MAX_CHUNKED_MESSAGES} messages are being sent in chunks";
+                    return false;
+                }
+                message = new Buffer();
+                m_chunkedMessages.Add(streamID, message);
+            }
+            var chunkSize = chunk.getBufferSize() - Buffer.CHUNK_HEADER_SIZE;
+            if (message.getBufferSize() + chunkSize > messageSize)
+            {
+                error = "Chunks are larger than their message";
+                return false;
+            }
+            message.write_bytes(chunk.getBuffer(), Buffer.CHUNK_HEADER_SIZE, chunkSize);
+
+            // If we have the whole message we call back with it...
+            if (message.getBufferSize() == messageSize)
+            {
+                m_chunkedMessages.Remove(streamID);
+                message.resetPosition();
+                m_callback?.onDataReceived(this, message);
+            }
+            return true;
+        }
+
+        /// <summary>
+        /// Called when the gateway has sent data we cannot read. We stop the threads, shut down
+        /// the socket and notify the callback that we have disconnected.
+        /// </summary>
+        private void onProtocolError(string error)
+        {
+            Logger.error($"Disconnecting from gateway: {error}");
+            m_stopThreads = true;
+            m_chunkedMessages.Clear();
+            m_socket.Shutdown(SocketShutdown.Both);
+            m_callback?.onDisconnected(this);
+        }
+
         #endregion
 
         #region Private data
@@ -374,6 +453,13 @@ namespace MessagingMeshLib.NET
         // A buffer for the message being actively read from the socket...
         private Buffer m_currentMessage = null;
 
+        // Messages being reassembled from chunks, by stream ID...
+        private readonly Dictionary<uint, Buffer> m_chunkedMessages = new();
+
+        // The maximum number of messages we reassemble from chunks at the same time, and their maximum size...
+        private const int MAX_CHUNKED_MESSAGES = 16;
+        private const int MAX_CHUNKED_MESSAGE_SIZE = 1024 * 1024 * 1024;
+
         // Fixed sized buffer for sending aggregated data for small messages to the socket...
         private const int SMALL_MESSAGE_SEND_BUFFER_SIZE = 8192;
         private byte[] m_smallMessageSendBuffer = new byte[SMALL_MESSAGE_SEND_BUFFER_SIZE];
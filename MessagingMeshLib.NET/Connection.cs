@@ -82,6 +82,7 @@ namespace MessagingMeshLib.NET
             networkMessage.Header.Action = NetworkMessageHeader.ActionEnum.CONNECT;
             networkMessage.Header.Subject = connectionParams.Service;
             networkMessage.Header.ReplySubject = connectionParams.ClientID;
+            networkMessage.Message.addBool("SupportsChunks", true);
             sendNetworkMessage(networkMessage);
 
             // We wait for the ACK to confirm that we have connected.
@@ -299,12 +300,16 @@ namespace MessagingMeshLib.NET
                 switch (action)
                 {
                     case NetworkMessageHeader.ActionEnum.ACK:
-                        onAck();
+                        onAck(networkMessage, buffer);
                         break;
 
                     case NetworkMessageHeader.ActionEnum.SEND_MESSAGE:
                         onGatewayMessage(networkMessage.Header, buffer);
                         break;
+
+                    case NetworkMessageHeader.ActionEnum.ADVISORY:
+                        Logger.warn($"Advisory from gateway: {networkMessage.Header.Subject}");
+                        break;
                 }
             }
             catch (Exception ex)
@@ -474,10 +479,17 @@ namespace MessagingMeshLib.NET
         /// <summary>
         /// Called when we see an ACK message from the Gateway.
         /// </summary>
-        private void onAck()
+        private void onAck(NetworkMessage networkMessage, Buffer buffer)
         {
             try
             {
+                // The ACK holds the prefix for our inboxes...
+                networkMessage.deserializeMessage(buffer);
+                if (networkMessage.Message.tryGetString("InboxPrefix", out var inboxPrefix))
+                {
+                    m_inboxPrefix = inboxPrefix;
+                }
+
                 // We signal that the ACK has been received...
                 m_ackSignal.Set();
             }
@@ -570,7 +582,7 @@ namespace MessagingMeshLib.NET
         private string createInbox()
         {
             var guid = Guid.NewGuid().ToString("N");
-            return $"_INBOX.{guid}";
+            return $"{m_inboxPrefix}{guid}";
         }
 
         #endregion
@@ -586,6 +598,10 @@ namespace MessagingMeshLib.NET
         // Waits for the ACK signal...
         private AutoResetEvent m_ackSignal = new(false);
 
+        // The prefix for our inboxes. The gateway sends one in the ACK which names the gateway and our
+        // connection, so that it can route replies to our inboxes directly...
+        private string m_inboxPrefix = "_INBOX.";
+
         // Info for a subscription to a subject.
         private class SubscriptionInfo
         {
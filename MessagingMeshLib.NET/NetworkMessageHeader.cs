@@ -21,7 +21,11 @@ namespace MessagingMeshLib.NET
             ACK,
             SUBSCRIBE,
             UNSUBSCRIBE,
-            SEND_MESSAGE
+            SEND_MESSAGE,
+            CONNECT_MESH_PEER,
+            SUBSCRIPTION_SNAPSHOT,
+            ADVISORY,
+            CREDIT
         };
 
         #endregion
@@ -23,6 +23,7 @@ void Buffer::reset()
     m_position = SIZE_SIZE;
     m_dataSize = SIZE_SIZE;
     m_hasAllData = false;
+    m_isChunk = false;
     m_networkMessageSizeBufferPosition = 0;
     m_gotNetworkBufferSize = false;
 }
@@ -457,6 +458,14 @@ size_t Buffer::readNetworkMessageSize(const char* pNetworkBuffer, size_t network
         std::memcpy(&m_bufferSize, &m_networkMessageSizeBuffer[0], SIZE_SIZE);
         m_gotNetworkBufferSize = true;
 
+        // If the chunk flag is set, the message is a chunk of a larger message, and
+        // the rest of the size is the size of the chunk...
+        if (static_cast<uint32_t>(m_bufferSize) & CHUNK_FLAG)
+        {
+            m_isChunk = true;
+            m_bufferSize = static_cast<int32_t>(static_cast<uint32_t>(m_bufferSize) & ~CHUNK_FLAG);
+        }
+
         // We allocate the data buffer for the size...
         delete[] m_pBuffer;
         m_dataSize = m_bufferSize;
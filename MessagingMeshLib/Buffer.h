@@ -48,6 +48,11 @@ namespace MessagingMesh
     /// populate the Buffer. For large messages this may be done over multiple network
     /// updates received by the Socket. 
     /// 
+    /// Large messages may be sent as chunks, each in its own network message, so that
+    /// other messages can be interleaved between them (see Socket). A chunk has the
+    /// CHUNK_FLAG bit set in its size, and starts with a stream ID and the size of the
+    /// whole message, followed by the next part of the message's data (after its size).
+    /// 
     /// The byte-array includes the size
     /// --------------------------------
     /// The byte-array managed by the Buffer includes the size of the byte-array as 
@@ -83,6 +88,12 @@ namespace MessagingMesh
         // The size in bytes of the buffer size (int32) - which we store at the start of the buffer...
         static const int SIZE_SIZE = 4;
 
+        // Set in the size of a network message which holds a chunk of a larger message...
+        static const uint32_t CHUNK_FLAG = 0x80000000;
+
+        // The size of the header at the start of a chunk: its size, its stream ID (uint32) and the size of the whole message (int32)...
+        static const int CHUNK_HEADER_SIZE = SIZE_SIZE + sizeof(uint32_t) + sizeof(int32_t);
+
     // Public methods...
     public:
         // Creates a Buffer instance.
@@ -115,6 +126,9 @@ namespace MessagingMesh
         // Returns true if we hold all data for a network message, false if not.
         bool hasAllData() const { return m_hasAllData; }
 
+        // Returns true if the network message read into the buffer is a chunk of a larger message.
+        bool isChunk() const { return m_isChunk; }
+
         // Reads data from a network data buffer until we have all the data for
         // the buffer as specified by the size in the network message.
         // Returns the number of bytes read from the buffer.
@@ -254,6 +268,9 @@ namespace MessagingMesh
         // True if we have all data for a network message, false if not.
         bool m_hasAllData = false;
 
+        // True if the network message is a chunk of a larger message.
+        bool m_isChunk = false;
+
         // Buffer when reading the size from a network message.
         // (We may receive the size across multiple network updates.)
         char m_networkMessageSizeBuffer[SIZE_SIZE] = {};
@@ -12,7 +12,14 @@ namespace MessagingMesh
     enum class NotificationType
     {
         // Notification sent when the connection has been completed (in particular for asynchronous connection).
-        CONNECTED
+        CONNECTED,
+
+        // Notification sent when the messages sent but not yet processed by the gateway reach
+        // ConnectionParams.SendQueueHighWaterMark. The info holds the size of the send queue.
+        SEND_QUEUE_HIGH_WATER_MARK,
+
+        // Notification sent when the send queue has fallen back to half the high-water mark.
+        SEND_QUEUE_BELOW_HIGH_WATER_MARK
     };
 
     // Signature for subscription callbacks.
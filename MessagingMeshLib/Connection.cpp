@@ -24,12 +24,27 @@ std::string Connection::createInbox()
 }
 
 // Sends a message to the specified subject.
-// Returns the number of bytes sent on the network.
+// Returns the number of bytes sent on the network, or WOULD_BLOCK.
+// Uses the default send-mode from the connection params if the gateway is flow controlling the connection.
 int32_t Connection::sendMessage(const MessagePtr& pMessage, const std::string& subject, const std::string& replySubject)
 {
     return m_pImpl->sendMessage(pMessage, subject, replySubject);
 }
 
+// Sends a message to the specified subject, with the send-mode specified.
+// Returns the number of bytes sent on the network, or WOULD_BLOCK.
+int32_t Connection::sendMessage(const MessagePtr& pMessage, const std::string& subject, const std::string& replySubject, ConnectionParams::SendMode sendMode)
+{
+    return m_pImpl->sendMessage(pMessage, subject, replySubject, sendMode);
+}
+
+// Gets the size (in bytes) of messages sent which the gateway has not yet processed.
+// (Zero if the gateway is not flow controlling the connection.)
+uint64_t Connection::getSendQueueBytes() const
+{
+    return m_pImpl->getSendQueueBytes();
+}
+
 // Sends a blocking request to the subject specified. Returns the reply or 
 // nullptr if the request times out.
 MessagePtr Connection::sendRequest(const std::string& subject, const MessagePtr& pMessage, double timeoutSeconds)
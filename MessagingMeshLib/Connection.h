@@ -16,6 +16,12 @@ namespace MessagingMesh
     /// </summary>
     class Connection
     {
+    // Constants...
+    public:
+        // Returned by sendMessage() when the message was not sent as it would have blocked
+        // waiting for credit from the gateway (see ConnectionParams::SendMode).
+        static constexpr int32_t WOULD_BLOCK = -1;
+
     // Public methods...
     public:
         // Constructor.
@@ -31,9 +37,18 @@ namespace MessagingMesh
         std::string createInbox();
 
         // Sends a message to the specified subject.
-        // Returns the number of bytes sent on the network.
+        // Returns the number of bytes sent on the network, or WOULD_BLOCK.
+        // Uses the default send-mode from the connection params if the gateway is flow controlling the connection.
         int32_t sendMessage(const MessagePtr& pMessage, const std::string& subject, const std::string& replySubject = "");
 
+        // Sends a message to the specified subject, with the send-mode specified.
+        // Returns the number of bytes sent on the network, or WOULD_BLOCK.
+        int32_t sendMessage(const MessagePtr& pMessage, const std::string& subject, const std::string& replySubject, ConnectionParams::SendMode sendMode);
+
+        // Gets the size (in bytes) of messages sent which the gateway has not yet processed.
+        // (Zero if the gateway is not flow controlling the connection.)
+        uint64_t getSendQueueBytes() const;
+
         // Sends a blocking request to the subject specified. Returns the reply or 
         // nullptr if the request times out.
         MessagePtr sendRequest(const std::string& subject, const MessagePtr& pMessage, double timeoutSeconds);
@@ -1,5 +1,8 @@
 #include "ConnectionImpl.h"
+#include <algorithm>
 #include <format>
+#include "Buffer.h"
+#include "Connection.h"
 #include "UVLoop.h"
 #include "Exception.h"
 #include "Socket.h"
@@ -46,6 +49,7 @@ ConnectionImpl::ConnectionImpl(const ConnectionParams& connectionParams, Connect
     header.setAction(NetworkMessageHeader::Action::CONNECT);
     header.setSubject(connectionParams.Service);
     header.setReplySubject(clientID);
+    networkMessage.getMessage()->addBool("SupportsChunks", true);
     MMUtils::sendNetworkMessage(networkMessage, m_pSocket);
 
     if (!connectionParams.ConnectAsynchronously)
@@ -89,8 +93,16 @@ const std::string& ConnectionImpl::getVersion()
 }
 
 // Sends a message to the specified subject.
-// Returns the number of bytes sent on the network.
-int32_t ConnectionImpl::sendMessage(const MessagePtr& pMessage, const std::string& subject, const std::string& replySubject) const
+// Returns the number of bytes sent on the network, or Connection::WOULD_BLOCK.
+// Uses the default send-mode from the connection params if the gateway is flow controlling the connection.
+int32_t ConnectionImpl::sendMessage(const MessagePtr& pMessage, const std::string& subject, const std::string& replySubject)
+{
+    return sendMessage(pMessage, subject, replySubject, m_connectionParams.DefaultSendMode);
+}
+
+// Sends a message to the specified subject, with the send-mode specified.
+// Returns the number of bytes sent on the network, or Connection::WOULD_BLOCK.
+int32_t ConnectionImpl::sendMessage(const MessagePtr& pMessage, const std::string& subject, const std::string& replySubject, ConnectionParams::SendMode sendMode)
 {
     // We create a NetworkMessage to send the message...
     NetworkMessage networkMessage;
@@ -100,8 +112,29 @@ int32_t ConnectionImpl::sendMessage(const MessagePtr& pMessage, const std::strin
     header.setReplySubject(replySubject);
     networkMessage.setMessage(pMessage);
 
+    // We serialize the message, and take credit for its size...
+    auto pBuffer = Buffer::create();
+    networkMessage.serialize(*pBuffer);
+    if (!takeCredit(pBuffer->getBufferSize(), sendMode))
+    {
+        return Connection::WOULD_BLOCK;
+    }
+
     // We send the message...
-    return MMUtils::sendNetworkMessage(networkMessage, m_pSocket);
+    m_pSocket->write(pBuffer);
+    return pBuffer->getBufferSize();
+}
+
+// Gets the size (in bytes) of messages sent which the gateway has not yet processed.
+// (Zero if the gateway is not flow controlling the connection.)
+uint64_t ConnectionImpl::getSendQueueBytes() const
+{
+    std::scoped_lock lock(m_creditMutex);
+    if (!m_flowControlled)
+    {
+        return 0;
+    }
+    return static_cast<uint64_t>(std::max<int64_t>(static_cast<int64_t>(m_creditWindow) - m_credit, 0));
 }
 
 // Sends a blocking request to the subject specified. 
@@ -134,16 +167,8 @@ MessagePtr ConnectionImpl::sendRequest(const std::string& subject, const Message
         m_requestSubscriptionIDs.insert(pSubscription->getSubscriptionID());
     }
 
-    // We create a NetworkMessage to send the request...
-    NetworkMessage networkMessage;
-    auto& header = networkMessage.getHeader();
-    header.setAction(NetworkMessageHeader::Action::SEND_MESSAGE);
-    header.setSubject(subject);
-    header.setReplySubject(inbox);
-    networkMessage.setMessage(pMessage);
-
-    // We send the message...
-    MMUtils::sendNetworkMessage(networkMessage, m_pSocket);
+    // We send the request, with the inbox as its reply subject...
+    sendMessage(pMessage, subject, inbox, ConnectionParams::SendMode::BLOCK);
 
     // We block on the auto reset event, waiting for the result...
     auto timeoutMilliseconds = int(timeoutSeconds * 1000);
@@ -373,12 +398,20 @@ void ConnectionImpl::onDataReceived(Socket* /*pSocket*/, BufferPtr pBuffer)
         switch (action)
         {
         case NetworkMessageHeader::Action::ACK:
-            onAck();
+            onAck(networkMessage, *pBuffer);
+            break;
+
+        case NetworkMessageHeader::Action::CREDIT:
+            onCredit(networkMessage, *pBuffer);
             break;
 
         case NetworkMessageHeader::Action::SEND_MESSAGE:
             onGatewayMessage(header, pBuffer);
             break;
+
+        case NetworkMessageHeader::Action::ADVISORY:
+            onAdvisory(networkMessage, *pBuffer);
+            break;
         }
     }
     catch (const std::exception& ex)
@@ -402,15 +435,42 @@ void ConnectionImpl::onConnectionStatusChanged(Socket* pSocket, Socket::Connecti
 
     case Socket::ConnectionStatus::DISCONNECTED:
         Logger::info(std::format("Socket disconnected: {} ({})", pSocket->getName(), message));
+        {
+            // The gateway will not grant more credit, so we release any senders waiting for it...
+            std::scoped_lock lock(m_creditMutex);
+            m_flowControlled = false;
+        }
+        m_creditCondition.notify_all();
         break;
     }
 }
 
 // Called when we see the ACK message from the Gateway.
-void ConnectionImpl::onAck()
+void ConnectionImpl::onAck(NetworkMessage& networkMessage, Buffer& buffer)
 {
     try
     {
+        // The ACK holds the prefix for our inboxes...
+        networkMessage.deserializeMessage(buffer);
+        auto inboxPrefix = networkMessage.getMessage()->tryGetString("InboxPrefix");
+        if (inboxPrefix)
+        {
+            m_inboxPrefix = inboxPrefix->get();
+        }
+
+        // If the gateway flow controls the connection, the ACK holds our credit window...
+        auto creditWindow = networkMessage.getMessage()->tryGetUnsignedInt64("CreditWindow");
+        if (creditWindow)
+        {
+            std::scoped_lock lock(m_creditMutex);
+            m_flowControlled = true;
+            m_creditWindow = *creditWindow;
+            m_credit = static_cast<int64_t>(*creditWindow);
+        }
+
+        // We only send large messages in chunks if the gateway has said it can read them...
+        m_pSocket->setPeerSupportsChunks(networkMessage.getMessage()->tryGetBool("SupportsChunks").value_or(false));
+
         // We signal that the ACK has been received...
         m_ackSignal.set();
 
@@ -426,6 +486,109 @@ void ConnectionImpl::onAck()
     }
 }
 
+// Called when we see a CREDIT message from the Gateway.
+void ConnectionImpl::onCredit(NetworkMessage& networkMessage, Buffer& buffer)
+{
+    // We add the credit, and wake up any senders waiting for it...
+    networkMessage.deserializeMessage(buffer);
+    auto credit = networkMessage.getMessage()->getUnsignedInt64("Bytes");
+    std::optional<NotificationType> notification;
+    {
+        std::scoped_lock lock(m_creditMutex);
+        m_credit += static_cast<int64_t>(credit);
+        notification = checkHighWaterMark();
+    }
+    m_creditCondition.notify_all();
+    if (notification)
+    {
+        sendHighWaterMarkNotification(*notification);
+    }
+}
+
+// Takes credit to send a message of the size specified, waiting for credit if the send-mode is BLOCK.
+// Returns false if the message should not be sent as it would block.
+bool ConnectionImpl::takeCredit(size_t messageSizeBytes, ConnectionParams::SendMode sendMode)
+{
+    std::optional<NotificationType> notification;
+    {
+        std::unique_lock lock(m_creditMutex);
+        if (!m_flowControlled)
+        {
+            return true;
+        }
+
+        // We can send a message if we have any credit left (so a message larger than the window
+        // can still be sent). If we do not, we act on the send-mode. We cannot wait on the messaging
+        // thread, as that is where credit is received...
+        if (m_credit <= 0)
+        {
+            if (sendMode == ConnectionParams::SendMode::RETURN_IF_WOULD_BLOCK)
+            {
+                return false;
+            }
+            if (sendMode == ConnectionParams::SendMode::BLOCK && !m_pUVLoop->isCurrentThread())
+            {
+                m_creditCondition.wait(lock, [this]() { return m_credit > 0 || !m_flowControlled; });
+            }
+        }
+        m_credit -= static_cast<int64_t>(messageSizeBytes);
+        notification = checkHighWaterMark();
+    }
+    if (notification)
+    {
+        sendHighWaterMarkNotification(*notification);
+    }
+    return true;
+}
+
+// Returns the notification to send if the send queue has crossed the high-water mark, or nullopt.
+// Must be called with the credit mutex held.
+std::optional<NotificationType> ConnectionImpl::checkHighWaterMark()
+{
+    auto highWaterMark = static_cast<int64_t>(m_connectionParams.SendQueueHighWaterMark);
+    if (highWaterMark == 0 || !m_flowControlled)
+    {
+        return std::nullopt;
+    }
+    auto sendQueueBytes = static_cast<int64_t>(m_creditWindow) - m_credit;
+    if (!m_aboveHighWaterMark && sendQueueBytes >= highWaterMark)
+    {
+        m_aboveHighWaterMark = true;
+        return NotificationType::SEND_QUEUE_HIGH_WATER_MARK;
+    }
+    if (m_aboveHighWaterMark && sendQueueBytes <= highWaterMark / 2)
+    {
+        m_aboveHighWaterMark = false;
+        return NotificationType::SEND_QUEUE_BELOW_HIGH_WATER_MARK;
+    }
+    return std::nullopt;
+}
+
+// Sends a notification for the send queue crossing the high-water mark.
+void ConnectionImpl::sendHighWaterMarkNotification(NotificationType notificationType)
+{
+    if (m_connectionParams.NotificationCallback)
+    {
+        m_connectionParams.NotificationCallback(m_connection, notificationType, std::format("SendQueueBytes={}", getSendQueueBytes()));
+    }
+}
+
+// Called when we see an ADVISORY message from the Gateway.
+void ConnectionImpl::onAdvisory(NetworkMessage& networkMessage, Buffer& buffer)
+{
+    // We log the advisory. For a slow-consumer advisory, the gateway has dropped messages
+    // to us as we are not reading them fast enough...
+    networkMessage.deserializeMessage(buffer);
+    auto pMessage = networkMessage.getMessage();
+    Logger::warn(std::format("Advisory from gateway: {} (DroppedMessages={}, DroppedBytes={}, ConflatedMessages={}, QueuedMessages={}, QueuedBytes={})",
+        networkMessage.getHeader().getSubject(),
+        pMessage->getUnsignedInt64("DroppedMessages"),
+        pMessage->getUnsignedInt64("DroppedBytes"),
+        pMessage->getUnsignedInt64("ConflatedMessages"),
+        pMessage->getUnsignedInt64("QueuedMessages"),
+        pMessage->getUnsignedInt64("QueuedBytes")));
+}
+
 // Called when we see a SEND_MESSAGE message from the Gateway.
 void ConnectionImpl::onGatewayMessage(const NetworkMessageHeader& header, BufferPtr pBuffer)
 {
@@ -533,5 +696,5 @@ void ConnectionImpl::performSubscriptionCallbacks(const VecCallbackInfo& callbac
 std::string ConnectionImpl::createInbox()
 {
     auto guid = MMUtils::createGUID();
-    return std::format("_INBOX.{}", guid);
+    return std::format("{}{}", m_inboxPrefix, guid);
 }
@@ -4,6 +4,9 @@
 #include <unordered_map>
 #include <queue>
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
 #include "SharedAliases.h"
 #include "Socket.h"
 #include "AutoResetEvent.h"
@@ -22,6 +25,17 @@ namespace MessagingMesh
     /// <summary>
     /// Implementation of the Connection class, ie a client connection
     /// to the messaging-mesh.
+    /// 
+    /// Flow control
+    /// ------------
+    /// The gateway can give us a credit window (in the ACK), which is the number of bytes of messages
+    /// we can send which it has not yet processed. It grants more credit (in CREDIT messages) as it
+    /// processes our messages. When the credit has been used up, sendMessage() waits, sends anyway or
+    /// returns WOULD_BLOCK depending on the send-mode. So a fast publisher is slowed down at source,
+    /// rather than filling our queues and the gateway's with messages.
+    /// 
+    /// We note the size of the messages sent which the gateway has not yet processed (the send queue),
+    /// and send notifications when it reaches the high-water mark, and when it falls back from it.
     /// </summary>
     class ConnectionImpl : Socket::ICallback
     {
@@ -40,8 +54,17 @@ namespace MessagingMesh
         std::string createInbox();
 
         // Sends a message to the specified subject.
-        // Returns the number of bytes sent on the network.
-        int32_t sendMessage(const MessagePtr& pMessage, const std::string& subject, const std::string& replySubject = "") const;
+        // Returns the number of bytes sent on the network, or Connection::WOULD_BLOCK.
+        // Uses the default send-mode from the connection params if the gateway is flow controlling the connection.
+        int32_t sendMessage(const MessagePtr& pMessage, const std::string& subject, const std::string& replySubject = "");
+
+        // Sends a message to the specified subject, with the send-mode specified.
+        // Returns the number of bytes sent on the network, or Connection::WOULD_BLOCK.
+        int32_t sendMessage(const MessagePtr& pMessage, const std::string& subject, const std::string& replySubject, ConnectionParams::SendMode sendMode);
+
+        // Gets the size (in bytes) of messages sent which the gateway has not yet processed.
+        // (Zero if the gateway is not flow controlling the connection.)
+        uint64_t getSendQueueBytes() const;
 
         // Sends a blocking request to the subject specified. 
         // Returns the reply or nullptr if the request times out.
@@ -83,7 +106,24 @@ namespace MessagingMesh
     // Private functions...
     private:
         // Called when we see the ACK message from the Gateway.
-        void onAck();
+        void onAck(NetworkMessage& networkMessage, Buffer& buffer);
+
+        // Called when we see a CREDIT message from the Gateway.
+        void onCredit(NetworkMessage& networkMessage, Buffer& buffer);
+
+        // Takes credit to send a message of the size specified, waiting for credit if the send-mode is BLOCK.
+        // Returns false if the message should not be sent as it would block.
+        bool takeCredit(size_t messageSizeBytes, ConnectionParams::SendMode sendMode);
+
+        // Returns the notification to send if the send queue has crossed the high-water mark, or nullopt.
+        // Must be called with the credit mutex held.
+        std::optional<NotificationType> checkHighWaterMark();
+
+        // Sends a notification for the send queue crossing the high-water mark.
+        void sendHighWaterMarkNotification(NotificationType notificationType);
+
+        // Called when we see an ADVISORY message from the Gateway.
+        void onAdvisory(NetworkMessage& networkMessage, Buffer& buffer);
 
         // Called when we see a SEND_MESSAGE message from the Gateway.
         void onGatewayMessage(const NetworkMessageHeader& header, BufferPtr pBuffer);
@@ -122,6 +162,11 @@ namespace MessagingMesh
         // Waits for the ACK signal...
         AutoResetEvent m_ackSignal;
 
+        // The prefix for our inboxes. The gateway sends one in the ACK which names the gateway and our
+        // connection, so that it can route replies to our inboxes directly. (Set before the ACK is
+        // signalled, and not changed after it.)
+        std::string m_inboxPrefix = "_INBOX.";
+
         // Threadsafe subscription ID.
         // Note: This starts at 1, which means we can use 0 to indicate an invalid subscription ID.
         std::atomic<uint32_t> m_nextSubscriptionID = 1;
@@ -163,6 +208,19 @@ namespace MessagingMesh
         // Message backlog if maxMessages is passed to processMessageQueue() and
         // not all messages have been processed.
         std::queue<QueuedMessage> m_messageBacklog;
+
+        // Flow control: true if the gateway has given us a credit window, the window, and the credit we
+        // have left (which can be negative if messages were sent without waiting for credit)...
+        bool m_flowControlled = false;
+        uint64_t m_creditWindow = 0;
+        int64_t m_credit = 0;
+
+        // True if the send queue has reached the high-water mark (and not yet fallen back from it)...
+        bool m_aboveHighWaterMark = false;
+
+        // Mutex for the flow control data, and a condition signalled when credit is granted...
+        mutable std::mutex m_creditMutex;
+        std::condition_variable m_creditCondition;
     };
 } // namespace
 
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include "Callbacks.h"
 
@@ -17,6 +18,23 @@ namespace MessagingMesh
             PROCESS_MESSAGE_QUEUE
         };
 
+        // Enum for how sendMessage() behaves when the gateway is flow controlling the connection
+        // and the credit it has granted us has been used up.
+        enum class SendMode
+        {
+            // sendMessage() waits until the gateway grants more credit.
+            // (Messages sent from callbacks on the Connection's messaging thread do not wait, as that
+            // thread receives the credit.)
+            BLOCK,
+
+            // sendMessage() sends the message without waiting. Messages queue up, so use the send-queue
+            // high-water mark to see when the gateway is not keeping up.
+            NON_BLOCKING,
+
+            // sendMessage() does not send the message, and returns Connection::WOULD_BLOCK.
+            RETURN_IF_WOULD_BLOCK
+        };
+
 
         // The gateway host or IP address.
         std::string GatewayHost;
@@ -36,6 +54,15 @@ namespace MessagingMesh
         // Callback for notifications.
         NotificationCallback NotificationCallback = nullptr;
 
+        // How sendMessage() behaves when the credit granted by the gateway has been used up (unless
+        // a send-mode is passed to sendMessage()).
+        SendMode DefaultSendMode = SendMode::BLOCK;
+
+        // The size (in bytes) of messages sent but not yet processed by the gateway at which we send
+        // a SEND_QUEUE_HIGH_WATER_MARK notification. We send SEND_QUEUE_BELOW_HIGH_WATER_MARK when
+        // it falls to half this size. Zero for no notifications.
+        uint64_t SendQueueHighWaterMark = 0;
+
         // If true constructing a Connection will return before the connection is complete.
         // You can use the notification callback to see when the connection is ready.
         bool ConnectAsynchronously = false;
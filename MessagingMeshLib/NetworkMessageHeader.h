@@ -24,7 +24,10 @@ namespace MessagingMesh
             SUBSCRIBE,
             UNSUBSCRIBE,
             SEND_MESSAGE,
-            CONNECT_MESH_PEER
+            CONNECT_MESH_PEER,
+            SUBSCRIPTION_SNAPSHOT,
+            ADVISORY,
+            CREDIT
         };
 
     // Public methods...
@@ -4,6 +4,7 @@
 #include "UVUtils.h"
 #include "UVLoop.h"
 #include "Buffer.h"
+#include "Exception.h"
 #include "OSSocketHolder.h"
 using namespace MessagingMesh;
 
@@ -30,6 +31,7 @@ Socket::~Socket()
     // We mark the socket as not connected and clear the write queue...
     m_connected = false;
     m_queuedWrites.clear();
+    m_loopWrites.clear();
 
     // The destructor could be called from a different thread than the one running the UV loop, so we marshall 
     // the socket close event to the socket's UV loop. (Provided that the socket has not already been closed.)
@@ -337,8 +339,10 @@ void Socket::onConnectCompleted(int status)
 void Socket::moveToLoop(UVLoopPtr pLoop)
 {
     // To move a socket to a new loop we:
-    // - Create a duplicate socket
     // - Mark the socket as not connected (so that writes are queued)
+    // - Stop reading (data received while we move is read on the new loop)
+    // - Wait for UV writes which have not completed
+    // - Create a duplicate socket
     // - Close the original UV socket handle
     // - Wait for close to complete
     // - Change the Socket's UVLoop to the new one
@@ -346,17 +350,51 @@ void Socket::moveToLoop(UVLoopPtr pLoop)
 
     Logger::info("Moving socket to loop: " + pLoop->getName());
 
-    // We duplicate the socket...
-    auto pNewOSSocket = UVUtils::duplicateSocket(m_pSocket->socket);
-
     // We mark the socket as not connected...
     m_connected = false;
 
+    // Writes made on the old loop from now on go to the thread-safe queue, as the socket
+    // will be written on the new loop's thread. We append writes already queued on this loop
+    // to the thread-safe queue now, so that they are sent after the move, before any later
+    // writes from this loop. (They go after writes already queued from other threads. Each
+    // publisher writes from one thread, so its writes stay in order.)...
+    m_loopWritesEnabled.store(false, std::memory_order_release);
+    for (auto& bufferInfo : m_loopWrites)
+    {
+        m_queuedWrites.add(bufferInfo);
+    }
+    m_loopWrites.clear();
+
+    // We stop reading...
+    uv_read_stop((uv_stream_t*)m_pSocket);
+
+    // Closing the socket cancels UV writes which have not completed, which would lose their data
+    // (and could cut off a message part-written to the socket). So if there are any, we close the
+    // socket when they have completed (see onWriteCompleted). No more UV writes are made while
+    // the socket is not connected, and the output queue is sent from the new loop...
+    m_pMoveToUVLoop = pLoop;
+    if (m_pendingUVWrites == 0)
+    {
+        moveToLoop_closeSocket();
+    }
+    else
+    {
+        Logger::info(std::format("Waiting for {} writes to complete before moving socket: {}", m_pendingUVWrites, m_name));
+    }
+}
+
+// Closes the socket to move it to another UV loop, once its UV writes have completed.
+void Socket::moveToLoop_closeSocket()
+{
+    // We duplicate the socket...
+    auto pNewOSSocket = UVUtils::duplicateSocket(m_pSocket->socket);
+
     // We close the socket...
     auto pMoveInfo = new move_socket_t;
     pMoveInfo->self = shared_from_this();
     pMoveInfo->pNewOSSocket = pNewOSSocket;
-    pMoveInfo->pNewUVLoop = pLoop;
+    pMoveInfo->pNewUVLoop = std::move(m_pMoveToUVLoop);
+    m_pMoveToUVLoop = nullptr;
     m_pSocket->data = pMoveInfo;
     uv_close((uv_handle_t*)m_pSocket, on_uv_close_move_socket_callback);
 }
@@ -406,8 +444,9 @@ void Socket::moveToLoop_registerDuplicatedSocket(UVLoopPtr pUVLoop, OSSocketHold
     {
         auto socket = pOSSocket->getSocket();
 
-        // We switch to the new UV loop...
+        // We switch to the new UV loop, and writes made on it can be queued without a lock...
         m_pUVLoop = pUVLoop;
+        m_loopWritesEnabled.store(true, std::memory_order_release);
 
         // We create the UV socket...
         createSocket();
@@ -438,11 +477,37 @@ void Socket::moveToLoop_registerDuplicatedSocket(UVLoopPtr pUVLoop, OSSocketHold
 // Queues data to be written to the socket.
 // Can be called from any thread, not just from the uv loop thread.
 // Queued writes will be coalesced into one network update.
-// RSSTODO: We need some way to slow down the client if it publishes too much too fast.
-void Socket::write(BufferPtr pBuffer, uint32_t subscriptionIDOverride)
+// Writes made on the socket's own loop are queued without a lock and sent at the
+// end of the loop iteration.
+// Queued writes are sent in order of priority, and in the order they were written within a priority.
+// Note: Publishers which send faster than the gateway can process their messages are slowed
+//       down by credit-based flow control (see ConnectionImpl and takeCreditToGrant()).
+void Socket::write(BufferPtr pBuffer, uint32_t subscriptionIDOverride, uint64_t conflationKey, WritePriority priority)
 {
-    // We queue the data to write...
-    BufferInfo bufferInfo(pBuffer, subscriptionIDOverride);
+    // If we are on the socket's loop (as we usually are in the gateway) we do not need a lock
+    // or a marshalled event. We queue the data and defer sending it to the end of the loop 
+    // iteration, which coalesces all the writes made in the iteration...
+    // Note: We check that loop writes are enabled before looking at the loop, as the loop
+    //       changes when the socket moves.
+    if (m_loopWritesEnabled.load(std::memory_order_acquire) && m_pUVLoop->isCurrentThread())
+    {
+        m_loopWrites.emplace_back(pBuffer, subscriptionIDOverride, conflationKey, priority);
+        if (!m_loopWritesPending)
+        {
+            m_loopWritesPending = true;
+            auto self = shared_from_this();
+            m_pUVLoop->deferToEndOfIteration(
+                [self](uv_loop_t* /*pLoop*/)
+                {
+                    self->processLoopWrites();
+                }
+            );
+        }
+        return;
+    }
+
+    // We are on a different thread, so we queue the data to write...
+    BufferInfo bufferInfo(pBuffer, subscriptionIDOverride, conflationKey, priority);
     m_queuedWrites.add(bufferInfo);
 
     // We take a shared pointer to the socket. This keeps it alive until the marshalled
@@ -460,6 +525,45 @@ void Socket::write(BufferPtr pBuffer, uint32_t subscriptionIDOverride)
     );
 }
 
+// Queues a batch of data to be written to the socket together, eg the cached values sent
+// for a new subscription.
+// Can be called from any thread. Writes from other threads take the lock once for the batch.
+void Socket::writeBatch(const std::vector<BufferPtr>& buffers, uint32_t subscriptionIDOverride)
+{
+    if (buffers.empty())
+    {
+        return;
+    }
+
+    // On the socket's loop, writes are queued without a lock, and all those made in the loop
+    // iteration are sent together...
+    if (m_loopWritesEnabled.load(std::memory_order_acquire) && m_pUVLoop->isCurrentThread())
+    {
+        for (const auto& pBuffer : buffers)
+        {
+            write(pBuffer, subscriptionIDOverride);
+        }
+        return;
+    }
+
+    // We are on a different thread, so we queue the batch and marshall one event to write it...
+    std::vector<BufferInfo> bufferInfos;
+    bufferInfos.reserve(buffers.size());
+    for (const auto& pBuffer : buffers)
+    {
+        bufferInfos.emplace_back(pBuffer, subscriptionIDOverride);
+    }
+    m_queuedWrites.add(bufferInfos);
+    auto self = shared_from_this();
+    m_pUVLoop->marshallUniqueEvent(
+        m_writeEventKey,
+        [self](uv_loop_t* /*pLoop*/)
+        {
+            self->processQueuedWrites();
+        }
+    );
+}
+
 // Sends network messages for all queued writes.
 void Socket::processQueuedWrites()
 {
@@ -471,15 +575,39 @@ void Socket::processQueuedWrites()
             return;
         }
 
-        // We convert the queued writes into UV write-requests and send them...
+        // We add the queued writes to the output queue and send them...
         auto queuedWrites = m_queuedWrites.getItems();
-        getWriteRequests(*queuedWrites, [&](UVUtils::WriteRequest* pWriteRequest)
-            {
-                send(pWriteRequest);
-            });
+        queueWrites(*queuedWrites);
+
+        // We send any writes queued on the loop (eg, while the socket was connecting)...
+        processLoopWrites();
+    }
+    catch (const std::exception& ex)
+    {
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
+
+// Sends network messages for writes queued on the socket's loop.
+void Socket::processLoopWrites()
+{
+    try
+    {
+        // We check if the socket is connected. If not, the writes stay queued until it is...
+        m_loopWritesPending = false;
+        if (!m_connected)
+        {
+            return;
+        }
+
+        // We add the queued writes to the output queue and send them. We clear the queue,
+        // keeping its capacity for the next loop iteration...
+        queueWrites(m_loopWrites);
+        m_loopWrites.clear();
     }
     catch (const std::exception& ex)
     {
+        m_loopWrites.clear();
         Logger::error(std::format("{}: {}", __func__, ex.what()));
     }
 }
@@ -487,7 +615,36 @@ void Socket::processQueuedWrites()
 // Sends data to the socket.
 void Socket::send(UVUtils::WriteRequest* pWriteRequest)
 {
-    uv_write(&pWriteRequest->write_request, (uv_stream_t*)m_pSocket, &pWriteRequest->buffer, 1, on_uv_write_callback);
+    // We first try to write the data straight away. If the socket's send buffer has space (as it 
+    // usually does for request / reply traffic) this writes it all, and we do not need to queue a
+    // UV write and wait for it to call back.
+    // Note: This does not write anything if earlier UV writes are still queued, so data is not
+    //       sent out of order.
+    auto pStream = (uv_stream_t*)m_pSocket;
+    auto bytesWritten = uv_try_write(pStream, pWriteRequest->buffers, (unsigned int)pWriteRequest->bufferCount);
+    if (bytesWritten > 0)
+    {
+        if (static_cast<size_t>(bytesWritten) == pWriteRequest->getSize())
+        {
+            UVUtils::releaseWriteRequest(pWriteRequest);
+            return;
+        }
+
+        // Some of the data was written, so we queue a write for the rest...
+        pWriteRequest->removeWrittenData(bytesWritten);
+    }
+
+    // We queue a UV write for the data not yet written. (If uv_try_write failed with an
+    // error other than UV_EAGAIN, uv_write will call back with the error.) We count the UV
+    // writes which have not completed, as the socket cannot be moved to another loop until
+    // they have (see moveToLoop)...
+    m_pendingUVWrites++;
+    auto status = uv_write(&pWriteRequest->write_request, pStream, pWriteRequest->buffers, (unsigned int)pWriteRequest->bufferCount, on_uv_write_callback);
+    if (status < 0)
+    {
+        // The write was not queued, so it will not call back...
+        onWriteCompleted(&pWriteRequest->write_request, status);
+    }
 }
 
 // (Static) callback from uv_write.
@@ -497,139 +654,458 @@ void Socket::on_uv_write_callback(uv_write_t* request, int status)
     pWriteRequest->pSocket->onWriteCompleted(request, status);
 }
 
-// Calls back with UV write requests to send for the queued data.
-void Socket::getWriteRequests(const std::vector<BufferInfo>& bufferInfos, std::function<void(UVUtils::WriteRequest*)> callback)
+// Notes that messages received from the peer have been processed. Returns the credit to grant
+// the peer, once the bytes processed since the last grant reach half the window, or zero.
+// Called on the loop which processes the socket's messages.
+uint64_t Socket::takeCreditToGrant(size_t processedBytes)
 {
-    // How we fill in the write requests depends on the size of the buffers in the queue.
-    // 
-    // Small buffers
-    // -------------
-    // If we have a lot of small buffers it is more efficient to combine them into one
-    // larger buffer before sending, to reduce the number of sends on the socket.
-    //
-    // Large buffers
-    // -------------
-    // For large buffers it is better to send them in one go.
-    //
-    // What we do
-    // ----------
-    // - We have pSmallMessagesWriteRequest for aggregating smaller messages. 
-    //
-    // - If a buffer is small (<= the small message send buffer size) we add it to the
-    //   small message write request. If it does not fit, we add what we can, and add the remainder
-    //   to the next small message write request.
-    //   
-    // - If a buffer is large (> small message send buffer size) then we send the buffer as it is.
-    //   NOTE: We make sure that we have sent any partially filled small write request first.
-    //
-    // Subscription ID override
-    // ------------------------
-    // When sending messages from the Gateway to clients buffer-infos may have a subscription ID
-    // override. This is the client-specific subscription ID for its subscription to the message.
-    // We need to make sure that this is 'pasted-in' to the appropriate position in the data we 
-    // send, ie just after the Size at the start of the buffer.
+    // We grant credit in batches, so that we do not send a grant for each message...
+    if (m_creditWindow == 0)
+    {
+        return 0;
+    }
+    m_processedBytes += processedBytes;
+    if (m_processedBytes < m_creditWindow / 2)
+    {
+        return 0;
+    }
+    auto credit = m_processedBytes;
+    m_processedBytes = 0;
+    return credit;
+}
+
+// Queues data to be written to the socket ahead of data already queued (in all priority
+// classes), and outside the output queue limits. Used for advisories about the queue itself.
+// Must be called on the uv loop thread.
+void Socket::writeAhead(BufferPtr pBuffer)
+{
+    // We add the data to the front of the highest-priority lane. (It moves the positions of
+    // the other writes in the lane back by one.)
+    auto& lane = getOutputLane(WritePriority::CONTROL);
+    lane.Writes.emplace_front(pBuffer, 0, 0, WritePriority::CONTROL);
+    lane.Bytes += pBuffer->getBufferSize();
+    lane.FrontPosition--;
+    m_outputQueueMessages++;
+    m_outputQueueBytes += pBuffer->getBufferSize();
+
+    // We send it with any other writes made in this loop iteration...
+    if (!m_loopWritesPending)
+    {
+        m_loopWritesPending = true;
+        auto self = shared_from_this();
+        m_pUVLoop->deferToEndOfIteration(
+            [self](uv_loop_t* /*pLoop*/)
+            {
+                self->processLoopWrites();
+            }
+        );
+    }
+}
 
-    // Size in a buffer of the Size + Subscription ID...
-    const int SIZE_PLUS_SUBSCRIPTION_ID = Buffer::SIZE_SIZE + sizeof(uint32_t);
+// Gets counts of data dropped from the output queue, and the data now queued.
+// Can be called from any thread.
+Socket::OutputQueueStats Socket::getOutputQueueStats() const
+{
+    OutputQueueStats outputQueueStats;
+    outputQueueStats.DroppedMessages = m_droppedMessages.load(std::memory_order_relaxed);
+    outputQueueStats.DroppedBytes = m_droppedBytes.load(std::memory_order_relaxed);
+    outputQueueStats.ConflatedMessages = m_conflatedMessages.load(std::memory_order_relaxed);
+    outputQueueStats.SlowConsumerDisconnections = m_slowConsumerDisconnections.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < WRITE_PRIORITY_COUNT; ++i)
+    {
+        auto& queueDepth = outputQueueStats.QueuedByPriority[i];
+        queueDepth.Messages = m_queuedMessages[i].load(std::memory_order_relaxed);
+        queueDepth.Bytes = m_queuedBytes[i].load(std::memory_order_relaxed);
+        outputQueueStats.QueuedMessages += queueDepth.Messages;
+        outputQueueStats.QueuedBytes += queueDepth.Bytes;
+    }
+    return outputQueueStats;
+}
 
-    // The small buffer write request...
-    const int SMALL_MESSAGE_SEND_BUFFER_SIZE = 8192;
-    UVUtils::WriteRequest* pSmallMessagesWriteRequest = nullptr;
-    auto smallMessageSendBufferPosition = 0;
+// Adds coalesced writes to the output queue, and sends as much of the queue as we can.
+void Socket::queueWrites(std::vector<BufferInfo>& bufferInfos)
+{
+    // We add the writes to the output queue...
+    for (auto& bufferInfo : bufferInfos)
+    {
+        if (!addToOutputQueue(bufferInfo))
+        {
+            disconnectSlowConsumer();
+            return;
+        }
+    }
 
-    // We process each buffer...
-    for(const auto& bufferInfo : bufferInfos)
+    // If data has been dropped, we tell the callback (which may write an advisory ahead
+    // of the queued data)...
+    if (m_dropsToNotify)
     {
-        // We check if the buffer is small or large...
-        auto bufferSize = bufferInfo.pBuffer->getBufferSize();
-        auto bufferData = bufferInfo.pBuffer->getBuffer();
-        if (bufferSize < SIZE_PLUS_SUBSCRIPTION_ID)
+        auto now = std::chrono::steady_clock::now();
+        if (now - m_lastDropNotificationTime >= DROP_NOTIFICATION_INTERVAL)
         {
-            // This does not look like a Messaging Mesh buffer.
-            continue;
+            m_dropsToNotify = false;
+            m_lastDropNotificationTime = now;
+            if (m_pCallback)
+            {
+                m_pCallback->onOutputQueueDrops(this);
+            }
         }
-        if (bufferSize <= SMALL_MESSAGE_SEND_BUFFER_SIZE)
+    }
+
+    // We send what we can...
+    sendOutputQueue();
+}
+
+// Adds a write to the output queue, applying the queue limits.
+// Returns false if the socket should be disconnected as a slow consumer.
+bool Socket::addToOutputQueue(BufferInfo& bufferInfo)
+{
+    // A write with a conflation key replaces the queued write for the same key, if there is one...
+    if (bufferInfo.conflationKey != 0 && conflate(bufferInfo))
+    {
+        return true;
+    }
+
+    // We check if the queue has space for the write...
+    size_t size = bufferInfo.pBuffer->getBufferSize();
+    if (isOutputQueueFull(size))
+    {
+        switch (m_outputQueueLimits.Policy)
         {
-            // We have a small message, so we add it to the small message write request...
-            auto bufferPosition = 0;
-            while (bufferPosition < bufferSize)
+        case SlowConsumerPolicy::DISCONNECT:
+            return false;
+
+        case SlowConsumerPolicy::DROP_NEWEST:
+            noteDropped(1, size);
+            return true;
+
+        case SlowConsumerPolicy::CONFLATE:
+            // We replace a queued write for the same subscription, or if there is none
+            // we drop the oldest writes (see below)...
+            if (conflate(bufferInfo))
             {
-                // We add as much as we can to the small message send buffer.
-                auto sizeRemaining_smallMessageSendBuffer = SMALL_MESSAGE_SEND_BUFFER_SIZE - smallMessageSendBufferPosition;
-                auto sizeRemaining_buffer = bufferSize - bufferPosition;
-                auto sizeToCopy = std::min(sizeRemaining_buffer, sizeRemaining_smallMessageSendBuffer);
-
-                // If we are writing from the start of the buffer we want the size-to-copy to be at least 
-                // eight bytes (for the Size and Subscription ID). If we do not have enough space we send
-                // the small message write request and create a new one...
-                if (bufferPosition == 0 && sizeToCopy < SIZE_PLUS_SUBSCRIPTION_ID && pSmallMessagesWriteRequest != nullptr)
-                {
-                    pSmallMessagesWriteRequest->buffer.len = smallMessageSendBufferPosition;
-                    callback(pSmallMessagesWriteRequest);
-                    pSmallMessagesWriteRequest = nullptr;
-                    smallMessageSendBufferPosition = 0;
-                    continue;
-                }
-                // We copy the data to the write request...
-                if (pSmallMessagesWriteRequest == nullptr)
-                {
-                    pSmallMessagesWriteRequest = UVUtils::allocateWriteRequest(SMALL_MESSAGE_SEND_BUFFER_SIZE, shared_from_this());
-                }
-                std::memcpy(pSmallMessagesWriteRequest->buffer.base + smallMessageSendBufferPosition, bufferData + bufferPosition, sizeToCopy);
+                m_dropsToNotify = true;
+                return true;
+            }
+            [[fallthrough]];
 
-                // If we are writing the first part of the buffer and we have an overridden subscription ID
-                // we override it in the write request...
-                if (bufferPosition == 0 && bufferInfo.subscriptionIDOverride != 0)
+        case SlowConsumerPolicy::DROP_OLDEST:
+            // We drop the oldest writes, starting with the lowest-priority lane...
+            while (m_outputQueueMessages > 0 && isOutputQueueFull(size))
+            {
+                if (!dropOldest())
                 {
-                    std::memcpy(pSmallMessagesWriteRequest->buffer.base + smallMessageSendBufferPosition + Buffer::SIZE_SIZE, &bufferInfo.subscriptionIDOverride, sizeof(uint32_t));
+                    break;
                 }
+            }
+            if (isOutputQueueFull(size))
+            {
+                // The write is larger than the queue can hold...
+                noteDropped(1, size);
+                return true;
+            }
+            break;
+        }
+    }
+
+    pushOutputQueue(std::move(bufferInfo));
+    return true;
+}
 
-                // We update the buffer positions...
-                smallMessageSendBufferPosition += sizeToCopy;
-                bufferPosition += sizeToCopy;
+// Returns true if adding data of the size specified would take the output queue over its limits.
+bool Socket::isOutputQueueFull(size_t size) const
+{
+    return (m_outputQueueLimits.MaxBytes != 0 && m_outputQueueBytes + size > m_outputQueueLimits.MaxBytes)
+        || (m_outputQueueLimits.MaxMessages != 0 && m_outputQueueMessages + 1 > m_outputQueueLimits.MaxMessages);
+}
 
-                // If we have filled the small message buffer we send it...
-                if (smallMessageSendBufferPosition == SMALL_MESSAGE_SEND_BUFFER_SIZE)
+// Replaces the queued write with the same conflation key and subscription ID with the write provided.
+// Returns false if there is no such queued write.
+bool Socket::conflate(BufferInfo& bufferInfo)
+{
+    // We find the queued write...
+    if (m_outputQueuePositions.empty() || !isConflatable(bufferInfo))
+    {
+        return false;
+    }
+    auto it = m_outputQueuePositions.find({ bufferInfo.subscriptionIDOverride, bufferInfo.conflationKey, bufferInfo.priority });
+    if (it == m_outputQueuePositions.end())
+    {
+        return false;
+    }
+
+    // We replace it, keeping its place in its lane, unless it is part-way through being sent in chunks...
+    auto& lane = getOutputLane(bufferInfo.priority);
+    auto& queuedBufferInfo = lane.Writes[it->second - lane.FrontPosition];
+    if (queuedBufferInfo.chunkOffset != 0)
+    {
+        return false;
+    }
+    size_t queuedSize = queuedBufferInfo.pBuffer->getBufferSize();
+    size_t size = bufferInfo.pBuffer->getBufferSize();
+    lane.Bytes = lane.Bytes - queuedSize + size;
+    m_outputQueueBytes = m_outputQueueBytes - queuedSize + size;
+    queuedBufferInfo.pBuffer = std::move(bufferInfo.pBuffer);
+    m_conflatedMessages.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// Returns true if the write can replace (or be replaced by) other queued writes.
+bool Socket::isConflatable(const BufferInfo& bufferInfo) const
+{
+    return bufferInfo.conflationKey != 0
+        || (m_outputQueueLimits.Policy == SlowConsumerPolicy::CONFLATE && bufferInfo.subscriptionIDOverride != 0);
+}
+
+// Returns the highest-priority lane with queued writes, or nullptr if the output queue is empty.
+Socket::OutputLane* Socket::getNextOutputLane()
+{
+    for (auto& lane : m_outputLanes)
+    {
+        if (!lane.Writes.empty())
+        {
+            return &lane;
+        }
+    }
+    return nullptr;
+}
+
+// Adds a write to the back of its lane of the output queue.
+void Socket::pushOutputQueue(BufferInfo&& bufferInfo)
+{
+    // We note the position of writes which may be replaced by later ones...
+    auto& lane = getOutputLane(bufferInfo.priority);
+    if (isConflatable(bufferInfo))
+    {
+        m_outputQueuePositions[{ bufferInfo.subscriptionIDOverride, bufferInfo.conflationKey, bufferInfo.priority }] = lane.FrontPosition + lane.Writes.size();
+    }
+    size_t size = bufferInfo.pBuffer->getBufferSize();
+    lane.Bytes += size;
+    m_outputQueueBytes += size;
+    m_outputQueueMessages++;
+    lane.Writes.push_back(std::move(bufferInfo));
+}
+
+// Removes the write at the front of the lane.
+void Socket::popOutputQueue(OutputLane& lane)
+{
+    auto& bufferInfo = lane.Writes.front();
+    if (!m_outputQueuePositions.empty() && isConflatable(bufferInfo))
+    {
+        auto it = m_outputQueuePositions.find({ bufferInfo.subscriptionIDOverride, bufferInfo.conflationKey, bufferInfo.priority });
+        if (it != m_outputQueuePositions.end() && it->second == lane.FrontPosition)
+        {
+            m_outputQueuePositions.erase(it);
+        }
+    }
+    size_t size = bufferInfo.pBuffer->getBufferSize();
+    lane.Bytes -= size;
+    m_outputQueueBytes -= size;
+    m_outputQueueMessages--;
+    lane.Writes.pop_front();
+    lane.FrontPosition++;
+}
+
+// Drops the oldest write in the lowest-priority lane which has queued writes (other than a
+// message part-sent in chunks). Returns false if there is no write which can be dropped.
+bool Socket::dropOldest()
+{
+    for (auto it = m_outputLanes.rbegin(); it != m_outputLanes.rend(); ++it)
+    {
+        // We cannot drop a message once we have started sending its chunks...
+        if (!it->Writes.empty() && it->Writes.front().chunkOffset == 0)
+        {
+            noteDropped(1, it->Writes.front().pBuffer->getBufferSize());
+            popOutputQueue(*it);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Clears the output queue.
+void Socket::clearOutputQueue()
+{
+    for (auto& lane : m_outputLanes)
+    {
+        lane.FrontPosition += lane.Writes.size();
+        lane.Writes.clear();
+        lane.Bytes = 0;
+    }
+    m_outputQueueMessages = 0;
+    m_outputQueueBytes = 0;
+    m_outputQueuePositions.clear();
+}
+
+// Updates the stats for the data in the output queue.
+void Socket::storeQueuedStats()
+{
+    for (size_t i = 0; i < WRITE_PRIORITY_COUNT; ++i)
+    {
+        m_queuedMessages[i].store(m_outputLanes[i].Writes.size(), std::memory_order_relaxed);
+        m_queuedBytes[i].store(m_outputLanes[i].Bytes, std::memory_order_relaxed);
+    }
+}
+
+// Notes that data has been dropped from the output queue.
+void Socket::noteDropped(size_t messageCount, size_t byteCount)
+{
+    m_droppedMessages.fetch_add(messageCount, std::memory_order_relaxed);
+    m_droppedBytes.fetch_add(byteCount, std::memory_order_relaxed);
+    m_dropsToNotify = true;
+}
+
+// Disconnects the socket as the reader is not keeping up with the data written to it.
+void Socket::disconnectSlowConsumer()
+{
+    // We drop the queued data...
+    noteDropped(m_outputQueueMessages, m_outputQueueBytes);
+    clearOutputQueue();
+    storeQueuedStats();
+    m_slowConsumerDisconnections.fetch_add(1, std::memory_order_relaxed);
+
+    // We disconnect...
+    handleSocketDisconnected("Slow consumer: output queue limit reached");
+}
+
+// Passes data from the output queue to UV writes, while the socket is keeping up.
+void Socket::sendOutputQueue()
+{
+    // We fill UV write requests from the front of the queue, until either the queue is empty or
+    // the data in UV writes which have not completed reaches the limit. (The rest is sent
+    // as the UV writes complete.) Each write is taken from the highest-priority lane which has
+    // data, so higher-priority data queued later overtakes lower-priority data...
+    //
+    // A chunk of a large message ends the write request, so the UV writes hold at most one chunk
+    // per request, and data queued in higher-priority lanes can go out between the chunks...
+    auto pStream = (uv_stream_t*)m_pSocket;
+    while (m_outputQueueMessages > 0 && uv_stream_get_write_queue_size(pStream) < MAX_UV_WRITE_QUEUE_BYTES)
+    {
+        auto pWriteRequest = UVUtils::allocateWriteRequest(shared_from_this());
+        for (auto pLane = getNextOutputLane(); pLane; pLane = getNextOutputLane())
+        {
+            auto& bufferInfo = pLane->Writes.front();
+            if (isChunked(bufferInfo))
+            {
+                if (addChunkToWriteRequest(*pWriteRequest, bufferInfo)
+                    && bufferInfo.chunkOffset == static_cast<size_t>(bufferInfo.pBuffer->getBufferSize() - Buffer::SIZE_SIZE))
                 {
-                    pSmallMessagesWriteRequest->buffer.len = smallMessageSendBufferPosition;
-                    callback(pSmallMessagesWriteRequest);
-                    pSmallMessagesWriteRequest = nullptr;
-                    smallMessageSendBufferPosition = 0;
+                    popOutputQueue(*pLane);
                 }
+                break;
             }
+            if (!addToWriteRequest(*pWriteRequest, bufferInfo))
+            {
+                break;
+            }
+            popOutputQueue(*pLane);
+        }
+        if (pWriteRequest->bufferCount > 0)
+        {
+            send(pWriteRequest);
         }
         else
         {
-            // We have a large message.
-            // We make sure that any partially filled small buffer has been sent.
-            if (pSmallMessagesWriteRequest != nullptr)
-            {
-                pSmallMessagesWriteRequest->buffer.len = smallMessageSendBufferPosition;
-                callback(pSmallMessagesWriteRequest);
-                pSmallMessagesWriteRequest = nullptr;
-                smallMessageSendBufferPosition = 0;
-            }
+            UVUtils::releaseWriteRequest(pWriteRequest);
+        }
+    }
 
-            // We send the large buffer...
-            auto pLargeWriteRequest = UVUtils::allocateWriteRequest(bufferSize, shared_from_this());
-            std::memcpy(pLargeWriteRequest->buffer.base, bufferData, bufferSize);
+    // We update the stats for the data still queued...
+    storeQueuedStats();
+}
 
-            // We override the subscription ID if needed...
-            if (bufferInfo.subscriptionIDOverride != 0)
-            {
-                std::memcpy(pLargeWriteRequest->buffer.base + Buffer::SIZE_SIZE, &bufferInfo.subscriptionIDOverride, sizeof(uint32_t));
-            }
+// Adds the buffer to the UV write request.
+// Returns false if the write request does not have space for the buffer.
+bool Socket::addToWriteRequest(UVUtils::WriteRequest& writeRequest, const BufferInfo& bufferInfo)
+{
+    // Scatter-gather writes
+    // ---------------------
+    // We do not copy the queued data. Each write request holds a list of buffers (iovecs) which
+    // point into the queued Buffers, and it holds references to the Buffers until the write has
+    // completed. This means that when the Gateway sends a message to many clients, the message
+    // is not copied for each of them.
+    //
+    // Many messages are combined into one write request, so that we make one write on the socket
+    // for them (until the request is full, when we start a new one).
+    //
+    // Subscription ID override
+    // ------------------------
+    // When sending messages from the Gateway to clients buffer-infos may have a subscription ID
+    // override. This is the client-specific subscription ID for its subscription to the message.
+    // It needs to be in the data we send just after the Size at the start of the buffer. We cannot
+    // change the (shared) buffer, so we send a small prefix (held in the write request) with the
+    // Size and the overridden Subscription ID, followed by the rest of the buffer.
+
+    // We check the buffer size...
+    size_t bufferSize = bufferInfo.pBuffer->getBufferSize();
+    auto bufferData = bufferInfo.pBuffer->getBuffer();
+    if (bufferSize < UVUtils::WriteRequest::PREFIX_SIZE)
+    {
+        // This does not look like a Messaging Mesh buffer, so we skip it.
+        return true;
+    }
 
-            callback(pLargeWriteRequest);
+    // We check that the write request has space for the buffer...
+    auto bufferCount = (bufferInfo.subscriptionIDOverride != 0) ? 2 : 1;
+    if (!writeRequest.hasSpace(bufferCount))
+    {
+        return false;
+    }
+
+    // We add the buffer to the write request, with a prefix if we are overriding the subscription ID...
+    if (bufferInfo.subscriptionIDOverride != 0)
+    {
+        writeRequest.addPrefix(bufferData, bufferInfo.subscriptionIDOverride);
+        if (bufferSize > UVUtils::WriteRequest::PREFIX_SIZE)
+        {
+            writeRequest.addBuffer(bufferData + UVUtils::WriteRequest::PREFIX_SIZE, bufferSize - UVUtils::WriteRequest::PREFIX_SIZE);
         }
     }
+    else
+    {
+        writeRequest.addBuffer(bufferData, bufferSize);
+    }
+    writeRequest.payloads.push_back(bufferInfo.pBuffer);
+    return true;
+}
+
+// Adds the next chunk of the buffer to the UV write request.
+// Returns false if the write request does not have space for the chunk.
+bool Socket::addChunkToWriteRequest(UVUtils::WriteRequest& writeRequest, BufferInfo& bufferInfo)
+{
+    // Each chunk is a network message with a header (see Buffer) followed by the next part of the
+    // message's data, ie the data after its size. As for other writes, we point into the message's
+    // Buffer rather than copying it. If the subscription ID is overridden, the first chunk starts
+    // with the overridden ID (held with the header) instead of the one in the Buffer...
+
+    // We check that the write request has space for the header and the data...
+    if (!writeRequest.hasSpace(2))
+    {
+        return false;
+    }
+
+    // A new message gets a stream ID...
+    auto bufferSize = bufferInfo.pBuffer->getBufferSize();
+    auto bufferData = bufferInfo.pBuffer->getBuffer();
+    if (bufferInfo.chunkOffset == 0)
+    {
+        bufferInfo.chunkStreamID = ++m_nextChunkStreamID;
+    }
 
-    // We send any remaining small message buffer...
-    if (pSmallMessagesWriteRequest != nullptr)
+    // We add the header and the data for the chunk...
+    auto dataSize = static_cast<size_t>(bufferSize - Buffer::SIZE_SIZE);
+    auto chunkSize = std::min(static_cast<size_t>(CHUNK_SIZE), dataSize - bufferInfo.chunkOffset);
+    auto offset = bufferInfo.chunkOffset;
+    uint32_t subscriptionIDOverride = 0;
+    if (offset == 0 && bufferInfo.subscriptionIDOverride != 0)
     {
-        pSmallMessagesWriteRequest->buffer.len = smallMessageSendBufferPosition;
-        callback(pSmallMessagesWriteRequest);
+        subscriptionIDOverride = bufferInfo.subscriptionIDOverride;
+        offset += sizeof(uint32_t);
     }
+    writeRequest.addChunkHeader(static_cast<int32_t>(Buffer::CHUNK_HEADER_SIZE + chunkSize), bufferInfo.chunkStreamID, bufferSize, subscriptionIDOverride);
+    writeRequest.addBuffer(bufferData + Buffer::SIZE_SIZE + offset, chunkSize - (offset - bufferInfo.chunkOffset));
+    writeRequest.payloads.push_back(bufferInfo.pBuffer);
+    bufferInfo.chunkOffset += chunkSize;
+    return true;
 }
 
 // Called when a write request has completed.
@@ -638,6 +1114,7 @@ void Socket::onWriteCompleted(uv_write_t* pRequest, int status)
     try
     {
         // We check the status...
+        m_pendingUVWrites--;
         if (status < 0)
         {
             // We log the error...
@@ -647,6 +1124,19 @@ void Socket::onWriteCompleted(uv_write_t* pRequest, int status)
             // It looks like the socket has disconnected...
             handleSocketDisconnected(error);
         }
+        else if (m_connected)
+        {
+            // There is now space for more UV writes, so we send more of the output queue.
+            // Note: We do this before releasing the write request, as it holds a reference to the socket.
+            sendOutputQueue();
+        }
+
+        // If the socket is waiting to move to another loop, we can close it once its UV writes
+        // have all completed...
+        if (m_pMoveToUVLoop && m_pendingUVWrites == 0)
+        {
+            moveToLoop_closeSocket();
+        }
 
         // We release the write request (including the buffer)...
         auto pWriteRequest = (UVUtils::WriteRequest*)pRequest;
@@ -666,8 +1156,13 @@ void Socket::handleSocketDisconnected(const std::string& error)
     // We note that the socket is no longer connected...
     m_connected = false;
 
-    // We clear the write queue...
+    // We clear the write queues...
     m_queuedWrites.clear();
+    m_loopWrites.clear();
+    clearOutputQueue();
+
+    // We drop any messages part-received in chunks...
+    m_chunkedMessages.clear();
 
     // We notify observers...
     if (m_pCallback)
@@ -791,7 +1286,22 @@ void Socket::onDataReceived(uv_stream_t* /*pStream*/, ssize_t nread, const uv_bu
                 // We reset the position of the message / buffer so that it is 
                 // ready to be read by the client in the callback...
                 m_pCurrentMessage->resetPosition();
-                if (m_pCallback)
+                if (m_pCurrentMessage->isChunk())
+                {
+                    // If the chunk breaks the chunking limits we cannot trust the rest of the data
+                    // from the peer, so we stop reading and disconnect it...
+                    std::string error;
+                    if (!onChunkReceived(*m_pCurrentMessage, error))
+                    {
+                        m_pCurrentMessage = nullptr;
+                        UVUtils::releaseBufferMemory(pBuffer);
+                        Logger::warn(std::format("onDataReceived from {}: {}", m_name, error));
+                        uv_read_stop((uv_stream_t*)m_pSocket);
+                        handleSocketDisconnected(error);
+                        return;
+                    }
+                }
+                else if (m_pCallback)
                 {
                     m_pCallback->onDataReceived(this, m_pCurrentMessage);
                 }
@@ -814,3 +1324,54 @@ void Socket::onDataReceived(uv_stream_t* /*pStream*/, ssize_t nread, const uv_bu
     }
 }
 
+// Adds a chunk to the message it is part of, and calls back with the message when it is complete.
+// Returns false (with the reason in error) if the chunk breaks the chunking limits.
+bool Socket::onChunkReceived(const Buffer& chunk, std::string& error)
+{
+    // We read the chunk header...
+    if (chunk.getBufferSize() < Buffer::CHUNK_HEADER_SIZE)
+    {
+        error = "Chunk is smaller than its header";
+        return false;
+    }
+    auto streamID = chunk.read_uint32();
+    auto messageSize = chunk.read_int32();
+    if (messageSize <= 0 || messageSize > MAX_CHUNKED_MESSAGE_SIZE)
+    {
+        error = std::format("Chunked message size {} is not valid", messageSize);
+        return false;
+    }
+
+    // We add the chunk's data to the message, which we create for its first chunk...
+    auto it = m_chunkedMessages.find(streamID);
+    if (it == m_chunkedMessages.end())
+    {
+        if (m_chunkedMessages.size() >= MAX_CHUNKED_MESSAGES)
+        {
+            error = std::format("More than {} messages are being sent in chunks", MAX_CHUNKED_MESSAGES);
+            return false;
+        }
+        it = m_chunkedMessages.emplace(streamID, Buffer::create()).first;
+    }
+    auto& pMessage = it->second;
+    auto chunkSize = chunk.getBufferSize() - Buffer::CHUNK_HEADER_SIZE;
+    if (pMessage->getBufferSize() + chunkSize > messageSize)
+    {
+        error = "Chunks are larger than their message";
+        return false;
+    }
+    pMessage->write_bytes(chunk.getBuffer() + Buffer::CHUNK_HEADER_SIZE, chunkSize);
+
+    // If we have the whole message we call back with it...
+    if (pMessage->getBufferSize() == messageSize)
+    {
+        auto pCompleteMessage = std::move(pMessage);
+        m_chunkedMessages.erase(it);
+        pCompleteMessage->resetPosition();
+        if (m_pCallback)
+        {
+            m_pCallback->onDataReceived(this, pCompleteMessage);
+        }
+    }
+    return true;
+}
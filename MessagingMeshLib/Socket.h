@@ -1,6 +1,12 @@
 #pragma once
 #include <string>
 #include <functional>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <vector>
 #include <libuv/uv.h>
 #include "SharedAliases.h"
 #include "ThreadsafeConsumableQueue.h"
@@ -17,6 +23,47 @@ namespace MessagingMesh
     /// 
     /// Can either be a client socket making a connection to a server
     /// or a server socket listening for client connections.
+    /// 
+    /// Output queue
+    /// ------------
+    /// Writes are coalesced and then added to the output queue. We pass data from the queue
+    /// to UV writes while the socket is keeping up, ie while the data in UV writes which have
+    /// not completed is below a limit. So when the reader at the other end is slow, data builds
+    /// up in our output queue, where we can apply limits to it (see OutputQueueLimits).
+    /// 
+    /// When a limit is reached we drop data or disconnect the socket, depending on the policy.
+    /// We keep counts of the data dropped, and tell the callback (at most once a second) when
+    /// data has been dropped, so that it can warn the client.
+    /// 
+    /// Last-value conflation
+    /// ---------------------
+    /// Writes can have a conflation key (eg, a hash of the message subject). A write with a key
+    /// replaces the queued write with the same key and subscription ID in place, rather than being
+    /// added to the back of the queue. So a reader which falls behind gets the latest value for
+    /// each key, and the queue holds at most one write for each.
+    /// 
+    /// Priority classes
+    /// ----------------
+    /// Writes have a priority (see WritePriority), and the output queue has a lane for each. We
+    /// send from the highest-priority lane which has data, so a reply or control message is not
+    /// queued behind megabytes of data for the same reader. Order is kept within each lane (but
+    /// not between them). Conflation replaces writes in the same lane. The queue limits apply to
+    /// all the lanes together, and DROP_OLDEST drops from the lowest-priority lane first.
+    /// 
+    /// Chunking
+    /// --------
+    /// Messages larger than CHUNK_SIZE are sent in chunks (see Buffer), one chunk per UV write,
+    /// and the message stays at the front of its lane until its last chunk has been sent. So
+    /// higher-priority data queued while a large message is being sent goes out after the
+    /// current chunk, rather than after the whole message. Chunks for each message have a
+    /// stream ID, and the reading socket reassembles them into the message, growing it as the
+    /// chunks arrive rather than allocating the whole message when it starts.
+    /// 
+    /// Chunks are a change to the wire format, so we only send them to a peer which has said
+    /// that it can read them (in the CONNECT or CONNECT_MESH_PEER message, or in the ACK), and
+    /// large messages to other peers are sent whole. The reading socket limits the number of
+    /// messages it reassembles at once and their size, and disconnects a peer which breaks the
+    /// limits, so that a peer cannot make us hold unbounded partial messages.
     /// </summary>
     class Socket : public std::enable_shared_from_this<Socket>
     {
@@ -31,6 +78,54 @@ namespace MessagingMesh
             DISCONNECTED
         };
 
+    public:
+        // What to do with data written to a socket when its output queue is full.
+        enum class SlowConsumerPolicy
+        {
+            DROP_NEWEST,    // Drop the data being written
+            DROP_OLDEST,    // Drop the oldest queued data to make space for it
+            CONFLATE,       // Replace queued data for the same subscription ID, or drop the oldest if there is none
+            DISCONNECT      // Disconnect the socket
+        };
+
+        // Limits on the data queued to be written to a socket, and what to do when they are reached.
+        struct OutputQueueLimits
+        {
+            size_t MaxBytes = 0;       // Zero for no limit
+            size_t MaxMessages = 0;    // Zero for no limit
+            SlowConsumerPolicy Policy = SlowConsumerPolicy::DISCONNECT;
+        };
+
+        // Priority classes for data written to a socket. Queued data is sent in priority order.
+        enum class WritePriority
+        {
+            CONTROL,    // Control traffic and replies to requests (eg, ACKs, credit grants, inbox replies)
+            NORMAL,     // Messages
+            BULK        // Large messages, which are sent after other data
+        };
+
+        // The number of write priority classes.
+        static constexpr size_t WRITE_PRIORITY_COUNT = 3;
+
+        // The data queued in one priority class of the output queue.
+        struct QueueDepth
+        {
+            uint64_t Messages = 0;
+            uint64_t Bytes = 0;
+        };
+
+        // Counts of data dropped from the output queue since the socket was created, plus the data now queued.
+        struct OutputQueueStats
+        {
+            uint64_t DroppedMessages = 0;
+            uint64_t DroppedBytes = 0;
+            uint64_t ConflatedMessages = 0;
+            uint64_t SlowConsumerDisconnections = 0;
+            uint64_t QueuedMessages = 0;
+            uint64_t QueuedBytes = 0;
+            std::array<QueueDepth, WRITE_PRIORITY_COUNT> QueuedByPriority;  // Indexed by WritePriority
+        };
+
     public:
         // Interface for socket callbacks.
         class ICallback
@@ -49,6 +144,10 @@ namespace MessagingMesh
 
             // Called when the movement of the socket to a new UV loop has been completed.
             virtual void onMoveToLoopComplete(Socket* pSocket) = 0;
+
+            // Called when data written to the socket has been dropped (or conflated) as the output queue is full.
+            // Called on the UV loop thread, at most once a second.
+            virtual void onOutputQueueDrops(Socket* /*pSocket*/) {}
         };
 
     // Public methods...
@@ -74,17 +173,31 @@ namespace MessagingMesh
         // Sets the callback.
         void setCallback(ICallback* pCallback);
 
+        // Gets the callback.
+        ICallback* getCallback() const { return m_pCallback; }
+
         // Gets whether this socket is a mesh peer (ie, a gateway in the mesh).
         bool getIsMeshPeer() const { return m_isMeshPeer; }
 
         // Sets whether this socket is a mesh peer (ie, a gateway in the mesh).
         void setIsMeshPeer(bool isMeshPeer) { m_isMeshPeer = isMeshPeer; }
 
-        // Gets whether this socket / client has already been updated by the Service Manager when sending updates to mesh peers.
-        bool getAlreadyUpdated() const { return m_alreadyUpdated; }
+        // Gets whether the peer can read large messages sent in chunks.
+        bool getPeerSupportsChunks() const { return m_peerSupportsChunks; }
 
-        // Sets whether this socket / client has already been updated by the Service Manager when sending updates to mesh peers.
-        void setAlreadyUpdated(bool alreadyUpdated) const { m_alreadyUpdated = alreadyUpdated; }
+        // Sets whether the peer can read large messages sent in chunks.
+        void setPeerSupportsChunks(bool peerSupportsChunks) { m_peerSupportsChunks = peerSupportsChunks; }
+
+        // Gets the number of bytes of messages the peer can send before it must wait for credit (zero for no flow control).
+        uint64_t getCreditWindow() const { return m_creditWindow; }
+
+        // Sets the number of bytes of messages the peer can send before it must wait for credit (zero for no flow control).
+        void setCreditWindow(uint64_t creditWindow) { m_creditWindow = creditWindow; }
+
+        // Notes that messages received from the peer have been processed. Returns the credit to grant
+        // the peer, once the bytes processed since the last grant reach half the window, or zero.
+        // Called on the loop which processes the socket's messages.
+        uint64_t takeCreditToGrant(size_t processedBytes);
 
         // Connects a server socket to listen on the specified port.
         void listen(int port);
@@ -98,7 +211,30 @@ namespace MessagingMesh
         // Queues data to be written to the socket.
         // Can be called from any thread, not just from the uv loop thread.
         // Queued writes will be coalesced into one network update.
-        void write(BufferPtr pBuffer, uint32_t subscriptionIDOverride = 0);
+        // Writes made on the socket's own loop are queued without a lock and sent at the
+        // end of the loop iteration.
+        // Writes with a (non-zero) conflation key replace any queued write with the same key
+        // and subscription ID.
+        // Queued writes are sent in order of priority, and in the order they were written within a priority.
+        void write(BufferPtr pBuffer, uint32_t subscriptionIDOverride = 0, uint64_t conflationKey = 0, WritePriority priority = WritePriority::NORMAL);
+
+        // Queues a batch of data to be written to the socket together, eg the cached values sent
+        // for a new subscription.
+        // Can be called from any thread. Writes from other threads take the lock once for the batch.
+        void writeBatch(const std::vector<BufferPtr>& buffers, uint32_t subscriptionIDOverride = 0);
+
+        // Queues data to be written to the socket ahead of data already queued (in all priority
+        // classes), and outside the output queue limits. Used for advisories about the queue itself.
+        // Must be called on the uv loop thread.
+        void writeAhead(BufferPtr pBuffer);
+
+        // Sets limits on the data queued to be written to the socket.
+        // Must be called before the socket is written to, eg before it is moved to its loop.
+        void setOutputQueueLimits(const OutputQueueLimits& outputQueueLimits) { m_outputQueueLimits = outputQueueLimits; }
+
+        // Gets counts of data dropped from the output queue, and the data now queued.
+        // Can be called from any thread.
+        OutputQueueStats getOutputQueueStats() const;
 
         // Moves the socket to be managed by the UV loop specified.
         void moveToLoop(UVLoopPtr pLoop);
@@ -132,9 +268,40 @@ namespace MessagingMesh
         // Data queued for writing.
         struct BufferInfo
         {
-            BufferInfo(BufferPtr b, uint32_t s) : pBuffer(b), subscriptionIDOverride(s) {}
+            BufferInfo(BufferPtr b, uint32_t s, uint64_t c = 0, WritePriority p = WritePriority::NORMAL) : pBuffer(b), subscriptionIDOverride(s), conflationKey(c), priority(p) {}
             BufferPtr pBuffer = nullptr;
             uint32_t subscriptionIDOverride = 0;
+            uint64_t conflationKey = 0;
+            WritePriority priority = WritePriority::NORMAL;
+            size_t chunkOffset = 0;       // The data sent so far (after the size) if the buffer is being sent in chunks
+            uint32_t chunkStreamID = 0;   // The stream ID for the chunks
+        };
+
+        // Identifies queued writes which replace each other when they are conflated.
+        struct ConflationKey
+        {
+            uint32_t SubscriptionID = 0;
+            uint64_t Key = 0;
+            WritePriority Priority = WritePriority::NORMAL;
+            bool operator==(const ConflationKey&) const = default;
+        };
+
+        // Hash for ConflationKey.
+        struct ConflationKeyHash
+        {
+            size_t operator()(const ConflationKey& key) const
+            {
+                return std::hash<uint64_t>{}(key.Key ^ (key.SubscriptionID * 0x9E3779B97F4A7C15ull) ^ static_cast<uint64_t>(key.Priority));
+            }
+        };
+
+        // The output queue for one priority class: its writes, the position of the write at the
+        // front (see m_outputQueuePositions) and the number of bytes it holds.
+        struct OutputLane
+        {
+            std::deque<BufferInfo> Writes;
+            uint64_t FrontPosition = 0;
+            size_t Bytes = 0;
         };
 
     // Private functions...
@@ -167,18 +334,84 @@ namespace MessagingMesh
         // Called when data has been received on a socket.
         void onDataReceived(uv_stream_t* pClientStream, ssize_t bufferSize, const uv_buf_t* pBuffer);
 
+        // Adds a chunk to the message it is part of, and calls back with the message when it is complete.
+        // Returns false (with the reason in error) if the chunk breaks the chunking limits.
+        bool onChunkReceived(const Buffer& chunk, std::string& error);
+
         // Called when a write request has completed.
         void onWriteCompleted(uv_write_t* pRequest, int status);
 
         // Sends network messages for all queued writes.
         void processQueuedWrites();
 
-        // Calls back with UV write requests to send for the queued data.
-        void getWriteRequests(const std::vector<BufferInfo>& bufferInfos, std::function<void(UVUtils::WriteRequest*)> callback);
+        // Sends network messages for writes queued on the socket's loop.
+        void processLoopWrites();
+
+        // Adds coalesced writes to the output queue, and sends as much of the queue as we can.
+        void queueWrites(std::vector<BufferInfo>& bufferInfos);
+
+        // Adds a write to the output queue, applying the queue limits.
+        // Returns false if the socket should be disconnected as a slow consumer.
+        bool addToOutputQueue(BufferInfo& bufferInfo);
+
+        // Returns true if adding data of the size specified would take the output queue over its limits.
+        bool isOutputQueueFull(size_t size) const;
+
+        // Replaces the queued write with the same conflation key and subscription ID with the write provided.
+        // Returns false if there is no such queued write.
+        bool conflate(BufferInfo& bufferInfo);
+
+        // Returns true if the write can replace (or be replaced by) other queued writes.
+        bool isConflatable(const BufferInfo& bufferInfo) const;
+
+        // Gets the output queue lane for the priority.
+        OutputLane& getOutputLane(WritePriority priority) { return m_outputLanes[static_cast<size_t>(priority)]; }
+
+        // Returns the highest-priority lane with queued writes, or nullptr if the output queue is empty.
+        OutputLane* getNextOutputLane();
+
+        // Adds a write to the back of its lane of the output queue.
+        void pushOutputQueue(BufferInfo&& bufferInfo);
+
+        // Removes the write at the front of the lane.
+        void popOutputQueue(OutputLane& lane);
+
+        // Drops the oldest write in the lowest-priority lane which has queued writes (other than a
+        // message part-sent in chunks). Returns false if there is no write which can be dropped.
+        bool dropOldest();
+
+        // Clears the output queue.
+        void clearOutputQueue();
+
+        // Updates the stats for the data in the output queue.
+        void storeQueuedStats();
+
+        // Notes that data has been dropped from the output queue.
+        void noteDropped(size_t messageCount, size_t byteCount);
+
+        // Disconnects the socket as the reader is not keeping up with the data written to it.
+        void disconnectSlowConsumer();
+
+        // Passes data from the output queue to UV writes, while the socket is keeping up.
+        void sendOutputQueue();
+
+        // Adds the buffer to the UV write request.
+        // Returns false if the write request does not have space for the buffer.
+        bool addToWriteRequest(UVUtils::WriteRequest& writeRequest, const BufferInfo& bufferInfo);
+
+        // Returns true if the write is sent in chunks.
+        bool isChunked(const BufferInfo& bufferInfo) const { return bufferInfo.chunkOffset != 0 || (m_peerSupportsChunks && bufferInfo.pBuffer->getBufferSize() > CHUNK_SIZE); }
+
+        // Adds the next chunk of the buffer to the UV write request.
+        // Returns false if the write request does not have space for the chunk.
+        bool addChunkToWriteRequest(UVUtils::WriteRequest& writeRequest, BufferInfo& bufferInfo);
 
         // Sends data to the socket.
         void send(UVUtils::WriteRequest* pWriteRequest);
 
+        // Closes the socket to move it to another UV loop, once its UV writes have completed.
+        void moveToLoop_closeSocket();
+
         // Called after the original socket is closed as part of moving the socket to another UV loop.
         void moveToLoop_onSocketClosed(move_socket_t* pMoveInfo);
 
@@ -233,9 +466,57 @@ namespace MessagingMesh
         // The message being currently read (possibly across multiple onDataReceived callbacks).
         BufferPtr m_pCurrentMessage;
 
+        // Messages being reassembled from chunks, by stream ID.
+        std::unordered_map<uint32_t, BufferPtr> m_chunkedMessages;
+
+        // The stream ID for the next message we send in chunks.
+        uint32_t m_nextChunkStreamID = 0;
+
+        // The number of UV writes which have not completed.
+        size_t m_pendingUVWrites = 0;
+
+        // The loop the socket is moving to, while we wait for its UV writes to complete before closing it.
+        UVLoopPtr m_pMoveToUVLoop = nullptr;
+
         // Data queued for writing.
         ThreadsafeConsumableQueue<BufferInfo> m_queuedWrites;
 
+        // Data queued for writing by code running on the socket's loop (only used on the loop's thread).
+        std::vector<BufferInfo> m_loopWrites;
+
+        // True if processLoopWrites() has been deferred to the end of the loop iteration.
+        bool m_loopWritesPending = false;
+
+        // True if writes on the socket's loop can use m_loopWrites. This is false while the
+        // socket is moving between loops, when writes go to the thread-safe queue.
+        std::atomic<bool> m_loopWritesEnabled = true;
+
+        // Coalesced writes waiting to be passed to UV writes, in a lane for each priority class (only
+        // used on the loop's thread), and the number of writes and bytes they hold in total...
+        std::array<OutputLane, WRITE_PRIORITY_COUNT> m_outputLanes;
+        size_t m_outputQueueMessages = 0;
+        size_t m_outputQueueBytes = 0;
+
+        // Limits on the output queue...
+        OutputQueueLimits m_outputQueueLimits;
+
+        // The position of the queued write for each conflation key (and for each subscription ID for
+        // the CONFLATE policy) in its lane. Positions count up from when the socket was created, and
+        // each lane's FrontPosition is the position of the write at its front...
+        std::unordered_map<ConflationKey, uint64_t, ConflationKeyHash> m_outputQueuePositions;
+
+        // Output queue stats (written on the loop's thread, and can be read from any thread)...
+        std::atomic<uint64_t> m_droppedMessages = 0;
+        std::atomic<uint64_t> m_droppedBytes = 0;
+        std::atomic<uint64_t> m_conflatedMessages = 0;
+        std::atomic<uint64_t> m_slowConsumerDisconnections = 0;
+        std::array<std::atomic<uint64_t>, WRITE_PRIORITY_COUNT> m_queuedMessages{};
+        std::array<std::atomic<uint64_t>, WRITE_PRIORITY_COUNT> m_queuedBytes{};
+
+        // True if data has been dropped since we last told the callback, and when we last told it...
+        bool m_dropsToNotify = false;
+        std::chrono::steady_clock::time_point m_lastDropNotificationTime;
+
         // Socket ID.
         // The atomic allows us to create a unique integer ID for each socket in the process.
         inline static std::atomic<uint64_t> m_atomicSocketID = 0;
@@ -247,12 +528,33 @@ namespace MessagingMesh
         // True if the socket is a mesh peer (ie, a gateway in the mesh)...
         bool m_isMeshPeer = false;
 
-        // Used by ServiceManager when updating mesh peers to avoid sending duplicate updates.
-        mutable bool m_alreadyUpdated = false;
+        // True if the peer can read large messages sent in chunks...
+        bool m_peerSupportsChunks = false;
+
+        // Flow control: the credit window for the peer, and the bytes processed since we last granted credit...
+        uint64_t m_creditWindow = 0;
+        uint64_t m_processedBytes = 0;
 
     // Constants...
     private:
         // The maximum backlog of unprocessed incoming connections.
         const int MAX_INCOMING_CONNECTION_BACKLOG = 128;
+
+        // We pass data from the output queue to UV writes while the data in UV writes which
+        // have not completed is below this size.
+        static constexpr size_t MAX_UV_WRITE_QUEUE_BYTES = 1024 * 1024;
+
+        // Messages larger than this are sent in chunks, each holding up to this much of the message.
+        static constexpr int32_t CHUNK_SIZE = 64 * 1024;
+
+        // The maximum number of messages we reassemble from chunks at the same time. (A sender
+        // has at most one message part-sent in chunks in each priority lane.)
+        static constexpr size_t MAX_CHUNKED_MESSAGES = 16;
+
+        // The maximum size of a message sent in chunks.
+        static constexpr int32_t MAX_CHUNKED_MESSAGE_SIZE = 1024 * 1024 * 1024;
+
+        // The minimum time between telling the callback that data has been dropped.
+        static constexpr std::chrono::seconds DROP_NOTIFICATION_INTERVAL = std::chrono::seconds(1);
     };
 } // namespace
@@ -1,13 +1,23 @@
 #include "Tests_MessagingMeshLib.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <filesystem>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "TestUtils.h"
 #include "Message.h"
 #include "Field.h"
 #include "BLOB.h"
 #include "Buffer.h"
 #include "MMUtils.h"
+#include "UVUtils.h"
+#include "UVLoop.h"
+#include "Socket.h"
 using namespace MessagingMesh;
 using namespace MessagingMesh::TestUtils;
 
@@ -21,6 +31,9 @@ void Tests_MessagingMeshLib::runAll(TestUtils::TestRun& testRun)
     tokenize(testRun);
     guids(testRun);
     tryGet(testRun);
+    writeRequest(testRun);
+    socketMove(testRun);
+    socketChunks(testRun);
 }
 
 // Tests writing to a reading from a buffer.
@@ -331,6 +344,501 @@ void Tests_MessagingMeshLib::tryGet(TestUtils::TestRun& testRun)
     }
 }
 
+// Tests building the buffers for a socket write request.
+void Tests_MessagingMeshLib::writeRequest(TestUtils::TestRun& testRun)
+{
+    // Returns the data the write request would send...
+    auto getData = [](const UVUtils::WriteRequest& writeRequest)
+    {
+        std::string data;
+        for (size_t i = 0; i < writeRequest.bufferCount; ++i)
+        {
+            data.append(writeRequest.buffers[i].base, writeRequest.buffers[i].len);
+        }
+        return data;
+    };
+
+    TestUtils::log("Write request with subscription ID override...");
+    {
+        // We write a buffer as it is, and then with its subscription ID overridden...
+        auto pBuffer = Buffer::create();
+        pBuffer->write_uint32(0x11111111);
+        pBuffer->write_int32(0x12345678);
+        auto buffer = pBuffer->getBuffer();
+        auto bufferSize = pBuffer->getBufferSize();
+
+        UVUtils::WriteRequest writeRequest;
+        writeRequest.addBuffer(buffer, bufferSize);
+        writeRequest.addPrefix(buffer, 0x22222222);
+        writeRequest.addBuffer(buffer + UVUtils::WriteRequest::PREFIX_SIZE, bufferSize - UVUtils::WriteRequest::PREFIX_SIZE);
+        assertEqual(testRun, writeRequest.bufferCount, (size_t)3);
+        assertEqual(testRun, writeRequest.prefixCount, (size_t)1);
+
+        // The first copy is unchanged, and the second has the new subscription ID...
+        auto data = getData(writeRequest);
+        assertEqual(testRun, data.size(), (size_t)(2 * bufferSize));
+        assertEqual(testRun, data.substr(0, bufferSize), std::string(buffer, bufferSize));
+        assertEqual(testRun, data.substr(bufferSize, 4), std::string(buffer, 4));
+        assertEqual(testRun, data.substr(bufferSize + 4, 4), std::string("\x22\x22\x22\x22"));
+        assertEqual(testRun, data.substr(bufferSize + 8), std::string(buffer + 8, bufferSize - 8));
+
+        // The shared buffer has not been changed...
+        assertEqual(testRun, std::string(buffer + 4, 4), std::string("\x11\x11\x11\x11"));
+    }
+
+    TestUtils::log("Write request partly written...");
+    {
+        UVUtils::WriteRequest writeRequest;
+        char data[] = "abcdefghij";
+        writeRequest.addBuffer(data, 3);
+        writeRequest.addBuffer(data + 3, 3);
+        writeRequest.addBuffer(data + 6, 4);
+        assertEqual(testRun, writeRequest.getSize(), (size_t)10);
+
+        // We remove data from the middle of the second buffer...
+        writeRequest.removeWrittenData(4);
+        assertEqual(testRun, writeRequest.bufferCount, (size_t)2);
+        assertEqual(testRun, getData(writeRequest), std::string("efghij"));
+
+        // We remove data to the end of a buffer...
+        writeRequest.removeWrittenData(2);
+        assertEqual(testRun, writeRequest.bufferCount, (size_t)1);
+        assertEqual(testRun, getData(writeRequest), std::string("ghij"));
+    }
+
+    TestUtils::log("Write request space...");
+    {
+        UVUtils::WriteRequest writeRequest;
+        char data[1] = {};
+        for (size_t i = 0; i < UVUtils::WriteRequest::MAX_BUFFERS - 1; ++i)
+        {
+            writeRequest.addBuffer(data, 1);
+        }
+        assertEqual(testRun, writeRequest.hasSpace(1), true);
+        assertEqual(testRun, writeRequest.hasSpace(2), false);
+
+        // A reset request is empty...
+        writeRequest.reset();
+        assertEqual(testRun, writeRequest.bufferCount, (size_t)0);
+        assertEqual(testRun, writeRequest.hasSpace(UVUtils::WriteRequest::MAX_BUFFERS), true);
+    }
+
+    TestUtils::log("Write request chunk...");
+    {
+        // We write the first chunk of a message, with its subscription ID overridden...
+        auto pBuffer = Buffer::create();
+        pBuffer->write_uint32(0x11111111);
+        pBuffer->write_int32(0x12345678);
+        pBuffer->write_int32(0x0abbccdd);
+        auto buffer = pBuffer->getBuffer();
+        auto bufferSize = pBuffer->getBufferSize();
+
+        UVUtils::WriteRequest writeRequest;
+        writeRequest.addChunkHeader(Buffer::CHUNK_HEADER_SIZE + 8, 7, bufferSize, 0x22222222);
+        writeRequest.addBuffer(buffer + UVUtils::WriteRequest::PREFIX_SIZE, 4);
+        assertEqual(testRun, writeRequest.bufferCount, (size_t)2);
+
+        // The chunk is read as a chunk, with its flag removed from the size...
+        auto data = getData(writeRequest);
+        auto pChunk = Buffer::create();
+        auto bytesRead = pChunk->readNetworkMessage(data.data(), data.size(), 0);
+        assertEqual(testRun, bytesRead, (size_t)(Buffer::CHUNK_HEADER_SIZE + 8));
+        assertEqual(testRun, pChunk->hasAllData(), true);
+        assertEqual(testRun, pChunk->isChunk(), true);
+        assertEqual(testRun, pChunk->getBufferSize(), (int32_t)(Buffer::CHUNK_HEADER_SIZE + 8));
+
+        // It has the stream ID, the size of the whole message and the start of its data...
+        pChunk->resetPosition();
+        assertEqual(testRun, pChunk->read_uint32(), (uint32_t)7);
+        assertEqual(testRun, pChunk->read_int32(), bufferSize);
+        assertEqual(testRun, pChunk->read_uint32(), (uint32_t)0x22222222);
+        assertEqual(testRun, pChunk->read_int32(), (int32_t)0x12345678);
+
+        // Other messages are not chunks...
+        auto pMessage = Buffer::create();
+        pMessage->readNetworkMessage(buffer, bufferSize, 0);
+        assertEqual(testRun, pMessage->isChunk(), false);
+    }
+}
+
+// Tests moving a socket to another UV loop while data written to it is being sent.
+void Tests_MessagingMeshLib::socketMove(TestUtils::TestRun& testRun)
+{
+    // Callback for one end of the connection. Messages hold a sequence number, which we check...
+    class SocketCallback : public Socket::ICallback
+    {
+    public:
+        void onNewConnection(SocketPtr pClientSocket)
+        {
+            pClientSocket->setCallback(this);
+            pAcceptedSocket = pClientSocket;
+        }
+
+        void onDataReceived(Socket* /*pSocket*/, BufferPtr pBuffer)
+        {
+            // We stall the first read, so that data written by the other end backs up into UV writes...
+            if (ReceivedMessages == 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            }
+            if (pBuffer->read_uint32() != ReceivedMessages)
+            {
+                OutOfOrder = true;
+            }
+            ReceivedMessages++;
+        }
+
+        void onConnectionStatusChanged(Socket* /*pSocket*/, Socket::ConnectionStatus connectionStatus, const std::string& /*message*/)
+        {
+            if (connectionStatus == Socket::ConnectionStatus::CONNECTION_SUCCEEDED)
+            {
+                Connected = true;
+            }
+            if (connectionStatus == Socket::ConnectionStatus::DISCONNECTED)
+            {
+                Disconnected = true;
+            }
+        }
+
+        void onMoveToLoopComplete(Socket* /*pSocket*/)
+        {
+            Moved = true;
+        }
+
+        SocketPtr pAcceptedSocket;
+        std::atomic<uint32_t> ReceivedMessages = 0;
+        std::atomic<bool> OutOfOrder = false;
+        std::atomic<bool> Connected = false;
+        std::atomic<bool> Disconnected = false;
+        std::atomic<bool> Moved = false;
+    };
+
+    // Waits (for up to ten seconds) for the condition to be true...
+    auto waitFor = [](const std::function<bool()>& condition)
+    {
+        for (int i = 0; i < 1000 && !condition(); ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return condition();
+    };
+
+    // Creates a message holding the sequence number...
+    auto createMessage = [](uint32_t sequenceNumber)
+    {
+        auto pBuffer = Buffer::create();
+        pBuffer->write_uint32(sequenceNumber);
+        pBuffer->write_bytes(std::string(4096, 'x').data(), 4096);
+        return pBuffer;
+    };
+
+    TestUtils::log("Socket move with queued data...");
+    {
+        const int port = 5099;
+        const uint32_t messageCount = 4000;
+        SocketCallback serverCallback;
+        SocketCallback clientCallback;
+        auto pServerUVLoop = UVLoop::create("TEST-SERVER", UVLoop::Temperature::COLD);
+        auto pClientUVLoop1 = UVLoop::create("TEST-CLIENT-1", UVLoop::Temperature::COLD);
+        auto pClientUVLoop2 = UVLoop::create("TEST-CLIENT-2", UVLoop::Temperature::COLD);
+
+        // We connect a client to a listening socket, once it is listening...
+        auto pListeningSocket = Socket::create(pServerUVLoop);
+        pListeningSocket->setCallback(&serverCallback);
+        auto pClientSocket = Socket::create(pClientUVLoop1);
+        pClientSocket->setCallback(&clientCallback);
+        pServerUVLoop->marshallEvent(
+            [&](uv_loop_t* /*pLoop*/)
+            {
+                pListeningSocket->listen(port);
+                pClientUVLoop1->marshallEvent([&](uv_loop_t* /*pLoop*/) { pClientSocket->connect("127.0.0.1", port); });
+            }
+        );
+        assertEqual(testRun, waitFor([&]() { return clientCallback.Connected.load(); }), true);
+
+        // We write more data than the socket buffers hold, while the server is stalled, and then
+        // move the socket in the next loop iteration, when UV writes are still being sent...
+        pClientUVLoop1->marshallEvent(
+            [&](uv_loop_t* /*pLoop*/)
+            {
+                for (uint32_t i = 0; i < messageCount; ++i)
+                {
+                    pClientSocket->write(createMessage(i));
+                }
+                pClientUVLoop1->marshallEvent([&](uv_loop_t* /*pLoop*/) { pClientSocket->moveToLoop(pClientUVLoop2); });
+            }
+        );
+        assertEqual(testRun, waitFor([&]() { return clientCallback.Moved.load(); }), true);
+
+        // The data is all received, in order, and the socket is still connected...
+        assertEqual(testRun, waitFor([&]() { return serverCallback.ReceivedMessages == messageCount; }), true);
+        assertEqual(testRun, serverCallback.OutOfOrder.load(), false);
+        assertEqual(testRun, clientCallback.Disconnected.load(), false);
+        assertEqual(testRun, serverCallback.Disconnected.load(), false);
+
+        // Data written after the move is sent from the new loop...
+        pClientSocket->write(createMessage(messageCount));
+        assertEqual(testRun, waitFor([&]() { return serverCallback.ReceivedMessages == messageCount + 1; }), true);
+        assertEqual(testRun, serverCallback.OutOfOrder.load(), false);
+
+        // We close the sockets before their loops...
+        pClientSocket = nullptr;
+        pListeningSocket = nullptr;
+        serverCallback.pAcceptedSocket = nullptr;
+    }
+}
+
+// Tests sending large messages in chunks, and the limits on the chunks a socket reads.
+void Tests_MessagingMeshLib::socketChunks(TestUtils::TestRun& testRun)
+{
+    // Callback for the server end of the connections...
+    class SocketCallback : public Socket::ICallback
+    {
+    public:
+        void onNewConnection(SocketPtr pClientSocket)
+        {
+            pClientSocket->setCallback(this);
+            pAcceptedSocket = pClientSocket;
+        }
+
+        void onDataReceived(Socket* /*pSocket*/, BufferPtr pBuffer)
+        {
+            std::scoped_lock lock(Mutex);
+            ReceivedMessages.push_back(std::string(pBuffer->getBuffer() + Buffer::SIZE_SIZE, pBuffer->getBufferSize() - Buffer::SIZE_SIZE));
+        }
+
+        void onConnectionStatusChanged(Socket* /*pSocket*/, Socket::ConnectionStatus connectionStatus, const std::string& /*message*/)
+        {
+            if (connectionStatus == Socket::ConnectionStatus::CONNECTION_SUCCEEDED)
+            {
+                Connected = true;
+            }
+            if (connectionStatus == Socket::ConnectionStatus::DISCONNECTED)
+            {
+                Disconnected = true;
+            }
+        }
+
+        void onMoveToLoopComplete(Socket* /*pSocket*/) {}
+
+        size_t getReceivedCount()
+        {
+            std::scoped_lock lock(Mutex);
+            return ReceivedMessages.size();
+        }
+
+        SocketPtr pAcceptedSocket;
+        std::mutex Mutex;
+        std::vector<std::string> ReceivedMessages;
+        std::atomic<bool> Connected = false;
+        std::atomic<bool> Disconnected = false;
+    };
+
+    // A client which writes raw data, so that we can send chunks which break the limits...
+    struct RawClient
+    {
+        uv_tcp_t Socket;
+        uv_connect_t ConnectRequest;
+        std::atomic<bool> Connected = false;
+        std::atomic<bool> Closed = false;
+    };
+
+    // Waits (for up to ten seconds) for the condition to be true...
+    auto waitFor = [](const std::function<bool()>& condition)
+    {
+        for (int i = 0; i < 1000 && !condition(); ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return condition();
+    };
+
+    // Adds an int32 to raw data...
+    auto addInt32 = [](std::string& data, uint32_t value)
+    {
+        char bytes[sizeof(value)];
+        std::memcpy(bytes, &value, sizeof(value));
+        data.append(bytes, sizeof(value));
+    };
+
+    // Adds a chunk, with the data for it, to raw data. (The message size in the chunk header includes the size field.)
+    auto addChunk = [&](std::string& data, uint32_t streamID, int32_t messageDataSize, const std::string& chunkData)
+    {
+        addInt32(data, static_cast<uint32_t>(Buffer::CHUNK_HEADER_SIZE + chunkData.size()) | Buffer::CHUNK_FLAG);
+        addInt32(data, streamID);
+        addInt32(data, static_cast<uint32_t>(Buffer::SIZE_SIZE + messageDataSize));
+        data.append(chunkData);
+    };
+
+    // Adds a (whole) message to raw data...
+    auto addMessage = [&](std::string& data, const std::string& messageData)
+    {
+        addInt32(data, static_cast<uint32_t>(Buffer::SIZE_SIZE + messageData.size()));
+        data.append(messageData);
+    };
+
+    const int port = 5100;
+    SocketCallback serverCallback;
+    auto pServerUVLoop = UVLoop::create("TEST-SERVER", UVLoop::Temperature::COLD);
+    auto pClientUVLoop = UVLoop::create("TEST-CLIENT", UVLoop::Temperature::COLD);
+    auto pListeningSocket = Socket::create(pServerUVLoop);
+    pListeningSocket->setCallback(&serverCallback);
+    std::atomic<bool> listening = false;
+    pServerUVLoop->marshallEvent([&](uv_loop_t* /*pLoop*/) { pListeningSocket->listen(port); listening = true; });
+    assertEqual(testRun, waitFor([&]() { return listening.load(); }), true);
+
+    // Connects a raw client to the server...
+    auto connectRawClient = [&](RawClient& rawClient)
+    {
+        serverCallback.Disconnected = false;
+        pClientUVLoop->marshallEvent(
+            [&](uv_loop_t* pLoop)
+            {
+                uv_tcp_init(pLoop, &rawClient.Socket);
+                rawClient.Socket.data = &rawClient;
+                sockaddr_in address;
+                uv_ip4_addr("127.0.0.1", port, &address);
+                uv_tcp_connect(&rawClient.ConnectRequest, &rawClient.Socket, (const sockaddr*)&address,
+                    [](uv_connect_t* pRequest, int status)
+                    {
+                        ((RawClient*)pRequest->handle->data)->Connected = (status == 0);
+                    }
+                );
+            }
+        );
+        return waitFor([&]() { return rawClient.Connected.load(); });
+    };
+
+    // Writes raw data from a raw client (in one write, as the data is small)...
+    auto writeRaw = [&](RawClient& rawClient, std::string data)
+    {
+        pClientUVLoop->marshallEvent(
+            [&rawClient, data](uv_loop_t* /*pLoop*/) mutable
+            {
+                auto buffer = uv_buf_init(data.data(), static_cast<unsigned int>(data.size()));
+                uv_try_write((uv_stream_t*)&rawClient.Socket, &buffer, 1);
+            }
+        );
+    };
+
+    // Closes a raw client, and waits for the server to see the disconnection...
+    auto closeRawClient = [&](RawClient& rawClient)
+    {
+        pClientUVLoop->marshallEvent(
+            [&](uv_loop_t* /*pLoop*/)
+            {
+                uv_close((uv_handle_t*)&rawClient.Socket, [](uv_handle_t* pHandle) { ((RawClient*)pHandle->data)->Closed = true; });
+            }
+        );
+        waitFor([&]() { return rawClient.Closed.load() && serverCallback.Disconnected.load(); });
+        serverCallback.pAcceptedSocket = nullptr;
+    };
+
+    TestUtils::log("Socket large messages, with and without chunks...");
+    {
+        // We send a large message to a peer which reads chunks, and then to one which does not.
+        // Both are received whole...
+        SocketCallback clientCallback;
+        auto pClientSocket = Socket::create(pClientUVLoop);
+        pClientSocket->setCallback(&clientCallback);
+        pClientUVLoop->marshallEvent([&](uv_loop_t* /*pLoop*/) { pClientSocket->connect("127.0.0.1", port); });
+        assertEqual(testRun, waitFor([&]() { return clientCallback.Connected.load(); }), true);
+        std::string messageData;
+        for (int i = 0; i < 300000; ++i)
+        {
+            messageData.push_back(static_cast<char>('a' + i % 26));
+        }
+        auto pBuffer = Buffer::create();
+        pBuffer->write_bytes(messageData.data(), static_cast<int32_t>(messageData.size()));
+        pClientUVLoop->marshallEvent([&](uv_loop_t* /*pLoop*/) { pClientSocket->setPeerSupportsChunks(true); pClientSocket->write(pBuffer); });
+        assertEqual(testRun, waitFor([&]() { return serverCallback.getReceivedCount() == 1; }), true);
+        pClientUVLoop->marshallEvent([&](uv_loop_t* /*pLoop*/) { pClientSocket->setPeerSupportsChunks(false); pClientSocket->write(pBuffer); });
+        assertEqual(testRun, waitFor([&]() { return serverCallback.getReceivedCount() == 2; }), true);
+        assertEqual(testRun, serverCallback.ReceivedMessages[0], messageData);
+        assertEqual(testRun, serverCallback.ReceivedMessages[1], messageData);
+        assertEqual(testRun, serverCallback.Disconnected.load(), false);
+        pClientSocket = nullptr;
+        waitFor([&]() { return serverCallback.Disconnected.load(); });
+        serverCallback.pAcceptedSocket = nullptr;
+        serverCallback.ReceivedMessages.clear();
+    }
+
+    TestUtils::log("Socket chunks reassembled...");
+    {
+        // We interleave the chunks for two messages with a whole message...
+        RawClient rawClient;
+        assertEqual(testRun, connectRawClient(rawClient), true);
+        std::string data;
+        addChunk(data, 1, 6, "abc");
+        addChunk(data, 2, 4, "wx");
+        addMessage(data, "message");
+        addChunk(data, 2, 4, "yz");
+        addChunk(data, 1, 6, "def");
+        writeRaw(rawClient, data);
+        assertEqual(testRun, waitFor([&]() { return serverCallback.getReceivedCount() == 3; }), true);
+        assertEqual(testRun, serverCallback.ReceivedMessages[0], std::string("message"));
+        assertEqual(testRun, serverCallback.ReceivedMessages[1], std::string("wxyz"));
+        assertEqual(testRun, serverCallback.ReceivedMessages[2], std::string("abcdef"));
+        assertEqual(testRun, serverCallback.Disconnected.load(), false);
+        closeRawClient(rawClient);
+        serverCallback.ReceivedMessages.clear();
+    }
+
+    TestUtils::log("Socket chunked messages limit...");
+    {
+        // We start the maximum number of chunked messages (16), and the socket still reads messages...
+        RawClient rawClient;
+        assertEqual(testRun, connectRawClient(rawClient), true);
+        std::string data;
+        for (uint32_t streamID = 1; streamID <= 16; ++streamID)
+        {
+            addChunk(data, streamID, 100, "abc");
+        }
+        addMessage(data, "message");
+        writeRaw(rawClient, data);
+        assertEqual(testRun, waitFor([&]() { return serverCallback.getReceivedCount() == 1; }), true);
+        assertEqual(testRun, serverCallback.Disconnected.load(), false);
+
+        // Starting one more disconnects the peer...
+        data.clear();
+        addChunk(data, 17, 100, "abc");
+        addMessage(data, "message");
+        writeRaw(rawClient, data);
+        assertEqual(testRun, waitFor([&]() { return serverCallback.Disconnected.load(); }), true);
+        assertEqual(testRun, serverCallback.getReceivedCount(), (size_t)1);
+        closeRawClient(rawClient);
+        serverCallback.ReceivedMessages.clear();
+    }
+
+    TestUtils::log("Socket chunked message size limit...");
+    {
+        // A message larger than the limit (1GB) disconnects the peer...
+        RawClient rawClient;
+        assertEqual(testRun, connectRawClient(rawClient), true);
+        std::string data;
+        addChunk(data, 1, 1024 * 1024 * 1024, "abc");
+        writeRaw(rawClient, data);
+        assertEqual(testRun, waitFor([&]() { return serverCallback.Disconnected.load(); }), true);
+        closeRawClient(rawClient);
+    }
+
+    TestUtils::log("Socket chunks larger than their message...");
+    {
+        RawClient rawClient;
+        assertEqual(testRun, connectRawClient(rawClient), true);
+        std::string data;
+        addChunk(data, 1, 4, "abc");
+        addChunk(data, 1, 4, "def");
+        writeRaw(rawClient, data);
+        assertEqual(testRun, waitFor([&]() { return serverCallback.Disconnected.load(); }), true);
+        assertEqual(testRun, serverCallback.getReceivedCount(), (size_t)0);
+        closeRawClient(rawClient);
+    }
+
+    // We close the listening socket before the loops...
+    pListeningSocket = nullptr;
+}
+
 // Tests message fields for message serialization tests.
 void Tests_MessagingMeshLib::testMessageFields(TestUtils::TestRun& testRun, const MessagePtr& m)
 {
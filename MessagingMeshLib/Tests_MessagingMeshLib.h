@@ -35,6 +35,15 @@ namespace MessagingMesh
         // Tests for tryGet methods.
         static void tryGet(TestUtils::TestRun& testRun);
 
+        // Tests building the buffers for a socket write request.
+        static void writeRequest(TestUtils::TestRun& testRun);
+
+        // Tests moving a socket to another UV loop while data written to it is being sent.
+        static void socketMove(TestUtils::TestRun& testRun);
+
+        // Tests sending large messages in chunks, and the limits on the chunks a socket reads.
+        static void socketChunks(TestUtils::TestRun& testRun);
+
     // Private functions...
     private:
         // Tests message fields for message serialization tests.
@@ -49,6 +49,14 @@ namespace MessagingMesh
             m_autoResetEvent.set();
         }
 
+        // Adds items to the vector (taking the lock once for all of them).
+        void add(const VecItemType& items)
+        {
+            std::scoped_lock lock(m_mutex);
+            m_items->insert(m_items->end(), items.begin(), items.end());
+            m_autoResetEvent.set();
+        }
+
         // Adds an item to the vector if the key has not already been registered.
         // Returns true if the item was added, false if not.
         bool addUnique(const UniqueKeyType& key, ItemType& item)
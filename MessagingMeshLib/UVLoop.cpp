@@ -49,8 +49,9 @@ void UVLoop::threadEntryPoint()
 {
     try
     {
-        // We set the thread's name...
+        // We set the thread's name, and note that this thread is running the loop...
         UVUtils::setThreadName(m_name);
+        m_pCurrentThreadUVLoop = this;
 
         // We create the uv loop and tell it that it is associated with 
         // this UVLoopThread object...
@@ -69,6 +70,21 @@ void UVLoop::threadEntryPoint()
                 self->processMarshalledEvents();
             });
 
+        // We run deferred events at the end of each loop iteration. The check handle does not 
+        // keep the loop alive on its own...
+        m_deferredEventsCheck = std::make_unique<uv_check_t>();
+        uv_check_init(m_loop.get(), m_deferredEventsCheck.get());
+        uv_check_start(
+            m_deferredEventsCheck.get(),
+            [](uv_check_t* pHandle)
+            {
+                auto self = (UVLoop*)pHandle->loop->data;
+                self->processDeferredEvents();
+            });
+        uv_unref((uv_handle_t*)m_deferredEventsCheck.get());
+        m_deferredEventsIdle = std::make_unique<uv_idle_t>();
+        uv_idle_init(m_loop.get(), m_deferredEventsIdle.get());
+
         // We signal the event in case there are already marshalled events...
         uv_async_send(m_marshalledEventsSignal.get());
 
@@ -144,3 +160,42 @@ void UVLoop::processMarshalledEvents()
         Logger::error(std::format("{}: {}", __func__, ex.what()));
     }
 }
+
+// Defers an event to the end of the current loop iteration.
+// Must be called on the loop's thread.
+void UVLoop::deferToEndOfIteration(MarshalledEvent deferredEvent)
+{
+    // If this is the first deferred event, we start the idle handle. This stops the loop 
+    // blocking while it polls for IO (if the event was deferred from a timer, say), so 
+    // the check handle runs the event in this iteration...
+    if (m_deferredEvents.empty())
+    {
+        uv_idle_start(m_deferredEventsIdle.get(), [](uv_idle_t* /*pHandle*/) {});
+    }
+    m_deferredEvents.push_back(std::move(deferredEvent));
+}
+
+// Processes events deferred to the end of the loop iteration.
+void UVLoop::processDeferredEvents()
+{
+    try
+    {
+        uv_idle_stop(m_deferredEventsIdle.get());
+
+        // Events can defer further events, so we run them until there are none left...
+        while (!m_deferredEvents.empty())
+        {
+            m_deferredEventsInProgress.swap(m_deferredEvents);
+            for (auto& deferredEvent : m_deferredEventsInProgress)
+            {
+                deferredEvent(m_loop.get());
+            }
+            m_deferredEventsInProgress.clear();
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        m_deferredEventsInProgress.clear();
+        Logger::error(std::format("{}: {}", __func__, ex.what()));
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <functional>
+#include <vector>
 #include <libuv/uv.h>
 #include "SharedAliases.h"
 #include "ThreadsafeConsumableQueue.h"
@@ -12,6 +13,11 @@ namespace MessagingMesh
     /// 
     /// You can marshall events to the loop which will be picked up
     /// and run on the loop's thread.
+    /// 
+    /// Code running on the loop's thread can also defer events to the end of the 
+    /// current loop iteration (after IO callbacks have run). These do not need a lock
+    /// and are run by a single uv_check handle. Sockets use this to coalesce writes 
+    /// made on their own loop.
     /// </summary>
     class UVLoop
     {
@@ -50,6 +56,13 @@ namespace MessagingMesh
         // are processed in the UV loop thread.
         void marshallUniqueEvent(const std::string& key, MarshalledEvent marshalledEvent);
 
+        // Returns true if we are running on the loop's thread.
+        bool isCurrentThread() const { return m_pCurrentThreadUVLoop == this; }
+
+        // Defers an event to the end of the current loop iteration.
+        // Must be called on the loop's thread.
+        void deferToEndOfIteration(MarshalledEvent deferredEvent);
+
     // Private functions...
     private:
         // Constructor.
@@ -62,6 +75,9 @@ namespace MessagingMesh
         // Processes marshalled events.
         void processMarshalledEvents();
 
+        // Processes events deferred to the end of the loop iteration.
+        void processDeferredEvents();
+
     // Private data...
     private:
         // The loop name. This will also be set as the name of the thread running the loop.
@@ -84,6 +100,21 @@ namespace MessagingMesh
 
         // Singnals the loop to stop when running hot...
         volatile bool m_stopLoop = false;
+
+        // Events deferred to the end of the loop iteration (only used on the loop's thread), and
+        // the events currently being processed...
+        std::vector<MarshalledEvent> m_deferredEvents;
+        std::vector<MarshalledEvent> m_deferredEventsInProgress;
+
+        // Runs deferred events after the IO callbacks in each loop iteration...
+        std::unique_ptr<uv_check_t> m_deferredEventsCheck;
+
+        // Started while there are deferred events, so that the loop does not block waiting for IO
+        // before running them...
+        std::unique_ptr<uv_idle_t> m_deferredEventsIdle;
+
+        // The loop running on the current thread (if any)...
+        inline static thread_local UVLoop* m_pCurrentThreadUVLoop = nullptr;
     };
 } // namespace
 
@@ -55,16 +55,36 @@ void UVUtils::releaseBufferMemory(const uv_buf_t* pBuffer)
     delete[] pBuffer->base;
 }
 
-// Allocates a write request.
-UVUtils::WriteRequest* UVUtils::allocateWriteRequest(size_t bufferSize, SocketPtr pSocket)
+// Allocates a write request (from the pool for the current thread, if possible).
+UVUtils::WriteRequest* UVUtils::allocateWriteRequest(SocketPtr pSocket)
 {
-    return new WriteRequest(bufferSize, pSocket);
+    WriteRequest* pWriteRequest;
+    if (m_writeRequestPool.empty())
+    {
+        pWriteRequest = new WriteRequest;
+    }
+    else
+    {
+        pWriteRequest = m_writeRequestPool.back().release();
+        m_writeRequestPool.pop_back();
+    }
+    pWriteRequest->pSocket = pSocket;
+    return pWriteRequest;
 }
 
-// Releases a write request.
+// Releases a write request (to the pool for the current thread, if it is not full).
 void UVUtils::releaseWriteRequest(WriteRequest* pWriteRequest)
 {
-    delete pWriteRequest;
+    // We release the payloads and the socket, and keep the request for re-use...
+    pWriteRequest->reset();
+    if (m_writeRequestPool.size() < MAX_POOLED_WRITE_REQUESTS)
+    {
+        m_writeRequestPool.emplace_back(pWriteRequest);
+    }
+    else
+    {
+        delete pWriteRequest;
+    }
 }
 
 // Duplicates the socket.
@@ -1,6 +1,8 @@
 #pragma once
+#include <cstring>
 #include <memory>
 #include <string>
+#include <vector>
 #include <functional>
 #include <libuv/uv.h>
 #include "Buffer.h"
@@ -23,32 +25,131 @@ namespace MessagingMesh
             std::string Service;   // Service or port
         };
 
-        // A UV write request plus the buffer it is writing.
+        // A UV write request plus the list of buffers (iovecs) it is writing.
+        //
+        // Before queueing the request with uv_write, the socket tries to write the data straight
+        // away (see Socket::send()). Any data this writes is removed from the request.
+        //
+        // The data is not copied into the request. Each buffer points into a (shared) Buffer
+        // which the request holds a reference to until the write has completed. So a message
+        // sent to many sockets is held in memory once, however many sockets it is sent to.
+        //
+        // Subscription ID override
+        // ------------------------
+        // A message with an overridden subscription ID is written as a prefix held in the request
+        // (the size and the overridden subscription ID), followed by the rest of the message.
+        //
+        // SocketPtr: We keep a reference to the socket shared pointer to ensure that the lifetime
+        //            of the Socket object is as long as that of the write request. Otherwise we can 
+        //            have asynchronous UV write requests which take place after the Socket has
+        //            been destructed.
+        //
+        // Write requests are pooled. Use allocateWriteRequest() and releaseWriteRequest().
         struct WriteRequest
         {
-            // Constructor specifying a buffer size.
-            // We allocate the buffer and release it in the destructor.
-            //
-            // SocketPtr: We keep a reference to the socket shared pointer to ensure that the lifetime
-            //            of the Socket object is as long as that of the write request. Otherwise we can 
-            //            have asynchronous UV write requests which take place after the Socket has
-            //            been destructed.
-            WriteRequest(size_t bufferSize, SocketPtr socket) :
-                write_request{},
-                pSocket(socket)
+            // The maximum number of buffers in one request...
+            static constexpr size_t MAX_BUFFERS = 128;
+
+            // The size of a prefix: the size of the message plus the subscription ID...
+            static constexpr size_t PREFIX_SIZE = Buffer::SIZE_SIZE + sizeof(uint32_t);
+
+            // Returns true if the request has space for the number of buffers specified.
+            bool hasSpace(size_t count) const { return bufferCount + count <= MAX_BUFFERS; }
+
+            // Adds a buffer pointing to data held elsewhere (eg, in one of the payloads).
+            void addBuffer(const char* pData, size_t size)
+            {
+                buffers[bufferCount++] = uv_buf_init(const_cast<char*>(pData), (unsigned int)size);
+            }
+
+            // Adds a buffer for a prefix, held in the request, with the message size and the subscription ID.
+            void addPrefix(const char* pSize, uint32_t subscriptionID)
+            {
+                auto pPrefix = prefixes[prefixCount++];
+                std::memcpy(pPrefix, pSize, Buffer::SIZE_SIZE);
+                std::memcpy(pPrefix + Buffer::SIZE_SIZE, &subscriptionID, sizeof(uint32_t));
+                addBuffer(pPrefix, PREFIX_SIZE);
+            }
+
+            // Adds a buffer for the header of a chunk of a large message, held in the request. The
+            // first chunk of a message with an overridden subscription ID starts with the ID, which
+            // is held with the header. (A request holds at most one chunk.)
+            void addChunkHeader(int32_t chunkSize, uint32_t streamID, int32_t messageSize, uint32_t subscriptionID)
+            {
+                auto frameSize = static_cast<uint32_t>(chunkSize) | Buffer::CHUNK_FLAG;
+                std::memcpy(chunkHeader, &frameSize, Buffer::SIZE_SIZE);
+                std::memcpy(chunkHeader + Buffer::SIZE_SIZE, &streamID, sizeof(uint32_t));
+                std::memcpy(chunkHeader + Buffer::SIZE_SIZE + sizeof(uint32_t), &messageSize, sizeof(int32_t));
+                size_t headerSize = Buffer::CHUNK_HEADER_SIZE;
+                if (subscriptionID != 0)
+                {
+                    std::memcpy(chunkHeader + headerSize, &subscriptionID, sizeof(uint32_t));
+                    headerSize += sizeof(uint32_t);
+                }
+                addBuffer(chunkHeader, headerSize);
+            }
+
+            // Gets the total size of the data in the buffers.
+            size_t getSize() const
             {
-                buffer.base = new char[bufferSize];
-                buffer.len = (ULONG)bufferSize;
+                size_t size = 0;
+                for (size_t i = 0; i < bufferCount; ++i)
+                {
+                    size += buffers[i].len;
+                }
+                return size;
             }
 
-            // Destructor.
-            ~WriteRequest()
+            // Removes data which has already been written from the front of the buffers.
+            void removeWrittenData(size_t size)
             {
-                delete[] buffer.base;
+                // We skip the buffers which have been completely written, and move the
+                // start of the first one which has been partly written...
+                size_t writtenCount = 0;
+                while (writtenCount < bufferCount && size >= buffers[writtenCount].len)
+                {
+                    size -= buffers[writtenCount].len;
+                    writtenCount++;
+                }
+                if (writtenCount < bufferCount)
+                {
+                    buffers[writtenCount].base += size;
+                    buffers[writtenCount].len -= (decltype(buffers[writtenCount].len))size;
+                }
+
+                // We move the remaining buffers to the front...
+                // Note: The prefixes the buffers point to stay where they are.
+                std::memmove(buffers, buffers + writtenCount, (bufferCount - writtenCount) * sizeof(uv_buf_t));
+                bufferCount -= writtenCount;
             }
 
-            uv_write_t write_request;
-            uv_buf_t buffer;
+            // Resets the request so that it can be re-used.
+            void reset()
+            {
+                write_request = {};
+                bufferCount = 0;
+                prefixCount = 0;
+                payloads.clear();
+                pSocket = nullptr;
+            }
+
+            // Note: This must be the first member, as UV callbacks cast the uv_write_t to the WriteRequest.
+            uv_write_t write_request{};
+
+            // The buffers to write...
+            uv_buf_t buffers[MAX_BUFFERS];
+            size_t bufferCount = 0;
+
+            // Prefixes written before messages with overridden subscription IDs...
+            char prefixes[MAX_BUFFERS][PREFIX_SIZE];
+            size_t prefixCount = 0;
+
+            // The header for a chunk of a large message (plus an overridden subscription ID)...
+            char chunkHeader[Buffer::CHUNK_HEADER_SIZE + sizeof(uint32_t)];
+
+            // The Buffers that the buffers point into...
+            std::vector<BufferPtr> payloads;
+
             SocketPtr pSocket;
         };
 
@@ -64,10 +165,10 @@ namespace MessagingMesh
         // Releases a buffer.
         static void releaseBufferMemory(const uv_buf_t* pBuffer);
 
-        // Allocates a write request.
-        static WriteRequest* allocateWriteRequest(size_t bufferSize, SocketPtr pSocket);
+        // Allocates a write request (from the pool for the current thread, if possible).
+        static WriteRequest* allocateWriteRequest(SocketPtr pSocket);
 
-        // Releases a write request.
+        // Releases a write request (to the pool for the current thread, if it is not full).
         static void releaseWriteRequest(WriteRequest* pWriteRequest);
 
         // Duplicates the socket.
@@ -90,6 +191,17 @@ namespace MessagingMesh
     private:
         // Duplicates the socket when compiling for Windows.
         static uv_os_sock_t duplicateSocket_Windows(const uv_os_sock_t& socket);
+
+    // Private data...
+    private:
+        // Write requests released on the current thread, for re-use. 
+        // Write requests are allocated and released on the socket's UV loop, so we do not need a lock.
+        inline static thread_local std::vector<std::unique_ptr<WriteRequest>> m_writeRequestPool;
+
+    // Constants...
+    private:
+        // The maximum number of write requests we pool on each thread...
+        static constexpr size_t MAX_POOLED_WRITE_REQUESTS = 64;
     };
 } // namespace
 